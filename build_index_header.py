@@ -17,44 +17,92 @@
 
 Import("env")
 import gzip
+import hashlib
 import os
-import struct
+import re
 from io import BytesIO
-import shutil
 
-def build_index_html_h(source, target, env):
-    if os.path.exists('%s/include/index_html.h' % env.subst('$PROJECT_DIR')):
-        if os.path.getmtime('%s/data/index.html' % env.subst('$PROJECT_DIR')) < os.path.getmtime('%s/include/index_html.h' % env.subst('$PROJECT_DIR')):
-            return
-    print("Attempting to compress %s/data/index.html" % env.subst('$PROJECT_DIR'))
+# The web interface is maintained as a single data/index.html file. During the
+# build the inline <style> and <script> blocks are split into separate assets
+# which are named based on their content. These assets never change for a
+# given name so the browser can cache them indefinitely and only the small
+# bootstrap index.html needs to be revalidated.
+WEB_ASSET_SOURCE = 'data/index.html'
+WEB_ASSET_HEADER = 'include/web_assets.h'
+
+INLINE_BLOCK_RE = re.compile(
+    r'<(style|script)(?P<attrs>(?:\s+type="[^"]*")?)>(?P<content>.*?)</\1>',
+    re.DOTALL | re.IGNORECASE)
+
+ASSET_TYPES = {
+    'style': ('css', 'text/css'),
+    'script': ('js', 'application/javascript'),
+}
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+def compress(data):
     gzFile = BytesIO()
-    with open('%s/data/index.html' % env.subst('$PROJECT_DIR'), 'rb') as f, gzip.GzipFile(mode='wb', fileobj=gzFile) as gz:
-        shutil.copyfileobj(f, gz)
-    gzFile.seek(0, os.SEEK_END)
-    gzLen = gzFile.tell()
-    gzFile.seek(0, os.SEEK_SET)
-    print('Compressed index.html.gz file is %d bytes' % gzLen)
-    with open('%s/include/index_html.h' % env.subst('$PROJECT_DIR'), 'w') as f:
+    # the timestamp is fixed so the output only depends on the content.
+    with gzip.GzipFile(mode='wb', fileobj=gzFile, mtime=0) as gz:
+        gz.write(data)
+    return gzFile.getvalue()
+
+def split_assets(html):
+    assets = []
+    def replace_block(match):
+        tag = match.group(1).lower()
+        content = match.group('content').encode('utf-8')
+        extension, contentType = ASSET_TYPES[tag]
+        path = '/assets/app.%s.%s' % (content_hash(content), extension)
+        assets.append((path, contentType, content, True))
+        if tag == 'style':
+            return '<link rel="stylesheet" href="%s">' % path
+        return '<script src="%s"></script>' % path
+    bootstrap = INLINE_BLOCK_RE.sub(replace_block, html).encode('utf-8')
+    assets.insert(0, ('/index.html', 'text/html', bootstrap, False))
+    return assets
+
+def write_array(f, name, data):
+    f.write("static const uint8_t %s[] PROGMEM = {\n" % name)
+    for offset in range(0, len(data), 16):
+        f.write("\t%s,\n" % ", ".join("0x{:02X}".format(b) for b in bytearray(data[offset:offset + 16])))
+    f.write("};\n")
+
+def build_web_assets_h(source, target, env):
+    projectDir = env.subst('$PROJECT_DIR')
+    sourceFile = '%s/%s' % (projectDir, WEB_ASSET_SOURCE)
+    headerFile = '%s/%s' % (projectDir, WEB_ASSET_HEADER)
+    if os.path.exists(headerFile):
+        if os.path.getmtime(sourceFile) < os.path.getmtime(headerFile):
+            return
+    print("Building web assets from %s" % sourceFile)
+    with open(sourceFile, 'rb') as f:
+        assets = split_assets(f.read().decode('utf-8'))
+    with open(headerFile, 'w') as f:
         f.write("#pragma once\n")
-        f.write("const size_t indexHtmlGz_size = {};\n".format(gzLen))
-        f.write("const uint8_t indexHtmlGz[] PROGMEM = {\n");
-        while True:
-            block = gzFile.read(16)
-            if len(block) < 16:
-                if len(block):
-                    f.write("\t")
-                    for b in block:
-                        # Python 2/3 compat
-                        if type(b) is str:
-                            b = ord(b)
-                        f.write("0x{:02X}, ".format(b))
-                    f.write("\n")
-                break
-            f.write("\t0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                    "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                    "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                    "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X},\n"
-                    .format(*struct.unpack("BBBBBBBBBBBBBBBB", block)))
+        f.write("// generated by build_index_header.py from %s, do not edit.\n\n" % WEB_ASSET_SOURCE)
+        f.write("struct WebAsset {\n")
+        f.write("  const char *path;\n")
+        f.write("  const char *contentType;\n")
+        f.write("  const char *etag;\n")
+        f.write("  const uint8_t *data;\n")
+        f.write("  const size_t size;\n")
+        f.write("  // immutable assets have the content hash in their path.\n")
+        f.write("  const bool immutable;\n")
+        f.write("};\n\n")
+        entries = []
+        for index, (path, contentType, content, immutable) in enumerate(assets):
+            gz = compress(content)
+            print('%s: %d bytes (%d bytes compressed)' % (path, len(content), len(gz)))
+            write_array(f, 'webAsset%d' % index, gz)
+            entries.append('  {"%s", "%s", "\\"%s\\"", webAsset%d, %d, %s},\n' %
+                (path, contentType, content_hash(content), index, len(gz),
+                 'true' if immutable else 'false'))
+        f.write("\nstatic const WebAsset webAssets[] = {\n")
+        for entry in entries:
+            f.write(entry)
         f.write("};\n")
 
-env.AddPreAction('$BUILD_DIR/src/Interfaces/WebServer.cpp.o', build_index_html_h)
+env.AddPreAction('$BUILD_DIR/src/Interfaces/WebServer.cpp.o', build_web_assets_h)
@@ -0,0 +1,82 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+// This file has no Arduino or ESP-IDF dependencies so that the ACK detection
+// can be exercised on the host, see tools/virtual_decoder_sim.cpp.
+
+// Interval (in microseconds) between ADC samples while ACK detection is
+// active, this gives a 4kHz sample rate.
+static constexpr uint32_t ACK_SAMPLE_INTERVAL_USEC = 250;
+
+// Number of samples retained for ACK detection, at 4kHz this covers 128ms
+// which is longer than any service mode packet sequence.
+static constexpr uint16_t ACK_SAMPLE_BUFFER_SIZE = 512;
+
+// Number of samples used to establish the baseline current draw before an
+// ACK pulse can be detected.
+static constexpr uint8_t ACK_BASELINE_SAMPLES = 8;
+
+// RCN-216 defines the ACK pulse as 6ms +/- 1ms, a pulse is accepted as soon
+// as it has lasted for the minimum duration.
+static constexpr uint16_t ACK_MIN_SAMPLES = 5000 / ACK_SAMPLE_INTERVAL_USEC;
+
+// Number of consecutive samples below the ACK threshold which are tolerated
+// during a pulse before it is considered to have ended (ADC noise).
+static constexpr uint8_t ACK_GLITCH_SAMPLES = 2;
+
+// Detects a service mode ACK pulse in a stream of current samples taken
+// every ACK_SAMPLE_INTERVAL_USEC. The first ACK_BASELINE_SAMPLES samples
+// after reset establish the baseline current draw, an ACK is detected once
+// ACK_MIN_SAMPLES samples have been at least the threshold above it.
+class AckDetector {
+public:
+  void reset() {
+    _baselineSum = 0;
+    _baselineCount = 0;
+    _highCount = 0;
+    _lowCount = 0;
+  }
+  // adds the next sample (in ADC units), returns true when the sample
+  // completes an ACK pulse.
+  bool addSample(uint16_t sample, uint16_t threshold) {
+    if(_baselineCount < ACK_BASELINE_SAMPLES) {
+      _baselineSum += sample;
+      _baselineCount++;
+    } else if(sample >= getBaseline() + threshold) {
+      _lowCount = 0;
+      if(++_highCount >= ACK_MIN_SAMPLES) {
+        return true;
+      }
+    } else if(_highCount && ++_lowCount > ACK_GLITCH_SAMPLES) {
+      _highCount = 0;
+      _lowCount = 0;
+    }
+    return false;
+  }
+  uint16_t getBaseline() {
+    return _baselineCount ? _baselineSum / _baselineCount : 0;
+  }
+private:
+  uint32_t _baselineSum{0};
+  uint8_t _baselineCount{0};
+  uint16_t _highCount{0};
+  uint8_t _lowCount{0};
+};
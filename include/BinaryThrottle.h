@@ -0,0 +1,120 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// This file has no Arduino or ESP-IDF dependencies so that the binary
+// protocol decoding can be exercised on the host, see
+// tools/throttle_protocol_bench.cpp.
+
+// Binary WebSocket throttle protocol opcodes. All multi-byte values are sent
+// in big-endian order and multiple commands (or events) may be sent in a
+// single frame.
+//
+// Clients which have not sent WS_BINARY_SUBSCRIBE receive loco, turnout and
+// power state events for all entities. After the first subscription only the
+// events for the subscribed topics are sent. State changes are collected and
+// sent at most once per WS_STATE_UPDATE_INTERVAL_MS with only the latest state
+// of each entity included.
+enum WS_BINARY_OPCODES {
+  // client to command station, commands addressing locomotive zero or with
+  // an out of range speed or function are rejected with WS_BINARY_ERROR.
+  WS_BINARY_SPEED = 0x01,           // {ADDR HI} {ADDR LO} {SPEED 0-126}
+  WS_BINARY_DIRECTION = 0x02,       // {ADDR HI} {ADDR LO} {1=FWD, 0=REV}
+  WS_BINARY_FUNCTION = 0x03,        // {ADDR HI} {ADDR LO} {FUNC} {STATE}
+  WS_BINARY_TURNOUT = 0x04,         // {ID HI} {ID LO} {0=CLOSED, 1=THROWN, 2=TOGGLE}
+  WS_BINARY_POWER = 0x05,           // {0=OFF, 1=ON}
+  WS_BINARY_ESTOP = 0x06,           // no arguments
+  WS_BINARY_LOCO_QUERY = 0x07,      // {ADDR HI} {ADDR LO}
+  WS_BINARY_CURRENT_SUBSCRIBE = 0x08, // {0=OFF, 1=ON}
+  WS_BINARY_SUBSCRIBE = 0x09,       // {TOPIC} {TOPIC ARGS}
+  WS_BINARY_UNSUBSCRIBE = 0x0A,     // {TOPIC} {TOPIC ARGS}
+  // command station to client
+  WS_BINARY_LOCO_STATE = 0x81,      // {ADDR HI} {ADDR LO} {SPEED} {DIR} {F0-F28 (4 bytes)}
+  WS_BINARY_TURNOUT_STATE = 0x84,   // {ID HI} {ID LO} {0=CLOSED, 1=THROWN}
+  WS_BINARY_POWER_STATE = 0x85,     // {0=OFF, 1=ON}
+  WS_BINARY_SENSOR_STATE = 0x86,    // {ID HI} {ID LO} {0=INACTIVE, 1=ACTIVE}
+  // {BOARD} {SEQ (4 bytes)} {COUNT} followed by COUNT entries of
+  // {MIN mA (2 bytes)} {MAX mA (2 bytes)} {AVG mA (2 bytes)}, BOARD is the
+  // index of the motor board in the GET /power response.
+  WS_BINARY_CURRENT = 0x88,
+  // state changes have been discarded, the client should query the state of
+  // its subscribed topics.
+  WS_BINARY_RESYNC = 0x89,          // no arguments
+  WS_BINARY_ERROR = 0xFF,           // {OPCODE}
+};
+
+// Topics for WS_BINARY_SUBSCRIBE and WS_BINARY_UNSUBSCRIBE, ranges are
+// inclusive.
+enum WS_BINARY_TOPICS {
+  WS_TOPIC_LOCO = 0x01,             // {ADDR HI} {ADDR LO}
+  WS_TOPIC_TURNOUTS = 0x02,         // {FIRST ID HI} {FIRST ID LO} {LAST ID HI} {LAST ID LO}
+  WS_TOPIC_SENSORS = 0x03,          // {FIRST ID HI} {FIRST ID LO} {LAST ID HI} {LAST ID LO}
+  WS_TOPIC_POWER = 0x04,            // no arguments
+  WS_TOPIC_CURRENT = 0x05,          // no arguments
+};
+
+// Highest speed accepted by WS_BINARY_SPEED, larger values would be treated
+// as a negative (emergency stop) speed by Locomotive::setSpeed.
+static constexpr uint8_t WS_BINARY_MAX_SPEED = 126;
+
+// Number of functions (F0-F28) accepted by WS_BINARY_FUNCTION.
+static constexpr uint8_t WS_BINARY_MAX_FUNCTIONS = 29;
+
+// Arguments of a locomotive command (WS_BINARY_SPEED, WS_BINARY_DIRECTION,
+// WS_BINARY_FUNCTION or WS_BINARY_LOCO_QUERY).
+struct BinaryLocoCommand {
+  uint16_t address{0};
+  // speed, direction or function number depending on the opcode.
+  uint8_t value{0};
+  // function state for WS_BINARY_FUNCTION.
+  uint8_t state{0};
+  // false when the address is zero or the speed or function is out of
+  // range, the command must be rejected with WS_BINARY_ERROR.
+  bool valid{false};
+};
+
+// decodes the arguments of a locomotive command, data points to the first
+// byte after the opcode. Returns the number of bytes consumed or zero if the
+// opcode is not a locomotive command or the command is truncated.
+static inline size_t decodeBinaryLocoCommand(uint8_t opcode, const uint8_t *data,
+                                             size_t len, BinaryLocoCommand &command) {
+  size_t size = 0;
+  if(opcode == WS_BINARY_SPEED || opcode == WS_BINARY_DIRECTION) {
+    size = 3;
+  } else if(opcode == WS_BINARY_FUNCTION) {
+    size = 4;
+  } else if(opcode == WS_BINARY_LOCO_QUERY) {
+    size = 2;
+  }
+  if(!size || len < size) {
+    return 0;
+  }
+  command.address = (data[0] << 8) | data[1];
+  command.value = size > 2 ? data[2] : 0;
+  command.state = size > 3 ? data[3] : 0;
+  command.valid = command.address != 0;
+  if(opcode == WS_BINARY_SPEED) {
+    command.valid &= command.value <= WS_BINARY_MAX_SPEED;
+  } else if(opcode == WS_BINARY_FUNCTION) {
+    command.valid &= command.value < WS_BINARY_MAX_FUNCTIONS;
+  }
+  return size;
+}
@@ -0,0 +1,61 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+// Number of changes retained by the change log, clients which fall further
+// behind than this will be asked to perform a full resync.
+static constexpr uint16_t CHANGE_LOG_SIZE = 256;
+
+enum class ChangeType : uint8_t {
+  TURNOUT,
+  OUTPUT,
+  SENSOR,
+  REMOTE_SENSOR,
+  LOCOMOTIVE,
+  CONSIST,
+  MAX_CHANGE_TYPES // NOTE: this must be the last entry in the enum.
+};
+
+struct ChangeLogEntry {
+  uint32_t sequence;
+  uint16_t id;
+  ChangeType type;
+};
+
+// Records which entities have been modified using a global sequence number
+// which increases by one for each change. Clients can poll for the entities
+// which have changed since the last sequence number they have seen rather
+// than retrieving the full list of entities.
+class ChangeLog {
+public:
+  // records a change to the entity and returns the sequence number assigned.
+  static uint32_t record(const ChangeType, const uint16_t);
+  // returns the sequence number of the most recent change.
+  static uint32_t getSequence();
+  // copies the most recent change for each entity modified after the provided
+  // sequence number and provides the sequence number of the most recent
+  // change, returns false if changes after the sequence number have been
+  // discarded and the client needs to perform a full resync.
+  static bool getChanges(const uint32_t, std::vector<ChangeLogEntry> &, uint32_t &);
+  static const char *getTypeName(const ChangeType);
+};
@@ -58,6 +58,19 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 // PROG TRACK MOTORBOARD MOTOR_BOARD_TYPE
 #define MOTORBOARD_TYPE_PROG ARDUINO_SHIELD
 
+// ADDITIONAL MAIN TRACK POWER DISTRICTS. EACH DISTRICT HAS ITS OWN MOTORBOARD AND IS
+// DRIVEN BY THE SAME DCC SIGNAL PIN AS THE MAIN TRACK. A SHORT CIRCUIT IN A DISTRICT
+// WILL ONLY DISABLE THAT DISTRICT. EACH DISTRICT IS DEFINED AS:
+// MOTORBOARD_DISTRICT(NAME, ENABLE PIN, CURRENT SENSE ADC PIN, MOTOR_BOARD_TYPE)
+//
+// NOTE: THE RAILCOM CUTOUT IS ONLY GENERATED ON THE MAIN TRACK MOTORBOARD.
+//
+// IF LEFT UNDEFINED ONLY THE MAIN TRACK MOTORBOARD WILL BE USED.
+
+//#define MOTORBOARD_OPS_DISTRICTS \
+//  MOTORBOARD_DISTRICT("YARD", 26, ADC1_CHANNEL_6, BTS7960B_5A) \
+//  MOTORBOARD_DISTRICT("BRANCH", 27, ADC1_CHANNEL_7, BTS7960B_5A)
+
 /////////////////////////////////////////////////////////////////////////////////////
 //
 // DEFINE WHICH PINS ARE USED FOR DCC SIGNAL GENERATION
@@ -80,3 +93,40 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 //#define ADC_CURRENT_ATTENUATION ADC_ATTEN_DB_11
 
 /////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// ENABLE THE CURRENT DRAW HISTORY (GET /current AND THE WEBSOCKET CURRENT FEED) FOR
+// THE MAIN TRACK MOTORBOARD AND EACH DISTRICT. THIS USES ~29KB OF RAM PER MOTORBOARD
+// AND ADDS WORK TO THE CURRENT MONITORING TASK FOR EACH MOTORBOARD, NO HISTORY IS
+// RECORDED FOR THE PROG TRACK MOTORBOARD.
+//
+// IF LEFT UNDEFINED THE CURRENT DRAW HISTORY WILL BE DISABLED.
+
+//#define CURRENT_HISTORY_ENABLED true
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// ENABLE RCN-218 (DCC-A) AUTOMATIC DECODER LOGON ON THE OPERATIONS TRACK. THIS
+// REQUIRES THE OPS RAILCOM DETECTOR PINS TO BE CONFIGURED.
+//
+// IF LEFT UNDEFINED DCC-A WILL BE DISABLED.
+
+//#define DCC_A_ENABLED true
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// ENABLE THE VIRTUAL DECODER ON THE PROGRAMMING TRACK. THIS IS INTENDED FOR TESTING
+// PROGRAMMING TRACK THROUGHPUT AND ACK DETECTION WITHOUT A DECODER, THE PROG TRACK
+// CURRENT SENSE READINGS WILL BE REPLACED WITH A SIMULATED DECODER CURRENT DRAW.
+// THE ACK TIMING CAN BE ADJUSTED AT RUNTIME VIA THE <vdec> COMMAND.
+//
+// IF LEFT UNDEFINED THE VIRTUAL DECODER WILL BE DISABLED.
+
+//#define VIRTUAL_DECODER_ENABLED true
+
+/////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,99 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+// Number of current samples (taken once per millisecond) summarized into
+// each bucket of the short term history, this gives a 10Hz history.
+static constexpr uint16_t CURRENT_HISTORY_FINE_SAMPLES = 100;
+
+// Number of buckets retained in the short term history (10 minutes).
+static constexpr uint16_t CURRENT_HISTORY_FINE_BUCKETS = 6000;
+
+// Number of short term buckets summarized into each bucket of the long term
+// history, this gives a 1Hz history.
+static constexpr uint8_t CURRENT_HISTORY_COARSE_RATIO = 10;
+
+// Number of buckets retained in the long term history (1 hour).
+static constexpr uint16_t CURRENT_HISTORY_COARSE_BUCKETS = 3600;
+
+// Summary of the current draw during a single bucket, values are ADC
+// readings.
+struct CurrentHistoryBucket {
+  uint16_t min;
+  uint16_t max;
+  uint16_t avg;
+};
+
+// Downsampled current draw history for a single motor board. Every bucket is
+// assigned a sequence number which increases by one for each bucket recorded
+// so clients can request only the buckets they have not yet received.
+//
+// To keep the memory usage down (~29kb per motor board) the buckets are
+// stored with 8 bits of resolution.
+//
+// The current monitoring task is the only writer and never blocks, readers
+// detect buckets which were overwritten while being copied and drop them.
+class CurrentHistory {
+public:
+  CurrentHistory();
+  // records a single sample, this is called by the current monitoring task.
+  void addSample(uint16_t);
+  // copies up to the requested number of buckets starting with the provided
+  // sequence number, returns the sequence number of the first bucket copied
+  // which will be later than requested when the older buckets have been
+  // discarded.
+  uint32_t getBuckets(bool, uint32_t, uint16_t, std::vector<CurrentHistoryBucket> &);
+  // returns the sequence number which will be assigned to the next bucket.
+  uint32_t getNextSequence(bool);
+  // returns the millis() value when the most recent bucket was recorded.
+  uint32_t getLastUpdate(bool);
+  static uint32_t getIntervalMillis(bool coarse) {
+    return coarse ? CURRENT_HISTORY_FINE_SAMPLES * CURRENT_HISTORY_COARSE_RATIO :
+                    CURRENT_HISTORY_FINE_SAMPLES;
+  }
+private:
+  class Ring {
+  public:
+    Ring(uint16_t);
+    void push(const CurrentHistoryBucket &);
+    uint32_t get(uint32_t, uint16_t, std::vector<CurrentHistoryBucket> &);
+    // published after the bucket has been stored.
+    std::atomic<uint32_t> _next{0};
+    std::atomic<uint32_t> _lastUpdate{0};
+  private:
+    const uint16_t _capacity;
+    std::unique_ptr<uint8_t[]> _buckets;
+  };
+  Ring _fine;
+  Ring _coarse;
+  // accumulators for the buckets in progress, only accessed by the current
+  // monitoring task.
+  uint16_t _fineMin{UINT16_MAX};
+  uint16_t _fineMax{0};
+  uint32_t _fineSum{0};
+  uint16_t _fineCount{0};
+  uint16_t _coarseMin{UINT16_MAX};
+  uint16_t _coarseMax{0};
+  uint32_t _coarseSum{0};
+  uint8_t _coarseCount{0};
+};
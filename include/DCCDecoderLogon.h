@@ -0,0 +1,40 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace dcc {
+  struct Feedback;
+}
+
+// RCN-218 (DCC-A) automatic decoder logon on the OPS track. While the track
+// is energized LOGON_ENABLE packets are broadcast periodically, decoders
+// which respond are queried for their ShortInfo, assigned an address and
+// added to the roster. Assigned addresses are persisted so a decoder will
+// receive the same address when it logs on again.
+//
+// This requires a RailCom detector on the OPS track.
+class DecoderLogonManager {
+public:
+  static void init();
+  // called by the OPS signal generator with the RailCom data received in the
+  // cutout following a DCC-A packet.
+  static void railComFeedback(const dcc::Feedback &);
+  static uint16_t getLogonCount();
+};
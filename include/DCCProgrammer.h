@@ -17,6 +17,13 @@ COPYRIGHT (c) 2019 Mike Dunston
 #pragma once
 
 #include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace dcc {
+  struct Feedback;
+}
 
 enum CV_NAMES {
   SHORT_ADDRESS=1,
@@ -28,7 +35,9 @@ enum CV_NAMES {
   CONSIST_ADDRESS=19,
   CONSIST_FUNCTION_CONTROL_F1_F8=21,
   CONSIST_FUNCTION_CONTROL_FL_F9_F12=22,
-  DECODER_CONFIG=29
+  DECODER_CONFIG=29,
+  INDEXED_CV_HIGH=31,
+  INDEXED_CV_LOW=32
 };
 
 static constexpr uint8_t CONSIST_ADDRESS_REVERSED_ORIENTATION = 0x80;
@@ -64,9 +73,146 @@ enum CONSIST_FUNCTION_CONTROL_FL_F9_F12_BITS {
   F12_BIT=4
 };
 
+// Interfaces which submit programming track jobs.
+enum PROG_CLIENT {
+  PROG_CLIENT_DCCPP=1,
+  PROG_CLIENT_LOCONET,
+  PROG_CLIENT_WEB
+};
+
+// Identifies the originator of a programming track job for fair queuing,
+// each originator has its own queue and the queues are serviced round-robin.
+// This combines the interface with a connection identifier assigned by the
+// interface so that each JMRI or WebSocket connection and each web browser
+// is queued separately, see makeProgClient.
+typedef uint64_t prog_client_t;
+
+static inline prog_client_t makeProgClient(const PROG_CLIENT interface, const uint32_t connection=0) {
+  return ((prog_client_t)interface << 32) | connection;
+}
+
+// Result of a decoder identification job, decoderConfig will be -1 if the
+// decoder could not be read and address will be zero if the address could
+// not be read.
+struct DecoderIdentity {
+  int16_t decoderConfig{-1};
+  uint16_t address{0};
+  bool longAddress{false};
+  bool stationary{false};
+  bool speedTable{false};
+};
 
-extern bool progTrackBusy;
+// Number of packets required to read a CV via bit probing, one per bit plus
+// the final byte verify.
+static constexpr uint8_t PROG_TRACK_BIT_PROBE_PACKETS = 9;
+
+// Statistics for CV reads on the programming track. Reads first verify the
+// known candidate values for a CV (fast path) and fall back to probing each
+// bit when none of the candidates are acknowledged.
+struct CVReadStatistics {
+  // total number of CV reads requested.
+  uint32_t reads{0};
+  // number of reads resolved by verifying a candidate value.
+  uint32_t fastPathHits{0};
+  // number of reads where candidates were tried but none were acknowledged.
+  uint32_t fastPathMisses{0};
+  // number of verify packets sent for candidate values (hits and misses).
+  uint32_t fastPathProbes{0};
+  // number of bit probing attempts (including retries).
+  uint32_t bitProbeReads{0};
+};
+
+// callback for CV jobs, receives the CV value (or bit value) or -1 on failure.
+typedef std::function<void(int16_t)> prog_cv_callback_t;
+// callback for decoder identification jobs.
+typedef std::function<void(const DecoderIdentity &)> prog_identify_callback_t;
+
+// A single CV in a bulk programming job. When cv31/cv32 are not negative they
+// are written before the CV is accessed to select the indexed CV page.
+struct BulkCVEntry {
+  uint16_t cv;
+  int16_t cv31{-1};
+  int16_t cv32{-1};
+  int16_t value{-1};
+};
+
+// A list of CVs to be read (or written) in a single programming session,
+// entries are processed in order starting from next and processing stops
+// at the first failure so the job can be resumed later.
+struct BulkProgrammingJob {
+  bool write{false};
+  size_t next{0};
+  std::vector<BulkCVEntry> entries;
+};
+
+// result of processing a single bulk job entry.
+enum BulkCVResult : uint8_t {
+  BULK_CV_SUCCESS,
+  BULK_CV_FAILED,
+  // the CV was not written by a restore since it is read-only or writing it
+  // would change the decoder (or the remaining entries) in other ways, see
+  // isBulkWriteExcluded.
+  BULK_CV_SKIPPED
+};
+
+// returns true if the entry must not be written by a bulk restore. CV7
+// (version) is read-only and a write is never acknowledged, writing CV8
+// (manufacturer) performs a factory reset on most decoders and CV31/CV32 are
+// only written as the index of an indexed entry since writing them on their
+// own would change the page used by the entries which follow.
+static inline bool isBulkWriteExcluded(const BulkCVEntry &entry) {
+  return entry.cv31 < 0 && (entry.cv == CV_NAMES::DECODER_VERSION ||
+                            entry.cv == CV_NAMES::DECODER_MANUFACTURER ||
+                            entry.cv == CV_NAMES::INDEXED_CV_HIGH ||
+                            entry.cv == CV_NAMES::INDEXED_CV_LOW);
+}
+
+// callback for bulk jobs, invoked after each entry has been processed with
+// the index of the entry and the result.
+typedef std::function<void(size_t, BulkCVResult)> prog_bulk_progress_callback_t;
+// callback for bulk jobs, invoked once all entries have been processed (true)
+// or processing has stopped due to a failure (false).
+typedef std::function<void(bool)> prog_bulk_callback_t;
+
+// Queued access to the PROGRAMMING track. All requests are executed on a
+// dedicated task and the provided callback is invoked on that task once the
+// job has completed, callers are never blocked.
+class ProgrammingTrackManager {
+public:
+  static void init();
+  static void readCV(const prog_client_t, const uint16_t, prog_cv_callback_t);
+  static void writeCVByte(const prog_client_t, const uint16_t, const uint8_t, prog_cv_callback_t);
+  static void writeCVBit(const prog_client_t, const uint16_t, const uint8_t, const bool, prog_cv_callback_t);
+  static void identify(const prog_client_t, prog_identify_callback_t);
+  // the job must not be modified by the caller until the completion callback
+  // has been invoked, the callbacks are invoked on the programming track task.
+  static void bulk(const prog_client_t, std::shared_ptr<BulkProgrammingJob>,
+                   prog_bulk_progress_callback_t, prog_bulk_callback_t);
+  // returns true if a job is running or pending.
+  static bool isBusy();
+  static uint16_t getPendingJobCount();
+  static CVReadStatistics getReadStatistics();
+  static void resetReadStatistics();
+};
+
+// RailCom based programming on the main (OPS) track. Requests are executed on
+// a dedicated task and the provided callback is invoked on that task once the
+// request has completed. A RailCom detector is required on the OPS track,
+// requests fail (-1) when the decoder does not respond.
+class OpsProgrammingManager {
+public:
+  static void init();
+  static void readCV(const uint16_t, const uint16_t, prog_cv_callback_t);
+  // writes the CV and verifies the value reported by the decoder in the
+  // RailCom response to the write packet.
+  static void writeCVByte(const uint16_t, const uint16_t, const uint8_t, prog_cv_callback_t);
+  // called by the OPS signal generator with the RailCom data received in the
+  // cutout following a POM packet.
+  static void railComFeedback(const dcc::Feedback &);
+};
 
+// NOTE: the functions below block the caller and must only be called from
+// the programming track task, use ProgrammingTrackManager instead.
 bool enterProgrammingMode();
 void leaveProgrammingMode();
 int16_t readCV(const uint16_t);
@@ -17,6 +17,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #pragma once
 
 #include <Arduino.h>
+#include <atomic>
 #include <mutex>
 #include <queue>
 #include <stdint.h>
@@ -28,7 +29,12 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 // MAX number of signal generators
 #define MAX_DCC_SIGNAL_GENERATORS 2
 
-#define MAX_BYTES_IN_PACKET 10
+// large enough for the RCN-218 LOGON_ASSIGN packet (11 bytes including the
+// checksum) which is the longest packet sent.
+#define MAX_BYTES_IN_PACKET 16
+
+// number of preamble bits included in the packet buffer.
+#define PACKET_PREAMBLE_BITS 22
 
 // standard DCC packet (S-9.2)
 // byte #
@@ -47,18 +53,48 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 // 8         9
 // XXXX XXXX XXXX XXXX
 //        ^ bit 1 of sixth byte (last bit of packet)
+// longer packets continue in the same manner with a zero bit before each
+// byte.
 struct Packet {
   uint8_t buffer[MAX_BYTES_IN_PACKET];
   uint8_t numberOfBits;
   int8_t numberOfRepeats;
+  uint32_t feedbackKey;
+};
+
+// Feedback keys are attached to packets so that RailCom data received in the
+// cutout following the packet can be routed to the requester, the lower 16
+// bits are the decoder address.
+enum RAILCOM_FEEDBACK_KEY {
+  RAILCOM_FEEDBACK_NONE = 0,
+  RAILCOM_FEEDBACK_POM = 0x10000,
+  RAILCOM_FEEDBACK_DCCA = 0x20000
+};
+
+// Packet statistics for a signal generator, these are updated without
+// locking so the values may be slightly inconsistent with each other.
+struct SignalGeneratorStatistics {
+  // packets added to the send queue.
+  std::atomic<uint32_t> queued{0};
+  // packets which have been sent with all requested repeats.
+  std::atomic<uint32_t> sent{0};
+  // packets discarded from the send queue before they were sent, this
+  // happens when an emergency stop drains the queue.
+  std::atomic<uint32_t> discarded{0};
+  // idle packets sent due to the send queue being empty.
+  std::atomic<uint32_t> idle{0};
+  // packets which took longer than expected to transmit.
+  std::atomic<uint32_t> slowTransmits{0};
+  // largest number of packets in the send queue.
+  std::atomic<uint32_t> queueHighWater{0};
 };
 
 class SignalGenerator {
 public:
   void startSignal(bool=true);
   void stopSignal();
-  void loadBytePacket(const uint8_t *, uint8_t, uint8_t, bool=false);
-  void loadPacket(std::vector<uint8_t>, int=0, bool=false);
+  void loadBytePacket(const uint8_t *, uint8_t, uint8_t, bool=false, uint32_t=RAILCOM_FEEDBACK_NONE);
+  void loadPacket(std::vector<uint8_t>, int=0, bool=false, uint32_t=RAILCOM_FEEDBACK_NONE);
 
   inline void waitForQueueEmpty() {
     while(!isQueueEmpty()) {
@@ -79,6 +115,7 @@ public:
         LOG(VERBOSE, "[%s %d] DCCPacket(%p) sent", getName(), esp_log_timestamp(),
             _currentPacket);
         pushFreePacket(_currentPacket);
+        _statistics.sent++;
         _currentPacket = nullptr;
         needNewPacket = true;
       } else if(_signalID == DCC_SIGNAL_OPERATIONS) {
@@ -127,6 +164,12 @@ public:
     std::lock_guard<std::mutex> guard(_toSendMux);
     return _toSend.size();
   }
+  inline uint16_t getSendQueueCapacity() {
+    return _sendQueueCapacity;
+  }
+  inline SignalGeneratorStatistics &getStatistics() {
+    return _statistics;
+  }
 
 protected:
   SignalGenerator(String, uint16_t, uint8_t, uint8_t);
@@ -144,6 +187,7 @@ private:
         _currentPacket = _toSend.front();
         _toSend.pop();
         pushFreePacket(_currentPacket);
+        _statistics.discarded++;
       }
     }
   }
@@ -175,6 +219,9 @@ private:
     std::lock_guard<std::mutex> guard(_toSendMux);
     LOG(VERBOSE, "[%s] Adding DCC Packet (%d bits, %d repeat)", getName(), packet->numberOfBits, packet->numberOfRepeats);
     _toSend.push(packet);
+    if(_toSend.size() > _statistics.queueHighWater) {
+      _statistics.queueHighWater = _toSend.size();
+    }
   }
 
   std::mutex _toSendMux;
@@ -184,6 +231,7 @@ private:
   Packet *_currentPacket{nullptr};
   uint16_t _sendQueueCapacity{0};
   uint16_t _sendQueueThreshold{0};
+  SignalGeneratorStatistics _statistics;
 
   bool _enabled{false};
 };
@@ -34,7 +34,7 @@ public:
   const int8_t _brakeEnablePin;
   const int8_t _railComEnablePin;
   const int8_t _railComShortPin;
-  void receiveRailComData();
+  void receiveRailComData(uint32_t);
 protected:
   void enable() override;
   void disable() override;
@@ -21,11 +21,19 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include <WString.h>
 #include <Stream.h>
 
+#include "DCCProgrammer.h"
+
 // Class definition for a single protocol command
 class DCCPPProtocolCommand {
 public:
   virtual ~DCCPPProtocolCommand() {}
   virtual void process(const std::vector<String>) = 0;
+  // called with the connection the command was received from, commands
+  // which queue programming track jobs override this so that each
+  // connection is queued separately.
+  virtual void process(const std::vector<String> &arguments, const prog_client_t) {
+    process(arguments);
+  }
   virtual String getID() = 0;
 };
 
@@ -33,7 +41,7 @@ public:
 class DCCPPProtocolHandler {
 public:
   static void init();
-  static void process(const String &);
+  static void process(const String &, const prog_client_t=makeProgClient(PROG_CLIENT_DCCPP));
   static void registerCommand(DCCPPProtocolCommand *);
   static DCCPPProtocolCommand *getCommandHandler(const String &);
 };
@@ -46,6 +54,8 @@ public:
 private:
   void processData();
   std::vector<uint8_t> _buffer;
+  // unique for each consumer (connection), used for programming track jobs.
+  const prog_client_t _client;
 };
 
 const String COMMAND_FAILED_RESPONSE = "<X>";
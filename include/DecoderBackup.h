@@ -0,0 +1,63 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <ArduinoJson.h>
+
+// Maximum length of a backup name, this is limited by the maximum length of
+// a SPIFFS file name.
+static constexpr uint8_t DECODER_BACKUP_MAX_NAME_LENGTH = 12;
+
+// Maximum number of CVs which can be included in a single backup.
+static constexpr uint16_t DECODER_BACKUP_MAX_CVS = 1024;
+
+// Progress VALUE reported when processing has stopped due to a failure.
+static constexpr int16_t DECODER_BACKUP_PROGRESS_FAILED = -1;
+
+// Progress VALUE reported when a restore did not write the CV, see
+// isBulkWriteExcluded.
+static constexpr int16_t DECODER_BACKUP_PROGRESS_SKIPPED = -2;
+
+// Bulk decoder backup and restore via the PROGRAMMING track. Each backup is
+// stored on the configuration filesystem and is updated as the job runs so
+// that an interrupted backup (or restore) can be resumed.
+//
+// CV lists are provided as a comma separated list of CV numbers, indexed CVs
+// are specified as {CV}/{CV31}/{CV32}, ie: "1,7,8,29,257/16/0,258/16/0".
+//
+// Progress is broadcast to all WebSocket clients as:
+// <backup {NAME} {DONE} {TOTAL} {CV} {VALUE}>
+// with a VALUE of -1 indicating that processing has stopped due to a failure
+// and -2 indicating that a restore skipped the CV. CV7, CV8 and non-indexed
+// CV31/CV32 entries are read by a backup but are never written by a restore.
+class DecoderBackupManager {
+public:
+  static bool isValidName(const String &);
+  // starts reading the CVs from the decoder, any existing backup with the
+  // same name will be replaced.
+  static bool startBackup(const String &, const String &);
+  // starts writing all CVs from a completed backup to the decoder.
+  static bool startRestore(const String &);
+  // resumes an incomplete backup (or restore).
+  static bool resume(const String &, bool);
+  static bool isActive(const String &);
+  // retrieves the current state of a backup (or restore), returns false if
+  // it does not exist.
+  static bool getState(const String &, bool, JsonObject &);
+  static bool remove(const String &);
+};
@@ -128,6 +128,18 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #define LOCONET_ENABLED false
 #endif
 
+#ifndef DCC_A_ENABLED
+#define DCC_A_ENABLED false
+#endif
+
+#ifndef VIRTUAL_DECODER_ENABLED
+#define VIRTUAL_DECODER_ENABLED false
+#endif
+
+#ifndef CURRENT_HISTORY_ENABLED
+#define CURRENT_HISTORY_ENABLED false
+#endif
+
 #ifndef S88_ENABLED
 #define S88_ENABLED false
 #endif
@@ -136,6 +148,13 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #define ENERGIZE_OPS_TRACK_ON_STARTUP false
 #endif
 
+// Minimum interval between speed (or function) packets triggered by throttle
+// updates for a single locomotive. Updates received during this interval are
+// combined and only the latest state is sent when the interval expires.
+#ifndef LOCO_UPDATE_COALESCE_WINDOW_MS
+#define LOCO_UPDATE_COALESCE_WINDOW_MS 20
+#endif
+
 #ifndef LOCONET_INVERTED_LOGIC
 #define LOCONET_INVERTED_LOGIC false
 #endif
@@ -155,11 +174,16 @@ constexpr uint16_t S88_MAX_SENSORS_PER_BUS = 512;
 #include "JsonConstants.h"
 #include "ConfigurationManager.h"
 #include "WiFiInterface.h"
+#include "WiThrottle.h"
 #include "InfoScreen.h"
 #include "DCCppProtocol.h"
 #include "DCCSignalGenerator.h"
 #include "DCCSignalGenerator_RMT.h"
 #include "DCCProgrammer.h"
+#include "DCCDecoderLogon.h"
+#include "VirtualDecoder.h"
+#include "ChangeLog.h"
+#include "Metrics.h"
 #include "MotorBoard.h"
 #include "Sensors.h"
 #include "Locomotive.h"
@@ -74,8 +74,61 @@ constexpr const char * JSON_SPEED_TABLE_NODE = "speedTable";
 constexpr const char * JSON_DECODER_VERSION_NODE = "version";
 constexpr const char * JSON_DECODER_MANUFACTURER_NODE = "manufacturer";
 constexpr const char * JSON_CREATE_NODE = "create";
+constexpr const char * JSON_JOB_NODE = "job";
+constexpr const char * JSON_VERIFY_NODE = "verify";
+constexpr const char * JSON_SESSION_NODE = "session";
+constexpr const char * JSON_DECODERS_NODE = "decoders";
+constexpr const char * JSON_UID_NODE = "uid";
+constexpr const char * JSON_CVS_NODE = "cvs";
+constexpr const char * JSON_CV31_NODE = "cv31";
+constexpr const char * JSON_CV32_NODE = "cv32";
+constexpr const char * JSON_RESTORE_NODE = "restore";
+constexpr const char * JSON_DONE_NODE = "done";
+constexpr const char * JSON_ACTIVE_NODE = "active";
 constexpr const char * JSON_OVERALL_STATE_NODE = "overallState";
 constexpr const char * JSON_LAST_UPDATE_NODE = "lastUpdate";
+constexpr const char * JSON_INTERVAL_NODE = "interval";
+constexpr const char * JSON_SINCE_NODE = "since";
+constexpr const char * JSON_FIRST_NODE = "first";
+constexpr const char * JSON_NEXT_NODE = "next";
+constexpr const char * JSON_SAMPLES_NODE = "samples";
+constexpr const char * JSON_RETRY_NODE = "retry";
+constexpr const char * JSON_SEQUENCE_NODE = "seq";
+constexpr const char * JSON_RESYNC_NODE = "resync";
+constexpr const char * JSON_CHANGES_NODE = "changes";
+constexpr const char * JSON_REMOVED_NODE = "removed";
+constexpr const char * JSON_OPERATION_NODE = "op";
+constexpr const char * JSON_ROUTES_NODE = "routes";
+constexpr const char * JSON_ROUTE_NODE = "route";
+constexpr const char * JSON_BLOCKED_NODE = "blocked";
+constexpr const char * JSON_THRESHOLD_NODE = "threshold";
+constexpr const char * JSON_MAX_HANDLER_TIME_NODE = "maxHandlerTime";
+constexpr const char * JSON_HANDLER_TIME_NODE = "handlerTime";
+constexpr const char * JSON_HANDLER_TIME_BUCKETS_NODE = "handlerTimeBuckets";
+constexpr const char * JSON_RESPONSE_SIZE_NODE = "responseSize";
+constexpr const char * JSON_RESPONSE_SIZE_BUCKETS_NODE = "responseSizeBuckets";
+constexpr const char * JSON_STREAM_NODE = "stream";
+constexpr const char * JSON_BUFFERED_NODE = "buffered";
+constexpr const char * JSON_STREAMED_NODE = "streamed";
+constexpr const char * JSON_MAX_HEAP_USED_NODE = "maxHeapUsed";
+constexpr const char * JSON_AVG_HEAP_USED_NODE = "avgHeapUsed";
+constexpr const char * JSON_MAX_FIRST_BYTE_NODE = "maxFirstByte";
+constexpr const char * JSON_AVG_FIRST_BYTE_NODE = "avgFirstByte";
+
+constexpr const char * JSON_FIELDS_NODE = "fields";
+
+// short keys used by the compact (/v2) API.
+constexpr const char * JSON_V2_ID_NODE = "i";
+constexpr const char * JSON_V2_ADDRESS_NODE = "a";
+constexpr const char * JSON_V2_SPEED_NODE = "s";
+constexpr const char * JSON_V2_DIRECTION_NODE = "d";
+constexpr const char * JSON_V2_ORIENTATION_NODE = "o";
+constexpr const char * JSON_V2_FUNCTIONS_NODE = "f";
+constexpr const char * JSON_V2_CONSIST_NODE = "c";
+constexpr const char * JSON_V2_BOARD_ADDRESS_NODE = "b";
+constexpr const char * JSON_V2_SUB_ADDRESS_NODE = "n";
+constexpr const char * JSON_V2_STATE_NODE = "s";
+constexpr const char * JSON_V2_TYPE_NODE = "t";
 
 constexpr const char * JSON_VALUE_FORWARD = "FWD";
 constexpr const char * JSON_VALUE_REVERSE = "REV";
@@ -87,6 +140,10 @@ constexpr const char * JSON_VALUE_ON = "On";
 constexpr const char * JSON_VALUE_FAULT = "Fault";
 constexpr const char * JSON_VALUE_THROWN = "Thrown";
 constexpr const char * JSON_VALUE_CLOSED = "Closed";
+constexpr const char * JSON_VALUE_TURNOUT = "turnout";
+constexpr const char * JSON_VALUE_OUTPUT = "output";
+constexpr const char * JSON_VALUE_LOCOMOTIVE = "locomotive";
+constexpr const char * JSON_VALUE_POWER = "power";
 constexpr const char * JSON_VALUE_LONG_ADDRESS = "Long Address";
 constexpr const char * JSON_VALUE_SHORT_ADDRESS = "Short Address";
 constexpr const char * JSON_VALUE_MOBILE_DECODER = "Mobile Decoder";
@@ -0,0 +1,32 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <ArduinoJson.h>
+
+// Invoked by the stream*() methods of the managers for each entity of a
+// collection, in collection order, with a key which uniquely identifies the
+// entity within the collection. Returns the JsonObject the entity should be
+// serialized into or nullptr to skip the entity.
+//
+// This allows a streamed response to take a snapshot of the keys once and
+// then serialize the entities in batches with a single pass over the
+// collection for each batch, entities which are removed while the response
+// is being sent are omitted and entities which are added are not included.
+typedef std::function<JsonObject *(const uint32_t)> json_stream_visitor_t;
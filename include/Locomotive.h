@@ -17,9 +17,28 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 
 #pragma once
 
+#include <atomic>
+#include "JsonStream.h"
+
 #define MAX_LOCOMOTIVE_FUNCTIONS 29
 #define MAX_LOCOMOTIVE_FUNCTION_PACKETS 5
 
+// Fields included in the compact JSON representation of a locomotive.
+enum LOCOMOTIVE_JSON_FIELDS : uint8_t {
+  LOCO_FIELD_ADDRESS = 0x01,
+  LOCO_FIELD_SPEED = 0x02,
+  LOCO_FIELD_DIRECTION = 0x04,
+  LOCO_FIELD_ORIENTATION = 0x08,
+  LOCO_FIELD_FUNCTIONS = 0x10,
+  // member addresses, only included for consists.
+  LOCO_FIELD_CONSIST = 0x20,
+  LOCO_FIELDS_ALL = 0x3F
+};
+
+// Added to the address of a consist to form its key when streaming the active
+// locomotives, a consist and a locomotive may share the same address.
+static constexpr uint32_t LOCO_STREAM_CONSIST_KEY = 0x10000;
+
 class Locomotive {
 public:
   Locomotive(uint8_t);
@@ -42,13 +61,19 @@ public:
       speed = 128;
     }
     LOG(INFO, "[Loco %d] speed: %d", _locoAddress, speed);
-    _speed = speed;
+    if(_speed != speed) {
+      _speed = speed;
+      markChanged();
+    }
   }
   int8_t getSpeed() {
     return _speed;
   }
   void setDirection(bool forward) {
-    _direction = forward;
+    if(_direction != forward) {
+      _direction = forward;
+      markChanged();
+    }
   }
   bool isDirectionForward() {
     return _direction;
@@ -66,6 +91,14 @@ public:
   void sendLocoUpdate(bool=false);
   void showStatus();
   void toJson(JsonObject &, bool=true, bool=true);
+  // compact representation used by the /v2 API, booleans are sent as 0/1
+  // and the function states are sent as a bitmask with F0 as bit 0.
+  void toCompactJson(JsonObject &, uint8_t=LOCO_FIELDS_ALL);
+  uint32_t getFunctionMask();
+  const uint32_t getChangeSequence() {
+    return _changeSequence;
+  }
+  void markChanged();
 
 #define _LOCO_FUNCTION_UPDATE_IMPL(funcID, pkt, offs, base, limit, sendPacket) \
   if(funcID >= base && funcID <= limit) { \
@@ -75,8 +108,7 @@ public:
       bitClear(_functionPackets[pkt][offs], funcID - base); \
     } \
     if(sendPacket) { \
-      dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(_functionPackets[pkt]); \
-      _lastFunctionsPacketTime[pkt] = esp_timer_get_time(); \
+      sendFunctionPacket(pkt); \
     } \
     return; \
   }
@@ -90,7 +122,10 @@ public:
 
   void setFunction(uint8_t funcID, bool state=false, bool batch=false) {
     LOG(INFO, "[Loco %d] F%d:%s", _locoAddress, funcID, state ? JSON_VALUE_ON : JSON_VALUE_OFF);
-    _functionState[funcID] = state;
+    if(_functionState[funcID] != state) {
+      _functionState[funcID] = state;
+      markChanged();
+    }
     uint8_t offs = 1;
     if(_locoAddress > 127) {
       offs++;
@@ -103,8 +138,7 @@ public:
         bitClear(_functionPackets[0][offs], 4);
       }
       if(!batch) {
-        dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(_functionPackets[0]);
-        _lastFunctionsPacketTime[0] = esp_timer_get_time();
+        sendFunctionPacket(0);
       }
       return;
     }
@@ -117,8 +151,13 @@ public:
   bool isFunctionEnabled(uint8_t funcID) {
     return _functionState[funcID];
   }
+protected:
+  virtual ChangeType getChangeType() {
+    return ChangeType::LOCOMOTIVE;
+  }
 private:
   void createFunctionPackets();
+  void sendFunctionPacket(uint8_t);
   int8_t _registerNumber{-1};
   uint16_t _locoAddress{0};
   int8_t _speed{0};
@@ -131,6 +170,12 @@ private:
                                                 false,false,false,false,false,false,false,false,
                                                 false,false,false,false};
   std::vector<uint8_t> _functionPackets[MAX_LOCOMOTIVE_FUNCTION_PACKETS];
+  uint32_t _changeSequence{0};
+  // throttle updates received within LOCO_UPDATE_COALESCE_WINDOW_MS of the
+  // previous packet are deferred, these will be sent by the periodic update.
+  std::atomic_bool _speedUpdatePending{false};
+  std::atomic<uint8_t> _pendingFunctionPackets{0};
+  uint64_t _lastFunctionUpdateTime{0};
 };
 
 class LocomotiveConsist : public Locomotive {
@@ -144,6 +189,7 @@ public:
   virtual ~LocomotiveConsist();
   void showStatus();
   void toJson(JsonObject &, bool=true, bool=true);
+  void toCompactJson(JsonObject &, uint8_t=LOCO_FIELDS_ALL);
   bool isAddressInConsist(uint16_t);
   void updateThrottle(uint16_t, int8_t, bool);
   void addLocomotive(uint16_t, bool, uint8_t);
@@ -161,6 +207,10 @@ public:
       }
     }
   }
+protected:
+  ChangeType getChangeType() {
+    return ChangeType::CONSIST;
+  }
 private:
   bool _decoderAssisstedConsist;
   std::vector<Locomotive *> _locos;
@@ -217,6 +267,7 @@ public:
   // gets or creates a new locomotive to be managed
   static Locomotive *getLocomotive(const uint16_t, const bool=true);
   static Locomotive *getLocomotiveByRegister(const uint8_t);
+  static Locomotive *getActiveLocomotive(const uint16_t);
   // removes a locomotive from management, sends speed zero before removal
   static void removeLocomotive(const uint16_t);
   static bool removeLocomotiveConsist(const uint16_t);
@@ -238,7 +289,16 @@ public:
   static std::vector<RosterEntry *> getDefaultLocos(const int8_t=-1);
   static void getDefaultLocos(JsonArray &);
   static void getActiveLocos(JsonArray &);
+  static bool getActiveLocoByAddress(const uint16_t, JsonObject &);
+  // active locomotives are keyed by address followed by the consists keyed
+  // by address | LOCO_STREAM_CONSIST_KEY.
+  static void streamActiveLocos(json_stream_visitor_t);
+  static bool getCompactActiveLocoByAddress(const uint16_t, JsonObject &, const uint8_t);
+  static void streamCompactActiveLocos(json_stream_visitor_t, const uint8_t);
   static void getRosterEntries(JsonArray &);
+  // roster entries are keyed by address.
+  static void streamRosterEntries(json_stream_visitor_t);
+  static std::vector<RosterEntry *> getRosterEntries();
   static bool isConsistAddress(uint16_t);
   static bool isAddressInConsist(uint16_t);
   static LocomotiveConsist *getConsistByID(uint8_t);
@@ -0,0 +1,35 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+// Runtime metrics for all subsystems in the Prometheus text exposition
+// format, these are served via GET /metrics.
+//
+// The counters are owned by each subsystem and are updated without locking,
+// this only collects the current values when the metrics are requested.
+class Metrics {
+public:
+  // registers a task so its stack high-water mark will be reported, this is
+  // normally called by the task itself when it starts.
+  static void registerTask(TaskHandle_t);
+  // must be called before a registered task is deleted.
+  static void unregisterTask(TaskHandle_t);
+  static void write(Print &);
+};
@@ -17,12 +17,20 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <ArduinoJson.h>
 #include <driver/adc.h>
 #include <esp_adc_cal.h>
+#include <esp_timer.h>
+#include <os/os.h>
+#include <utils/Ewma.hxx>
+#include "AckDetector.h"
+#include "CurrentHistory.h"
 #include "DCCppProtocol.h"
 #include "DCCSignalGenerator.h"
+#include "PowerDistrict.h"
 
 enum MOTOR_BOARD_TYPE { ARDUINO_SHIELD, POLOLU, LMD18200, BTS7960B_5A, BTS7960B_10A };
 
@@ -31,14 +39,24 @@ public:
   GenericMotorBoard(adc1_channel_t, uint8_t, uint16_t, uint32_t, String, bool);
   virtual ~GenericMotorBoard() {}
   void powerOn(bool=true);
-  void powerOff(bool=true, bool=false);
+  void powerOff(bool=true);
   void showStatus();
+  // takes a single current sample and updates the fault state, this is
+  // called by the current monitoring task once per millisecond. Only the
+  // enable pin and the fault state are updated here, the resulting
+  // notifications are sent by processEvents.
   virtual void check();
+  // reports any overcurrent or automatic re-enable events raised by check,
+  // this must not be called from the current monitoring task.
+  void processEvents();
   bool isOn() {
-    return _state;
+    return _district.isEnabled();
   }
   bool isOverCurrent() {
-    return _triggered;
+    return _district.isFaulted();
+  }
+  const PowerDistrictState &getDistrictState() {
+    return _district;
   }
   const String getName() {
     return _name;
@@ -58,20 +76,72 @@ public:
   float getCurrentDraw() {
     return (float)((_current * _maxMilliAmps) / 4096.0f);
   }
+  // returns the number of milliseconds until the board will be re-enabled
+  // after an overcurrent event.
+  uint32_t getRetryRemaining();
+  // returns nullptr when no current history is recorded for this board, see
+  // CURRENT_HISTORY_ENABLED.
+  CurrentHistory *getCurrentHistory() {
+    return _history.get();
+  }
   virtual uint16_t captureSample(uint8_t, bool=false);
+  // continuous high-rate sampling used for service mode ACK detection.
+  void startAckSampling();
+  void stopAckSampling();
+  // discards all previously captured samples and resets the ACK detector,
+  // this should be called before sending the packet(s) to be acknowledged.
+  void resetAckDetection();
+  // waits up to the provided number of milliseconds for an ACK pulse of at
+  // least the provided ADC value above the baseline current draw.
+  bool waitForAck(uint16_t, uint32_t);
+protected:
+  // applies the pending district enable/disable request, this is only called
+  // by the current monitoring task or before it has been started.
+  void applyDistrictRequest();
 private:
+  // updates the enable pin and the current filters for a change in the
+  // district state, see applyDistrictRequest.
+  void handleDistrictEvent(PowerDistrictEvent);
+  // waits for the current monitoring task to apply the pending district
+  // enable/disable request.
+  void waitForDistrictRequest();
+  static void ackSampleCallback(void *);
+  uint16_t readADC();
+  void recordSample(uint16_t sample) {
+    if(_history) {
+      _history->addSample(sample);
+    }
+  }
   const String _name;
   const adc1_channel_t _senseChannel;
   const uint8_t _enablePin;
   const uint32_t _maxMilliAmps;
   const uint32_t _triggerValue;
+  const uint32_t _shortValue;
   const bool _progTrack;
   uint32_t _current;
-  uint32_t _lastCheckTime;
-  bool _state;
-  bool _triggered;
-  uint8_t _triggerClearedCountdown;
-  uint8_t _triggerRecurrenceCount;
+  PowerDistrictState _district;
+  // events raised by check which have not yet been reported, see
+  // MOTOR_BOARD_EVENT_* and processEvents.
+  std::atomic<uint8_t> _pendingEvents{0};
+  // details of the most recent overcurrent event for processEvents.
+  const char *_faultReason{nullptr};
+  uint32_t _faultCurrent{0};
+  // most recent raw samples, the median of these is used to reject single
+  // sample spikes from the ADC.
+  uint16_t _recentSamples[5]{0};
+  uint8_t _recentSampleIndex{0};
+  // responds within a few samples and is used for short circuit detection.
+  AbsEwma _fastCurrent;
+  // averages over ~100ms and is used for sustained overload detection and
+  // reporting.
+  AbsEwma _slowCurrent;
+  std::unique_ptr<CurrentHistory> _history;
+  esp_timer_handle_t _ackTimer{nullptr};
+  std::unique_ptr<uint16_t[]> _ackSamples;
+  std::atomic<uint32_t> _ackSampleHead{0};
+  uint32_t _ackSampleTail{0};
+  AckDetector _ackDetector;
 };
 
 class MotorBoardManager {
@@ -81,7 +151,13 @@ public:
   static GenericMotorBoard *getBoardByName(String);
   static std::vector<String> getBoardNames();
   static uint8_t getMotorBoardCount();
+  // starts the current monitoring task, this must be called after all motor
+  // boards have been registered.
+  static void startMonitoring();
   static void check();
+  // reports events raised by the current monitoring task, this is called
+  // from loop().
+  static void processEvents();
   static void powerOnAll();
   static bool powerOn(const String);
   static void powerOffAll();
@@ -20,6 +20,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include "DCCppProtocol.h"
+#include "JsonStream.h"
 
 const uint8_t OUTPUT_IFLAG_INVERT = 0;
 const uint8_t OUTPUT_IFLAG_RESTORE_STATE = 1;
@@ -45,6 +46,10 @@ public:
     return _active;
   }
   void showStatus();
+  const uint32_t getChangeSequence() {
+    return _changeSequence;
+  }
+  void markChanged();
   const String getFlagsAsString() {
     String flagsString = "";
     if(bitRead(_flags, OUTPUT_IFLAG_INVERT)) {
@@ -68,6 +73,7 @@ private:
   uint8_t _pin;
   uint8_t _flags;
   bool _active;
+  uint32_t _changeSequence{0};
 };
 
 class OutputManager {
@@ -79,6 +85,8 @@ class OutputManager {
     static Output *getOutput(uint16_t);
     static bool toggle(uint16_t);
     static void getState(JsonArray &);
+    // outputs are keyed by ID.
+    static void streamState(json_stream_visitor_t);
     static void showStatus();
     static bool createOrUpdate(const uint16_t, const uint8_t, const uint8_t);
     static bool remove(const uint16_t);
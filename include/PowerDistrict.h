@@ -0,0 +1,204 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+
+// This file has no Arduino or ESP-IDF dependencies so that the fault
+// handling can be exercised on the host, see tools/power_district_sim.cpp.
+
+// Number of milliseconds after enabling a motor board during which short
+// circuit detection is suppressed, this allows decoder capacitors to charge.
+// Sustained overload detection remains active during this period.
+static constexpr uint32_t MOTOR_BOARD_INRUSH_BLANKING_MS = 20;
+
+// Number of milliseconds to wait after an overcurrent event before the motor
+// board will be enabled again, this doubles for each consecutive fault.
+static constexpr uint32_t MOTOR_BOARD_FAULT_RETRY_MS = 5000;
+
+// Maximum number of milliseconds to wait before re-enabling a motor board
+// after repeated overcurrent events.
+static constexpr uint32_t MOTOR_BOARD_FAULT_RETRY_MAX_MS = 60000;
+
+// Number of milliseconds a motor board must run without an overcurrent event
+// before the retry delay is reset to MOTOR_BOARD_FAULT_RETRY_MS.
+static constexpr uint32_t MOTOR_BOARD_FAULT_RESET_MS = 30000;
+
+enum PowerDistrictEvent : uint8_t {
+  POWER_DISTRICT_NONE,
+  // the fast current average crossed the short circuit limit.
+  POWER_DISTRICT_SHORT_CIRCUIT,
+  // the slow current average crossed the overload limit.
+  POWER_DISTRICT_OVERLOAD,
+  // the retry delay after a fault has expired and the district is enabled.
+  POWER_DISTRICT_RETRY,
+  // an explicit enable request has been applied, see requestEnable.
+  POWER_DISTRICT_ENABLED,
+  // an explicit disable request has been applied, see requestDisable.
+  POWER_DISTRICT_DISABLED
+};
+
+// Pending explicit enable/disable request for a district, see
+// PowerDistrictState::requestEnable.
+enum PowerDistrictRequest : uint8_t {
+  POWER_DISTRICT_REQUEST_NONE,
+  POWER_DISTRICT_REQUEST_ENABLE,
+  POWER_DISTRICT_REQUEST_DISABLE
+};
+
+// Enable and fault state of a single power district (motor board). This
+// decides when the district must be disabled and when it is enabled again,
+// the caller is responsible for the enable pin and the current readings.
+//
+// Explicit enable and disable requests are only recorded by the calling
+// task and are applied by the next update (or applyRequest) so that all
+// state changes, and the resulting enable pin changes, are made by the
+// current monitoring task. A disable request is applied before the retry
+// delay is evaluated so it can not be undone by an automatic re-enable.
+//
+// requestEnable, requestDisable, isRequestPending, isEnabled and isFaulted
+// may be called from any task, all other methods are expected to be called
+// by the current monitoring task.
+class PowerDistrictState {
+public:
+  PowerDistrictState(uint32_t overloadLimit, uint32_t shortLimit) :
+    _overloadLimit(overloadLimit), _shortLimit(shortLimit) {}
+  // requests the district be enabled, this cancels a pending retry. Only the
+  // most recent request is applied.
+  void requestEnable() {
+    _request = POWER_DISTRICT_REQUEST_ENABLE;
+  }
+  // requests the district be disabled, this cancels a pending retry. Only
+  // the most recent request is applied.
+  void requestDisable() {
+    _request = POWER_DISTRICT_REQUEST_DISABLE;
+  }
+  bool isRequestPending() const {
+    return _request != POWER_DISTRICT_REQUEST_NONE;
+  }
+  // applies the pending request (if any), returns POWER_DISTRICT_ENABLED or
+  // POWER_DISTRICT_DISABLED when the district state was changed.
+  PowerDistrictEvent applyRequest(uint32_t now) {
+    auto request = _request.exchange(POWER_DISTRICT_REQUEST_NONE);
+    if(request == POWER_DISTRICT_REQUEST_ENABLE && !_enabled) {
+      _powerOnTime = now;
+      _faulted = false;
+      _enabled = true;
+      return POWER_DISTRICT_ENABLED;
+    } else if(request == POWER_DISTRICT_REQUEST_DISABLE && (_enabled || _faulted)) {
+      _enabled = false;
+      _faulted = false;
+      return POWER_DISTRICT_DISABLED;
+    }
+    return POWER_DISTRICT_NONE;
+  }
+  // applies the pending request and then evaluates the current averages (in
+  // ADC units) while the district is enabled or the retry delay while it is
+  // faulted. The current values are ignored while the district is not
+  // enabled and when a request has been applied since they were taken
+  // before the district state changed.
+  PowerDistrictEvent update(uint32_t now, uint32_t fastCurrent, uint32_t slowCurrent) {
+    auto event = applyRequest(now);
+    if(event != POWER_DISTRICT_NONE) {
+      return event;
+    } else if(_faulted) {
+      if(now - _triggerTime >= _retryDelay) {
+        _powerOnTime = now;
+        _faulted = false;
+        _enabled = true;
+        return POWER_DISTRICT_RETRY;
+      }
+      return POWER_DISTRICT_NONE;
+    } else if(!_enabled) {
+      return POWER_DISTRICT_NONE;
+    }
+    if(fastCurrent >= _shortLimit && (now - _powerOnTime) >= MOTOR_BOARD_INRUSH_BLANKING_MS) {
+      fault(now);
+      return POWER_DISTRICT_SHORT_CIRCUIT;
+    } else if(slowCurrent >= _overloadLimit) {
+      fault(now);
+      return POWER_DISTRICT_OVERLOAD;
+    }
+    return POWER_DISTRICT_NONE;
+  }
+  bool isEnabled() const {
+    return _enabled;
+  }
+  // returns true if the district is disabled due to an overcurrent event and
+  // will be enabled again once the retry delay expires.
+  bool isFaulted() const {
+    return _faulted;
+  }
+  // number of consecutive overcurrent events.
+  uint8_t getFaultCount() const {
+    return _faultCount;
+  }
+  uint32_t getRetryDelay() const {
+    return _retryDelay;
+  }
+  // returns the number of milliseconds until the district will be enabled
+  // again after an overcurrent event.
+  uint32_t getRetryRemaining(uint32_t now) const {
+    uint32_t elapsed = now - _triggerTime;
+    return _faulted && elapsed < _retryDelay ? _retryDelay - elapsed : 0;
+  }
+private:
+  void fault(uint32_t now) {
+    _enabled = false;
+    _triggerTime = now;
+    // back off on repeated faults, a district which has been running for a
+    // while starts over with the minimum delay.
+    if(now - _powerOnTime >= MOTOR_BOARD_FAULT_RESET_MS) {
+      _faultCount = 0;
+    }
+    _retryDelay = MOTOR_BOARD_FAULT_RETRY_MAX_MS;
+    if(_faultCount < 16) {
+      _retryDelay = std::min(MOTOR_BOARD_FAULT_RETRY_MS << _faultCount, MOTOR_BOARD_FAULT_RETRY_MAX_MS);
+    }
+    if(_faultCount < UINT8_MAX) {
+      _faultCount++;
+    }
+    _faulted = true;
+  }
+  const uint32_t _overloadLimit;
+  const uint32_t _shortLimit;
+  std::atomic<bool> _enabled{false};
+  std::atomic<bool> _faulted{false};
+  std::atomic<PowerDistrictRequest> _request{POWER_DISTRICT_REQUEST_NONE};
+  uint32_t _powerOnTime{0};
+  uint32_t _triggerTime{0};
+  uint32_t _retryDelay{0};
+  uint8_t _faultCount{0};
+};
+
+// Combined state of the districts which share a single DCC signal.
+struct PowerDistrictSummary {
+  bool anyEnabled{false};
+  bool anyFaulted{false};
+  void add(const PowerDistrictState &district) {
+    anyEnabled |= district.isEnabled();
+    anyFaulted |= district.isFaulted();
+  }
+  // the signal is stopped once no district is using it, a district which is
+  // waiting to be re-enabled after a fault still needs it.
+  bool isSignalRequired() const {
+    return anyEnabled || anyFaulted;
+  }
+};
@@ -21,6 +21,7 @@ COPYRIGHT (c) 2018 Dan Worth
 #include <ArduinoJson.h>
 #include "Sensors.h"
 #include "DCCppProtocol.h"
+#include "JsonStream.h"
 
 class RemoteSensor : public Sensor {
 public:
@@ -33,8 +34,13 @@ public:
     return _value;
   }
   void setSensorValue(const uint16_t value) {
+    bool valueChanged = (_value != value);
     _value = value;
     _lastUpdate = millis();
+    if(valueChanged && isActive() == (_value != 0)) {
+      // the state is not changing so the change needs to be recorded here.
+      markChanged();
+    }
     set(_value != 0);
   }
   const uint32_t getLastUpdate() {
@@ -43,6 +49,10 @@ public:
   virtual void check();
   void showSensor();
   virtual void toJson(JsonObject &, bool=false);
+protected:
+  virtual ChangeType getChangeType() {
+    return ChangeType::REMOTE_SENSOR;
+  }
 private:
   uint16_t _rawID;
   uint16_t _value;
@@ -55,7 +65,12 @@ public:
   static void show();
   static void createOrUpdate(const uint16_t, const uint16_t=0);
   static bool remove(const uint16_t);
+  // returns the remote sensor with the provided sensor ID, this is the ID
+  // used by ChangeLog and includes REMOTE_SENSORS_FIRST_SENSOR.
+  static RemoteSensor *getSensor(const uint16_t);
   static void getState(JsonArray &);
+  // remote sensors are keyed by ID.
+  static void streamState(json_stream_visitor_t);
 };
 
 class RemoteSensorsCommandAdapter : public DCCPPProtocolCommand {
@@ -18,6 +18,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #ifndef _S88_SENSORS_H_
 #define _S88_SENSORS_H_
 
+#include <atomic>
 #include <ArduinoJson.h>
 #include "Sensors.h"
 #include "DCCppProtocol.h"
@@ -87,9 +88,22 @@ public:
   static bool createOrUpdateBus(const uint8_t, const uint8_t, const uint16_t);
   static bool removeBus(const uint8_t);
   static void getState(JsonArray &);
+  // duration of the most recent and slowest scan of all busses.
+  static uint32_t getLastScanMicros() {
+    return _lastScanMicros;
+  }
+  static uint32_t getMaxScanMicros() {
+    return _maxScanMicros;
+  }
+  static uint32_t getScanCount() {
+    return _scanCount;
+  }
 private:
   static TaskHandle_t _taskHandle;
   static xSemaphoreHandle _s88SensorLock;
+  static std::atomic<uint32_t> _lastScanMicros;
+  static std::atomic<uint32_t> _maxScanMicros;
+  static std::atomic<uint32_t> _scanCount;
 };
 
 class S88BusCommandAdapter : public DCCPPProtocolCommand {
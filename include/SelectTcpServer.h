@@ -0,0 +1,138 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <executor/Executor.hxx>
+#include <executor/Service.hxx>
+#include <executor/StateFlow.hxx>
+#include <utils/socket_listener.hxx>
+
+class SelectTcpServer;
+
+// A single TCP client connection served by a SelectTcpServer. The socket is
+// placed into non-blocking mode and all reads and writes are performed by two
+// select() based StateFlows on the shared socket executor, no thread is
+// created per client.
+class SelectTcpClient {
+public:
+  SelectTcpClient(SelectTcpServer *, int);
+  virtual ~SelectTcpClient();
+  int getFD() {
+    return _fd;
+  }
+  // queues data to be sent to the client, this can be called from any thread.
+  void send(const std::string &);
+protected:
+  // called on the socket executor once the client has been registered.
+  virtual void connected() {}
+  // called on the socket executor for every block of data received.
+  virtual void receive(uint8_t *, size_t) = 0;
+  // disconnects the client, the instance will be deleted once both the
+  // read and write flows have exited.
+  void close();
+private:
+  friend class SelectTcpServer;
+  class ReadFlow : public StateFlowBase {
+  public:
+    ReadFlow(SelectTcpClient *);
+    void start() {
+      start_flow(STATE(read_data));
+    }
+  private:
+    Action read_data();
+    Action data_received();
+    SelectTcpClient *_client;
+    StateFlowSelectHelper _helper{this};
+    uint8_t _buf[128];
+  };
+  class WriteFlow : public StateFlowBase {
+  public:
+    WriteFlow(SelectTcpClient *);
+    void start() {
+      start_flow(STATE(wait_for_data));
+    }
+  private:
+    friend class SelectTcpClient;
+    Action wait_for_data();
+    Action write_done();
+    SelectTcpClient *_client;
+    StateFlowSelectHelper _helper{this};
+    std::string _active;
+    bool _idle{false};
+  };
+  void start();
+  void flowExited();
+  SelectTcpServer *_server;
+  const int _fd;
+  std::mutex _lock;
+  std::string _pending;
+  bool _closing{false};
+  uint8_t _activeFlows{0};
+  ReadFlow _reader;
+  WriteFlow _writer;
+};
+
+// TCP server which serves all of its clients from the shared socket executor
+// using ExecutorBase::select rather than a thread per connection.
+class SelectTcpServer {
+public:
+  typedef std::function<SelectTcpClient *(SelectTcpServer *, int)> client_factory_t;
+  SelectTcpServer(const char *, uint16_t, client_factory_t);
+  virtual ~SelectTcpServer();
+  void begin();
+  // sends the data to all connected clients, this can be called from any thread.
+  void broadcast(const std::string &);
+  size_t getClientCount();
+  const char *getName() {
+    return _name;
+  }
+  uint32_t getBytesSent() {
+    return _bytesSent;
+  }
+  uint32_t getBytesReceived() {
+    return _bytesReceived;
+  }
+  uint32_t getBytesDiscarded() {
+    return _bytesDiscarded;
+  }
+  Service *service();
+  static ExecutorBase *executor();
+  // returns all servers which have been created, this is used for reporting
+  // statistics.
+  static std::vector<SelectTcpServer *> &getServers();
+private:
+  friend class SelectTcpClient;
+  void addClient(int);
+  void removeClient(SelectTcpClient *);
+  const char *_name;
+  const uint16_t _port;
+  client_factory_t _factory;
+  std::unique_ptr<SocketListener> _listener;
+  std::mutex _lock;
+  std::vector<SelectTcpClient *> _clients;
+  std::atomic<uint32_t> _bytesSent{0};
+  std::atomic<uint32_t> _bytesReceived{0};
+  std::atomic<uint32_t> _bytesDiscarded{0};
+};
@@ -20,6 +20,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include <ArduinoJson.h>
 #include "DCCppProtocol.h"
 #include "WiFiInterface.h"
+#include "JsonStream.h"
 
 const int8_t NON_STORED_SENSOR_PIN=-1;
 
@@ -44,6 +45,10 @@ public:
   }
   virtual void check();
   void show();
+  const uint32_t getChangeSequence() {
+    return _changeSequence;
+  }
+  void markChanged();
 protected:
   void set(bool state) {
     if(_lastState != state) {
@@ -54,8 +59,12 @@ protected:
       } else {
         wifiInterface.print(F("<q %d>"), _sensorID);
       }
+      markChanged();
     }
   }
+  virtual ChangeType getChangeType() {
+    return ChangeType::SENSOR;
+  }
   void setID(uint16_t id) {
     _sensorID = id;
   }
@@ -64,6 +73,7 @@ private:
   int8_t _pin;
   bool _pullUp;
   bool _lastState;
+  uint32_t _changeSequence{0};
 };
 
 class SensorManager {
@@ -73,6 +83,8 @@ public:
   static uint16_t store();
   static void sensorTask(void *param);
   static void getState(JsonArray &);
+  // sensors are keyed by ID.
+  static void streamState(json_stream_visitor_t);
   static Sensor *getSensor(uint16_t);
   static bool createOrUpdate(const uint16_t, const uint8_t, const bool);
   static bool remove(const uint16_t);
@@ -18,6 +18,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 
 #include <ArduinoJson.h>
 #include "DCCppProtocol.h"
+#include "JsonStream.h"
 
 enum TurnoutType {
   LEFT=0,
@@ -27,6 +28,17 @@ enum TurnoutType {
   MAX_TURNOUT_TYPES // NOTE: this must be the last entry in the enum.
 };
 
+// Fields included in the compact JSON representation of a turnout.
+enum TURNOUT_JSON_FIELDS : uint8_t {
+  TURNOUT_FIELD_ID = 0x01,
+  TURNOUT_FIELD_ADDRESS = 0x02,
+  TURNOUT_FIELD_BOARD_ADDRESS = 0x04,
+  TURNOUT_FIELD_SUB_ADDRESS = 0x08,
+  TURNOUT_FIELD_STATE = 0x10,
+  TURNOUT_FIELD_TYPE = 0x20,
+  TURNOUT_FIELDS_ALL = 0x3F
+};
+
 void calculateTurnoutBoardAddressAndIndex(uint16_t *boardAddress, uint8_t *boardIndex, uint16_t address);
 
 class Turnout {
@@ -37,6 +49,8 @@ public:
   void update(uint16_t, int8_t, TurnoutType);
   void set(bool=false, bool=true);
   void toJson(JsonObject &, bool=false);
+  // compact representation used by the /v2 API.
+  void toCompactJson(JsonObject &, uint8_t=TURNOUT_FIELDS_ALL);
   const uint16_t getID() {
     return _turnoutID;
   }
@@ -62,6 +76,10 @@ public:
   void setType(const TurnoutType type) {
     _type = type;
   }
+  const uint32_t getChangeSequence() {
+    return _changeSequence;
+  }
+  void markChanged();
 private:
   uint16_t _turnoutID;
   uint16_t _address;
@@ -69,6 +87,7 @@ private:
   uint16_t _boardAddress;
   bool _thrown;
   TurnoutType _type;
+  uint32_t _changeSequence{0};
 };
 
 class TurnoutManager {
@@ -80,6 +99,9 @@ public:
   static bool toggleByID(uint16_t);
   static bool toggleByAddress(uint16_t);
   static void getState(JsonArray &, bool=true);
+  // turnouts are keyed by ID.
+  static void streamState(json_stream_visitor_t, bool=true);
+  static void streamCompactState(json_stream_visitor_t, const uint8_t);
   static void showStatus();
   static Turnout *createOrUpdate(const uint16_t, const uint16_t, const int8_t, const TurnoutType=TurnoutType::LEFT);
   static bool removeByID(const uint16_t);
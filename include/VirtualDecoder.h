@@ -0,0 +1,58 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include "DCCppProtocol.h"
+#include "VirtualDecoderModel.h"
+
+struct Packet;
+
+// Virtual decoder attached to the PROGRAMMING track, this is intended for
+// measuring programming track throughput and ACK detection without a decoder
+// (or motor board) being connected.
+//
+// Packets transmitted by the PROG signal generator are decoded and passed to
+// a VirtualDecoderModel which executes service mode direct byte/bit
+// instructions against an in-memory CV image. Current readings for the PROG
+// motor board are replaced with a synthetic trace which includes the ACK
+// pulses.
+class VirtualDecoder {
+public:
+  // called by the PROG signal generator after a packet has been transmitted.
+  static void packetSent(const Packet *);
+  // returns the synthetic current draw as an ADC reading.
+  static uint16_t getCurrentSample(uint32_t);
+  static VirtualDecoderProfile getProfile();
+  static void setProfile(const VirtualDecoderProfile &);
+  // restores the CV image to the default values and clears the statistics,
+  // this is also used to initialize the CV image during startup.
+  static void reset();
+};
+
+// <vdec> - displays the virtual decoder profile and ACK statistics
+// <vdec {DELAY USEC} {DURATION USEC} {IDLE MA} {ACK MA} {NOISE MA} {MISS %}>
+//   - updates the virtual decoder profile
+// <vdec reset> - restores the virtual decoder CV image to defaults
+class VirtualDecoderCommand : public DCCPPProtocolCommand {
+public:
+  void process(const std::vector<String>);
+  String getID() {
+    return "vdec";
+  }
+};
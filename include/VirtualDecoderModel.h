@@ -0,0 +1,178 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+// This file has no Arduino or ESP-IDF dependencies so that the virtual
+// decoder can be exercised on the host, see tools/virtual_decoder_sim.cpp.
+
+// Timing and current profile used by the virtual decoder when generating ACK
+// pulses, all times are relative to the end of the packet which triggered
+// the ACK.
+struct VirtualDecoderProfile {
+  uint32_t ackDelayUsec;
+  uint32_t ackDurationUsec;
+  uint16_t idleMilliAmps;
+  uint16_t ackMilliAmps;
+  uint16_t noiseMilliAmps;
+  // percentage of ACK pulses which will not be generated.
+  uint8_t missedAckPercent;
+};
+
+// Number of CVs supported by service mode direct addressing.
+static constexpr uint16_t VIRTUAL_DECODER_CV_COUNT = 1024;
+
+// value written to CV8 which resets the CV image to the defaults, this is
+// the NMRA recommended value for a decoder reset.
+static constexpr uint8_t VIRTUAL_DECODER_RESET_VALUE = 8;
+
+// Longest packet (including the checksum byte) which will be decoded.
+static constexpr uint8_t VIRTUAL_DECODER_MAX_PACKET_BYTES = 16;
+
+// Service mode state and CV image of the virtual decoder. Packets are
+// provided as bytes (including the checksum byte) in the order they are
+// transmitted, direct mode byte and bit instructions are executed against
+// the CV image and the result indicates if the decoder responds with an ACK.
+//
+// This is not thread safe, the caller is responsible for locking.
+class VirtualDecoderModel {
+public:
+  VirtualDecoderModel() {
+    reset();
+  }
+  // restores the CV image to the default values and clears the statistics.
+  void reset() {
+    resetCVs();
+    _lastPacketLength = 0;
+    _lastPacketExecuted = false;
+    _serviceMode = false;
+    _packetsDecoded = 0;
+    _instructionsExecuted = 0;
+  }
+  // returns true if the packet completes an instruction which the decoder
+  // acknowledges, packets with an invalid checksum are ignored.
+  bool packetReceived(const uint8_t *data, uint8_t length) {
+    uint8_t checksum = 0;
+    for(uint8_t index = 0; index < length; index++) {
+      checksum ^= data[index];
+    }
+    if(length < 3 || length > VIRTUAL_DECODER_MAX_PACKET_BYTES || checksum) {
+      return false;
+    }
+    _packetsDecoded++;
+    // instructions are only executed on the second identical packet and only
+    // once until a different packet is received.
+    if(length == _lastPacketLength && !memcmp(data, _lastPacket, length)) {
+      if(_lastPacketExecuted) {
+        return false;
+      }
+      _lastPacketExecuted = true;
+    } else {
+      memcpy(_lastPacket, data, length);
+      _lastPacketLength = length;
+      _lastPacketExecuted = false;
+      if(length == 3 && !data[0] && !data[1]) {
+        _serviceMode = true;
+      } else if(length != 4 || (data[0] & 0xF0) != 0x70) {
+        _serviceMode = false;
+      }
+      return false;
+    }
+    if(_serviceMode && length == 4 && (data[0] & 0xF0) == 0x70) {
+      _instructionsExecuted++;
+      return executeServiceModeInstruction(data);
+    }
+    return false;
+  }
+  // CV numbers start at one.
+  uint8_t getCV(uint16_t cv) {
+    return _cvs[(cv - 1) % VIRTUAL_DECODER_CV_COUNT];
+  }
+  void setCV(uint16_t cv, uint8_t value) {
+    _cvs[(cv - 1) % VIRTUAL_DECODER_CV_COUNT] = value;
+  }
+  uint32_t getPacketsDecoded() {
+    return _packetsDecoded;
+  }
+  uint32_t getInstructionsExecuted() {
+    return _instructionsExecuted;
+  }
+private:
+  void resetCVs() {
+    memset(_cvs, 0, sizeof(_cvs));
+    _cvs[0] = 3;     // CV1: short address
+    _cvs[6] = 1;     // CV7: version
+    _cvs[7] = 13;    // CV8: manufacturer (public domain & DIY)
+    _cvs[28] = 6;    // CV29: 28/128 speed steps, analog conversion enabled
+  }
+  // executes a service mode direct mode instruction (RCN-216 section 4.2),
+  // returns true if the decoder would acknowledge the instruction.
+  bool executeServiceModeInstruction(const uint8_t *data) {
+    const uint16_t cv = ((data[0] & 0x03) << 8) | data[1];
+    const uint8_t bit = data[2] & 0x07;
+    const uint8_t bitValue = (data[2] >> 3) & 0x01;
+    switch(data[0] & 0x0C) {
+      case 0x04:
+        // verify byte
+        return _cvs[cv] == data[2];
+      case 0x0C:
+        // write byte, CV7 and CV8 are read-only but a write of the reset
+        // value to CV8 restores the defaults.
+        if(cv == 7 && data[2] == VIRTUAL_DECODER_RESET_VALUE) {
+          resetCVs();
+          return true;
+        } else if(cv == 6 || cv == 7) {
+          return false;
+        }
+        _cvs[cv] = data[2];
+        return true;
+      case 0x08:
+        // bit manipulation: 111KDBBB
+        if((data[2] & 0xE0) != 0xE0) {
+          return false;
+        } else if(data[2] & 0x10) {
+          if(cv == 6 || cv == 7) {
+            return false;
+          }
+          _cvs[cv] = (_cvs[cv] & ~(1 << bit)) | (bitValue << bit);
+          return true;
+        }
+        return ((_cvs[cv] >> bit) & 0x01) == bitValue;
+    }
+    return false;
+  }
+  uint8_t _cvs[VIRTUAL_DECODER_CV_COUNT];
+  uint8_t _lastPacket[VIRTUAL_DECODER_MAX_PACKET_BYTES];
+  uint8_t _lastPacketLength;
+  bool _lastPacketExecuted;
+  bool _serviceMode;
+  uint32_t _packetsDecoded;
+  uint32_t _instructionsExecuted;
+};
+
+// converts a current draw to the ADC reading of a motor board with the
+// provided full scale current.
+static inline uint16_t getVirtualDecoderSample(int32_t milliAmps, uint32_t maxMilliAmps) {
+  if(milliAmps <= 0 || !maxMilliAmps) {
+    return 0;
+  }
+  return std::min((uint32_t)4095, (uint32_t)((milliAmps * 4096) / maxMilliAmps));
+}
@@ -16,11 +16,20 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 **********************************************************************/
 #pragma once
 
+#include <atomic>
 #include <ESPAsyncWebServer.h>
 #include <ESPmDNS.h>
 
+#include "BinaryThrottle.h"
 #include "InfoScreen.h"
 
+struct WebAsset;
+
+// WebSocket sub-protocol which enables the binary throttle protocol, clients
+// which do not request this will use the DCC++ text protocol. Note that the
+// client must only offer this single sub-protocol.
+constexpr const char * WS_BINARY_PROTOCOL = "esp32cs-binary";
+
 class ESP32CSWebServer : public AsyncWebServer {
 public:
   ESP32CSWebServer();
@@ -31,21 +40,60 @@ public:
     InfoScreen::replaceLine(INFO_SCREEN_WS_CLIENTS_LINE, F("WS Clients: 0"));
 #endif
   }
-  void broadcastToWS(const String &buf) {
-    webSocket.textAll(buf);
+  // queues a text protocol message for all text WebSocket clients, the
+  // queued messages are sent by flushWebSocketText.
+  void broadcastToWS(const String &);
+  // sends the queued text protocol messages to each WebSocket client as a
+  // single frame.
+  void flushWebSocketText();
+  void notifyPowerState();
+  // sends the entity state changes since the last call to the WebSocket
+  // clients which have subscribed to them.
+  void sendStateUpdates();
+  // sends any new current history buckets to the WebSocket clients which
+  // have subscribed to them.
+  void sendCurrentHistory();
+  size_t getWebSocketClientCount() {
+    return webSocket.count();
   }
+  uint32_t getWebSocketBytesSent();
 private:
   AsyncWebSocket webSocket;
+  // sequence number of the next current history bucket to send for each
+  // motor board.
+  std::vector<uint32_t> _currentHistorySequence;
+  uint32_t _lastCurrentHistoryCheck{0};
+  // sequence number of the last ChangeLog entry sent to WebSocket clients.
+  uint32_t _stateSequence{0};
+  uint32_t _lastStateUpdate{0};
+  uint32_t _lastTextFlush{0};
+  std::atomic_bool _powerStateChanged{false};
+  // registers a route with handler time and response size instrumentation,
+  // this is otherwise the same as AsyncWebServer::on.
+  void route(const char *, WebRequestMethodComposite, ArRequestHandlerFunction,
+             ArUploadHandlerFunction=nullptr, ArBodyHandlerFunction=nullptr);
+  void handleWebAsset(AsyncWebServerRequest *, const WebAsset *);
+  void handleMetrics(AsyncWebServerRequest *);
+  void handleRouteStatistics(AsyncWebServerRequest *);
   void handleESPInfo(AsyncWebServerRequest *);
   void handleProgrammer(AsyncWebServerRequest *);
+  void handleDecoderBackup(AsyncWebServerRequest *);
   void handlePower(AsyncWebServerRequest *);
+  void handleCurrentHistory(AsyncWebServerRequest *);
   void handleOutputs(AsyncWebServerRequest *);
   void handleTurnouts(AsyncWebServerRequest *);
   void handleSensors(AsyncWebServerRequest *);
   void handleConfig(AsyncWebServerRequest *);
   void handleLocomotive(AsyncWebServerRequest *);
+  void handleLocomotiveV2(AsyncWebServerRequest *);
+  void handleTurnoutsV2(AsyncWebServerRequest *);
 #if S88_ENABLED
   void handleS88Sensors(AsyncWebServerRequest *);
 #endif
   void handleRemoteSensors(AsyncWebServerRequest *);
+  void handleChanges(AsyncWebServerRequest *);
+  void handleBatch(AsyncWebServerRequest *);
+  void handleBatchBody(AsyncWebServerRequest *, uint8_t *, size_t, size_t, size_t);
 };
+
+extern ESP32CSWebServer esp32csWebServer;
@@ -18,6 +18,8 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #pragma once
 
 #include <ESPAsyncWebServer.h>
+#include <map>
+#include <mutex>
 
 class WiFiInterface {
 public:
@@ -27,6 +29,19 @@ public:
   void showInitInfo();
   void send(const String &);
   void print(const __FlashStringHelper *fmt, ...);
+  // notifies throttles which track state outside of the DCC++ protocol
+  void notifyTurnoutState(uint16_t, bool);
+  void notifyPowerState();
+  // while a batch is active all data sent from the calling task is buffered
+  // and sent as a single broadcast when the batch ends. Data sent from other
+  // tasks is not affected, each task has its own batch so batches from
+  // different interfaces do not wait for each other.
+  void beginBatch();
+  void endBatch();
+private:
+  // only held while accessing _batches, not while the batch is processed.
+  std::mutex _batchLock;
+  std::map<TaskHandle_t, String> _batches;
 };
 
 extern WiFiInterface wifiInterface;
@@ -0,0 +1,39 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Default TCP port used by WiThrottle compatible throttles (Engine Driver,
+// WiThrottle, etc).
+constexpr uint16_t WITHROTTLE_LISTENER_PORT = 12090;
+
+// Native WiThrottle protocol server, all clients are served from the shared
+// socket executor used by the JMRI interface.
+class WiThrottleServer {
+public:
+  static void begin();
+  static size_t getClientCount();
+  // notifies connected throttles of a turnout state change, this can be
+  // called from any thread.
+  static void notifyTurnoutState(uint16_t, bool);
+  // notifies connected throttles of the current track power state, this can
+  // be called from any thread.
+  static void notifyPowerState();
+};
@@ -0,0 +1,118 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+
+// ADC readings are 12 bits, only the upper 8 bits are stored.
+static constexpr uint8_t CURRENT_HISTORY_STORAGE_SHIFT = 4;
+
+// number of bytes used for each stored bucket (min, max, avg).
+static constexpr uint8_t CURRENT_HISTORY_BUCKET_SIZE = 3;
+
+CurrentHistory::Ring::Ring(uint16_t capacity) : _capacity(capacity),
+  _buckets(new (std::nothrow) uint8_t[capacity * CURRENT_HISTORY_BUCKET_SIZE]) {
+  if(!_buckets) {
+    LOG_ERROR("[CurrentHistory] Unable to allocate %d buckets, history will not be recorded", capacity);
+  }
+}
+
+void CurrentHistory::Ring::push(const CurrentHistoryBucket &bucket) {
+  const uint32_t next = _next.load(std::memory_order_relaxed);
+  if(_buckets) {
+    uint8_t *entry = &_buckets[(next % _capacity) * CURRENT_HISTORY_BUCKET_SIZE];
+    entry[0] = bucket.min >> CURRENT_HISTORY_STORAGE_SHIFT;
+    entry[1] = bucket.max >> CURRENT_HISTORY_STORAGE_SHIFT;
+    entry[2] = bucket.avg >> CURRENT_HISTORY_STORAGE_SHIFT;
+  }
+  _lastUpdate.store(millis(), std::memory_order_relaxed);
+  _next.store(next + 1, std::memory_order_release);
+}
+
+uint32_t CurrentHistory::Ring::get(uint32_t since, uint16_t count, std::vector<CurrentHistoryBucket> &buckets) {
+  const uint32_t next = _next.load(std::memory_order_acquire);
+  uint32_t first = next > _capacity ? next - _capacity : 0;
+  if(since > first) {
+    first = std::min(since, next);
+  }
+  if(!_buckets) {
+    return first;
+  }
+  const size_t start = buckets.size();
+  for(uint32_t sequence = first; sequence < next && buckets.size() < count; sequence++) {
+    const uint8_t *entry = &_buckets[(sequence % _capacity) * CURRENT_HISTORY_BUCKET_SIZE];
+    buckets.push_back({
+      (uint16_t)(entry[0] << CURRENT_HISTORY_STORAGE_SHIFT),
+      (uint16_t)(entry[1] << CURRENT_HISTORY_STORAGE_SHIFT),
+      (uint16_t)(entry[2] << CURRENT_HISTORY_STORAGE_SHIFT)
+    });
+  }
+  // the current monitoring task may have recorded more buckets while these
+  // were copied, any which share an entry with a bucket recorded (or being
+  // recorded) since then are dropped.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint32_t after = _next.load(std::memory_order_relaxed);
+  if(after >= _capacity && after - _capacity + 1 > first) {
+    const size_t overwritten = std::min((size_t)(after - _capacity + 1 - first), buckets.size() - start);
+    buckets.erase(buckets.begin() + start, buckets.begin() + start + overwritten);
+    first += overwritten;
+  }
+  return first;
+}
+
+CurrentHistory::CurrentHistory() : _fine(CURRENT_HISTORY_FINE_BUCKETS),
+  _coarse(CURRENT_HISTORY_COARSE_BUCKETS) {
+}
+
+void CurrentHistory::addSample(uint16_t sample) {
+  _fineMin = std::min(_fineMin, sample);
+  _fineMax = std::max(_fineMax, sample);
+  _fineSum += sample;
+  if(++_fineCount < CURRENT_HISTORY_FINE_SAMPLES) {
+    return;
+  }
+  CurrentHistoryBucket fine = {_fineMin, _fineMax, (uint16_t)(_fineSum / _fineCount)};
+  _fineMin = UINT16_MAX;
+  _fineMax = 0;
+  _fineSum = 0;
+  _fineCount = 0;
+
+  _coarseMin = std::min(_coarseMin, fine.min);
+  _coarseMax = std::max(_coarseMax, fine.max);
+  _coarseSum += fine.avg;
+  bool coarseComplete = ++_coarseCount >= CURRENT_HISTORY_COARSE_RATIO;
+
+  _fine.push(fine);
+  if(coarseComplete) {
+    _coarse.push({_coarseMin, _coarseMax, (uint16_t)(_coarseSum / _coarseCount)});
+    _coarseMin = UINT16_MAX;
+    _coarseMax = 0;
+    _coarseSum = 0;
+    _coarseCount = 0;
+  }
+}
+
+uint32_t CurrentHistory::getBuckets(bool coarse, uint32_t since, uint16_t count, std::vector<CurrentHistoryBucket> &buckets) {
+  return coarse ? _coarse.get(since, count, buckets) : _fine.get(since, count, buckets);
+}
+
+uint32_t CurrentHistory::getNextSequence(bool coarse) {
+  return coarse ? _coarse._next.load() : _fine._next.load();
+}
+
+uint32_t CurrentHistory::getLastUpdate(bool coarse) {
+  return coarse ? _coarse._lastUpdate.load() : _fine._lastUpdate.load();
+}
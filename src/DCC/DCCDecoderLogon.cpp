@@ -0,0 +1,294 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+
+#if DCC_A_ENABLED
+
+#include <atomic>
+#include <map>
+#include <dcc/RailCom.hxx>
+
+// DCC-A command address, all RCN-218 packets are sent to this address.
+static constexpr uint8_t DCCA_ADDRESS = 254;
+
+// RCN-218 command bytes.
+static constexpr uint8_t DCCA_GET_DATA_START = 0x00;
+static constexpr uint8_t DCCA_SELECT = 0xD0;
+static constexpr uint8_t DCCA_LOGON_ASSIGN = 0xE0;
+static constexpr uint8_t DCCA_LOGON_ENABLE = 0xFC;
+
+// LOGON_ENABLE group which includes all decoders which have not yet logged on
+// in the current session.
+static constexpr uint8_t DCCA_LOGON_GROUP_ALL = 0x00;
+
+// SELECT sub-command to read the ShortInfo block from the decoder.
+static constexpr uint8_t DCCA_SELECT_READ_SHORT_INFO = 0xFF;
+
+// datagram identifier used by decoders in response to LOGON_ENABLE.
+static constexpr uint8_t DCCA_ID_LOGON = 15;
+
+// number of milliseconds between LOGON_ENABLE broadcasts while decoders are
+// responding, this is increased to DCCA_IDLE_INTERVAL_MS when no decoder
+// responds.
+static constexpr uint32_t DCCA_DISCOVERY_INTERVAL_MS = 100;
+static constexpr uint32_t DCCA_IDLE_INTERVAL_MS = 1000;
+
+// number of milliseconds to wait for a RailCom response after queueing a
+// DCC-A packet, this includes the time the packet spends in the OPS queue.
+static constexpr uint32_t DCCA_RESPONSE_TIMEOUT_MS = 100;
+
+// number of times a SELECT or LOGON_ASSIGN will be sent before giving up.
+static constexpr uint8_t DCCA_ATTEMPTS = 3;
+
+// first address which will be assigned to a decoder when the address it
+// reports in the ShortInfo block is already in use.
+static constexpr uint16_t DCCA_FIRST_DYNAMIC_ADDRESS = 1000;
+
+// highest locomotive address which can be assigned.
+static constexpr uint16_t DCCA_MAX_LOCO_ADDRESS = 10239;
+
+// Priority and stack size for the decoder logon task.
+static constexpr UBaseType_t DCCA_TASK_PRIORITY = 1;
+static constexpr uint32_t DCCA_TASK_STACK_SIZE = 4096;
+
+static constexpr const char *DCCA_JSON_FILE = "dcca.json";
+
+// decoder unique IDs (manufacturer << 32 | DID) to assigned address.
+static std::map<uint64_t, uint16_t> dccaAssignedAddresses;
+static uint16_t dccaCommandStationID = 0;
+static uint8_t dccaSessionID = 0;
+static std::atomic<uint16_t> dccaLogonCount{0};
+
+// response datagram shared with the OPS signal generator task, the response
+// is only written while dccaAwaitingResponse is true.
+static std::atomic<bool> dccaAwaitingResponse{false};
+static uint8_t dccaResponse[6];
+static SemaphoreHandle_t dccaResponseReceived = nullptr;
+
+// CRC-8 (x^8 + x^5 + x^4 + 1) as used by RCN-218 for packets and datagrams.
+static uint8_t dccaCRC8(const uint8_t *data, size_t length) {
+  uint8_t crc = 0;
+  for(size_t index = 0; index < length; index++) {
+    uint8_t value = data[index];
+    for(uint8_t bit = 0; bit < 8; bit++) {
+      bool mix = (crc ^ value) & 0x01;
+      crc >>= 1;
+      if(mix) {
+        crc ^= 0x8C;
+      }
+      value >>= 1;
+    }
+  }
+  return crc;
+}
+
+static void loadDecoderAssignments() {
+  if(configStore.exists(DCCA_JSON_FILE)) {
+    DynamicJsonBuffer buffer;
+    JsonObject &root = configStore.load(DCCA_JSON_FILE, buffer);
+    dccaSessionID = root[JSON_SESSION_NODE];
+    JsonArray &decoders = root.get<JsonArray>(JSON_DECODERS_NODE);
+    for(auto decoder : decoders) {
+      JsonObject &entry = decoder.as<JsonObject &>();
+      uint64_t uid = ((uint64_t)entry[JSON_DECODER_MANUFACTURER_NODE].as<uint16_t>() << 32) |
+                     entry[JSON_UID_NODE].as<uint32_t>();
+      dccaAssignedAddresses[uid] = entry[JSON_ADDRESS_NODE];
+    }
+  }
+  LOG(INFO, "[DCC-A] Loaded %d decoder assignments", dccaAssignedAddresses.size());
+}
+
+static void storeDecoderAssignments() {
+  DynamicJsonBuffer buffer;
+  JsonObject &root = buffer.createObject();
+  root[JSON_SESSION_NODE] = dccaSessionID;
+  JsonArray &decoders = root.createNestedArray(JSON_DECODERS_NODE);
+  for(const auto &assignment : dccaAssignedAddresses) {
+    JsonObject &entry = decoders.createNestedObject();
+    entry[JSON_DECODER_MANUFACTURER_NODE] = (uint16_t)(assignment.first >> 32);
+    entry[JSON_UID_NODE] = (uint32_t)(assignment.first & 0xFFFFFFFF);
+    entry[JSON_ADDRESS_NODE] = assignment.second;
+  }
+  configStore.store(DCCA_JSON_FILE, root);
+}
+
+// sends the packet on the OPS track and waits for the decoder response, the
+// CRC-8 is appended to the packet when requested.
+static bool sendDCCAPacket(std::vector<uint8_t> packet, bool appendCRC, uint8_t *response) {
+  if(appendCRC) {
+    packet.push_back(dccaCRC8(packet.data(), packet.size()));
+  }
+  xSemaphoreTake(dccaResponseReceived, 0);
+  dccaAwaitingResponse = true;
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packet, 1, false, RAILCOM_FEEDBACK_DCCA);
+  bool received = xSemaphoreTake(dccaResponseReceived, pdMS_TO_TICKS(DCCA_RESPONSE_TIMEOUT_MS)) == pdTRUE;
+  dccaAwaitingResponse = false;
+  if(received) {
+    memcpy(response, dccaResponse, sizeof(dccaResponse));
+  }
+  return received;
+}
+
+static bool isAddressAvailable(uint16_t address, uint64_t uid) {
+  for(const auto &assignment : dccaAssignedAddresses) {
+    if(assignment.second == address && assignment.first != uid) {
+      return false;
+    }
+  }
+  return !LocomotiveManager::getRosterEntry(address, false);
+}
+
+static void processDecoderLogon(uint16_t manufacturer, uint32_t did) {
+  const uint64_t uid = ((uint64_t)manufacturer << 32) | did;
+  std::vector<uint8_t> selectHeader = {DCCA_ADDRESS,
+    (uint8_t)(DCCA_SELECT | ((manufacturer >> 8) & 0x0F)), lowByte(manufacturer),
+    (uint8_t)(did >> 24), (uint8_t)(did >> 16), (uint8_t)(did >> 8), (uint8_t)did};
+  uint8_t response[6];
+  uint16_t address = 0;
+
+  auto assigned = dccaAssignedAddresses.find(uid);
+  if(assigned != dccaAssignedAddresses.end()) {
+    address = assigned->second;
+  } else {
+    // read the ShortInfo block to retrieve the decoder's current address
+    std::vector<uint8_t> select(selectHeader);
+    select.push_back(DCCA_SELECT_READ_SHORT_INFO);
+    for(uint8_t attempt = 0; attempt < DCCA_ATTEMPTS && !address; attempt++) {
+      sendDCCAPacket(select, true, response);
+      if(sendDCCAPacket({DCCA_ADDRESS, DCCA_GET_DATA_START}, false, response) &&
+         dccaCRC8(response, 5) == response[5]) {
+        uint16_t preferred = ((response[0] & 0x3F) << 8) | response[1];
+        LOG(INFO, "[DCC-A] Decoder %03X:%08X ShortInfo: address %d, max function %d, capabilities %02x",
+            manufacturer, did, preferred, response[2], response[3]);
+        if(preferred && preferred <= DCCA_MAX_LOCO_ADDRESS && isAddressAvailable(preferred, uid)) {
+          address = preferred;
+        }
+        break;
+      }
+    }
+    for(uint16_t candidate = DCCA_FIRST_DYNAMIC_ADDRESS; !address && candidate <= DCCA_MAX_LOCO_ADDRESS; candidate++) {
+      if(isAddressAvailable(candidate, uid)) {
+        address = candidate;
+      }
+    }
+    if(!address) {
+      LOG_ERROR("[DCC-A] No address available for decoder %03X:%08X", manufacturer, did);
+      return;
+    }
+  }
+
+  std::vector<uint8_t> assign = {DCCA_ADDRESS,
+    (uint8_t)(DCCA_LOGON_ASSIGN | ((manufacturer >> 8) & 0x0F)), lowByte(manufacturer),
+    (uint8_t)(did >> 24), (uint8_t)(did >> 16), (uint8_t)(did >> 8), (uint8_t)did,
+    (uint8_t)((address >> 8) & 0x3F), lowByte(address)};
+  bool acknowledged = false;
+  for(uint8_t attempt = 0; attempt < DCCA_ATTEMPTS && !acknowledged; attempt++) {
+    acknowledged = sendDCCAPacket(assign, true, response);
+  }
+  if(!acknowledged) {
+    LOG(WARNING, "[DCC-A] Decoder %03X:%08X did not acknowledge address %d", manufacturer, did, address);
+    return;
+  }
+  LOG(INFO, "[DCC-A] Decoder %03X:%08X assigned address %d", manufacturer, did, address);
+  dccaLogonCount++;
+  if(assigned == dccaAssignedAddresses.end()) {
+    dccaAssignedAddresses[uid] = address;
+    storeDecoderAssignments();
+  }
+  if(!LocomotiveManager::getRosterEntry(address, false)) {
+    auto entry = LocomotiveManager::getRosterEntry(address);
+    entry->setDescription(StringPrintf("DCC-A %03X:%08X", manufacturer, did).c_str());
+    entry->setType(JSON_VALUE_MOBILE_DECODER);
+    LocomotiveManager::store();
+  }
+}
+
+static void decoderLogonTask(void *arg) {
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
+  auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_OPS);
+  uint32_t interval = DCCA_IDLE_INTERVAL_MS;
+  while(true) {
+    vTaskDelay(pdMS_TO_TICKS(interval));
+    interval = DCCA_IDLE_INTERVAL_MS;
+    if(!motorBoard->isOn()) {
+      continue;
+    }
+    uint8_t response[6];
+    if(sendDCCAPacket({DCCA_ADDRESS, (uint8_t)(DCCA_LOGON_ENABLE | DCCA_LOGON_GROUP_ALL),
+                       highByte(dccaCommandStationID), lowByte(dccaCommandStationID), dccaSessionID},
+                      false, response) && (response[0] >> 4) == DCCA_ID_LOGON) {
+      uint16_t manufacturer = ((response[0] & 0x0F) << 8) | response[1];
+      uint32_t did = ((uint32_t)response[2] << 24) | ((uint32_t)response[3] << 16) |
+                     ((uint32_t)response[4] << 8) | response[5];
+      processDecoderLogon(manufacturer, did);
+      // more decoders may be waiting to log on
+      interval = DCCA_DISCOVERY_INTERVAL_MS;
+    }
+  }
+}
+
+void DecoderLogonManager::init() {
+  loadDecoderAssignments();
+  // a new session ID causes all decoders to log on again, assigned addresses
+  // are retained by the decoders and by the command station.
+  dccaSessionID++;
+  uint64_t mac = ESP.getEfuseMac();
+  dccaCommandStationID = (uint16_t)((mac >> 32) ^ (mac & 0xFFFF));
+  storeDecoderAssignments();
+  LOG(INFO, "[DCC-A] Command station ID: %04X, session: %d", dccaCommandStationID, dccaSessionID);
+  dccaResponseReceived = xSemaphoreCreateBinary();
+  xTaskCreate(decoderLogonTask, "DCC-A", DCCA_TASK_STACK_SIZE, nullptr, DCCA_TASK_PRIORITY, nullptr);
+}
+
+void DecoderLogonManager::railComFeedback(const dcc::Feedback &feedback) {
+  if(!dccaAwaitingResponse) {
+    return;
+  }
+  // DCC-A datagrams use both RailCom channels, 8 bytes of 6 bits each.
+  uint8_t raw[8];
+  size_t length = 0;
+  for(size_t index = 0; index < feedback.ch1Size && length < sizeof(raw); index++) {
+    raw[length++] = feedback.ch1Data[index];
+  }
+  for(size_t index = 0; index < feedback.ch2Size && length < sizeof(raw); index++) {
+    raw[length++] = feedback.ch2Data[index];
+  }
+  if(length != sizeof(raw)) {
+    return;
+  }
+  uint64_t datagram = 0;
+  for(size_t index = 0; index < length; index++) {
+    uint8_t decoded = dcc::railcom_decode[raw[index]];
+    if(decoded > 0x3F) {
+      // invalid data, usually caused by multiple decoders responding
+      return;
+    }
+    datagram = (datagram << 6) | decoded;
+  }
+  for(size_t index = 0; index < sizeof(dccaResponse); index++) {
+    dccaResponse[index] = (datagram >> (40 - (index * 8))) & 0xFF;
+  }
+  dccaAwaitingResponse = false;
+  xSemaphoreGive(dccaResponseReceived);
+}
+
+uint16_t DecoderLogonManager::getLogonCount() {
+  return dccaLogonCount;
+}
+
+#endif // DCC_A_ENABLED
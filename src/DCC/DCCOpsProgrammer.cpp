@@ -0,0 +1,186 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <dcc/RailCom.hxx>
+
+// Priority for the OPS programming task, this only waits for RailCom
+// responses so it does not need to be above the loopTask priority.
+static constexpr UBaseType_t OPS_PROG_TASK_PRIORITY = 1;
+
+// Stack size to allocate for the OPS programming task, request callbacks are
+// executed on this task.
+static constexpr uint32_t OPS_PROG_TASK_STACK_SIZE = 4096;
+
+// Maximum number of pending requests, additional requests will be rejected
+// immediately.
+static constexpr uint8_t OPS_PROG_MAX_PENDING_JOBS = 16;
+
+// number of times a POM packet will be queued before giving up on a response.
+static constexpr uint8_t OPS_PROG_ATTEMPTS = 3;
+
+// number of times each POM packet is sent, the decoder will respond in the
+// cutout following each of them.
+static constexpr uint8_t OPS_PROG_PACKET_REPEATS = 2;
+
+// number of milliseconds to wait for a RailCom response after queueing a POM
+// packet, this includes the time the packet spends in the OPS packet queue.
+static constexpr uint32_t OPS_PROG_RESPONSE_TIMEOUT_MS = 100;
+
+// special values for opsResponse, all other values are the CV value reported
+// by the decoder.
+static constexpr int16_t OPS_RESPONSE_NONE = -1;
+static constexpr int16_t OPS_RESPONSE_BUSY = -2;
+static constexpr int16_t OPS_RESPONSE_NACK = -3;
+
+struct OpsProgrammingJob {
+  bool write;
+  uint16_t address;
+  uint16_t cv;
+  uint8_t value;
+  prog_cv_callback_t callback;
+};
+
+static std::mutex opsJobLock;
+static std::deque<OpsProgrammingJob> opsJobs;
+static TaskHandle_t opsProgTaskHandle = nullptr;
+
+// feedback key of the POM packet awaiting a response and the response
+// received, these are shared with the OPS signal generator task.
+static std::atomic<uint32_t> opsPendingKey{RAILCOM_FEEDBACK_NONE};
+static std::atomic<int16_t> opsResponse{OPS_RESPONSE_NONE};
+static SemaphoreHandle_t opsResponseReceived = nullptr;
+
+static int16_t executeOpsProgrammingJob(const OpsProgrammingJob &job) {
+  auto& signalGenerator = dccSignal[DCC_SIGNAL_OPERATIONS];
+  const uint32_t feedbackKey = RAILCOM_FEEDBACK_POM | job.address;
+  std::vector<uint8_t> packet;
+  if(job.address > 127) {
+    packet.push_back((uint8_t)(0xC0 | highByte(job.address)));
+  }
+  packet.push_back(lowByte(job.address));
+  // CV access (long form), 0xE4 is verify (read) and 0xEC is write byte
+  packet.push_back((uint8_t)((job.write ? 0xEC : 0xE4) + (highByte(job.cv - 1) & 0x03)));
+  packet.push_back(lowByte(job.cv - 1));
+  packet.push_back(job.write ? job.value : 0);
+
+  for(uint8_t attempt = 1; attempt <= OPS_PROG_ATTEMPTS; attempt++) {
+    LOG(VERBOSE, "[POM %d/%d] %s CV %d for loco %d", attempt, OPS_PROG_ATTEMPTS,
+        job.write ? "Writing" : "Reading", job.cv, job.address);
+    // discard any late response from a previous attempt
+    xSemaphoreTake(opsResponseReceived, 0);
+    opsResponse = OPS_RESPONSE_NONE;
+    opsPendingKey = feedbackKey;
+    signalGenerator->loadPacket(packet, OPS_PROG_PACKET_REPEATS, false, feedbackKey);
+    if(xSemaphoreTake(opsResponseReceived, pdMS_TO_TICKS(OPS_PROG_RESPONSE_TIMEOUT_MS)) != pdTRUE) {
+      LOG(VERBOSE, "[POM %d/%d] No response for CV %d from loco %d", attempt, OPS_PROG_ATTEMPTS,
+          job.cv, job.address);
+      continue;
+    }
+    int16_t response = opsResponse;
+    if(response == OPS_RESPONSE_NACK) {
+      LOG(WARNING, "[POM] Loco %d rejected CV %d request", job.address, job.cv);
+      break;
+    } else if(response == OPS_RESPONSE_BUSY) {
+      LOG(VERBOSE, "[POM] Loco %d is busy, retrying", job.address);
+    } else if(job.write && response != job.value) {
+      LOG(WARNING, "[POM] Loco %d reported CV %d as %d after writing %d", job.address,
+          job.cv, response, job.value);
+    } else {
+      LOG(INFO, "[POM] Loco %d CV %d value is %d", job.address, job.cv, response);
+      return response;
+    }
+  }
+  opsPendingKey = RAILCOM_FEEDBACK_NONE;
+  return -1;
+}
+
+static void opsProgrammingTask(void *arg) {
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
+  while(true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while(true) {
+      OpsProgrammingJob job;
+      {
+        std::lock_guard<std::mutex> guard(opsJobLock);
+        if(opsJobs.empty()) {
+          break;
+        }
+        job = std::move(opsJobs.front());
+        opsJobs.pop_front();
+      }
+      job.callback(executeOpsProgrammingJob(job));
+    }
+  }
+}
+
+static void queueOpsProgrammingJob(OpsProgrammingJob &&job) {
+  {
+    std::lock_guard<std::mutex> guard(opsJobLock);
+    if(opsJobs.size() < OPS_PROG_MAX_PENDING_JOBS && opsProgTaskHandle) {
+      opsJobs.push_back(std::move(job));
+      xTaskNotifyGive(opsProgTaskHandle);
+      return;
+    }
+  }
+  LOG(WARNING, "[POM] Rejecting request, too many pending requests");
+  job.callback(-1);
+}
+
+void OpsProgrammingManager::init() {
+  opsResponseReceived = xSemaphoreCreateBinary();
+  xTaskCreate(opsProgrammingTask, "POM", OPS_PROG_TASK_STACK_SIZE, nullptr,
+              OPS_PROG_TASK_PRIORITY, &opsProgTaskHandle);
+}
+
+void OpsProgrammingManager::readCV(const uint16_t address, const uint16_t cv, prog_cv_callback_t callback) {
+  queueOpsProgrammingJob({false, address, cv, 0, callback});
+}
+
+void OpsProgrammingManager::writeCVByte(const uint16_t address, const uint16_t cv, const uint8_t value, prog_cv_callback_t callback) {
+  queueOpsProgrammingJob({true, address, cv, value, callback});
+}
+
+void OpsProgrammingManager::railComFeedback(const dcc::Feedback &feedback) {
+  if(feedback.feedbackKey != opsPendingKey) {
+    return;
+  }
+  std::vector<dcc::RailcomPacket> packets;
+  dcc::parse_railcom_data(feedback, &packets);
+  for(const auto &packet : packets) {
+    if(packet.railcom_channel != 2) {
+      continue;
+    }
+    if(packet.type == dcc::RailcomPacket::MOB_POM) {
+      opsResponse = packet.argument & 0xFF;
+    } else if(packet.type == dcc::RailcomPacket::BUSY) {
+      opsResponse = OPS_RESPONSE_BUSY;
+    } else if(packet.type == dcc::RailcomPacket::NACK) {
+      opsResponse = OPS_RESPONSE_NACK;
+    } else {
+      continue;
+    }
+    // only the first response to each attempt is used
+    opsPendingKey = RAILCOM_FEEDBACK_NONE;
+    xSemaphoreGive(opsResponseReceived);
+    return;
+  }
+}
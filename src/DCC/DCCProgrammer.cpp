@@ -17,15 +17,87 @@ COPYRIGHT (c) 2019 Mike Dunston
 
 #include "ESP32CommandStation.h"
 
-// number of samples to take when monitoring current after a CV verify
-// (bit or byte) has been sent
-static constexpr DRAM_ATTR uint8_t CVSampleCount = 150;
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+
+// number of milliseconds to wait for an ACK after the packets for a CV
+// operation (bit or byte) have been sent.
+static constexpr uint32_t PROG_TRACK_ACK_TIMEOUT_MS = 30;
 
 // number of attempts the programming track will make to read/write a CV
 static constexpr uint8_t PROG_TRACK_CV_ATTEMPTS = 3;
 
 // flag for when programming track is actively being used
-bool progTrackBusy = false;
+static bool progTrackBusy = false;
+
+// Priority for the programming track task, this needs to be higher than the
+// loopTask priority (1) so ACK sampling is not delayed.
+static constexpr UBaseType_t PROG_TRACK_TASK_PRIORITY = 3;
+
+// Stack size to allocate for the programming track task, job callbacks are
+// executed on this task.
+static constexpr uint32_t PROG_TRACK_TASK_STACK_SIZE = 4096;
+
+// Maximum number of pending jobs per client, additional jobs will be
+// rejected immediately.
+static constexpr uint8_t PROG_TRACK_MAX_JOBS_PER_CLIENT = 32;
+
+enum PROG_JOB_TYPE {
+  PROG_JOB_READ_CV,
+  PROG_JOB_WRITE_CV_BYTE,
+  PROG_JOB_WRITE_CV_BIT,
+  PROG_JOB_IDENTIFY,
+  PROG_JOB_BULK
+};
+
+// Number of bulk job entries processed before the job is moved to the back
+// of the queue so that other clients are not blocked by large jobs. The
+// programming track stays energized while jobs remain in the queue.
+static constexpr uint8_t PROG_TRACK_BULK_SLICE_SIZE = 16;
+
+struct ProgrammingTrackJob {
+  PROG_JOB_TYPE type;
+  uint16_t cv;
+  uint8_t value;
+  uint8_t bit;
+  prog_cv_callback_t callback;
+  prog_identify_callback_t identifyCallback;
+  std::shared_ptr<BulkProgrammingJob> bulkJob;
+  prog_bulk_progress_callback_t bulkProgressCallback;
+  prog_bulk_callback_t bulkCallback;
+};
+
+static std::mutex progJobLock;
+static std::map<prog_client_t, std::deque<ProgrammingTrackJob>> progJobQueues;
+static prog_client_t progLastClient = 0;
+static uint16_t progPendingJobs = 0;
+static bool progJobActive = false;
+static TaskHandle_t progTrackTaskHandle = nullptr;
+
+// Maximum number of candidate values tracked per CV for the verify-first
+// read strategy, candidates are kept in most recently seen order.
+static constexpr uint8_t PROG_TRACK_MAX_READ_CANDIDATES = 4;
+
+// Maximum number of CVs which will have learned candidate values, once this
+// limit is reached only CVs with default candidates will learn new values.
+static constexpr uint8_t PROG_TRACK_MAX_CANDIDATE_CVS = 32;
+
+// Candidate values for CV reads, these are verified before falling back to
+// probing each bit of the CV. This is only accessed from the programming
+// track task.
+static std::map<uint16_t, std::deque<uint8_t>> cvReadCandidates = {
+  // default short address
+  {CV_NAMES::SHORT_ADDRESS, {3}},
+  // default long address (0) and the long address form of the default (3)
+  {CV_NAMES::LONG_ADDRESS_MSB_ADDRESS, {192}},
+  {CV_NAMES::LONG_ADDRESS_LSB_ADDRESS, {0, 3}},
+  // 28/128 speed steps with analog conversion, with and without long address
+  {CV_NAMES::DECODER_CONFIG, {6, 38}},
+};
+
+static CVReadStatistics cvReadStats;
 
 bool enterProgrammingMode() {
   const auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG);
@@ -59,6 +131,9 @@ bool enterProgrammingMode() {
   // delay for a short bit before entering programming mode
   vTaskDelay(pdMS_TO_TICKS(40));
 
+  // start continuous sampling for ACK detection
+  motorBoard->startAckSampling();
+
   return true;
 }
 
@@ -68,20 +143,97 @@ void leaveProgrammingMode() {
   }
 
   // deenergize the programming track
-  MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG)->powerOff(false);
+  const auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG);
+  motorBoard->stopAckSampling();
+  motorBoard->powerOff(false);
 
   // reset flag to indicate the programming track is free
   progTrackBusy = false;
 }
 
+// moves (or adds) the value to the front of the candidate list for the CV.
+static void learnCVCandidate(const uint16_t cv, const uint8_t value) {
+  auto entry = cvReadCandidates.find(cv);
+  if(entry == cvReadCandidates.end()) {
+    if(cvReadCandidates.size() >= PROG_TRACK_MAX_CANDIDATE_CVS) {
+      return;
+    }
+    entry = cvReadCandidates.emplace(cv, std::deque<uint8_t>()).first;
+  }
+  auto &candidates = entry->second;
+  auto existing = std::find(candidates.begin(), candidates.end(), value);
+  if(existing != candidates.end()) {
+    candidates.erase(existing);
+  } else if(candidates.size() >= PROG_TRACK_MAX_READ_CANDIDATES) {
+    candidates.pop_back();
+  }
+  candidates.push_front(value);
+}
+
+static bool verifyCVByte(const uint16_t cv, const uint8_t value) {
+  const auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG);
+  const uint16_t milliAmpAck = (4096 * 60 / motorBoard->getMaxMilliAmps());
+  uint8_t verifyCVPacket[4] = { (uint8_t)(0x74 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), value, 0x00};
+  auto& signalGenerator = dccSignal[DCC_SIGNAL_PROGRAMMING];
+  motorBoard->resetAckDetection();
+  signalGenerator->loadBytePacket(resetPacket, 2, 3);
+  signalGenerator->loadBytePacket(verifyCVPacket, 3, 5);
+  signalGenerator->waitForQueueEmpty();
+  return motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS);
+}
+
+// attempts to read the CV by verifying each of the known candidate values,
+// returns -1 if none of the candidates were acknowledged by the decoder.
+static int16_t readCVFromCandidates(const uint16_t cv) {
+  auto entry = cvReadCandidates.find(cv);
+  if(entry == cvReadCandidates.end() || entry->second.empty()) {
+    return -1;
+  }
+  uint8_t probes = 0;
+  int16_t cvValue = -1;
+  for(auto candidate : entry->second) {
+    esp_task_wdt_reset();
+    probes++;
+    LOG(VERBOSE, "[PROG] CV %d, verifying candidate %d", cv, candidate);
+    if(verifyCVByte(cv, candidate)) {
+      cvValue = candidate;
+      break;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(progJobLock);
+    cvReadStats.fastPathProbes += probes;
+    if(cvValue >= 0) {
+      cvReadStats.fastPathHits++;
+    } else {
+      cvReadStats.fastPathMisses++;
+    }
+  }
+  if(cvValue >= 0) {
+    LOG(INFO, "[PROG] CV %d, verified as candidate %d (%d probes)", cv, cvValue, probes);
+  }
+  return cvValue;
+}
+
 int16_t readCV(const uint16_t cv) {
   const auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG);
   const uint16_t milliAmpAck = (4096 * 60 / motorBoard->getMaxMilliAmps());
   uint8_t readCVBitPacket[4] = { (uint8_t)(0x78 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), 0x00, 0x00};
-  uint8_t verifyCVPacket[4] = { (uint8_t)(0x74 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), 0x00, 0x00};
-  int16_t cvValue = -1;
   auto& signalGenerator = dccSignal[DCC_SIGNAL_PROGRAMMING];
 
+  {
+    std::lock_guard<std::mutex> guard(progJobLock);
+    cvReadStats.reads++;
+  }
+
+  // try the likely values first, this takes one packet per candidate
+  // instead of the nine needed to probe each bit.
+  int16_t cvValue = readCVFromCandidates(cv);
+  if(cvValue >= 0) {
+    learnCVCandidate(cv, cvValue);
+    return cvValue;
+  }
+
   for(int attempt = 0; attempt < PROG_TRACK_CV_ATTEMPTS && cvValue == -1; attempt++) {
     esp_task_wdt_reset();
     LOG(INFO, "[PROG %d/%d] Attempting to read CV %d", attempt+1, PROG_TRACK_CV_ATTEMPTS, cv);
@@ -96,10 +248,11 @@ int16_t readCV(const uint16_t cv) {
     for(uint8_t bit = 0; bit < 8; bit++) {
       LOG(VERBOSE, "[PROG] CV %d, bit [%d/7]", cv, bit);
       readCVBitPacket[2] = 0xE8 + bit;
+      motorBoard->resetAckDetection();
       signalGenerator->loadBytePacket(resetPacket, 2, 3);
       signalGenerator->loadBytePacket(readCVBitPacket, 3, 5);
       signalGenerator->waitForQueueEmpty();
-      if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+      if(motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS)) {
         LOG(VERBOSE, "[PROG] CV %d, bit [%d/7] ON", cv, bit);
         bitWrite(cvValue, bit, 1);
       } else {
@@ -108,17 +261,18 @@ int16_t readCV(const uint16_t cv) {
     }
 
     // verify the byte we received
-    verifyCVPacket[2] = cvValue & 0xFF;
     LOG(INFO, "[PROG %d/%d] Attempting to verify read of CV %d as %d", attempt+1, PROG_TRACK_CV_ATTEMPTS, cv, cvValue);
-    signalGenerator->loadBytePacket(resetPacket, 2, 3);
-    signalGenerator->loadBytePacket(verifyCVPacket, 3, 5);
-    signalGenerator->waitForQueueEmpty();
-    if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+    if(verifyCVByte(cv, cvValue)) {
       LOG(INFO, "[PROG] CV %d, verified as %d", cv, cvValue);
     } else {
       LOG(WARNING, "[PROG] CV %d, could not be verified", cv);
       cvValue = -1;
     }
+    std::lock_guard<std::mutex> guard(progJobLock);
+    cvReadStats.bitProbeReads++;
+  }
+  if(cvValue >= 0) {
+    learnCVCandidate(cv, cvValue);
   }
   LOG(INFO, "[PROG] CV %d value is %d", cv, cvValue);
   return cvValue;
@@ -135,21 +289,27 @@ bool writeProgCVByte(const uint16_t cv, const uint8_t cvValue) {
   for(uint8_t attempt = 1; attempt <= PROG_TRACK_CV_ATTEMPTS && !writeVerified; attempt++) {
     esp_task_wdt_reset();
     LOG(INFO, "[PROG %d/%d] Attempting to write CV %d as %d", attempt, PROG_TRACK_CV_ATTEMPTS, cv, cvValue);
-    if(attempt) {
+    if(attempt > 1) {
       LOG(VERBOSE, "[PROG] Resetting DCC Decoder");
       signalGenerator->loadBytePacket(resetPacket, 2, 25);
+      // the reset burst must complete before ACK detection is reset, it
+      // would otherwise overrun the ACK sample buffer.
+      signalGenerator->waitForQueueEmpty();
     }
+    motorBoard->resetAckDetection();
     signalGenerator->loadBytePacket(resetPacket, 2, 3);
     signalGenerator->loadBytePacket(writeCVBytePacket, 3, 4);
     signalGenerator->waitForQueueEmpty();
 
     // verify that the decoder received the write byte packet and sent an ACK
-    if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+    if(motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS)) {
+      motorBoard->resetAckDetection();
       signalGenerator->loadBytePacket(verifyCVBytePacket, 3, 5);
       signalGenerator->waitForQueueEmpty();
       // check that decoder sends an ACK for the verify operation
-      if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+      if(motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS)) {
         writeVerified = true;
+        learnCVCandidate(cv, cvValue);
         LOG(INFO, "[PROG] CV %d write value %d verified.", cv, cvValue);
       }
     } else {
@@ -163,27 +323,32 @@ bool writeProgCVBit(const uint16_t cv, const uint8_t bit, const bool value) {
   const auto motorBoard = MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG);
   const uint16_t milliAmpAck = (4096 * 60 / motorBoard->getMaxMilliAmps());
   uint8_t writeCVBitPacket[4] = { (uint8_t)(0x78 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), (uint8_t)(0xF0 + bit + value * 8), 0x00};
-  uint8_t verifyCVBitPacket[4] = { (uint8_t)(0x74 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), (uint8_t)(0xB0 + bit + value * 8), 0x00};
+  // bit manipulation (111KDBBB) with K=0 verifies the bit instead of writing it.
+  uint8_t verifyCVBitPacket[4] = { (uint8_t)(0x78 + (highByte(cv - 1) & 0x03)), lowByte(cv - 1), (uint8_t)(0xE0 + bit + value * 8), 0x00};
   bool writeVerified = false;
   auto& signalGenerator = dccSignal[DCC_SIGNAL_PROGRAMMING];
 
   for(uint8_t attempt = 1; attempt <= PROG_TRACK_CV_ATTEMPTS && !writeVerified; attempt++) {
     esp_task_wdt_reset();
     LOG(INFO, "[PROG %d/%d] Attempting to write CV %d bit %d as %d", attempt, PROG_TRACK_CV_ATTEMPTS, cv, bit, value);
-    if(attempt) {
+    if(attempt > 1) {
       LOG(VERBOSE, "[PROG] Resetting DCC Decoder");
-      signalGenerator->loadBytePacket(resetPacket, 2, 3);
+      signalGenerator->loadBytePacket(resetPacket, 2, 25);
+      signalGenerator->waitForQueueEmpty();
     }
+    motorBoard->resetAckDetection();
+    signalGenerator->loadBytePacket(resetPacket, 2, 3);
     signalGenerator->loadBytePacket(writeCVBitPacket, 3, 4);
     signalGenerator->waitForQueueEmpty();
 
     // verify that the decoder received the write byte packet and sent an ACK
-    if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+    if(motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS)) {
+      motorBoard->resetAckDetection();
       signalGenerator->loadBytePacket(resetPacket, 2, 3);
       signalGenerator->loadBytePacket(verifyCVBitPacket, 3, 5);
       signalGenerator->waitForQueueEmpty();
       // check that decoder sends an ACK for the verify operation
-      if(motorBoard->captureSample(CVSampleCount) > milliAmpAck) {
+      if(motorBoard->waitForAck(milliAmpAck, PROG_TRACK_ACK_TIMEOUT_MS)) {
         writeVerified = true;
         LOG(INFO, "[PROG %d/%d] CV %d write bit %d verified.", attempt, PROG_TRACK_CV_ATTEMPTS, cv, bit);
       }
@@ -239,3 +404,238 @@ void writeOpsCVBit(const uint16_t locoAddress, const uint16_t cv, const uint8_t
     signalGenerator->loadBytePacket(writeCVBitPacket, 4, 4);
   }
 }
+
+static void identifyDecoder(DecoderIdentity &identity) {
+  identity.decoderConfig = readCV(CV_NAMES::DECODER_CONFIG);
+  if(identity.decoderConfig < 0) {
+    LOG(WARNING, "[PROG] Failed to read decoder configuration");
+    return;
+  }
+  if(bitRead(identity.decoderConfig, DECODER_CONFIG_BITS::DECODER_TYPE)) {
+    identity.stationary = true;
+    identity.longAddress = true;
+    int16_t decoderManufacturer = readCV(CV_NAMES::DECODER_MANUFACTURER);
+    int16_t addrMSB = readCV(CV_NAMES::ACCESSORY_DECODER_MSB_ADDRESS);
+    int16_t addrLSB = readCV(CV_NAMES::SHORT_ADDRESS);
+    if(addrMSB >= 0 && addrLSB >= 0) {
+      if(decoderManufacturer == 0xA5) { // MERG uses 7 bit LSB
+        identity.address = (uint16_t)(((addrMSB & 0x07) << 7) | (addrLSB & 0x7F));
+      } else if(decoderManufacturer == 0x19) { // Team Digital uses 8 bit LSB and 4 bit MSB
+        identity.address = (uint16_t)(((addrMSB & 0x0F) << 8) | addrLSB);
+      } else { // NMRA spec shows 6 bit LSB
+        identity.address = (uint16_t)(((addrMSB & 0x07) << 6) | (addrLSB & 0x1F));
+      }
+    } else {
+      LOG(WARNING, "[PROG] Failed to read address MSB/LSB");
+    }
+  } else {
+    identity.speedTable = bitRead(identity.decoderConfig, DECODER_CONFIG_BITS::SPEED_TABLE);
+    if(bitRead(identity.decoderConfig, DECODER_CONFIG_BITS::SHORT_OR_LONG_ADDRESS)) {
+      identity.longAddress = true;
+      int16_t addrMSB = readCV(CV_NAMES::LONG_ADDRESS_MSB_ADDRESS);
+      int16_t addrLSB = readCV(CV_NAMES::LONG_ADDRESS_LSB_ADDRESS);
+      if(addrMSB >= 0 && addrLSB >= 0) {
+        identity.address = (uint16_t)(((addrMSB & 0xFF) << 8) | (addrLSB & 0xFF));
+      } else {
+        LOG(WARNING, "[PROG] Unable to read address MSB/LSB");
+      }
+    } else {
+      int16_t shortAddr = readCV(CV_NAMES::SHORT_ADDRESS);
+      if(shortAddr > 0) {
+        identity.address = shortAddr;
+      } else {
+        LOG(WARNING, "[PROG] Unable to read short address CV");
+      }
+    }
+  }
+}
+
+// processes up to PROG_TRACK_BULK_SLICE_SIZE entries of a bulk job, returns
+// true when there are entries remaining to be processed.
+static bool executeBulkProgrammingSlice(ProgrammingTrackJob &job) {
+  auto &bulk = *job.bulkJob;
+  // CV31/CV32 are always written before the first indexed entry of a slice
+  // since another job may have changed them.
+  int16_t cv31 = -1;
+  int16_t cv32 = -1;
+  for(uint8_t count = 0; count < PROG_TRACK_BULK_SLICE_SIZE && bulk.next < bulk.entries.size(); count++) {
+    auto &entry = bulk.entries[bulk.next];
+    if(bulk.write && isBulkWriteExcluded(entry)) {
+      LOG(INFO, "[PROG] Bulk job skipping write of CV %d", entry.cv);
+      job.bulkProgressCallback(bulk.next, BULK_CV_SKIPPED);
+      bulk.next++;
+      continue;
+    }
+    bool success = true;
+    if(entry.cv31 >= 0 && entry.cv31 != cv31) {
+      success = writeProgCVByte(CV_NAMES::INDEXED_CV_HIGH, entry.cv31);
+      cv31 = success ? entry.cv31 : -1;
+    }
+    if(success && entry.cv32 >= 0 && entry.cv32 != cv32) {
+      success = writeProgCVByte(CV_NAMES::INDEXED_CV_LOW, entry.cv32);
+      cv32 = success ? entry.cv32 : -1;
+    }
+    if(success && bulk.write) {
+      success = writeProgCVByte(entry.cv, entry.value);
+    } else if(success) {
+      int16_t value = readCV(entry.cv);
+      success = value >= 0;
+      if(success) {
+        entry.value = value;
+      }
+    }
+    job.bulkProgressCallback(bulk.next, success ? BULK_CV_SUCCESS : BULK_CV_FAILED);
+    if(!success) {
+      LOG(WARNING, "[PROG] Bulk job stopped at entry %d/%d (CV %d)", bulk.next + 1,
+          bulk.entries.size(), entry.cv);
+      job.bulkCallback(false);
+      return false;
+    }
+    bulk.next++;
+  }
+  if(bulk.next < bulk.entries.size()) {
+    return true;
+  }
+  job.bulkCallback(true);
+  return false;
+}
+
+static void failProgrammingTrackJob(ProgrammingTrackJob &job) {
+  if(job.type == PROG_JOB_IDENTIFY) {
+    DecoderIdentity identity;
+    job.identifyCallback(identity);
+  } else if(job.type == PROG_JOB_BULK) {
+    job.bulkCallback(false);
+  } else {
+    job.callback(-1);
+  }
+}
+
+static void queueProgrammingTrackJob(const prog_client_t, ProgrammingTrackJob &&);
+
+static void executeProgrammingTrackJob(ProgrammingTrackJob &job) {
+  if(job.type == PROG_JOB_READ_CV) {
+    job.callback(readCV(job.cv));
+  } else if(job.type == PROG_JOB_WRITE_CV_BYTE) {
+    job.callback(writeProgCVByte(job.cv, job.value) ? job.value : -1);
+  } else if(job.type == PROG_JOB_WRITE_CV_BIT) {
+    job.callback(writeProgCVBit(job.cv, job.bit, job.value) ? job.value : -1);
+  } else if(job.type == PROG_JOB_IDENTIFY) {
+    DecoderIdentity identity;
+    identifyDecoder(identity);
+    job.identifyCallback(identity);
+  } else if(job.type == PROG_JOB_BULK && executeBulkProgrammingSlice(job)) {
+    // requeue the remainder of the job behind any other pending jobs.
+    queueProgrammingTrackJob(progLastClient, std::move(job));
+  }
+}
+
+// retrieves the next job to execute, clients are serviced in round-robin
+// order based on their client identifier.
+static bool getNextProgrammingTrackJob(ProgrammingTrackJob &job) {
+  std::lock_guard<std::mutex> guard(progJobLock);
+  if(progJobQueues.empty()) {
+    progJobActive = false;
+    return false;
+  }
+  auto queue = progJobQueues.upper_bound(progLastClient);
+  if(queue == progJobQueues.end()) {
+    queue = progJobQueues.begin();
+  }
+  job = std::move(queue->second.front());
+  queue->second.pop_front();
+  progLastClient = queue->first;
+  if(queue->second.empty()) {
+    progJobQueues.erase(queue);
+  }
+  progPendingJobs--;
+  progJobActive = true;
+  return true;
+}
+
+static void queueProgrammingTrackJob(const prog_client_t client, ProgrammingTrackJob &&job) {
+  {
+    std::lock_guard<std::mutex> guard(progJobLock);
+    auto &queue = progJobQueues[client];
+    if(queue.size() < PROG_TRACK_MAX_JOBS_PER_CLIENT && progTrackTaskHandle) {
+      queue.push_back(std::move(job));
+      progPendingJobs++;
+      xTaskNotifyGive(progTrackTaskHandle);
+      return;
+    }
+    if(queue.empty()) {
+      progJobQueues.erase(client);
+    }
+  }
+  LOG(WARNING, "[PROG] Rejecting job from client %d:%d, too many pending jobs",
+      (uint32_t)(client >> 32), (uint32_t)client);
+  failProgrammingTrackJob(job);
+}
+
+static void programmingTrackTask(void *arg) {
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
+  while(true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ProgrammingTrackJob job;
+    bool programmingMode = false;
+    while(getNextProgrammingTrackJob(job)) {
+      if(!programmingMode) {
+        programmingMode = enterProgrammingMode();
+      }
+      if(programmingMode) {
+        executeProgrammingTrackJob(job);
+      } else {
+        failProgrammingTrackJob(job);
+      }
+    }
+    if(programmingMode) {
+      leaveProgrammingMode();
+    }
+  }
+}
+
+void ProgrammingTrackManager::init() {
+  xTaskCreate(programmingTrackTask, "ProgTrack", PROG_TRACK_TASK_STACK_SIZE,
+              nullptr, PROG_TRACK_TASK_PRIORITY, &progTrackTaskHandle);
+}
+
+void ProgrammingTrackManager::readCV(const prog_client_t client, const uint16_t cv, prog_cv_callback_t callback) {
+  queueProgrammingTrackJob(client, {PROG_JOB_READ_CV, cv, 0, 0, callback, nullptr});
+}
+
+void ProgrammingTrackManager::writeCVByte(const prog_client_t client, const uint16_t cv, const uint8_t value, prog_cv_callback_t callback) {
+  queueProgrammingTrackJob(client, {PROG_JOB_WRITE_CV_BYTE, cv, value, 0, callback, nullptr});
+}
+
+void ProgrammingTrackManager::writeCVBit(const prog_client_t client, const uint16_t cv, const uint8_t bit, const bool value, prog_cv_callback_t callback) {
+  queueProgrammingTrackJob(client, {PROG_JOB_WRITE_CV_BIT, cv, value, bit, callback, nullptr});
+}
+
+void ProgrammingTrackManager::identify(const prog_client_t client, prog_identify_callback_t callback) {
+  queueProgrammingTrackJob(client, {PROG_JOB_IDENTIFY, 0, 0, 0, nullptr, callback});
+}
+
+void ProgrammingTrackManager::bulk(const prog_client_t client, std::shared_ptr<BulkProgrammingJob> job,
+                                   prog_bulk_progress_callback_t progress, prog_bulk_callback_t callback) {
+  queueProgrammingTrackJob(client, {PROG_JOB_BULK, 0, 0, 0, nullptr, nullptr, job, progress, callback});
+}
+
+bool ProgrammingTrackManager::isBusy() {
+  std::lock_guard<std::mutex> guard(progJobLock);
+  return progJobActive || progPendingJobs;
+}
+
+uint16_t ProgrammingTrackManager::getPendingJobCount() {
+  std::lock_guard<std::mutex> guard(progJobLock);
+  return progPendingJobs;
+}
+
+CVReadStatistics ProgrammingTrackManager::getReadStatistics() {
+  std::lock_guard<std::mutex> guard(progJobLock);
+  return cvReadStats;
+}
+
+void ProgrammingTrackManager::resetReadStatistics() {
+  std::lock_guard<std::mutex> guard(progJobLock);
+  cvReadStats = {};
+}
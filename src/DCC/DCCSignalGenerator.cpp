@@ -52,25 +52,32 @@ void sendDCCEmergencyStop() {
   }
 }
 
-void SignalGenerator::loadBytePacket(const uint8_t *data, uint8_t length, uint8_t repeatCount, bool drainToSendQueue) {
+void SignalGenerator::loadBytePacket(const uint8_t *data, uint8_t length, uint8_t repeatCount, bool drainToSendQueue, uint32_t feedbackKey) {
   std::vector<uint8_t> packet;
   for(int i = 0; i < length; i++) {
     packet.push_back(data[i]);
   }
-  loadPacket(packet, repeatCount, drainToSendQueue);
+  loadPacket(packet, repeatCount, drainToSendQueue, feedbackKey);
 }
 
-void SignalGenerator::loadPacket(std::vector<uint8_t> data, int numberOfRepeats, bool drainToSendQueue) {
+void SignalGenerator::loadPacket(std::vector<uint8_t> data, int numberOfRepeats, bool drainToSendQueue, uint32_t feedbackKey) {
   // minimum DCC packet size is 2 bytes (excluding preamble bits and checksum byte)
   if(data.size() < 2) {
     return;
   }
+  // the packet must fit in the buffer including preamble, start bits and
+  // checksum byte.
+  if(PACKET_PREAMBLE_BITS + ((data.size() + 1) * 9) >= MAX_BYTES_IN_PACKET * 8) {
+    LOG_ERROR("[%s] DCC packet too long (%d bytes), discarding", getName(), data.size());
+    return;
+  }
   if(drainToSendQueue) {
     drainQueue();
   }
   Packet *packet = getFreePacket();
   memset(packet, 0, sizeof(Packet));
   packet->numberOfRepeats = numberOfRepeats;
+  packet->feedbackKey = feedbackKey;
 
   // calculate checksum (XOR)
   // add first byte as checksum byte
@@ -83,30 +90,20 @@ void SignalGenerator::loadPacket(std::vector<uint8_t> data, int numberOfRepeats,
   // 22 bit DCC preamble
   packet->buffer[0] = 0xFF;
   packet->buffer[1] = 0xFF;
-  // first bit of actual data at the end of the preamble
-  packet->buffer[2] = 0xFC + bitRead(data[0], 7);
-  packet->buffer[3] = data[0] << 1;
-  packet->buffer[4] = data[1];
-  packet->buffer[5] = data[2] >> 1;
-  packet->buffer[6] = data[2] << 7;
-  packet->numberOfBits = 49;
-
-  if (data.size() >= 4) {
-    packet->buffer[6] += data[3] >> 2;
-    packet->buffer[7] = data[3] << 6;
-    packet->numberOfBits = 58;
-  }
-  if (data.size() >= 5) {
-    packet->buffer[7] += data[4] >> 3;
-    packet->buffer[8] = data[4] << 5;
-    packet->numberOfBits = 67;
-  }
-  if (data.size() >= 6) {
-    packet->buffer[8] += data[5] >> 4;
-    packet->buffer[9] = data[5] << 4;
-    packet->numberOfBits = 76;
+  packet->buffer[2] = 0xFC;
+  packet->numberOfBits = PACKET_PREAMBLE_BITS;
+  for(auto value : data) {
+    // zero start bit before each byte, the buffer has already been cleared.
+    packet->numberOfBits++;
+    for(uint8_t bit = 0; bit < 8; bit++) {
+      if(value & DCC_PACKET_BIT_MASK[bit]) {
+        packet->buffer[packet->numberOfBits / 8] |= DCC_PACKET_BIT_MASK[packet->numberOfBits % 8];
+      }
+      packet->numberOfBits++;
+    }
   }
   pushReadyPacket(packet);
+  _statistics.queued++;
 }
 
 SignalGenerator::SignalGenerator(String name, uint16_t maxPackets, uint8_t signalID, uint8_t signalPin) : _name(name), _signalID(signalID), _sendQueueCapacity(maxPackets) {
@@ -88,11 +88,23 @@ constexpr uint64_t MAX_DCC_PACKET_TIME = (ZERO_BIT_PULSE_USEC * 2) * 100;
     ESP_ERROR_CHECK(rmt_write_items(signal->_rmtChannel, bits, count, true)); \
     uint64_t ts_end = esp_timer_get_time(); \
     if ((ts_end - ts_start) > MAX_DCC_PACKET_TIME) { \
+        signal->getStatistics().slowTransmits++; \
         LOG(WARNING, "[%s] SLOW DCC transmit! %s:%s, %d bits", \
             signal->getName(), uint64_to_string(ts_start).c_str(), \
             uint64_to_string(ts_end).c_str(), count); \
     }
 
+// When the virtual decoder is enabled all packets sent on the PROG track are
+// also passed to it so it can generate ACK pulses.
+#if VIRTUAL_DECODER_ENABLED
+#define VIRTUAL_DECODER_PACKET_SENT(signal, packet) \
+    if(signal->_rmtChannel == DCC_SIGNAL_PROGRAMMING) { \
+        VirtualDecoder::packetSent(packet); \
+    }
+#else
+#define VIRTUAL_DECODER_PACKET_SENT(signal, packet)
+#endif
+
 #define RMT_TRANSMIT_DCC(signal, preambleBitCount) \
     while(xSemaphoreTake(signal->_stopRequest, 0) != pdTRUE) { \
         esp_task_wdt_reset(); \
@@ -102,8 +114,10 @@ constexpr uint64_t MAX_DCC_PACKET_TIME = (ZERO_BIT_PULSE_USEC * 2) * 100;
             rmt_item32_t encodedPacket[MAX_DCC_PACKET_BITS]; \
             CONVERT_DCC_PACKET_TO_RMT(packet, encodedPacket, encodedBitCount) \
             RMT_TRANSMIT_BITS(signal, encodedPacket, encodedBitCount) \
+            VIRTUAL_DECODER_PACKET_SENT(signal, packet) \
         } else { \
             RMT_TRANSMIT_BITS(signal, DCC_IDLE_PACKET, 50) \
+            signal->getStatistics().idle++; \
         } \
     }
 
@@ -118,6 +132,7 @@ constexpr uint64_t MAX_DCC_PACKET_TIME = (ZERO_BIT_PULSE_USEC * 2) * 100;
             RMT_TRANSMIT_BITS(signal, encodedPacket, encodedBitCount) \
         } else { \
             RMT_TRANSMIT_BITS(signal, DCC_IDLE_PACKET, 50) \
+            signal->getStatistics().idle++; \
         } \
         digitalWrite(signal->_signalPin, LOW); \
         delayMicroseconds(RAILCOM_PACKET_END_DELAY_USEC); \
@@ -125,7 +140,7 @@ constexpr uint64_t MAX_DCC_PACKET_TIME = (ZERO_BIT_PULSE_USEC * 2) * 100;
         delayMicroseconds(RAILCOM_BRAKE_ENABLE_DELAY_USEC); \
         digitalWrite(signal->_outputEnablePin, LOW); \
         digitalWrite(signal->_railComEnablePin, HIGH); \
-        signal->receiveRailComData(); \
+        signal->receiveRailComData(packet ? packet->feedbackKey : RAILCOM_FEEDBACK_NONE); \
         digitalWrite(signal->_railComEnablePin, LOW); \
         if(digitalRead(signal->_railComShortPin)) { \
             /* TBD */ \
@@ -139,6 +154,7 @@ constexpr uint64_t MAX_DCC_PACKET_TIME = (ZERO_BIT_PULSE_USEC * 2) * 100;
 static void RMT_task_entry(void *param) {
     SignalGenerator_RMT *signal = static_cast<SignalGenerator_RMT *>(param);
     esp_task_wdt_add(NULL);
+    Metrics::registerTask(xTaskGetCurrentTaskHandle());
     xSemaphoreTake(signal->_stopComplete, portMAX_DELAY);
     LOG(INFO, "[%s] RMT feeder task starting up", signal->getName());
     if(signal->_rmtChannel == DCC_SIGNAL_PROGRAMMING) {
@@ -154,6 +170,7 @@ static void RMT_task_entry(void *param) {
         RMT_TRANSMIT_DCC(signal, OPS_TRACK_PREAMBLE_BITS)
     }
     LOG(INFO, "[%s] RMT feeder task shut down", signal->getName());
+    Metrics::unregisterTask(xTaskGetCurrentTaskHandle());
     xSemaphoreGive(signal->_stopComplete);
     vTaskDelete(NULL);
 }
@@ -223,22 +240,34 @@ void SignalGenerator_RMT::disable() {
     LOG(INFO, "[%s] RMT Feeder task stopped", getName());
 }
 
-void SignalGenerator_RMT::receiveRailComData() {
-    std::vector<uint8_t> data(8);
+void SignalGenerator_RMT::receiveRailComData(uint32_t feedbackKey) {
+    std::vector<uint8_t> data;
+    data.reserve(8);
     while(uartAvailable(_railComUART)) {
         data.push_back(uartRead(_railComUART));
     }
-    if(data.size() < 2 || data.size() > 8) {
+    if(data.empty()) {
+        // no decoder responded in this cutout
+        return;
+    } else if(data.size() < 2 || data.size() > 8) {
         LOG_ERROR("[%s] Invalid RailCom data length of %d received.", getName(), data.size());
     } else {
         dcc::Feedback feedback;
-        feedback.reset(0);
+        feedback.reset(feedbackKey);
         auto dataPtr = data.begin();
         feedback.add_ch1_data(*dataPtr++);
         feedback.add_ch1_data(*dataPtr++);
         while(dataPtr != data.end()) {
             feedback.add_ch2_data(*dataPtr++);
         }
+        if(feedbackKey & RAILCOM_FEEDBACK_POM) {
+            OpsProgrammingManager::railComFeedback(feedback);
+        }
+#if DCC_A_ENABLED
+        if(feedbackKey & RAILCOM_FEEDBACK_DCCA) {
+            DecoderLogonManager::railComFeedback(feedback);
+        }
+#endif
 #if LCC_ENABLED
         auto buf = railComHub.alloc();
         memcpy(buf->data()->data(), &feedback, sizeof(dcc::Feedback));
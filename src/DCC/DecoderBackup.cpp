@@ -0,0 +1,279 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+#include "DecoderBackup.h"
+#include "WebServer.h"
+
+#include <map>
+#include <mutex>
+
+// Number of CVs processed between updates of the backup file while a job is
+// running, the file is always updated when the job completes or fails.
+static constexpr uint8_t DECODER_BACKUP_SAVE_INTERVAL = 16;
+
+// Backups and restores which are currently queued or running, the key is the
+// name of the file used to store the job.
+static std::map<std::string, std::shared_ptr<BulkProgrammingJob>> activeBackups;
+static std::map<std::string, size_t> activeBackupProgress;
+static std::mutex backupLock;
+
+static std::string getBackupFileName(const String &name, bool restore) {
+  return StringPrintf("%s%s.json", restore ? "cvr_" : "cvb_", name.c_str());
+}
+
+// parses a single CV entry: {CV}[/{CV31}/{CV32}][={VALUE}]
+static bool parseBackupEntry(String text, BulkCVEntry &entry) {
+  text.trim();
+  int valueIndex = text.indexOf('=');
+  if(valueIndex >= 0) {
+    entry.value = text.substring(valueIndex + 1).toInt();
+    text = text.substring(0, valueIndex);
+  }
+  int pageIndex = text.indexOf('/');
+  if(pageIndex >= 0) {
+    int cv32Index = text.indexOf('/', pageIndex + 1);
+    if(cv32Index < 0) {
+      return false;
+    }
+    entry.cv31 = text.substring(pageIndex + 1, cv32Index).toInt();
+    entry.cv32 = text.substring(cv32Index + 1).toInt();
+    if(entry.cv31 < 0 || entry.cv31 > 255 || entry.cv32 < 0 || entry.cv32 > 255) {
+      return false;
+    }
+    text = text.substring(0, pageIndex);
+  }
+  entry.cv = text.toInt();
+  return entry.cv >= 1 && entry.cv <= 1024 && entry.value <= 255;
+}
+
+static String formatBackupEntry(const BulkCVEntry &entry) {
+  String text(entry.cv);
+  if(entry.cv31 >= 0) {
+    text += "/" + String(entry.cv31) + "/" + String(entry.cv32);
+  }
+  if(entry.value >= 0) {
+    text += "=" + String(entry.value);
+  }
+  return text;
+}
+
+static void saveBackup(const std::string &fileName, const String &name, bool restore,
+                       const BulkProgrammingJob &job, size_t done) {
+  DynamicJsonBuffer buffer;
+  JsonObject &root = buffer.createObject();
+  root[JSON_NAME_NODE] = name;
+  root[JSON_RESTORE_NODE] = restore ? JSON_VALUE_TRUE : JSON_VALUE_FALSE;
+  root[JSON_DONE_NODE] = done;
+  root[JSON_COUNT_NODE] = job.entries.size();
+  JsonArray &cvs = root.createNestedArray(JSON_CVS_NODE);
+  for(const auto &entry : job.entries) {
+    cvs.add(formatBackupEntry(entry));
+  }
+  configStore.store(fileName.c_str(), root);
+}
+
+static bool loadBackup(const std::string &fileName, BulkProgrammingJob &job) {
+  if(!configStore.exists(fileName.c_str())) {
+    return false;
+  }
+  DynamicJsonBuffer buffer;
+  JsonObject &root = configStore.load(fileName.c_str(), buffer);
+  if(!root.success() || !root.containsKey(JSON_CVS_NODE)) {
+    LOG_ERROR("[Backup] %s is not a valid backup file", fileName.c_str());
+    return false;
+  }
+  JsonArray &cvs = root.get<JsonArray>(JSON_CVS_NODE);
+  for(auto entryText : cvs) {
+    BulkCVEntry entry;
+    if(!parseBackupEntry(entryText.as<const char *>(), entry)) {
+      LOG_ERROR("[Backup] %s contains an invalid entry: %s", fileName.c_str(),
+                entryText.as<const char *>());
+      return false;
+    }
+    job.entries.push_back(entry);
+  }
+  job.next = std::min((size_t)root[JSON_DONE_NODE].as<int>(), job.entries.size());
+  job.write = root[JSON_RESTORE_NODE] == JSON_VALUE_TRUE;
+  return true;
+}
+
+static bool startBulkJob(const String &name, bool restore, std::shared_ptr<BulkProgrammingJob> job) {
+  std::string fileName = getBackupFileName(name, restore);
+  {
+    std::lock_guard<std::mutex> guard(backupLock);
+    if(activeBackups.count(fileName)) {
+      return false;
+    }
+    activeBackups[fileName] = job;
+    activeBackupProgress[fileName] = job->next;
+  }
+  saveBackup(fileName, name, restore, *job, job->next);
+  LOG(INFO, "[Backup] Starting %s of %s (%d/%d)", restore ? "restore" : "backup", name.c_str(),
+      job->next, job->entries.size());
+  ProgrammingTrackManager::bulk(makeProgClient(PROG_CLIENT_WEB), job,
+    [fileName, name, restore, job](size_t index, BulkCVResult result) {
+      const auto &entry = job->entries[index];
+      bool success = result != BULK_CV_FAILED;
+      size_t done = success ? index + 1 : index;
+      {
+        std::lock_guard<std::mutex> guard(backupLock);
+        activeBackupProgress[fileName] = done;
+      }
+      int16_t value = entry.value;
+      if(result == BULK_CV_FAILED) {
+        value = DECODER_BACKUP_PROGRESS_FAILED;
+      } else if(result == BULK_CV_SKIPPED) {
+        value = DECODER_BACKUP_PROGRESS_SKIPPED;
+      }
+      esp32csWebServer.broadcastToWS(String(StringPrintf("<backup %s %d %d %d %d>", name.c_str(),
+        done, job->entries.size(), entry.cv, value).c_str()));
+      if(success && (done % DECODER_BACKUP_SAVE_INTERVAL) == 0) {
+        saveBackup(fileName, name, restore, *job, done);
+      }
+    },
+    [fileName, name, restore, job](bool success) {
+      LOG(INFO, "[Backup] %s of %s %s (%d/%d)", restore ? "Restore" : "Backup", name.c_str(),
+          success ? "completed" : "failed", job->next, job->entries.size());
+      saveBackup(fileName, name, restore, *job, job->next);
+      std::lock_guard<std::mutex> guard(backupLock);
+      activeBackups.erase(fileName);
+      activeBackupProgress.erase(fileName);
+    });
+  return true;
+}
+
+bool DecoderBackupManager::isValidName(const String &name) {
+  if(!name.length() || name.length() > DECODER_BACKUP_MAX_NAME_LENGTH) {
+    return false;
+  }
+  for(size_t index = 0; index < name.length(); index++) {
+    char ch = name.charAt(index);
+    if(!isalnum(ch) && ch != '-' && ch != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DecoderBackupManager::startBackup(const String &name, const String &cvList) {
+  if(!isValidName(name) || isActive(name)) {
+    return false;
+  }
+  auto job = std::make_shared<BulkProgrammingJob>();
+  int start = 0;
+  while(start < (int)cvList.length() && job->entries.size() < DECODER_BACKUP_MAX_CVS) {
+    int end = cvList.indexOf(',', start);
+    if(end < 0) {
+      end = (int)cvList.length();
+    }
+    BulkCVEntry entry;
+    if(!parseBackupEntry(cvList.substring(start, end), entry)) {
+      LOG(WARNING, "[Backup] Invalid CV entry: %s", cvList.substring(start, end).c_str());
+      return false;
+    }
+    // the value (if any) is discarded since it will be read from the decoder.
+    entry.value = -1;
+    job->entries.push_back(entry);
+    start = end + 1;
+  }
+  if(job->entries.empty()) {
+    return false;
+  }
+  // a previous restore of this backup is no longer valid
+  configStore.remove(getBackupFileName(name, true).c_str());
+  return startBulkJob(name, false, job);
+}
+
+bool DecoderBackupManager::startRestore(const String &name) {
+  if(!isValidName(name) || isActive(name)) {
+    return false;
+  }
+  auto job = std::make_shared<BulkProgrammingJob>();
+  if(!loadBackup(getBackupFileName(name, false), *job) || job->next < job->entries.size()) {
+    LOG(WARNING, "[Backup] %s is not a complete backup, unable to restore", name.c_str());
+    return false;
+  }
+  job->write = true;
+  job->next = 0;
+  return startBulkJob(name, true, job);
+}
+
+bool DecoderBackupManager::resume(const String &name, bool restore) {
+  if(!isValidName(name) || isActive(name)) {
+    return false;
+  }
+  auto job = std::make_shared<BulkProgrammingJob>();
+  if(!loadBackup(getBackupFileName(name, restore), *job) || job->next >= job->entries.size()) {
+    return false;
+  }
+  return startBulkJob(name, restore, job);
+}
+
+bool DecoderBackupManager::isActive(const String &name) {
+  std::lock_guard<std::mutex> guard(backupLock);
+  return activeBackups.count(getBackupFileName(name, false)) ||
+         activeBackups.count(getBackupFileName(name, true));
+}
+
+bool DecoderBackupManager::getState(const String &name, bool restore, JsonObject &state) {
+  if(!isValidName(name)) {
+    return false;
+  }
+  std::string fileName = getBackupFileName(name, restore);
+  state[JSON_NAME_NODE] = name;
+  state[JSON_RESTORE_NODE] = restore ? JSON_VALUE_TRUE : JSON_VALUE_FALSE;
+  {
+    std::lock_guard<std::mutex> guard(backupLock);
+    auto active = activeBackups.find(fileName);
+    if(active != activeBackups.end()) {
+      // the CV values are owned by the programming track task until the job
+      // has completed, only the progress is reported.
+      state[JSON_ACTIVE_NODE] = JSON_VALUE_TRUE;
+      state[JSON_DONE_NODE] = activeBackupProgress[fileName];
+      state[JSON_COUNT_NODE] = active->second->entries.size();
+      return true;
+    }
+  }
+  BulkProgrammingJob job;
+  if(!loadBackup(fileName, job)) {
+    return false;
+  }
+  state[JSON_ACTIVE_NODE] = JSON_VALUE_FALSE;
+  state[JSON_DONE_NODE] = job.next;
+  state[JSON_COUNT_NODE] = job.entries.size();
+  JsonArray &cvs = state.createNestedArray(JSON_CVS_NODE);
+  for(const auto &entry : job.entries) {
+    JsonObject &cv = cvs.createNestedObject();
+    cv[JSON_CV_NODE] = entry.cv;
+    if(entry.cv31 >= 0) {
+      cv[JSON_CV31_NODE] = entry.cv31;
+      cv[JSON_CV32_NODE] = entry.cv32;
+    }
+    cv[JSON_VALUE_NODE] = entry.value;
+  }
+  return true;
+}
+
+bool DecoderBackupManager::remove(const String &name) {
+  if(!isValidName(name) || isActive(name)) {
+    return false;
+  }
+  configStore.remove(getBackupFileName(name, false).c_str());
+  configStore.remove(getBackupFileName(name, true).c_str());
+  return true;
+}
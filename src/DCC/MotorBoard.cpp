@@ -17,22 +17,73 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 
 #include "ESP32CommandStation.h"
 
+#include <utils/median.hxx>
+
 #ifndef ADC_CURRENT_ATTENUATION
 #define ADC_CURRENT_ATTENUATION ADC_ATTEN_DB_11
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////
 
-const uint8_t motorBoardADCSampleCount = 50;
-const uint16_t motorBoardCheckInterval = 250;
-const uint16_t motorBoardCheckFaultCountdownInterval = 40;
+// Priority for the current monitoring task, this needs to be above all other
+// tasks on the APP CPU so that a short circuit is detected promptly.
+static constexpr UBaseType_t MOTOR_BOARD_MONITOR_TASK_PRIORITY = configMAX_PRIORITIES - 2;
+
+// Stack size for the current monitoring task, the fault notifications are
+// sent from loop() so this only needs to cover sampling.
+static constexpr uint32_t MOTOR_BOARD_MONITOR_TASK_STACK_SIZE = 2048;
+
+// The current monitoring task runs on the APP CPU, the PRO CPU is used for
+// the DCC signal generation and WiFi.
+static constexpr BaseType_t MOTOR_BOARD_MONITOR_TASK_CORE = APP_CPU_NUM;
+
+// Interval (in milliseconds) between current samples for each motor board.
+static constexpr uint32_t MOTOR_BOARD_SAMPLE_INTERVAL_MS = 1;
+
+// EWMA coefficient for short circuit detection, at 1kHz a saturated reading
+// crosses the short circuit threshold ~2ms after the median filter passes it.
+static constexpr float MOTOR_BOARD_FAST_EWMA_ALPHA = 0.25f;
+
+// EWMA coefficient for overload detection and reporting, at 1kHz this has a
+// time constant of ~100ms.
+static constexpr float MOTOR_BOARD_SLOW_EWMA_ALPHA = 0.99f;
+
+// Short circuit threshold as a percentage of the overload threshold.
+static constexpr uint32_t MOTOR_BOARD_SHORT_CIRCUIT_PERCENT = 150;
+
+// The ADC saturates at 4095, the short circuit threshold is capped below this
+// so that it can still be reached by the fast EWMA.
+static constexpr uint32_t MOTOR_BOARD_SHORT_CIRCUIT_MAX_ADC = 3700;
+
+// Pending event flags raised by the current monitoring task and reported by
+// MotorBoardManager::processEvents.
+static constexpr uint8_t MOTOR_BOARD_EVENT_FAULT = 0x01;
+static constexpr uint8_t MOTOR_BOARD_EVENT_RETRY = 0x02;
+
+// current monitoring task, see MotorBoardManager::startMonitoring.
+static TaskHandle_t monitorTaskHandle = nullptr;
 
 LinkedList<GenericMotorBoard *> motorBoards([](GenericMotorBoard *board) {delete board; });
 
+// returns the combined state of the OPS motor boards (districts).
+static PowerDistrictSummary getOPSDistrictSummary() {
+  PowerDistrictSummary summary;
+  for (const auto& board : motorBoards) {
+    if(!board->isProgrammingTrack()) {
+      summary.add(board->getDistrictState());
+    }
+  }
+  return summary;
+}
+
 class NonMonitoredMotorBoard : public GenericMotorBoard {
 public:
   NonMonitoredMotorBoard(uint8_t enablePin, String name) : GenericMotorBoard(ADC1_CHANNEL_0, enablePin, 0, 0, name, false) {}
-  virtual void check() {}
+  // there are no current readings, only the enable/disable requests are
+  // applied.
+  virtual void check() {
+    applyDistrictRequest();
+  }
   virtual uint16_t captureSample(uint8_t sampleCount, bool logResults=false) {
     return 0;
   }
@@ -42,85 +93,95 @@ GenericMotorBoard::GenericMotorBoard(adc1_channel_t senseChannel, uint8_t enable
   uint16_t triggerMilliAmps, uint32_t maxMilliAmps, String name, bool programmingTrack) :
   _name(name), _senseChannel(senseChannel), _enablePin(enablePin),
   _maxMilliAmps(maxMilliAmps), _triggerValue(4096 * triggerMilliAmps / maxMilliAmps),
-  _progTrack(programmingTrack), _current(0), _state(false), _triggered(false),
-  _triggerClearedCountdown(0), _triggerRecurrenceCount(0) {
+  _shortValue(std::min(_triggerValue * MOTOR_BOARD_SHORT_CIRCUIT_PERCENT / 100, MOTOR_BOARD_SHORT_CIRCUIT_MAX_ADC)),
+  _progTrack(programmingTrack), _current(0), _district(_triggerValue, _shortValue),
+  _fastCurrent(MOTOR_BOARD_FAST_EWMA_ALPHA),
+  _slowCurrent(MOTOR_BOARD_SLOW_EWMA_ALPHA) {
+#if CURRENT_HISTORY_ENABLED
+  // the PROG track is only energized while programming so its history would
+  // almost entirely be zero.
+  if(!_progTrack) {
+    _history.reset(new CurrentHistory());
+  }
+#endif
   adc1_config_channel_atten(_senseChannel, ADC_CURRENT_ATTENUATION);
   pinMode(enablePin, OUTPUT);
   digitalWrite(enablePin, LOW);
-  LOG(INFO, "[%s] Configuring motor board [ADC1 Channel: %d, currentLimit: %d, enablePin: %d]",
-    _name.c_str(), _senseChannel, _triggerValue, _enablePin);
+  LOG(INFO, "[%s] Configuring motor board [ADC1 Channel: %d, currentLimit: %d, shortLimit: %d, enablePin: %d]",
+    _name.c_str(), _senseChannel, _triggerValue, _shortValue, _enablePin);
 }
 
 void GenericMotorBoard::powerOn(bool announce) {
-  if(!_state) {
+  if(!_district.isEnabled()) {
     LOG(INFO, "[%s] Enabling DCC Signal", _name.c_str());
-    digitalWrite(_enablePin, HIGH);
-    _state = true;
+    // an explicit power on cancels the pending automatic re-enable, the
+    // output is enabled by the current monitoring task.
+    _district.requestEnable();
+    waitForDistrictRequest();
+    if(!_progTrack) {
+      wifiInterface.notifyPowerState();
+    }
     if(announce) {
 #if LOCONET_ENABLED
       locoNet.reportPower(true);
 #endif
       wifiInterface.print(F("<p1 %s>"), _name.c_str());
     }
-    // enable the DCC signal
-    if(_progTrack && !dccSignal[DCC_SIGNAL_PROGRAMMING]->isEnabled()) {
-      dccSignal[DCC_SIGNAL_PROGRAMMING]->startSignal(false);
+    // enable the DCC signal, all OPS districts share the same signal so it
+    // may already be running.
+    if(_progTrack) {
+      if(!dccSignal[DCC_SIGNAL_PROGRAMMING]->isEnabled()) {
+        dccSignal[DCC_SIGNAL_PROGRAMMING]->startSignal(false);
 #if STATUS_LED_ENABLED
-      setStatusLED(STATUS_LED::PROG_LED, STATUS_LED_COLOR::LED_GREEN);
+        setStatusLED(STATUS_LED::PROG_LED, STATUS_LED_COLOR::LED_GREEN);
 #endif
-    } else if(!dccSignal[DCC_SIGNAL_OPERATIONS]->isEnabled()) {
-      dccSignal[DCC_SIGNAL_OPERATIONS]->startSignal();
+      }
+    } else {
+      if(!dccSignal[DCC_SIGNAL_OPERATIONS]->isEnabled()) {
+        dccSignal[DCC_SIGNAL_OPERATIONS]->startSignal();
+      }
 #if STATUS_LED_ENABLED
-      setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_GREEN);
+      setStatusLED(STATUS_LED::OPS_LED, getOPSDistrictSummary().anyFaulted ? STATUS_LED_COLOR::LED_RED : STATUS_LED_COLOR::LED_GREEN);
 #endif
     }
   }
 }
 
-void GenericMotorBoard::powerOff(bool announce, bool overCurrent) {
+void GenericMotorBoard::powerOff(bool announce) {
   LOG(INFO, "[%s] Disabling DCC Signal", _name.c_str());
-  digitalWrite(_enablePin, LOW);
-  _state = false;
+  // an explicit power off cancels the automatic re-enable, the output is
+  // disabled by the current monitoring task before the signal is stopped.
+  _district.requestDisable();
+  waitForDistrictRequest();
   if(!_progTrack) {
+    wifiInterface.notifyPowerState();
     if(announce) {
-      if(overCurrent) {
-#if LOCONET_ENABLED
-        locoNet.send(OPC_IDLE, 0, 0);
-#endif
-        wifiInterface.print(F("<p2 %s>"), _name.c_str());
-#if STATUS_LED_ENABLED
-        setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_RED);
-#endif
-      } else {
 #if LOCONET_ENABLED
-        locoNet.reportPower(false);
+      locoNet.reportPower(false);
 #endif
-        wifiInterface.print(F("<p0 %s>"), _name.c_str());
+      wifiInterface.print(F("<p0 %s>"), _name.c_str());
 #if STATUS_LED_ENABLED
-        setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_GREEN);
+      setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_GREEN);
 #endif
-      }
     }
   }
-  if(!overCurrent) {
-    // disable the DCC signal
-    if(_progTrack) {
-      dccSignal[DCC_SIGNAL_PROGRAMMING]->stopSignal();
+  // disable the DCC signal
+  if(_progTrack) {
+    dccSignal[DCC_SIGNAL_PROGRAMMING]->stopSignal();
 #if STATUS_LED_ENABLED
-      setStatusLED(STATUS_LED::PROG_LED, STATUS_LED_COLOR::LED_OFF);
+    setStatusLED(STATUS_LED::PROG_LED, STATUS_LED_COLOR::LED_OFF);
 #endif
-    } else if(MotorBoardManager::getCountOfOPSBoards() == 1) {
-      dccSignal[DCC_SIGNAL_OPERATIONS]->stopSignal();
+  } else if(!getOPSDistrictSummary().isSignalRequired()) {
+    dccSignal[DCC_SIGNAL_OPERATIONS]->stopSignal();
 #if STATUS_LED_ENABLED
-      setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_OFF);
+    setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_OFF);
 #endif
-    }
   }
 }
 
 void GenericMotorBoard::showStatus() {
   if(!_progTrack) {
-    if(_state) {
+    if(_district.isEnabled()) {
       wifiInterface.print(F("<p1 %s>"), _name.c_str());
       wifiInterface.print(F("<a %s %d>"), _name.c_str(), getLastRead());
     } else {
@@ -130,28 +191,99 @@ void GenericMotorBoard::showStatus() {
 }
 
 void GenericMotorBoard::check() {
-  // if we have exceeded the CURRENT_SAMPLE_TIME we need to check if we are over/under current.
-  if(isOn() && ((millis() - _lastCheckTime) > motorBoardCheckInterval)) {
-        _lastCheckTime = millis();
-    _current = captureSample(motorBoardADCSampleCount);
-    if(_current >= _triggerValue) {
-      LOG(INFO, "[%s] Overcurrent detected %2.2f mA (raw: %d)", _name.c_str(), getCurrentDraw(), _current);
-      powerOff(true, true);
-      _triggered = true;
-      _triggerClearedCountdown = motorBoardCheckFaultCountdownInterval;
-      _triggerRecurrenceCount = 0;
-    } else if(_current >= _triggerValue && _triggered) {
-      _triggerRecurrenceCount++;
-      LOG(INFO, "[%s] Overcurrent persists (%d ms) %2.2f mA (raw: %d)", _name.c_str(), _triggerRecurrenceCount * motorBoardCheckInterval, getCurrentDraw(), _current);
-    } else if(_current < _triggerValue && _triggered) {
-      _triggerClearedCountdown--;
-      if(_triggerClearedCountdown == 0) {
-        LOG(INFO, "[%s] Overcurrent cleared %2.2f mA, enabling (raw: %d)", _name.c_str(), getCurrentDraw(), _current);
-        powerOn();
-        _triggered=false;
-      } else {
-        LOG(INFO, "[%s] Overcurrent cleared %2.2f mA, %d ms before re-enable (raw: %d)", _name.c_str(), getCurrentDraw(), _triggerClearedCountdown * motorBoardCheckInterval, _current);
+  unsigned sample = 0;
+  if(_district.isEnabled()) {
+    _recentSamples[_recentSampleIndex++ % 5] = readADC();
+    sample = median_5(_recentSamples[0], _recentSamples[1], _recentSamples[2],
+                      _recentSamples[3], _recentSamples[4]);
+    _fastCurrent.add_value(sample);
+    _slowCurrent.add_value(sample);
+    _current = _slowCurrent.avg();
+  }
+  handleDistrictEvent(_district.update(millis(), _fastCurrent.avg(), _current));
+  // the history is recorded after the fault handling so it never delays
+  // turning off the track output.
+  recordSample(sample);
+}
+
+void GenericMotorBoard::handleDistrictEvent(PowerDistrictEvent event) {
+  if(event == POWER_DISTRICT_SHORT_CIRCUIT || event == POWER_DISTRICT_OVERLOAD) {
+    // disable the output before anything else is done
+    digitalWrite(_enablePin, LOW);
+    _current = _fastCurrent.avg();
+    _faultReason = event == POWER_DISTRICT_SHORT_CIRCUIT ? "Short circuit" : "Overcurrent";
+    _faultCurrent = _current;
+    _pendingEvents |= MOTOR_BOARD_EVENT_FAULT;
+  } else if(event == POWER_DISTRICT_RETRY || event == POWER_DISTRICT_ENABLED) {
+    // discard any readings from before the board was disabled. The DCC
+    // signal is kept running while a board is waiting to be re-enabled so
+    // only the output needs to be enabled here.
+    memset(_recentSamples, 0, sizeof(_recentSamples));
+    _fastCurrent.reset_state(0);
+    _slowCurrent.reset_state(0);
+    _current = 0;
+    digitalWrite(_enablePin, HIGH);
+    if(event == POWER_DISTRICT_RETRY) {
+      _pendingEvents |= MOTOR_BOARD_EVENT_RETRY;
+    }
+  } else if(event == POWER_DISTRICT_DISABLED) {
+    digitalWrite(_enablePin, LOW);
+  }
+}
+
+void GenericMotorBoard::applyDistrictRequest() {
+  handleDistrictEvent(_district.applyRequest(millis()));
+}
+
+void GenericMotorBoard::waitForDistrictRequest() {
+  if(!monitorTaskHandle) {
+    // the current monitoring task has not been started, nothing else can be
+    // updating the district.
+    applyDistrictRequest();
+    return;
+  }
+  while(_district.isRequestPending()) {
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+}
+
+uint32_t GenericMotorBoard::getRetryRemaining() {
+  return _district.getRetryRemaining(millis());
+}
+
+void GenericMotorBoard::processEvents() {
+  uint8_t events = _pendingEvents.exchange(0);
+  if(events & MOTOR_BOARD_EVENT_FAULT) {
+    LOG(WARNING, "[%s] %s detected %2.2f mA (raw: %d), retrying in %d ms", _name.c_str(),
+        _faultReason, (float)((_faultCurrent * _maxMilliAmps) / 4096.0f), _faultCurrent,
+        _district.getRetryDelay());
+    if(!_progTrack) {
+      wifiInterface.notifyPowerState();
+#if LOCONET_ENABLED
+      // other districts may still be running, only report the loss of
+      // track power when no district remains enabled.
+      if(!getOPSDistrictSummary().anyEnabled) {
+        locoNet.send(OPC_IDLE, 0, 0);
       }
+#endif
+      wifiInterface.print(F("<p2 %s>"), _name.c_str());
+#if STATUS_LED_ENABLED
+      setStatusLED(STATUS_LED::OPS_LED, STATUS_LED_COLOR::LED_RED);
+#endif
+    }
+  }
+  if(events & MOTOR_BOARD_EVENT_RETRY) {
+    LOG(INFO, "[%s] Overcurrent timeout expired, enabled (attempt %d)", _name.c_str(),
+        _district.getFaultCount());
+    if(!_progTrack) {
+      wifiInterface.notifyPowerState();
+#if LOCONET_ENABLED
+      locoNet.reportPower(true);
+#endif
+      wifiInterface.print(F("<p1 %s>"), _name.c_str());
+#if STATUS_LED_ENABLED
+      setStatusLED(STATUS_LED::OPS_LED, getOPSDistrictSummary().anyFaulted ? STATUS_LED_COLOR::LED_RED : STATUS_LED_COLOR::LED_GREEN);
+#endif
     }
   }
 }
@@ -159,7 +291,7 @@ void GenericMotorBoard::check() {
 uint16_t GenericMotorBoard::captureSample(uint8_t sampleCount, bool logResults) {
   std::vector<int> readings;
   while(readings.size() < sampleCount) {
-    readings.push_back(adc1_get_raw(_senseChannel));
+    readings.push_back(readADC());
     vTaskDelay(pdMS_TO_TICKS(1));
   }
   auto avgReading = std::accumulate(readings.begin(), readings.end(), 0) / readings.size();
@@ -169,6 +301,72 @@ uint16_t GenericMotorBoard::captureSample(uint8_t sampleCount, bool logResults)
   return avgReading;
 }
 
+uint16_t GenericMotorBoard::readADC() {
+#if VIRTUAL_DECODER_ENABLED
+  if(_progTrack) {
+    return VirtualDecoder::getCurrentSample(_maxMilliAmps);
+  }
+#endif
+  return adc1_get_raw(_senseChannel);
+}
+
+void GenericMotorBoard::ackSampleCallback(void *arg) {
+  GenericMotorBoard *board = static_cast<GenericMotorBoard *>(arg);
+  uint32_t head = board->_ackSampleHead.load(std::memory_order_relaxed);
+  board->_ackSamples[head % ACK_SAMPLE_BUFFER_SIZE] = board->readADC();
+  board->_ackSampleHead.store(head + 1, std::memory_order_release);
+}
+
+void GenericMotorBoard::startAckSampling() {
+  if(!_ackTimer) {
+    _ackSamples.reset(new uint16_t[ACK_SAMPLE_BUFFER_SIZE]);
+    esp_timer_create_args_t args = {
+      .callback = ackSampleCallback,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "ack"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &_ackTimer));
+  }
+  resetAckDetection();
+  esp_timer_start_periodic(_ackTimer, ACK_SAMPLE_INTERVAL_USEC);
+}
+
+void GenericMotorBoard::stopAckSampling() {
+  if(_ackTimer) {
+    esp_timer_stop(_ackTimer);
+  }
+}
+
+void GenericMotorBoard::resetAckDetection() {
+  _ackSampleTail = _ackSampleHead.load(std::memory_order_acquire);
+  _ackDetector.reset();
+}
+
+bool GenericMotorBoard::waitForAck(uint16_t ackThreshold, uint32_t timeoutMs) {
+  uint64_t deadline = esp_timer_get_time() + (timeoutMs * 1000ULL);
+  while(true) {
+    uint32_t head = _ackSampleHead.load(std::memory_order_acquire);
+    if(head - _ackSampleTail > ACK_SAMPLE_BUFFER_SIZE) {
+      LOG(WARNING, "[%s] ACK sample buffer overrun, %d samples lost", _name.c_str(),
+          head - _ackSampleTail - ACK_SAMPLE_BUFFER_SIZE);
+      _ackSampleTail = head - ACK_SAMPLE_BUFFER_SIZE;
+    }
+    while(_ackSampleTail != head) {
+      uint16_t sample = _ackSamples[_ackSampleTail++ % ACK_SAMPLE_BUFFER_SIZE];
+      if(_ackDetector.addSample(sample, ackThreshold)) {
+        LOG(VERBOSE, "[%s] ACK detected (baseline: %d, sample: %d)", _name.c_str(),
+            _ackDetector.getBaseline(), sample);
+        return true;
+      }
+    }
+    if(esp_timer_get_time() > deadline) {
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+}
+
 void MotorBoardManager::registerBoard(adc1_channel_t sensePin, uint8_t enablePin, MOTOR_BOARD_TYPE type, String name, bool programmingTrack) {
   InfoScreen::replaceLine(INFO_SCREEN_ROTATING_STATUS_LINE, F("%s Init"), name.c_str());
   uint32_t maxAmps = 0;
@@ -218,12 +416,34 @@ GenericMotorBoard *MotorBoardManager::getBoardByName(String name) {
   return nullptr;
 }
 
+static void motorBoardMonitorTask(void *arg) {
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
+  TickType_t lastWake = xTaskGetTickCount();
+  while(true) {
+    MotorBoardManager::check();
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(MOTOR_BOARD_SAMPLE_INTERVAL_MS));
+  }
+}
+
+void MotorBoardManager::startMonitoring() {
+  xTaskCreatePinnedToCore(motorBoardMonitorTask, "MotorBoards",
+                          MOTOR_BOARD_MONITOR_TASK_STACK_SIZE, nullptr,
+                          MOTOR_BOARD_MONITOR_TASK_PRIORITY, &monitorTaskHandle,
+                          MOTOR_BOARD_MONITOR_TASK_CORE);
+}
+
 void MotorBoardManager::check() {
   for (const auto& board : motorBoards) {
     board->check();
   }
 }
 
+void MotorBoardManager::processEvents() {
+  for (const auto& board : motorBoards) {
+    board->processEvents();
+  }
+}
+
 void MotorBoardManager::powerOnAll() {
   LOG(VERBOSE, "Enabling DCC Signal for all OPS track outputs");
   for (const auto& board : motorBoards) {
@@ -246,7 +466,9 @@ void MotorBoardManager::powerOnAll() {
 void MotorBoardManager::powerOffAll() {
   LOG(VERBOSE, "Disabling DCC Signal for all track outputs");
   for (const auto& board : motorBoards) {
-    if(board->isOn()) {
+    // boards waiting to be re-enabled after a fault are included so that
+    // they stay off.
+    if(board->isOn() || board->isOverCurrent()) {
       board->powerOff(false);
       board->showStatus();
     }
@@ -321,6 +543,7 @@ void MotorBoardManager::getState(JsonArray &array) {
     } else if(motorBoard->isOverCurrent()) {
       board[JSON_STATE_NODE] = JSON_VALUE_FAULT;
       board[JSON_USAGE_NODE] = motorBoard->getCurrentDraw();
+      board[JSON_RETRY_NODE] = motorBoard->getRetryRemaining();
     } else {
       board[JSON_STATE_NODE] = JSON_VALUE_OFF;
       board[JSON_USAGE_NODE] = 0;
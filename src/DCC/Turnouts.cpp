@@ -154,6 +154,24 @@ void TurnoutManager::getState(JsonArray & array, bool readableStrings) {
   }
 }
 
+void TurnoutManager::streamState(json_stream_visitor_t visitor, bool readableStrings) {
+  for (const auto& turnout : turnouts) {
+    JsonObject *json = visitor(turnout->getID());
+    if(json) {
+      turnout->toJson(*json, readableStrings);
+    }
+  }
+}
+
+void TurnoutManager::streamCompactState(json_stream_visitor_t visitor, const uint8_t fields) {
+  for (const auto& turnout : turnouts) {
+    JsonObject *json = visitor(turnout->getID());
+    if(json) {
+      turnout->toCompactJson(*json, fields);
+    }
+  }
+}
+
 void TurnoutManager::showStatus() {
   for (const auto& turnout : turnouts) {
     turnout->showStatus();
@@ -167,6 +185,7 @@ Turnout *TurnoutManager::createOrUpdate(const uint16_t id, const uint16_t addres
   } else {
     turnout = new Turnout(id, address, index, false, type);
     turnouts.add(turnout);
+    turnout->markChanged();
   }
   return turnout;
 }
@@ -175,6 +194,7 @@ bool TurnoutManager::removeByID(const uint16_t id) {
   Turnout *turnout = getTurnoutByID(id);
   if(turnout) {
     LOG(VERBOSE, "[Turnout %d] Deleted", turnout->getID());
+    ChangeLog::record(ChangeType::TURNOUT, turnout->getID());
     turnouts.remove(turnout);
     return true;
   }
@@ -185,6 +205,7 @@ bool TurnoutManager::removeByAddress(const uint16_t address) {
   Turnout *turnout = getTurnoutByAddress(address);
   if(turnout) {
     LOG(VERBOSE, "[Turnout %d] Deleted as it used address %d", turnout->getID(), address);
+    ChangeLog::record(ChangeType::TURNOUT, turnout->getID());
     turnouts.remove(turnout);
     return true;
   }
@@ -282,6 +303,7 @@ void Turnout::update(uint16_t address, int8_t index, TurnoutType type) {
     LOG(VERBOSE, "[Turnout %d] Updated to address %d:%d and type %s",
       _turnoutID, _address, _index, TURNOUT_TYPE_STRINGS[_type]);
   }
+  markChanged();
 }
 
 void Turnout::toJson(JsonObject &json, bool readableStrings) {
@@ -305,6 +327,27 @@ void Turnout::toJson(JsonObject &json, bool readableStrings) {
   json[JSON_TYPE_NODE] = (int)_type;
 }
 
+void Turnout::toCompactJson(JsonObject &json, uint8_t fields) {
+  if(fields & TURNOUT_FIELD_ID) {
+    json[JSON_V2_ID_NODE] = _turnoutID;
+  }
+  if(fields & TURNOUT_FIELD_ADDRESS) {
+    json[JSON_V2_ADDRESS_NODE] = _address;
+  }
+  if(fields & TURNOUT_FIELD_BOARD_ADDRESS) {
+    json[JSON_V2_BOARD_ADDRESS_NODE] = _boardAddress;
+  }
+  if(fields & TURNOUT_FIELD_SUB_ADDRESS) {
+    json[JSON_V2_SUB_ADDRESS_NODE] = _boardAddress ? -1 : _index;
+  }
+  if(fields & TURNOUT_FIELD_STATE) {
+    json[JSON_V2_STATE_NODE] = (uint8_t)_thrown;
+  }
+  if(fields & TURNOUT_FIELD_TYPE) {
+    json[JSON_V2_TYPE_NODE] = (int)_type;
+  }
+}
+
 void Turnout::set(bool thrown, bool sendDCCPacket) {
   _thrown = thrown;
   if(sendDCCPacket) {
@@ -315,10 +358,16 @@ void Turnout::set(bool thrown, bool sendDCCPacket) {
     DCCPPProtocolHandler::getCommandHandler("a")->process(args);
   }
   wifiInterface.print(F("<H %d %d>"), _turnoutID, _thrown);
+  wifiInterface.notifyTurnoutState(_turnoutID, _thrown);
+  markChanged();
   LOG(VERBOSE, "[Turnout %d] Set to %s", _turnoutID,
     _thrown ? JSON_VALUE_THROWN : JSON_VALUE_CLOSED);
 }
 
+void Turnout::markChanged() {
+  _changeSequence = ChangeLog::record(ChangeType::TURNOUT, _turnoutID);
+}
+
 void Turnout::showStatus() {
   wifiInterface.print(F("<H %d %d %d %d>"), _turnoutID, _address, _index, _thrown);
 }
@@ -0,0 +1,144 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+
+#if VIRTUAL_DECODER_ENABLED
+
+#include <atomic>
+#include <mutex>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+// Default profile, this approximates a typical sound decoder which draws
+// a small idle current and responds ~1ms after the second matching packet.
+static constexpr VirtualDecoderProfile VIRTUAL_DECODER_DEFAULT_PROFILE = {
+  1000,   // ackDelayUsec
+  6000,   // ackDurationUsec
+  10,     // idleMilliAmps
+  80,     // ackMilliAmps
+  5,      // noiseMilliAmps
+  0       // missedAckPercent
+};
+
+static std::mutex virtualDecoderLock;
+static VirtualDecoderProfile profile = VIRTUAL_DECODER_DEFAULT_PROFILE;
+static VirtualDecoderModel decoder;
+
+// the ACK pulse currently being generated, times are the lower 32 bits of
+// esp_timer_get_time() which is sufficient for pulses of a few ms.
+static std::atomic<uint32_t> ackStartUsec{0};
+static std::atomic<uint32_t> ackDurationUsec{0};
+
+static uint32_t acksSent{0};
+static uint32_t acksMissed{0};
+
+static void sendAck(const VirtualDecoderProfile &current) {
+  if((esp_random() % 100) < current.missedAckPercent) {
+    acksMissed++;
+    return;
+  }
+  acksSent++;
+  ackDurationUsec = 0;
+  ackStartUsec = (uint32_t)esp_timer_get_time() + current.ackDelayUsec;
+  ackDurationUsec = current.ackDurationUsec;
+}
+
+void VirtualDecoder::packetSent(const Packet *packet) {
+  uint8_t data[MAX_BYTES_IN_PACKET];
+  uint8_t length = 0;
+  // each byte is preceded by a zero start bit, see SignalGenerator::loadPacket
+  for(uint16_t start = PACKET_PREAMBLE_BITS; start + 9 <= packet->numberOfBits; start += 9) {
+    uint8_t value = 0;
+    for(uint8_t bit = 0; bit < 8; bit++) {
+      uint16_t index = start + 1 + bit;
+      if(packet->buffer[index / 8] & DCC_PACKET_BIT_MASK[index % 8]) {
+        value |= DCC_PACKET_BIT_MASK[bit];
+      }
+    }
+    data[length++] = value;
+  }
+  std::lock_guard<std::mutex> guard(virtualDecoderLock);
+  if(decoder.packetReceived(data, length)) {
+    sendAck(profile);
+  }
+}
+
+uint16_t VirtualDecoder::getCurrentSample(uint32_t maxMilliAmps) {
+  VirtualDecoderProfile current;
+  {
+    std::lock_guard<std::mutex> guard(virtualDecoderLock);
+    current = profile;
+  }
+  int32_t milliAmps = current.idleMilliAmps;
+  uint32_t duration = ackDurationUsec;
+  if(duration && ((uint32_t)esp_timer_get_time() - ackStartUsec) < duration) {
+    milliAmps += current.ackMilliAmps;
+  }
+  if(current.noiseMilliAmps) {
+    milliAmps += (int32_t)(esp_random() % ((current.noiseMilliAmps * 2) + 1)) - current.noiseMilliAmps;
+  }
+  return getVirtualDecoderSample(milliAmps, maxMilliAmps);
+}
+
+VirtualDecoderProfile VirtualDecoder::getProfile() {
+  std::lock_guard<std::mutex> guard(virtualDecoderLock);
+  return profile;
+}
+
+void VirtualDecoder::setProfile(const VirtualDecoderProfile &newProfile) {
+  std::lock_guard<std::mutex> guard(virtualDecoderLock);
+  profile = newProfile;
+  LOG(INFO, "[VirtualDecoder] ACK delay: %dus, duration: %dus, idle: %dmA, ack: %dmA, noise: %dmA, missed: %d%%",
+      profile.ackDelayUsec, profile.ackDurationUsec, profile.idleMilliAmps,
+      profile.ackMilliAmps, profile.noiseMilliAmps, profile.missedAckPercent);
+}
+
+void VirtualDecoder::reset() {
+  std::lock_guard<std::mutex> guard(virtualDecoderLock);
+  decoder.reset();
+  acksSent = 0;
+  acksMissed = 0;
+}
+
+void VirtualDecoderCommand::process(const std::vector<String> arguments) {
+  if(arguments.size() == 1 && arguments[0].equalsIgnoreCase("reset")) {
+    VirtualDecoder::reset();
+    wifiInterface.send(COMMAND_SUCCESSFUL_RESPONSE);
+    return;
+  } else if(arguments.size() == 6) {
+    VirtualDecoderProfile newProfile;
+    newProfile.ackDelayUsec = arguments[0].toInt();
+    newProfile.ackDurationUsec = arguments[1].toInt();
+    newProfile.idleMilliAmps = arguments[2].toInt();
+    newProfile.ackMilliAmps = arguments[3].toInt();
+    newProfile.noiseMilliAmps = arguments[4].toInt();
+    newProfile.missedAckPercent = std::min(100L, arguments[5].toInt());
+    VirtualDecoder::setProfile(newProfile);
+  } else if(!arguments.empty()) {
+    wifiInterface.send(COMMAND_FAILED_RESPONSE);
+    return;
+  }
+  auto current = VirtualDecoder::getProfile();
+  std::lock_guard<std::mutex> guard(virtualDecoderLock);
+  wifiInterface.print(F("<vdec %d %d %d %d %d %d %d %d %d %d>"), current.ackDelayUsec,
+    current.ackDurationUsec, current.idleMilliAmps, current.ackMilliAmps,
+    current.noiseMilliAmps, current.missedAckPercent, decoder.getPacketsDecoded(),
+    decoder.getInstructionsExecuted(), acksSent, acksMissed);
+}
+
+#endif // VIRTUAL_DECODER_ENABLED
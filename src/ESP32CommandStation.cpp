@@ -21,6 +21,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include "RemoteSensors.h"
 #include "HC12Interface.h"
 #include "NextionInterface.h"
+#include "WebServer.h"
 
 const char * buildTime = __DATE__ " " __TIME__;
 
@@ -45,6 +46,8 @@ void setup() {
   Serial.begin(115200L);
   Serial.setDebugOutput(true);
   LOG(INFO, "ESP32 Command Station v%s starting up", VERSION);
+  // setup() and loop() run on the Arduino loop task.
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
 #ifndef ALLOW_USAGE_OF_RESTRICTED_GPIO_PINS
   restrictedPins.push_back(0);
   restrictedPins.push_back(2);
@@ -84,13 +87,30 @@ void setup() {
                                    MOTORBOARD_ENABLE_PIN_OPS,
                                    MOTORBOARD_TYPE_OPS,
                                    MOTORBOARD_NAME_OPS);
+#ifdef MOTORBOARD_OPS_DISTRICTS
+#define MOTORBOARD_DISTRICT(name, enablePin, sensePin, type) \
+  MotorBoardManager::registerBoard(sensePin, enablePin, type, name);
+  MOTORBOARD_OPS_DISTRICTS
+#undef MOTORBOARD_DISTRICT
+#endif
   MotorBoardManager::registerBoard(MOTORBOARD_CURRENT_SENSE_PROG,
                                    MOTORBOARD_ENABLE_PIN_PROG,
                                    MOTORBOARD_TYPE_PROG,
                                    MOTORBOARD_NAME_PROG,
                                    true);
-  dccSignal[DCC_SIGNAL_OPERATIONS] = new SignalGenerator_RMT("OPS", 512, DCC_SIGNAL_OPERATIONS, DCC_SIGNAL_PIN_OPERATIONS, MOTORBOARD_ENABLE_PIN_OPS);
+  dccSignal[DCC_SIGNAL_OPERATIONS] = new SignalGenerator_RMT("OPS", 512, DCC_SIGNAL_OPERATIONS, DCC_SIGNAL_PIN_OPERATIONS, MOTORBOARD_ENABLE_PIN_OPS,
+                                                             OPS_BRAKE_ENABLE_PIN, OPS_RAILCOM_ENABLE_PIN, OPS_RAILCOM_SHORT_PIN,
+                                                             OPS_RAILCOM_UART, OPS_RAILCOM_UART_RX_PIN);
   dccSignal[DCC_SIGNAL_PROGRAMMING] = new SignalGenerator_RMT("PROG", 10, DCC_SIGNAL_PROGRAMMING, DCC_SIGNAL_PIN_PROGRAMMING, MOTORBOARD_ENABLE_PIN_PROG);
+  MotorBoardManager::startMonitoring();
+  ProgrammingTrackManager::init();
+  OpsProgrammingManager::init();
+#if DCC_A_ENABLED
+  DecoderLogonManager::init();
+#endif
+#if VIRTUAL_DECODER_ENABLED
+  VirtualDecoder::reset();
+#endif
 
   DCCPPProtocolHandler::init();
   OutputManager::init();
@@ -130,7 +150,7 @@ void setup() {
     if(MotorBoardManager::isTrackPowerOn()) {
       response.sd.trk |= GTRK_POWER;
     }
-    if(progTrackBusy) {
+    if(ProgrammingTrackManager::isBusy()) {
       response.sd.trk |= GTRK_PROG_BUSY;
     }
     locoNet.send(&response);
@@ -171,48 +191,45 @@ void setup() {
     if(msg->pt.slot == PRG_SLOT) {
       if(msg->pt.command == 0x00) {
         // Cancel / abort request, currently ignored
-      } else if (progTrackBusy) {
-        locoNet.send(OPC_LONG_ACK, OPC_MASK, 0);
       } else {
         uint16_t cv = PROG_CV_NUM(msg->pt);
         uint8_t value = PROG_DATA(msg->pt);
         if((msg->pt.command & DIR_BYTE_ON_SRVC_TRK) == 0 &&
           (msg->pt.command & PCMD_RW) == 1) { // CV Write on PROG
-          if(enterProgrammingMode()) {
-            locoNet.send(OPC_LONG_ACK, OPC_MASK, 1);
-            msg->pt.command = OPC_SL_RD_DATA;
-            if(!writeProgCVByte(cv, value)) {
-              msg->pt.pstat = PSTAT_WRITE_FAIL;
-            } else {
-              msg->pt.data7 = value;
-              if(value & 0x80) {
-                msg->pt.cvh |= CVH_D7;
+          // the request has been accepted, the result will be sent once the
+          // programming track job completes.
+          locoNet.send(OPC_LONG_ACK, OPC_MASK, 1);
+          lnMsg response = *msg;
+          response.pt.command = OPC_SL_RD_DATA;
+          ProgrammingTrackManager::writeCVByte(makeProgClient(PROG_CLIENT_LOCONET), cv, value,
+            [response](int16_t result) mutable {
+              if(result < 0) {
+                response.pt.pstat = PSTAT_WRITE_FAIL;
+              } else {
+                response.pt.data7 = result & 0x7F;
+                if(result & 0x80) {
+                  response.pt.cvh |= CVH_D7;
+                }
               }
-            }
-            leaveProgrammingMode();
-            locoNet.send(msg);
-          } else {
-            locoNet.send(OPC_LONG_ACK, OPC_MASK, 0);
-          }
+              locoNet.send(&response);
+            });
         } else if((msg->pt.command & DIR_BYTE_ON_SRVC_TRK) == 0 &&
           (msg->pt.command & PCMD_RW) == 0) { // CV Read on PROG
-          if(enterProgrammingMode()) {
-            locoNet.send(OPC_LONG_ACK, OPC_MASK, 1);
-            msg->pt.command = OPC_SL_RD_DATA;
-            int16_t value = readCV(cv);
-            if(value == -1) {
-              msg->pt.pstat = PSTAT_READ_FAIL;
-            } else {
-              msg->pt.data7 = value & 0x7F;
-              if(value & 0x80) {
-                msg->pt.cvh |= CVH_D7;
+          locoNet.send(OPC_LONG_ACK, OPC_MASK, 1);
+          lnMsg response = *msg;
+          response.pt.command = OPC_SL_RD_DATA;
+          ProgrammingTrackManager::readCV(makeProgClient(PROG_CLIENT_LOCONET), cv,
+            [response](int16_t result) mutable {
+              if(result < 0) {
+                response.pt.pstat = PSTAT_READ_FAIL;
+              } else {
+                response.pt.data7 = result & 0x7F;
+                if(result & 0x80) {
+                  response.pt.cvh |= CVH_D7;
+                }
               }
-            }
-            leaveProgrammingMode();
-            locoNet.send(msg);
-          } else {
-            locoNet.send(OPC_LONG_ACK, OPC_MASK, 0);
-          }
+              locoNet.send(&response);
+            });
         } else if ((msg->pt.command & OPS_BYTE_NO_FEEDBACK) == 0) {
           // CV Write on OPS, no feedback
           locoNet.send(OPC_LONG_ACK, OPC_MASK, 0x40);
@@ -270,9 +287,12 @@ void loop() {
     delay(250);
     esp32_restart();
   }
-  MotorBoardManager::check();
+  MotorBoardManager::processEvents();
   if(!otaInProgress) {
     InfoScreen::update();
+    esp32csWebServer.sendCurrentHistory();
+    esp32csWebServer.sendStateUpdates();
+    esp32csWebServer.flushWebSocketText();
 #if LCC_ENABLED
     lccInterface.update();
 #endif
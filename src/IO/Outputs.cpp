@@ -167,6 +167,15 @@ void OutputManager::getState(JsonArray & array) {
   }
 }
 
+void OutputManager::streamState(json_stream_visitor_t visitor) {
+  for (const auto& output : outputs) {
+    JsonObject *json = visitor(output->getID());
+    if(json) {
+      output->toJson(*json, true);
+    }
+  }
+}
+
 void OutputManager::showStatus() {
   for (const auto& output : outputs) {
     output->showStatus();
@@ -183,7 +192,9 @@ bool OutputManager::createOrUpdate(const uint16_t id, const uint8_t pin, const u
   if(std::find(restrictedPins.begin(), restrictedPins.end(), pin) != restrictedPins.end()) {
     return false;
   }
-  outputs.add(new Output(id, pin, flags));
+  Output *output = new Output(id, pin, flags);
+  outputs.add(output);
+  output->markChanged();
   return true;
 }
 
@@ -196,6 +207,7 @@ bool OutputManager::remove(const uint16_t id) {
   }
   if(outputToRemove != nullptr) {
     LOG(INFO, "[Output] Removing Output(%d)", outputToRemove->getID());
+    ChangeLog::record(ChangeType::OUTPUT, outputToRemove->getID());
     outputs.remove(outputToRemove);
     return true;
   }
@@ -243,6 +255,7 @@ void Output::set(bool active, bool announce) {
   LOG(INFO, "[Output] Output(%d) set to %s", _id, _active ? JSON_VALUE_ON : JSON_VALUE_OFF);
   if(announce) {
     wifiInterface.print(F("<Y %d %d>"), _id, !_active);
+    markChanged();
   }
 }
 
@@ -260,6 +273,11 @@ void Output::update(uint8_t pin, uint8_t flags) {
   }
   LOG(VERBOSE, "[Output] Output(%d) on pin %d updated, flags: %s", _id, _pin, getFlagsAsString().c_str());
   pinMode(_pin, OUTPUT);
+  markChanged();
+}
+
+void Output::markChanged() {
+  _changeSequence = ChangeLog::record(ChangeType::OUTPUT, _id);
 }
 
 void Output::toJson(JsonObject &json, bool readableStrings) {
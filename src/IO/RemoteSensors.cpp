@@ -110,6 +110,7 @@ void RemoteSensorManager::createOrUpdate(const uint16_t id, const uint16_t value
   RemoteSensor *newSensor = new RemoteSensor(id, value);
   remoteSensors.add(newSensor);
   sensors.add(newSensor);
+  newSensor->markChanged();
 }
 
 bool RemoteSensorManager::remove(const uint16_t id) {
@@ -121,6 +122,7 @@ bool RemoteSensorManager::remove(const uint16_t id) {
     }
   }
   if(sensorToRemove != nullptr) {
+    ChangeLog::record(ChangeType::REMOTE_SENSOR, sensorToRemove->getID());
     remoteSensors.remove(sensorToRemove);
     sensors.remove(sensorToRemove);
     return true;
@@ -128,6 +130,15 @@ bool RemoteSensorManager::remove(const uint16_t id) {
   return false;
 }
 
+RemoteSensor *RemoteSensorManager::getSensor(const uint16_t id) {
+  for (const auto& sensor : remoteSensors) {
+    if(sensor->getID() == id) {
+      return sensor;
+    }
+  }
+  return nullptr;
+}
+
 void RemoteSensorManager::getState(JsonArray &array) {
   for (const auto& sensor : remoteSensors) {
     JsonObject &json = array.createNestedObject();
@@ -135,6 +146,15 @@ void RemoteSensorManager::getState(JsonArray &array) {
   }
 }
 
+void RemoteSensorManager::streamState(json_stream_visitor_t visitor) {
+  for (const auto& sensor : remoteSensors) {
+    JsonObject *json = visitor(sensor->getID());
+    if(json) {
+      sensor->toJson(*json);
+    }
+  }
+}
+
 void RemoteSensorManager::show() {
   if(remoteSensors.isEmpty()) {
     wifiInterface.send(COMMAND_FAILED_RESPONSE);
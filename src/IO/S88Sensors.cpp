@@ -18,6 +18,8 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include "ESP32CommandStation.h"
 #include "S88Sensors.h"
 
+#include <esp_timer.h>
+
 /**********************************************************************
 
 The ESP32 Command Station supports multiple S88 Sensor busses.
@@ -63,6 +65,9 @@ static constexpr const char * S88_SENSORS_JSON_FILE = "s88.json";
 
 TaskHandle_t S88BusManager::_taskHandle;
 xSemaphoreHandle S88BusManager::_s88SensorLock;
+std::atomic<uint32_t> S88BusManager::_lastScanMicros{0};
+std::atomic<uint32_t> S88BusManager::_maxScanMicros{0};
+std::atomic<uint32_t> S88BusManager::_scanCount{0};
 
 static constexpr UBaseType_t S88_SENSOR_TASK_PRIORITY = 1;
 static constexpr uint32_t S88_SENSOR_TASK_STACK_SIZE = 2048;
@@ -116,9 +121,11 @@ uint8_t S88BusManager::store() {
 
 void S88BusManager::s88SensorTask(void *param) {
   esp_task_wdt_add(NULL);
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
   while(true) {
     esp_task_wdt_reset();
     MUTEX_LOCK(_s88SensorLock);
+    uint64_t scanStart = esp_timer_get_time();
     for (const auto& sensorBus : s88SensorBus) {
       sensorBus->prepForRead();
     }
@@ -150,6 +157,11 @@ void S88BusManager::s88SensorTask(void *param) {
       delayMicroseconds(S88_SENSOR_READ_TIME);
     }
     MUTEX_UNLOCK(_s88SensorLock);
+    _lastScanMicros = esp_timer_get_time() - scanStart;
+    if(_lastScanMicros > _maxScanMicros) {
+      _maxScanMicros = _lastScanMicros.load();
+    }
+    _scanCount++;
     vTaskDelay(S88_SENSOR_CHECK_DELAY);
   }
 }
@@ -143,6 +143,17 @@ void SensorManager::getState(JsonArray & array) {
   }
 }
 
+void SensorManager::streamState(json_stream_visitor_t visitor) {
+  MUTEX_LOCK(_lock);
+  for (const auto& sensor : sensors) {
+    JsonObject *json = visitor(sensor->getID());
+    if(json) {
+      sensor->toJson(*json, true);
+    }
+  }
+  MUTEX_UNLOCK(_lock);
+}
+
 Sensor *SensorManager::getSensor(uint16_t id) {
   for (const auto& sensor : sensors) {
     if(sensor->getID() == id && sensor->getPin() != -1) {
@@ -166,7 +177,9 @@ bool SensorManager::createOrUpdate(const uint16_t id, const uint8_t pin, const b
     MUTEX_UNLOCK(_lock);
     return false;
   }
-  sensors.add(new Sensor(id, pin, pullUp));
+  Sensor *sensor = new Sensor(id, pin, pullUp);
+  sensors.add(sensor);
+  sensor->markChanged();
   MUTEX_UNLOCK(_lock);
   return true;
 }
@@ -182,6 +195,7 @@ bool SensorManager::remove(const uint16_t id) {
   }
   if(sensorToRemove != nullptr) {
     LOG(INFO, "[Sensors] Removing Sensor(%d)", sensorToRemove->getID());
+    ChangeLog::record(ChangeType::SENSOR, sensorToRemove->getID());
     sensors.remove(sensorToRemove);
     MUTEX_UNLOCK(_lock);
     return true;
@@ -222,6 +236,10 @@ Sensor::Sensor(JsonObject &json) : _lastState(false) {
   }
 }
 
+void Sensor::markChanged() {
+  _changeSequence = ChangeLog::record(getChangeType(), _sensorID);
+}
+
 void Sensor::toJson(JsonObject &json, bool includeState) {
   json[JSON_ID_NODE] = _sensorID;
   json[JSON_PIN_NODE] = _pin;
@@ -0,0 +1,77 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#include "ESP32CommandStation.h"
+
+#include <set>
+
+static constexpr const char *CHANGE_TYPE_STRINGS[] = {
+  "turnout",
+  "output",
+  "sensor",
+  "remoteSensor",
+  "locomotive",
+  "consist"
+};
+
+static std::mutex changeLogLock;
+static ChangeLogEntry changeLog[CHANGE_LOG_SIZE];
+// sequence number of the most recent change, sequence numbers start at one
+// so zero can be used by clients which have not seen any changes.
+static uint32_t changeSequence{0};
+
+uint32_t ChangeLog::record(const ChangeType type, const uint16_t id) {
+  std::lock_guard<std::mutex> guard(changeLogLock);
+  changeSequence++;
+  changeLog[changeSequence % CHANGE_LOG_SIZE] = {changeSequence, id, type};
+  return changeSequence;
+}
+
+uint32_t ChangeLog::getSequence() {
+  std::lock_guard<std::mutex> guard(changeLogLock);
+  return changeSequence;
+}
+
+bool ChangeLog::getChanges(const uint32_t since, std::vector<ChangeLogEntry> &changes, uint32_t &latest) {
+  std::lock_guard<std::mutex> guard(changeLogLock);
+  latest = changeSequence;
+  // a sequence number from the future is from before a restart of the
+  // command station.
+  if(since > changeSequence ||
+     (changeSequence > CHANGE_LOG_SIZE && since < changeSequence - CHANGE_LOG_SIZE)) {
+    return false;
+  }
+  // walk backwards through the log so only the most recent change for each
+  // entity is reported.
+  std::set<uint32_t> seen;
+  for(uint32_t sequence = changeSequence; sequence > since; sequence--) {
+    const auto &entry = changeLog[sequence % CHANGE_LOG_SIZE];
+    if(seen.insert(((uint32_t)entry.type << 16) | entry.id).second) {
+      changes.push_back(entry);
+    }
+  }
+  std::reverse(changes.begin(), changes.end());
+  return true;
+}
+
+const char *ChangeLog::getTypeName(const ChangeType type) {
+  if(type < ChangeType::MAX_CHANGE_TYPES) {
+    return CHANGE_TYPE_STRINGS[(uint8_t)type];
+  }
+  return "";
+}
@@ -22,12 +22,71 @@ and has been adapter for use in ESP32 COMMAND STATION.
 
 #include "ESP32CommandStation.h"
 
+#include <atomic>
+#include <map>
+#include <mutex>
+
 #include "Turnouts.h"
 #include "S88Sensors.h"
 #include "RemoteSensors.h"
 
 LinkedList<DCCPPProtocolCommand *> registeredCommands([](DCCPPProtocolCommand *command) {delete command; });
 
+// Number of log2 microsecond buckets used for command execution time
+// tracking, the last bucket holds all samples of ~0.5sec or longer.
+static constexpr uint8_t COMMAND_STATS_BUCKETS = 20;
+
+// Execution statistics for a single protocol command.
+struct CommandStats {
+  uint32_t count{0};
+  uint64_t totalTime{0};
+  uint32_t maxTime{0};
+  // sum of the free heap lost across each execution of the command, this is
+  // memory which was still allocated when the command returned. Memory which
+  // is allocated and released within the command is not visible here.
+  int64_t retainedHeap{0};
+  uint32_t histogram[COMMAND_STATS_BUCKETS]{0};
+};
+
+static std::map<DCCPPProtocolCommand *, CommandStats> commandStats;
+static std::mutex commandStatsLock;
+static uint32_t commandStatsMinFreeHeap{UINT32_MAX};
+// esp_timer_get_time() value when collection started, this is used for the
+// observed command rate.
+static uint64_t commandStatsStartTime{0};
+
+static void recordCommandStats(DCCPPProtocolCommand *command, uint32_t elapsed, int32_t retainedHeap) {
+  std::lock_guard<std::mutex> guard(commandStatsLock);
+  if(!commandStatsStartTime) {
+    commandStatsStartTime = esp_timer_get_time() - elapsed;
+  }
+  auto &stats = commandStats[command];
+  stats.count++;
+  stats.totalTime += elapsed;
+  stats.maxTime = std::max(stats.maxTime, elapsed);
+  stats.retainedHeap += retainedHeap;
+  uint8_t bucket = 0;
+  while(bucket < COMMAND_STATS_BUCKETS - 1 && (elapsed >> bucket) > 1) {
+    bucket++;
+  }
+  stats.histogram[bucket]++;
+  commandStatsMinFreeHeap = std::min(commandStatsMinFreeHeap, ESP.getFreeHeap());
+}
+
+// returns the upper bound (in microseconds) of the bucket which contains the
+// requested percentile.
+static uint32_t getCommandStatsPercentile(const CommandStats &stats, uint8_t percentile) {
+  uint32_t target = (stats.count * percentile + 99) / 100;
+  uint32_t seen = 0;
+  for(uint8_t bucket = 0; bucket < COMMAND_STATS_BUCKETS; bucket++) {
+    seen += stats.histogram[bucket];
+    if(seen >= target) {
+      return 1UL << (bucket + 1);
+    }
+  }
+  return stats.maxTime;
+}
+
 // <e> command handler, this command will clear all stored configuration data
 // on the ESP32. All Turnouts, Outputs, Sensors and S88 Sensors (if enabled)
 // will need to be reconfigured after sending this command.
@@ -89,17 +148,16 @@ public:
 class ReadCVCommand : public DCCPPProtocolCommand {
 public:
   void process(const std::vector<String> arguments) {
+    process(arguments, makeProgClient(PROG_CLIENT_DCCPP));
+  }
+  void process(const std::vector<String> &arguments, const prog_client_t client) {
     int cvNumber = arguments[0].toInt();
-    int16_t cvValue = -1;
-    if(enterProgrammingMode()) {
-      cvValue = readCV(cvNumber);
-      leaveProgrammingMode();
-    }
-    wifiInterface.print(F("<r%d|%d|%d %d>"),
-      arguments[1].toInt(),
-      arguments[2].toInt(),
-      cvNumber,
-      cvValue);
+    int callback = arguments[1].toInt();
+    int callbackSub = arguments[2].toInt();
+    ProgrammingTrackManager::readCV(client, cvNumber,
+      [cvNumber, callback, callbackSub](int16_t cvValue) {
+        wifiInterface.print(F("<r%d|%d|%d %d>"), callback, callbackSub, cvNumber, cvValue);
+      });
   }
 
   String getID() {
@@ -114,21 +172,16 @@ public:
 class WriteCVByteProgCommand : public DCCPPProtocolCommand {
 public:
   void process(const std::vector<String> arguments) {
+    process(arguments, makeProgClient(PROG_CLIENT_DCCPP));
+  }
+  void process(const std::vector<String> &arguments, const prog_client_t client) {
     int cvNumber = arguments[0].toInt();
-    int16_t cvValue = arguments[1].toInt();
-    if(enterProgrammingMode()) {
-      if(!writeProgCVByte(cvNumber, cvValue)) {
-        cvValue = -1;
-      }
-      leaveProgrammingMode();
-    } else {
-      cvValue = -1;
-    }
-    wifiInterface.print(F("<r%d|%d|%d %d>"),
-      arguments[2].toInt(),
-      arguments[3].toInt(),
-      cvNumber,
-      cvValue);
+    int callback = arguments[2].toInt();
+    int callbackSub = arguments[3].toInt();
+    ProgrammingTrackManager::writeCVByte(client, cvNumber, arguments[1].toInt(),
+      [cvNumber, callback, callbackSub](int16_t cvValue) {
+        wifiInterface.print(F("<r%d|%d|%d %d>"), callback, callbackSub, cvNumber, cvValue);
+      });
   }
 
   String getID() {
@@ -136,30 +189,25 @@ public:
   }
 };
 
-// <W {CV} {BIT} {VALUE} {CALLBACK} {CALLBACK-SUB}> command handler, this
+// <B {CV} {BIT} {VALUE} {CALLBACK} {CALLBACK-SUB}> command handler, this
 // command attempts to write a single bit value for a CV on the PROGRAMMING
 // track. The returned value is either the actual bit value of the CV or -1 if
 // there is a failure writing or verifying the CV value.
 class WriteCVBitProgCommand : public DCCPPProtocolCommand {
 public:
   void process(const std::vector<String> arguments) {
+    process(arguments, makeProgClient(PROG_CLIENT_DCCPP));
+  }
+  void process(const std::vector<String> &arguments, const prog_client_t client) {
     int cvNumber = arguments[0].toInt();
     uint8_t bit = arguments[1].toInt();
-    int8_t bitValue = arguments[1].toInt();
-    if(enterProgrammingMode()) {
-      if(!writeProgCVBit(cvNumber, bit, bitValue == 1)) {
-        bitValue = -1;
-      }
-      leaveProgrammingMode();
-    } else {
-      bitValue = -1;
-    }
-    wifiInterface.print(F("<r%d|%d|%d %d %d>"),
-      arguments[2].toInt(),
-      arguments[3].toInt(),
-      cvNumber,
-      bit,
-      bitValue);
+    int8_t bitValue = arguments[2].toInt();
+    int callback = arguments[3].toInt();
+    int callbackSub = arguments[4].toInt();
+    ProgrammingTrackManager::writeCVBit(client, cvNumber, bit, bitValue == 1,
+      [cvNumber, bit, callback, callbackSub](int16_t bitValue) {
+        wifiInterface.print(F("<r%d|%d|%d %d %d>"), callback, callbackSub, cvNumber, bit, bitValue);
+      });
   }
 
   String getID() {
@@ -231,6 +279,66 @@ public:
   }
 };
 
+// <stats> command handler, this command reports execution statistics for all
+// protocol commands that have been processed, one line per command:
+// <stats {ID} {COUNT} {AVG US} {P50 US} {P99 US} {MAX US} {AVG RETAINED HEAP BYTES}>
+// followed by a summary line:
+// <stats * {COUNT} {SECONDS} {COMMANDS PER SEC} {BUSY PERMILLE} {MIN FREE HEAP}>
+// where the rate and busy time are observed over the collection period (since
+// startup or the last reset), and the programming track CV read statistics:
+// <stats prog {READS} {FAST HITS} {FAST MISSES} {FAST PROBES} {BIT PROBE READS} {PACKETS SAVED}>
+// The times cover DCCPPProtocolHandler::process only, this does not include
+// time spent in the receive buffer or the DCC packet queue. The percentile
+// values are the upper bound of a log2 bucket. Sending <stats reset> will
+// clear all collected statistics.
+class CommandStatsCommand : public DCCPPProtocolCommand {
+public:
+  void process(const std::vector<String> arguments) {
+    std::lock_guard<std::mutex> guard(commandStatsLock);
+    if(arguments.size() == 1 && arguments[0].equalsIgnoreCase("reset")) {
+      commandStats.clear();
+      commandStatsMinFreeHeap = UINT32_MAX;
+      commandStatsStartTime = esp_timer_get_time();
+      ProgrammingTrackManager::resetReadStatistics();
+      wifiInterface.send(COMMAND_SUCCESSFUL_RESPONSE);
+      return;
+    }
+    uint32_t totalCount = 0;
+    uint64_t totalTime = 0;
+    for(const auto& entry : commandStats) {
+      const auto &stats = entry.second;
+      if(!stats.count) {
+        continue;
+      }
+      totalCount += stats.count;
+      totalTime += stats.totalTime;
+      wifiInterface.print(F("<stats %s %d %d %d %d %d %d>"),
+        entry.first->getID().c_str(), stats.count,
+        (uint32_t)(stats.totalTime / stats.count),
+        getCommandStatsPercentile(stats, 50),
+        getCommandStatsPercentile(stats, 99),
+        stats.maxTime, (int32_t)(stats.retainedHeap / stats.count));
+    }
+    uint64_t period = commandStatsStartTime ? esp_timer_get_time() - commandStatsStartTime : 0;
+    wifiInterface.print(F("<stats * %d %d %d %d %d>"), totalCount,
+      (uint32_t)(period / 1000000ULL),
+      period ? (uint32_t)((totalCount * 1000000ULL) / period) : 0,
+      period ? (uint32_t)((totalTime * 1000ULL) / period) : 0,
+      commandStatsMinFreeHeap == UINT32_MAX ? ESP.getFreeHeap() : commandStatsMinFreeHeap);
+    auto progStats = ProgrammingTrackManager::getReadStatistics();
+    // each fast path hit avoids probing every bit of the CV, every candidate
+    // verify packet (including misses) is counted against the savings.
+    int32_t packetsSaved = (progStats.fastPathHits * PROG_TRACK_BIT_PROBE_PACKETS) - progStats.fastPathProbes;
+    wifiInterface.print(F("<stats prog %d %d %d %d %d %d>"), progStats.reads,
+      progStats.fastPathHits, progStats.fastPathMisses, progStats.fastPathProbes,
+      progStats.bitProbeReads, packetsSaved);
+  }
+
+  String getID() {
+    return "stats";
+  }
+};
+
 // <estop> command handler, this command sends the current free heap space as response.
 class EStopCommand : public DCCPPProtocolCommand {
 public:
@@ -272,10 +380,14 @@ void DCCPPProtocolHandler::init() {
   registerCommand(new RemoteSensorsCommandAdapter());
   registerCommand(new FreeHeapCommand());
   registerCommand(new EStopCommand());
+  registerCommand(new CommandStatsCommand());
+#if VIRTUAL_DECODER_ENABLED
+  registerCommand(new VirtualDecoderCommand());
+#endif
 }
 
-void DCCPPProtocolHandler::process(const String &commandString) {
-  std::vector<String> parts;
+// splits a command into the command ID (returned) and arguments.
+static String parseCommand(const String &commandString, std::vector<String> &arguments) {
   if(commandString.indexOf(' ') > 0) {
     int index = 0;
     while(index < commandString.length()) {
@@ -284,27 +396,37 @@ void DCCPPProtocolHandler::process(const String &commandString) {
       if(index < 0) {
         index = commandString.length();
       }
-      parts.push_back(commandString.substring(previousIndex, index));
+      arguments.push_back(commandString.substring(previousIndex, index));
       // move past the space
       index++;
     }
   } else {
-    parts.push_back(commandString);
+    arguments.push_back(commandString);
   }
-  String commandID = parts.front();
-  parts.erase(parts.begin());
-  LOG(VERBOSE, "Command: %s, argument count: %d", commandID.c_str(), parts.size());
-  bool processed = false;
-  for (const auto& command : registeredCommands) {
-    if(commandID == command->getID()) {
-      command->process(parts);
-      processed = true;
-    }
-  }
-  if(!processed) {
+  String commandID = arguments.front();
+  arguments.erase(arguments.begin());
+  LOG(VERBOSE, "Command: %s, argument count: %d", commandID.c_str(), arguments.size());
+  return commandID;
+}
+
+static void executeCommand(DCCPPProtocolCommand *command, const String &commandID,
+                           const std::vector<String> &arguments, const prog_client_t client) {
+  if(!command) {
     LOG_ERROR("No command handler for [%s]", commandID.c_str());
     wifiInterface.send(COMMAND_FAILED_RESPONSE);
+    return;
   }
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint64_t start = esp_timer_get_time();
+  command->process(arguments, client);
+  recordCommandStats(command, esp_timer_get_time() - start,
+                     (int32_t)freeHeap - (int32_t)ESP.getFreeHeap());
+}
+
+void DCCPPProtocolHandler::process(const String &commandString, const prog_client_t client) {
+  std::vector<String> arguments;
+  String commandID = parseCommand(commandString, arguments);
+  executeCommand(getCommandHandler(commandID), commandID, arguments, client);
 }
 
 void DCCPPProtocolHandler::registerCommand(DCCPPProtocolCommand *cmd) {
@@ -328,7 +450,12 @@ DCCPPProtocolCommand *DCCPPProtocolHandler::getCommandHandler(const String &id)
   return nullptr;
 }
 
-DCCPPProtocolConsumer::DCCPPProtocolConsumer() {
+// Connection identifier assigned to the next DCCPPProtocolConsumer, zero is
+// used for commands which are not received via a consumer.
+static std::atomic<uint32_t> nextConsumerConnection{1};
+
+DCCPPProtocolConsumer::DCCPPProtocolConsumer() :
+  _client(makeProgClient(PROG_CLIENT_DCCPP, nextConsumerConnection++)) {
   _buffer.reserve(256);
 }
 
@@ -339,7 +466,35 @@ void DCCPPProtocolConsumer::feed(uint8_t *data, size_t len) {
   processData();
 }
 
+// A command received as part of a batch.
+struct BatchCommand {
+  String id;
+  std::vector<String> arguments;
+  DCCPPProtocolCommand *handler{nullptr};
+  // set when a later command in the batch makes this one redundant.
+  bool superseded{false};
+  // number of superseded commands this command replies on behalf of.
+  uint16_t replies{0};
+};
+
+// sends the <T {REGISTER} {SPEED} {DIR}> reply for a <t> command which was
+// superseded by a later <t> for the same register and locomotive, the reply
+// contains the state set by the later command. Consist throttle commands do
+// not reply so none is sent for them.
+static void replyToSupersededThrottle(const std::vector<String> &arguments) {
+  uint16_t locoAddress = arguments[1].toInt();
+  if(LocomotiveManager::isConsistAddress(locoAddress) ||
+     LocomotiveManager::isAddressInConsist(locoAddress)) {
+    return;
+  }
+  auto loco = LocomotiveManager::getLocomotiveByRegister(arguments[0].toInt());
+  if(loco && loco->getLocoAddress() == locoAddress) {
+    loco->showStatus();
+  }
+}
+
 void DCCPPProtocolConsumer::processData() {
+  std::vector<String> commands;
   auto s = _buffer.begin();
   auto consumed = _buffer.begin();
   for(; s != _buffer.end();) {
@@ -350,11 +505,59 @@ void DCCPPProtocolConsumer::processData() {
       s++;
       // discard the >
       *e = 0;
-      String str(reinterpret_cast<char*>(&*s));
-      DCCPPProtocolHandler::process(std::move(str));
+      commands.emplace_back(reinterpret_cast<char*>(&*s));
       consumed = e;
     }
     s = e;
   }
   _buffer.erase(_buffer.begin(), consumed); // drop everything we used from the buffer.
+
+  if(commands.size() == 1) {
+    DCCPPProtocolHandler::process(commands.front(), _client);
+  } else if(commands.size() > 1) {
+    // multiple commands were received together, parse all of them up front
+    // so the handler for each distinct command ID is only looked up once.
+    std::vector<BatchCommand> batch(commands.size());
+    std::map<String, DCCPPProtocolCommand *> handlers;
+    for(size_t index = 0; index < commands.size(); index++) {
+      auto &entry = batch[index];
+      entry.id = parseCommand(commands[index], entry.arguments);
+      auto handler = handlers.find(entry.id);
+      if(handler == handlers.end()) {
+        handler = handlers.emplace(entry.id, DCCPPProtocolHandler::getCommandHandler(entry.id)).first;
+      }
+      entry.handler = handler->second;
+    }
+    // drop any throttle command which is superseded by a later throttle
+    // command for the same register and loco, the later command replies on
+    // its behalf so the client receives one <T> per <t>.
+    std::map<std::pair<int32_t, int32_t>, size_t> throttled;
+    for(size_t index = batch.size(); index-- > 0;) {
+      auto &entry = batch[index];
+      if(entry.id == "t" && entry.arguments.size() == 4) {
+        std::pair<int32_t, int32_t> key(entry.arguments[0].toInt(), entry.arguments[1].toInt());
+        auto latest = throttled.find(key);
+        if(latest != throttled.end()) {
+          LOG(VERBOSE, "Dropping superseded throttle command: %s", commands[index].c_str());
+          entry.superseded = true;
+          batch[latest->second].replies++;
+        } else {
+          throttled[key] = index;
+        }
+      }
+    }
+    // process the remaining commands with all responses sent as a single
+    // broadcast once the batch completes.
+    wifiInterface.beginBatch();
+    for(const auto& entry : batch) {
+      if(entry.superseded) {
+        continue;
+      }
+      executeCommand(entry.handler, entry.id, entry.arguments, _client);
+      for(uint16_t reply = 0; reply < entry.replies; reply++) {
+        replyToSupersededThrottle(entry.arguments);
+      }
+    }
+    wifiInterface.endBatch();
+  }
 }
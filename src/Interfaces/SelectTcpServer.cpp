@@ -0,0 +1,227 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+#include "SelectTcpServer.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// Priority for the shared socket executor thread, this matches the priority
+// previously used for the per-client JMRI threads.
+static constexpr int SOCKET_EXECUTOR_PRIORITY = 0;
+
+// Stack size for the shared socket executor thread. All DCC++ command
+// handlers for TCP clients run on this thread.
+static constexpr size_t SOCKET_EXECUTOR_STACK_SIZE = 4096;
+
+// Maximum number of bytes which will be buffered for a client that is not
+// reading data fast enough, any further data will be discarded.
+static constexpr size_t SOCKET_CLIENT_MAX_PENDING_BYTES = 2048;
+
+static Executor<1> *socketExecutor = nullptr;
+static Service *socketService = nullptr;
+
+ExecutorBase *SelectTcpServer::executor() {
+  if(socketExecutor == nullptr) {
+    socketExecutor = new Executor<1>("SocketExec", SOCKET_EXECUTOR_PRIORITY,
+                                     SOCKET_EXECUTOR_STACK_SIZE);
+    socketService = new Service(socketExecutor);
+  }
+  return socketExecutor;
+}
+
+Service *SelectTcpServer::service() {
+  executor();
+  return socketService;
+}
+
+std::vector<SelectTcpServer *> &SelectTcpServer::getServers() {
+  // servers may be created during static initialization so the list is
+  // created on first use.
+  static std::vector<SelectTcpServer *> servers;
+  return servers;
+}
+
+SelectTcpServer::SelectTcpServer(const char *name, uint16_t port, client_factory_t factory) :
+  _name(name), _port(port), _factory(factory) {
+  getServers().push_back(this);
+}
+
+SelectTcpServer::~SelectTcpServer() {
+  _listener.reset();
+  auto &servers = getServers();
+  servers.erase(std::remove(servers.begin(), servers.end(), this), servers.end());
+}
+
+void SelectTcpServer::begin() {
+  if(_listener) {
+    return;
+  }
+  // ensure the executor is running before we start accepting connections
+  executor();
+  LOG(INFO, "[%s] Listening on port %d", _name, _port);
+  _listener.reset(new SocketListener(_port, [this](int fd) {
+    // the accept callback runs on the listener thread, hand the new
+    // connection over to the executor so all client state is owned there.
+    executor()->add(new CallbackExecutable([this, fd]() {
+      addClient(fd);
+    }));
+  }));
+}
+
+void SelectTcpServer::broadcast(const std::string &buf) {
+  std::lock_guard<std::mutex> guard(_lock);
+  for (const auto& client : _clients) {
+    client->send(buf);
+  }
+}
+
+size_t SelectTcpServer::getClientCount() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _clients.size();
+}
+
+void SelectTcpServer::addClient(int fd) {
+  LOG(INFO, "[%s %d] connected", _name, fd);
+  SelectTcpClient *client = _factory(this, fd);
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _clients.push_back(client);
+  }
+  client->start();
+}
+
+void SelectTcpServer::removeClient(SelectTcpClient *client) {
+  std::lock_guard<std::mutex> guard(_lock);
+  auto it = std::find(_clients.begin(), _clients.end(), client);
+  if(it != _clients.end()) {
+    _clients.erase(it);
+  }
+}
+
+SelectTcpClient::SelectTcpClient(SelectTcpServer *server, int fd) : _server(server),
+  _fd(fd), _reader(this), _writer(this) {
+  ::fcntl(_fd, F_SETFL, O_RDWR | O_NONBLOCK);
+}
+
+SelectTcpClient::~SelectTcpClient() {
+  ::close(_fd);
+}
+
+void SelectTcpClient::start() {
+  _activeFlows = 2;
+  _reader.start();
+  _writer.start();
+  connected();
+}
+
+void SelectTcpClient::send(const std::string &buf) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if(_closing) {
+    return;
+  }
+  if(_pending.length() + buf.length() > SOCKET_CLIENT_MAX_PENDING_BYTES) {
+    LOG(WARNING, "[%s %d] client is not reading data, discarding %d bytes",
+        _server->getName(), _fd, buf.length());
+    _server->_bytesDiscarded += buf.length();
+    return;
+  }
+  _pending.append(buf);
+  if(_writer._idle) {
+    _writer._idle = false;
+    _writer.notify();
+  }
+}
+
+void SelectTcpClient::close() {
+  std::lock_guard<std::mutex> guard(_lock);
+  if(_closing) {
+    return;
+  }
+  _closing = true;
+  // wake up any pending select() on the socket so both flows can exit.
+  ::shutdown(_fd, SHUT_RDWR);
+  if(_writer._idle) {
+    _writer._idle = false;
+    _writer.notify();
+  }
+}
+
+void SelectTcpClient::flowExited() {
+  if(--_activeFlows == 0) {
+    LOG(INFO, "[%s %d] disconnected", _server->getName(), _fd);
+    _server->removeClient(this);
+    // defer the delete so that any notifications already queued on the
+    // executor for this client are processed first.
+    _server->executor()->add(new CallbackExecutable([this]() {
+      delete this;
+    }));
+  }
+}
+
+SelectTcpClient::ReadFlow::ReadFlow(SelectTcpClient *client) :
+  StateFlowBase(client->_server->service()), _client(client) {
+}
+
+StateFlowBase::Action SelectTcpClient::ReadFlow::read_data() {
+  return read_single(&_helper, _client->_fd, _buf, sizeof(_buf), STATE(data_received));
+}
+
+StateFlowBase::Action SelectTcpClient::ReadFlow::data_received() {
+  if(_helper.hasError_) {
+    _client->close();
+    _client->flowExited();
+    return exit();
+  }
+  _client->_server->_bytesReceived += sizeof(_buf) - _helper.remaining_;
+  _client->receive(_buf, sizeof(_buf) - _helper.remaining_);
+  return call_immediately(STATE(read_data));
+}
+
+SelectTcpClient::WriteFlow::WriteFlow(SelectTcpClient *client) :
+  StateFlowBase(client->_server->service()), _client(client) {
+}
+
+StateFlowBase::Action SelectTcpClient::WriteFlow::wait_for_data() {
+  {
+    std::lock_guard<std::mutex> guard(_client->_lock);
+    if(!_client->_closing) {
+      if(_client->_pending.empty()) {
+        _idle = true;
+        return wait();
+      }
+      _active.swap(_client->_pending);
+    }
+  }
+  if(_active.empty()) {
+    _client->flowExited();
+    return exit();
+  }
+  return write_repeated(&_helper, _client->_fd, _active.data(), _active.length(),
+                        STATE(write_done));
+}
+
+StateFlowBase::Action SelectTcpClient::WriteFlow::write_done() {
+  _client->_server->_bytesSent += _active.length() - _helper.remaining_;
+  _active.clear();
+  if(_helper.hasError_) {
+    _client->close();
+  }
+  return call_immediately(STATE(wait_for_data));
+}
@@ -16,6 +16,11 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 **********************************************************************/
 
 #include "ESP32CommandStation.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <esp_timer.h>
 #include <ESPAsyncWebServer.h>
 #include <SPIFFSEditor.h>
 #include <AsyncJson.h>
@@ -26,10 +31,12 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include "Turnouts.h"
 #include "S88Sensors.h"
 #include "RemoteSensors.h"
-#include "index_html.h"
+#include "DecoderBackup.h"
+#include "web_assets.h"
 
 enum HTTP_STATUS_CODES {
   STATUS_OK = 200,
+  STATUS_ACCEPTED = 202,
   STATUS_NOT_MODIFIED = 304,
   STATUS_BAD_REQUEST = 400,
   STATUS_NOT_FOUND = 404,
@@ -37,12 +44,332 @@ enum HTTP_STATUS_CODES {
   STATUS_NOT_ACCEPTABLE = 406,
   STATUS_CONFLICT = 409,
   STATUS_PRECONDITION_FAILED = 412,
+  STATUS_PAYLOAD_TOO_LARGE = 413,
   STATUS_SERVER_ERROR = 500
 };
 
+// Maximum number of current history buckets returned by a single
+// GET /current request, older buckets can be retrieved via the since
+// parameter.
+static constexpr uint16_t MAX_CURRENT_HISTORY_RESPONSE_BUCKETS = 600;
+
+// Maximum number of current history buckets sent to WebSocket clients in a
+// single frame, any additional buckets will be sent with the next frame.
+static constexpr uint8_t MAX_CURRENT_HISTORY_WS_BUCKETS = 10;
+
+// Minimum interval between WebSocket state update frames, changes made
+// during this interval are combined so only the latest state of each entity
+// is sent.
+static constexpr uint32_t WS_STATE_UPDATE_INTERVAL_MS = 50;
+
+// Maximum number of subscriptions of each topic type per WebSocket client.
+static constexpr uint8_t WS_MAX_SUBSCRIPTIONS = 16;
+
+// Interval between sending the queued text protocol messages to WebSocket
+// clients, all messages queued during this interval are sent as a single
+// frame.
+static constexpr uint32_t WS_TEXT_FLUSH_INTERVAL_MS = 20;
+
+// Maximum number of text protocol bytes queued for a WebSocket client, when
+// this would be exceeded the queued messages are sent immediately.
+static constexpr size_t WS_MAX_QUEUED_TEXT_BYTES = 1024;
+
+// Initial size of the buffer used to serialize a batch of entities when
+// streaming a JSON array response, the buffer grows as needed.
+static constexpr size_t JSON_STREAM_ENTITY_BUFFER_SIZE = 512;
+
+// Number of entities serialized by each pass over a collection when streaming
+// a JSON array response, this bounds the memory used for a single chunk while
+// keeping the number of passes over the collection low.
+static constexpr size_t JSON_STREAM_BATCH_ENTITIES = 16;
+
+// Cache-Control header values for the web interface assets. Assets which
+// include the content hash in their path never change and can be cached
+// forever, the bootstrap index.html must be revalidated on each load so that
+// new asset paths are picked up after a firmware update.
+static constexpr const char * WEB_ASSET_CACHE_IMMUTABLE = "public, max-age=31536000, immutable";
+static constexpr const char * WEB_ASSET_CACHE_REVALIDATE = "no-cache";
+
+// Upper bounds (inclusive) of the handler time histogram buckets in
+// microseconds, an additional bucket counts all longer handler times.
+static constexpr uint32_t ROUTE_HANDLER_TIME_BUCKETS[] = {
+  100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000
+};
+static constexpr size_t ROUTE_HANDLER_TIME_BUCKET_COUNT =
+  (sizeof(ROUTE_HANDLER_TIME_BUCKETS) / sizeof(ROUTE_HANDLER_TIME_BUCKETS[0])) + 1;
+
+// Upper bounds (inclusive) of the response size histogram buckets in bytes,
+// an additional bucket counts all larger responses.
+static constexpr uint32_t ROUTE_RESPONSE_SIZE_BUCKETS[] = {
+  64, 256, 1024, 4096, 16384, 65536
+};
+static constexpr size_t ROUTE_RESPONSE_SIZE_BUCKET_COUNT =
+  (sizeof(ROUTE_RESPONSE_SIZE_BUCKETS) / sizeof(ROUTE_RESPONSE_SIZE_BUCKETS[0])) + 1;
+
+// Handlers which run for longer than this (in microseconds) prevent the
+// async_tcp task from servicing any other client and will be logged.
+static constexpr uint32_t ROUTE_HANDLER_BLOCKED_THRESHOLD_USEC = 50000;
+
+// Heap usage and time to first byte of the JSON array responses sent by a
+// route, recorded separately for streamed and fully buffered (stream=false)
+// responses so the two can be compared.
+struct JsonArrayStatistics {
+  uint32_t count{0};
+  // bytes of heap used while generating the response.
+  uint32_t maxHeapUsed{0};
+  uint32_t totalHeapUsed{0};
+  // milliseconds from the start of the handler until the first byte of the
+  // response was available to send.
+  uint32_t maxFirstByte{0};
+  uint32_t totalFirstByte{0};
+};
+
+// Handler time and response size statistics for a single route, these are
+// reported via GET /diagnostics/routes.
+//
+// All route handlers run on the async_tcp task so these are not locked.
+struct RouteStatistics {
+  RouteStatistics(const String &uri) : name(uri) {}
+  const String name;
+  // number of handler invocations, body and upload handlers are invoked
+  // once for each block of data received.
+  uint32_t count{0};
+  // number of handler invocations which exceeded the blocked threshold.
+  uint32_t blocked{0};
+  uint32_t maxHandlerTime{0};
+  uint32_t handlerTime[ROUTE_HANDLER_TIME_BUCKET_COUNT]{0};
+  uint32_t responseSize[ROUTE_RESPONSE_SIZE_BUCKET_COUNT]{0};
+  JsonArrayStatistics bufferedArrays;
+  JsonArrayStatistics streamedArrays;
+};
+
+// The route statistics are created by the ESP32CSWebServer constructor which
+// may run before the static initializers of this file.
+static std::vector<RouteStatistics *> &getRouteStatistics() {
+  static std::vector<RouteStatistics *> routes;
+  return routes;
+}
+
+static RouteStatistics *createRouteStatistics(const char *uri) {
+  auto route = new RouteStatistics(uri);
+  getRouteStatistics().push_back(route);
+  return route;
+}
+
+// route which owns the handler currently running on the async_tcp task.
+static RouteStatistics *activeRoute = nullptr;
+
+template<size_t N>
+static void recordHistogram(const uint32_t (&bounds)[N], uint32_t *buckets, uint32_t value) {
+  size_t bucket = 0;
+  while(bucket < N && value > bounds[bucket]) {
+    bucket++;
+  }
+  buckets[bucket]++;
+}
+
+// records the size of the response being sent by the active route, this is
+// only possible when the size is known by the handler.
+static void recordResponseSize(RouteStatistics *route, size_t size) {
+  if(route) {
+    recordHistogram(ROUTE_RESPONSE_SIZE_BUCKETS, route->responseSize, size);
+  }
+}
+
+static void recordResponseSize(size_t size) {
+  recordResponseSize(activeRoute, size);
+}
+
+static void recordJsonArray(RouteStatistics *route, bool streamed, uint32_t heapUsed,
+                            uint32_t firstByte) {
+  if(route) {
+    JsonArrayStatistics &stats = streamed ? route->streamedArrays : route->bufferedArrays;
+    stats.count++;
+    stats.maxHeapUsed = std::max(stats.maxHeapUsed, heapUsed);
+    stats.totalHeapUsed += heapUsed;
+    stats.maxFirstByte = std::max(stats.maxFirstByte, firstByte);
+    stats.totalFirstByte += firstByte;
+  }
+}
+
+// Measures the time spent in a route handler, this is created on the stack
+// of the wrapper registered by ESP32CSWebServer::route.
+class RouteHandlerTimer {
+public:
+  RouteHandlerTimer(RouteStatistics *route) : _route(route), _start(esp_timer_get_time()) {
+    activeRoute = route;
+  }
+  ~RouteHandlerTimer() {
+    activeRoute = nullptr;
+    uint32_t elapsed = esp_timer_get_time() - _start;
+    _route->count++;
+    _route->maxHandlerTime = std::max(_route->maxHandlerTime, elapsed);
+    recordHistogram(ROUTE_HANDLER_TIME_BUCKETS, _route->handlerTime, elapsed);
+    if(elapsed > ROUTE_HANDLER_BLOCKED_THRESHOLD_USEC) {
+      _route->blocked++;
+      LOG(WARNING, "[WebSrv] %s handler blocked the async_tcp task for %dms",
+          _route->name.c_str(), elapsed / 1000);
+    }
+  }
+private:
+  RouteStatistics *_route;
+  const uint64_t _start;
+};
+
+// Invokes the provided visitor for each entity of a collection, this wraps
+// one of the manager stream*() methods.
+typedef std::function<void(json_stream_visitor_t)> json_stream_source_t;
+
+// Builds a chunked response containing a JSON array with one element per
+// entity of the collection. The keys of the entities are captured when the
+// response is started, each chunk then serializes the next batch of up to
+// JSON_STREAM_BATCH_ENTITIES entities with a single pass over the collection
+// so the memory required does not depend on the number of entities.
+static AsyncWebServerResponse *beginJsonArrayStream(AsyncWebServerRequest *request,
+                                                    json_stream_source_t source) {
+  struct JsonArrayStreamState {
+    json_stream_source_t source;
+    std::vector<uint32_t> keys;
+    size_t nextKey{0};
+    size_t entities{0};
+    String pending{"["};
+    size_t pendingOffset{0};
+    bool complete{false};
+    uint32_t startTime{0};
+    uint32_t startFreeHeap{0};
+    uint32_t firstChunkTime{0};
+    size_t totalBytes{0};
+    uint32_t minFreeHeap{UINT32_MAX};
+  };
+  auto state = std::make_shared<JsonArrayStreamState>();
+  state->startTime = millis();
+  state->startFreeHeap = ESP.getFreeHeap();
+  state->source = source;
+  state->source([state](const uint32_t key) -> JsonObject * {
+    state->keys.push_back(key);
+    return nullptr;
+  });
+  String url = request->url();
+  // the response is generated after the handler has returned.
+  RouteStatistics *route = activeRoute;
+  return request->beginChunkedResponse("application/json",
+    [state, url, route](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      size_t written = 0;
+      while(written < maxLen) {
+        if(state->pendingOffset >= state->pending.length()) {
+          if(state->complete) {
+            break;
+          }
+          state->pending = "";
+          state->pendingOffset = 0;
+          if(state->nextKey >= state->keys.size()) {
+            state->pending = "]";
+            state->complete = true;
+          } else {
+            const size_t batchStart = state->nextKey;
+            const size_t batchSize = std::min(JSON_STREAM_BATCH_ENTITIES,
+                                              state->keys.size() - batchStart);
+            state->nextKey += batchSize;
+            DynamicJsonBuffer jsonBuffer(JSON_STREAM_ENTITY_BUFFER_SIZE);
+            std::vector<JsonObject *> batch(batchSize, nullptr);
+            state->source([state, &jsonBuffer, &batch, batchStart](const uint32_t key) -> JsonObject * {
+              for(size_t slot = 0; slot < batch.size(); slot++) {
+                if(!batch[slot] && state->keys[batchStart + slot] == key) {
+                  batch[slot] = &jsonBuffer.createObject();
+                  return batch[slot];
+                }
+              }
+              return nullptr;
+            });
+            // entities removed since the response was started are omitted.
+            for(auto entity : batch) {
+              if(entity) {
+                if(state->entities++) {
+                  state->pending += ",";
+                }
+                entity->printTo(state->pending);
+              }
+            }
+          }
+          state->minFreeHeap = std::min(state->minFreeHeap, ESP.getFreeHeap());
+        }
+        size_t len = std::min(maxLen - written, state->pending.length() - state->pendingOffset);
+        memcpy(buffer + written, state->pending.c_str() + state->pendingOffset, len);
+        state->pendingOffset += len;
+        written += len;
+      }
+      if(!index) {
+        state->firstChunkTime = millis() - state->startTime;
+      }
+      state->totalBytes += written;
+      if(!written) {
+        const uint32_t heapUsed = state->startFreeHeap - std::min(state->startFreeHeap, state->minFreeHeap);
+        recordResponseSize(route, state->totalBytes);
+        recordJsonArray(route, true, heapUsed, state->firstChunkTime);
+        LOG(VERBOSE, "[WebSrv] %s (streamed): %d entities, %d bytes, first chunk: %dms, total: %dms, heap used: %d",
+            url.c_str(), state->entities, state->totalBytes, state->firstChunkTime,
+            millis() - state->startTime, heapUsed);
+      }
+      return written;
+    });
+}
+
+// Builds the complete JSON array in memory before it is sent, this is how
+// the collections were returned before beginJsonArrayStream and is only used
+// when requested via stream=false so the two can be compared.
+static AsyncWebServerResponse *buildJsonArrayResponse(AsyncWebServerRequest *request,
+                                                      json_stream_source_t source) {
+  const uint32_t startTime = millis();
+  const uint32_t startFreeHeap = ESP.getFreeHeap();
+  auto jsonResponse = new AsyncJsonResponse(true);
+  JsonArray &array = jsonResponse->getRoot();
+  source([&array](const uint32_t) -> JsonObject * {
+    return &array.createNestedObject();
+  });
+  jsonResponse->setCode(STATUS_OK);
+  const size_t length = jsonResponse->setLength();
+  const uint32_t heapUsed = startFreeHeap - std::min(startFreeHeap, ESP.getFreeHeap());
+  const uint32_t firstByte = millis() - startTime;
+  recordResponseSize(length);
+  recordJsonArray(activeRoute, false, heapUsed, firstByte);
+  LOG(VERBOSE, "[WebSrv] %s (buffered): %d entities, %d bytes, first byte: %dms, heap used: %d",
+      request->url().c_str(), array.size(), length, firstByte, heapUsed);
+  return jsonResponse;
+}
+
+// sends a JSON array response for a collection, this is streamed unless the
+// request includes stream=false.
+static void sendJsonArray(AsyncWebServerRequest *request, json_stream_source_t source) {
+  if(request->hasArg(JSON_STREAM_NODE) && request->arg(JSON_STREAM_NODE) == JSON_VALUE_FALSE) {
+    request->send(buildJsonArrayResponse(request, source));
+  } else {
+    request->send(beginJsonArrayStream(request, source));
+  }
+}
+
+// builds a WS_BINARY_LOCO_STATE message for the provided locomotive.
+static void buildBinaryLocoState(Locomotive *loco, std::vector<uint8_t> &buffer) {
+  uint32_t functions = 0;
+  for(uint8_t funcID = 0; funcID < MAX_LOCOMOTIVE_FUNCTIONS; funcID++) {
+    if(loco->isFunctionEnabled(funcID)) {
+      bitSet(functions, funcID);
+    }
+  }
+  buffer.push_back(WS_BINARY_LOCO_STATE);
+  buffer.push_back(highByte(loco->getLocoAddress()));
+  buffer.push_back(lowByte(loco->getLocoAddress()));
+  buffer.push_back(loco->getSpeed());
+  buffer.push_back(loco->isDirectionForward());
+  buffer.push_back((functions >> 24) & 0xFF);
+  buffer.push_back((functions >> 16) & 0xFF);
+  buffer.push_back((functions >> 8) & 0xFF);
+  buffer.push_back(functions & 0xFF);
+}
+
 class WebSocketClient : public DCCPPProtocolConsumer {
 public:
-  WebSocketClient(int clientID, IPAddress remoteIP) : _id(clientID), _remoteIP(remoteIP) {
+  WebSocketClient(int clientID, IPAddress remoteIP, bool binary) : _id(clientID),
+    _remoteIP(remoteIP), _binary(binary) {
   }
   virtual ~WebSocketClient() {}
   int getID() {
@@ -51,11 +378,307 @@ public:
   String getName() {
     return _remoteIP.toString() + "/" + String(_id);
   }
+  bool isBinary() {
+    return _binary;
+  }
+  bool isCurrentSubscriber() {
+    return _currentSubscriber;
+  }
+  bool isLocoSubscriber(uint16_t address) {
+    std::lock_guard<std::mutex> guard(_subscriptionLock);
+    return !_filtered || _locoSubscriptions.count(address);
+  }
+  bool isTurnoutSubscriber(uint16_t id) {
+    std::lock_guard<std::mutex> guard(_subscriptionLock);
+    return !_filtered || isInRange(_turnoutSubscriptions, id);
+  }
+  bool isSensorSubscriber(uint16_t id) {
+    std::lock_guard<std::mutex> guard(_subscriptionLock);
+    return _filtered && isInRange(_sensorSubscriptions, id);
+  }
+  bool isPowerSubscriber() {
+    std::lock_guard<std::mutex> guard(_subscriptionLock);
+    return !_filtered || _powerSubscriber;
+  }
+  // adds a text protocol message to be sent with the next flushText call,
+  // returns the number of bytes sent if the queued messages had to be sent
+  // first to make room.
+  size_t queueText(AsyncWebSocket &socket, const String &message) {
+    std::lock_guard<std::mutex> guard(_textLock);
+    size_t sent = 0;
+    if(_queuedText.length() + message.length() > WS_MAX_QUEUED_TEXT_BYTES) {
+      sent = sendQueuedText(socket);
+    }
+    _queuedText += message;
+    return sent;
+  }
+  // sends all queued text protocol messages as a single frame, returns the
+  // number of bytes sent.
+  size_t flushText(AsyncWebSocket &socket) {
+    std::lock_guard<std::mutex> guard(_textLock);
+    return sendQueuedText(socket);
+  }
+  // processes one or more binary protocol commands, any response that is
+  // intended only for this client is added to reply.
+  void processBinary(uint8_t *data, size_t len, std::vector<uint8_t> &reply) {
+    size_t index = 0;
+    while(index < len) {
+      uint8_t opcode = data[index++];
+      size_t remaining = len - index;
+      BinaryLocoCommand command;
+      size_t consumed = decodeBinaryLocoCommand(opcode, &data[index], remaining, command);
+      if(consumed) {
+        index += consumed;
+        if(!command.valid) {
+          // getLocomotive returns nullptr for address zero and a speed
+          // above 126 would be sent as an emergency stop.
+          reply.push_back(WS_BINARY_ERROR);
+          reply.push_back(opcode);
+          continue;
+        }
+        auto loco = LocomotiveManager::getLocomotive(command.address);
+        if(opcode == WS_BINARY_LOCO_QUERY) {
+          buildBinaryLocoState(loco, reply);
+        } else if(opcode == WS_BINARY_FUNCTION) {
+          loco->setFunction(command.value, command.state);
+        } else {
+          if(opcode == WS_BINARY_SPEED) {
+            loco->setSpeed(command.value);
+          } else {
+            loco->setDirection(command.value);
+          }
+          loco->sendLocoUpdate(true);
+          // text clients receive the same <T> as for a <t> command, binary
+          // clients and throttles receive the change via the ChangeLog.
+          loco->showStatus();
+        }
+      } else if(opcode == WS_BINARY_TURNOUT && remaining >= 3) {
+        uint16_t turnoutID = (data[index] << 8) | data[index + 1];
+        bool found = false;
+        if(data[index + 2] == 2) {
+          found = TurnoutManager::toggleByID(turnoutID);
+        } else {
+          found = TurnoutManager::setByID(turnoutID, data[index + 2]);
+        }
+        if(!found) {
+          reply.push_back(WS_BINARY_ERROR);
+          reply.push_back(opcode);
+        }
+        index += 3;
+      } else if(opcode == WS_BINARY_POWER && remaining >= 1) {
+        if(data[index]) {
+          MotorBoardManager::powerOnAll();
+        } else {
+          MotorBoardManager::powerOffAll();
+        }
+        index += 1;
+      } else if(opcode == WS_BINARY_ESTOP) {
+        LocomotiveManager::emergencyStop();
+      } else if(opcode == WS_BINARY_CURRENT_SUBSCRIBE && remaining >= 1) {
+        _currentSubscriber = data[index];
+        index += 1;
+      } else if((opcode == WS_BINARY_SUBSCRIBE || opcode == WS_BINARY_UNSUBSCRIBE) &&
+                remaining >= 1) {
+        size_t consumed = processSubscription(opcode == WS_BINARY_SUBSCRIBE,
+                                              &data[index], remaining, reply);
+        if(!consumed) {
+          LOG(WARNING, "[WS %s] Invalid subscription: %02x (%d bytes remaining)",
+              getName().c_str(), data[index], (int)remaining);
+          reply.push_back(WS_BINARY_ERROR);
+          reply.push_back(opcode);
+          return;
+        }
+        index += consumed;
+      } else {
+        // unknown opcode or truncated command, discard the remainder of
+        // the frame since we can not determine the next command boundary.
+        LOG(WARNING, "[WS %s] Invalid binary command: %02x (%d bytes remaining)",
+            getName().c_str(), opcode, (int)remaining);
+        reply.push_back(WS_BINARY_ERROR);
+        reply.push_back(opcode);
+        return;
+      }
+    }
+  }
 private:
+  typedef std::pair<uint16_t, uint16_t> subscription_range_t;
+  // must be called with _textLock held so that messages queued by other
+  // tasks are sent in order.
+  size_t sendQueuedText(AsyncWebSocket &socket) {
+    size_t len = _queuedText.length();
+    if(len) {
+      socket.text(_id, _queuedText);
+      _queuedText = "";
+    }
+    return len;
+  }
+  static bool isInRange(const std::vector<subscription_range_t> &ranges, uint16_t id) {
+    for(const auto &range : ranges) {
+      if(id >= range.first && id <= range.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+  static bool updateRange(std::vector<subscription_range_t> &ranges,
+                          subscription_range_t range, bool subscribe) {
+    auto existing = std::find(ranges.begin(), ranges.end(), range);
+    if(!subscribe) {
+      if(existing != ranges.end()) {
+        ranges.erase(existing);
+      }
+      return true;
+    } else if(existing != ranges.end()) {
+      return true;
+    } else if(ranges.size() >= WS_MAX_SUBSCRIPTIONS || range.first > range.second) {
+      return false;
+    }
+    ranges.push_back(range);
+    return true;
+  }
+  // processes a single subscription change, returns the number of bytes
+  // consumed or zero if the subscription is not valid.
+  size_t processSubscription(bool subscribe, uint8_t *data, size_t len,
+                             std::vector<uint8_t> &reply) {
+    uint8_t topic = data[0];
+    std::lock_guard<std::mutex> guard(_subscriptionLock);
+    if(topic == WS_TOPIC_LOCO && len >= 3) {
+      uint16_t address = (data[1] << 8) | data[2];
+      if(!subscribe) {
+        _locoSubscriptions.erase(address);
+      } else if(_locoSubscriptions.size() >= WS_MAX_SUBSCRIPTIONS) {
+        return 0;
+      } else {
+        _locoSubscriptions.insert(address);
+        // send the current state so the client does not need to query it
+        auto loco = LocomotiveManager::getActiveLocomotive(address);
+        if(loco) {
+          buildBinaryLocoState(loco, reply);
+        }
+      }
+      _filtered = true;
+      return 3;
+    } else if((topic == WS_TOPIC_TURNOUTS || topic == WS_TOPIC_SENSORS) && len >= 5) {
+      subscription_range_t range((data[1] << 8) | data[2], (data[3] << 8) | data[4]);
+      if(!updateRange(topic == WS_TOPIC_TURNOUTS ? _turnoutSubscriptions : _sensorSubscriptions,
+                      range, subscribe)) {
+        return 0;
+      }
+      _filtered = true;
+      return 5;
+    } else if(topic == WS_TOPIC_POWER) {
+      _powerSubscriber = subscribe;
+      _filtered = true;
+      if(subscribe) {
+        reply.push_back(WS_BINARY_POWER_STATE);
+        reply.push_back(MotorBoardManager::isTrackPowerOn());
+      }
+      return 1;
+    } else if(topic == WS_TOPIC_CURRENT) {
+      _currentSubscriber = subscribe;
+      _filtered = true;
+      return 1;
+    }
+    return 0;
+  }
   uint32_t _id;
   IPAddress _remoteIP;
+  bool _binary;
+  bool _currentSubscriber{false};
+  std::mutex _subscriptionLock;
+  // set after the first subscription, until then the client receives the
+  // loco, turnout and power events for all entities.
+  bool _filtered{false};
+  bool _powerSubscriber{false};
+  std::set<uint16_t> _locoSubscriptions;
+  std::vector<subscription_range_t> _turnoutSubscriptions;
+  std::vector<subscription_range_t> _sensorSubscriptions;
+  std::mutex _textLock;
+  String _queuedText;
 };
-LinkedList<WebSocketClient *> webSocketClients([](WebSocketClient *client) {delete client;});
+
+// Connected WebSocket clients indexed by the AsyncWebSocket client ID. The
+// table is updated on the async_tcp task and read by any task that sends to
+// the clients, a client remains valid while referenced even if it has
+// disconnected in the meantime.
+static std::unordered_map<uint32_t, std::shared_ptr<WebSocketClient>> webSocketClients;
+static std::mutex webSocketClientLock;
+
+static std::shared_ptr<WebSocketClient> getWebSocketClient(uint32_t id) {
+  std::lock_guard<std::mutex> guard(webSocketClientLock);
+  auto client = webSocketClients.find(id);
+  if(client != webSocketClients.end()) {
+    return client->second;
+  }
+  return nullptr;
+}
+
+// returns a copy of the client table so that sending to the clients does
+// not block connection events.
+static std::vector<std::shared_ptr<WebSocketClient>> getWebSocketClients() {
+  std::lock_guard<std::mutex> guard(webSocketClientLock);
+  std::vector<std::shared_ptr<WebSocketClient>> clients;
+  clients.reserve(webSocketClients.size());
+  for(const auto &client : webSocketClients) {
+    clients.push_back(client.second);
+  }
+  return clients;
+}
+
+static size_t getWebSocketClientTableSize() {
+  std::lock_guard<std::mutex> guard(webSocketClientLock);
+  return webSocketClients.size();
+}
+
+// total number of bytes queued for sending to WebSocket clients.
+static std::atomic<uint32_t> webSocketBytesSent{0};
+
+// Maximum number of web programming track requests to track, when this is
+// exceeded the oldest completed request will be discarded.
+static constexpr uint8_t MAX_WEB_PROGRAMMER_JOBS = 16;
+
+// Programming track requests from the web interface, the result of a request
+// is retrieved via GET /programmer?job={ID} which returns 202 until the job
+// has completed.
+struct WebProgrammerJob {
+  bool complete;
+  int code;
+  String body;
+};
+static std::map<uint32_t, WebProgrammerJob> webProgrammerJobs;
+static std::mutex webProgrammerJobLock;
+static uint32_t nextWebProgrammerJobID = 1;
+
+// programming track jobs are queued per remote address so that one browser
+// can not delay the jobs of another, decoder backups use connection zero.
+static prog_client_t getWebProgClient(AsyncWebServerRequest *request) {
+  return makeProgClient(PROG_CLIENT_WEB, (uint32_t)request->client()->remoteIP());
+}
+
+static uint32_t createWebProgrammerJob() {
+  std::lock_guard<std::mutex> guard(webProgrammerJobLock);
+  if(webProgrammerJobs.size() >= MAX_WEB_PROGRAMMER_JOBS) {
+    for(auto it = webProgrammerJobs.begin(); it != webProgrammerJobs.end(); ++it) {
+      if(it->second.complete) {
+        webProgrammerJobs.erase(it);
+        break;
+      }
+    }
+  }
+  uint32_t jobID = nextWebProgrammerJobID++;
+  webProgrammerJobs[jobID] = {false, STATUS_ACCEPTED, ""};
+  return jobID;
+}
+
+static void completeWebProgrammerJob(uint32_t jobID, int code, JsonObject &result) {
+  std::lock_guard<std::mutex> guard(webProgrammerJobLock);
+  auto job = webProgrammerJobs.find(jobID);
+  if(job != webProgrammerJobs.end()) {
+    job->second.complete = true;
+    job->second.code = code;
+    result.printTo(job->second.body);
+  }
+}
 
 static const char * _err2str(uint8_t _error){
     if(_error == UPDATE_ERROR_OK){
@@ -90,19 +713,10 @@ static const char * _err2str(uint8_t _error){
 
 ESP32CSWebServer::ESP32CSWebServer() : AsyncWebServer(80), webSocket("/ws") {
   rewrite("/", "/index.html");
-  on("/index.html", HTTP_GET,
-    [](AsyncWebServerRequest *request) {
-      const char * htmlBuildTime = __DATE__ " " __TIME__;
-      if (request->header("If-Modified-Since").equals(htmlBuildTime)) {
-        request->send(STATUS_NOT_MODIFIED);
-      } else {
-        AsyncWebServerResponse *response = request->beginResponse_P(STATUS_OK, "text/html", indexHtmlGz, indexHtmlGz_size);
-        response->addHeader("Content-Encoding", "gzip");
-        response->addHeader("Last-Modified", htmlBuildTime);
-        request->send(response);
-      }
-    });
-  on("/features", HTTP_GET, [](AsyncWebServerRequest *request) {
+  for(const auto &asset : webAssets) {
+    route(asset.path, HTTP_GET, std::bind(&ESP32CSWebServer::handleWebAsset, this, std::placeholders::_1, &asset));
+  }
+  route("/features", HTTP_GET, [](AsyncWebServerRequest *request) {
     auto jsonResponse = new AsyncJsonResponse();
     JsonObject &root = jsonResponse->getRoot();
 #if S88_ENABLED
@@ -112,30 +726,49 @@ ESP32CSWebServer::ESP32CSWebServer() : AsyncWebServer(80), webSocket("/ws") {
     root[JSON_S88_NODE] = JSON_VALUE_FALSE;
 #endif
     jsonResponse->setCode(STATUS_OK);
-    jsonResponse->setLength();
+    recordResponseSize(jsonResponse->setLength());
     request->send(jsonResponse);
   });
-  on("/programmer", HTTP_GET | HTTP_POST,
+  route("/programmer", HTTP_GET | HTTP_POST,
     std::bind(&ESP32CSWebServer::handleProgrammer, this, std::placeholders::_1));
-  on("/power", HTTP_GET | HTTP_PUT,
+  route("/backup", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
+    std::bind(&ESP32CSWebServer::handleDecoderBackup, this, std::placeholders::_1));
+  route("/power", HTTP_GET | HTTP_PUT,
     std::bind(&ESP32CSWebServer::handlePower, this, std::placeholders::_1));
-  on("/outputs", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
+  route("/current", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleCurrentHistory, this, std::placeholders::_1));
+  route("/outputs", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleOutputs, this, std::placeholders::_1));
-  on("/turnouts", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
+  route("/turnouts", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleTurnouts, this, std::placeholders::_1));
-  on("/sensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
+  route("/sensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleSensors, this, std::placeholders::_1));
 #if S88_ENABLED
-  on("/s88sensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
+  route("/s88sensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleS88Sensors, this, std::placeholders::_1));
 #endif
-  on("/remoteSensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
+  route("/remoteSensors", HTTP_GET | HTTP_POST | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleRemoteSensors, this, std::placeholders::_1));
-  on("/config", HTTP_POST | HTTP_DELETE,
+  route("/config", HTTP_POST | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleConfig, this, std::placeholders::_1));
-  on("/locomotive", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
+  route("/locomotive", HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_DELETE,
     std::bind(&ESP32CSWebServer::handleLocomotive, this, std::placeholders::_1));
-  on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
+  route("/v2/locomotive", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleLocomotiveV2, this, std::placeholders::_1));
+  route("/v2/turnouts", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleTurnoutsV2, this, std::placeholders::_1));
+  route("/changes", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleChanges, this, std::placeholders::_1));
+  route("/metrics", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleMetrics, this, std::placeholders::_1));
+  route("/diagnostics/routes", HTTP_GET,
+    std::bind(&ESP32CSWebServer::handleRouteStatistics, this, std::placeholders::_1));
+  route("/batch", HTTP_POST,
+    std::bind(&ESP32CSWebServer::handleBatch, this, std::placeholders::_1), nullptr,
+    std::bind(&ESP32CSWebServer::handleBatchBody, this, std::placeholders::_1,
+      std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
+      std::placeholders::_5));
+  route("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
     request->send(STATUS_OK, "text/plain", _err2str(Update.getError()));
   }, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
     if (!index) {
@@ -189,32 +822,62 @@ ESP32CSWebServer::ESP32CSWebServer() : AsyncWebServer(80), webSocket("/ws") {
     }
   });
 
-  webSocket.onEvent([](AsyncWebSocket * server, AsyncWebSocketClient * client,
+  // WebSocket events are also processed on the async_tcp task.
+  RouteStatistics *webSocketRoute = createRouteStatistics("/ws");
+  webSocket.onEvent([webSocketRoute](AsyncWebSocket * server, AsyncWebSocketClient * client,
       AwsEventType type, void * arg, uint8_t *data, size_t len) {
     if (type == WS_EVT_CONNECT) {
-      webSocketClients.add(new WebSocketClient(client->id(), client->remoteIP()));
-      client->printf("<iDCC++ ESP32 Command Station: V-%s / %s %s>", VERSION, __DATE__, __TIME__);
+      // the connect event receives the upgrade request which contains the
+      // requested sub-protocol (if any).
+      auto request = static_cast<AsyncWebServerRequest *>(arg);
+      bool binary = request->hasHeader("Sec-WebSocket-Protocol") &&
+                    request->header("Sec-WebSocket-Protocol").equals(WS_BINARY_PROTOCOL);
+      {
+        std::lock_guard<std::mutex> guard(webSocketClientLock);
+        webSocketClients[client->id()] =
+          std::make_shared<WebSocketClient>(client->id(), client->remoteIP(), binary);
+      }
+      if(binary) {
+        uint8_t powerState[] = {WS_BINARY_POWER_STATE, MotorBoardManager::isTrackPowerOn()};
+        client->binary(powerState, sizeof(powerState));
+        webSocketBytesSent += sizeof(powerState);
+      } else {
+        webSocketBytesSent += client->printf("<iDCC++ ESP32 Command Station: V-%s / %s %s>", VERSION, __DATE__, __TIME__);
+      }
   #if INFO_SCREEN_WS_CLIENTS_LINE >= 0
-      InfoScreen::print(12, INFO_SCREEN_WS_CLIENTS_LINE, F("%02d"), webSocketClients.length());
+      InfoScreen::print(12, INFO_SCREEN_WS_CLIENTS_LINE, F("%02d"), getWebSocketClientTableSize());
   #endif
     } else if (type == WS_EVT_DISCONNECT) {
-      WebSocketClient *toRemove = nullptr;
-      for (const auto& clientNode : webSocketClients) {
-        if(clientNode->getID() == client->id()) {
-          toRemove = clientNode;
-        }
-      }
-      if(toRemove != nullptr) {
-        webSocketClients.remove(toRemove);
+      {
+        std::lock_guard<std::mutex> guard(webSocketClientLock);
+        webSocketClients.erase(client->id());
       }
   #if INFO_SCREEN_WS_CLIENTS_LINE >= 0
-      InfoScreen::print(12, INFO_SCREEN_WS_CLIENTS_LINE, F("%02d"), webSocketClients.length());
+      InfoScreen::print(12, INFO_SCREEN_WS_CLIENTS_LINE, F("%02d"), getWebSocketClientTableSize());
   #endif
     } else if (type == WS_EVT_DATA) {
-      for (const auto& clientNode : webSocketClients) {
-        if(clientNode->getID() == client->id()) {
-          clientNode->feed(data, len);
+      RouteHandlerTimer timer(webSocketRoute);
+      auto frame = static_cast<AwsFrameInfo *>(arg);
+      // the table lock is not held while processing the data since the
+      // commands may broadcast to all clients.
+      auto clientNode = getWebSocketClient(client->id());
+      if(!clientNode) {
+        return;
+      }
+      if(frame->opcode == WS_BINARY && clientNode->isBinary()) {
+        // binary commands must arrive in a single frame
+        if(frame->final && frame->index == 0 && frame->len == len) {
+          std::vector<uint8_t> reply;
+          clientNode->processBinary(data, len, reply);
+          if(!reply.empty()) {
+            client->binary(reply.data(), reply.size());
+            webSocketBytesSent += reply.size();
+          }
+        } else {
+          LOG(WARNING, "[WS %s] Discarding fragmented binary frame", clientNode->getName().c_str());
         }
+      } else {
+        clientNode->feed(data, len);
       }
     }
   });
@@ -222,148 +885,331 @@ ESP32CSWebServer::ESP32CSWebServer() : AsyncWebServer(80), webSocket("/ws") {
   addHandler(new SPIFFSEditor(SPIFFS));
 }
 
+void ESP32CSWebServer::route(const char *uri, WebRequestMethodComposite method,
+                             ArRequestHandlerFunction onRequest,
+                             ArUploadHandlerFunction onUpload,
+                             ArBodyHandlerFunction onBody) {
+  RouteStatistics *route = createRouteStatistics(uri);
+  ArUploadHandlerFunction uploadWrapper = nullptr;
+  ArBodyHandlerFunction bodyWrapper = nullptr;
+  if(onUpload) {
+    uploadWrapper = [route, onUpload](AsyncWebServerRequest *request, String filename,
+                                      size_t index, uint8_t *data, size_t len, bool final) {
+      RouteHandlerTimer timer(route);
+      onUpload(request, filename, index, data, len, final);
+    };
+  }
+  if(onBody) {
+    bodyWrapper = [route, onBody](AsyncWebServerRequest *request, uint8_t *data,
+                                  size_t len, size_t index, size_t total) {
+      RouteHandlerTimer timer(route);
+      onBody(request, data, len, index, total);
+    };
+  }
+  on(uri, method, [route, onRequest](AsyncWebServerRequest *request) {
+    RouteHandlerTimer timer(route);
+    onRequest(request);
+  }, uploadWrapper, bodyWrapper);
+}
+
+void ESP32CSWebServer::broadcastToWS(const String &buf) {
+  for (const auto& clientNode : getWebSocketClients()) {
+    if(!clientNode->isBinary()) {
+      webSocketBytesSent += clientNode->queueText(webSocket, buf);
+    }
+  }
+}
+
+void ESP32CSWebServer::flushWebSocketText() {
+  if(millis() - _lastTextFlush < WS_TEXT_FLUSH_INTERVAL_MS) {
+    return;
+  }
+  _lastTextFlush = millis();
+  for (const auto& clientNode : getWebSocketClients()) {
+    if(!clientNode->isBinary()) {
+      webSocketBytesSent += clientNode->flushText(webSocket);
+    }
+  }
+}
+
+void ESP32CSWebServer::notifyPowerState() {
+  // the power state will be sent with the next state update
+  _powerStateChanged = true;
+}
+
+void ESP32CSWebServer::sendStateUpdates() {
+  if(millis() - _lastStateUpdate < WS_STATE_UPDATE_INTERVAL_MS) {
+    return;
+  }
+  _lastStateUpdate = millis();
+  auto clients = getWebSocketClients();
+  bool haveBinaryClients = false;
+  for (const auto& clientNode : clients) {
+    if(clientNode->isBinary()) {
+      haveBinaryClients = true;
+    }
+  }
+  bool powerChanged = _powerStateChanged.exchange(false);
+  if(!haveBinaryClients) {
+    _stateSequence = ChangeLog::getSequence();
+    return;
+  }
+  std::vector<ChangeLogEntry> changes;
+  bool complete = ChangeLog::getChanges(_stateSequence, changes, _stateSequence);
+  if(changes.empty() && complete && !powerChanged) {
+    return;
+  }
+
+  // build the events once, they are then filtered for each client.
+  std::vector<std::pair<ChangeLogEntry, std::vector<uint8_t>>> events;
+  for(const auto &change : changes) {
+    std::vector<uint8_t> event;
+    if(change.type == ChangeType::TURNOUT) {
+      auto turnout = TurnoutManager::getTurnoutByID(change.id);
+      if(turnout) {
+        event = {WS_BINARY_TURNOUT_STATE, highByte(change.id), lowByte(change.id),
+                 turnout->isThrown()};
+      }
+    } else if(change.type == ChangeType::SENSOR || change.type == ChangeType::REMOTE_SENSOR) {
+      // SensorManager::getSensor skips the remote sensors since they do not
+      // have a pin.
+      Sensor *sensor = change.type == ChangeType::SENSOR ?
+        SensorManager::getSensor(change.id) : RemoteSensorManager::getSensor(change.id);
+      if(sensor) {
+        event = {WS_BINARY_SENSOR_STATE, highByte(change.id), lowByte(change.id),
+                 sensor->isActive()};
+      }
+    } else if(change.type == ChangeType::LOCOMOTIVE) {
+      auto loco = LocomotiveManager::getActiveLocomotive(change.id);
+      if(loco) {
+        buildBinaryLocoState(loco, event);
+      }
+    } else if(change.type == ChangeType::CONSIST) {
+      auto consist = LocomotiveManager::getConsistByID(change.id);
+      if(consist) {
+        buildBinaryLocoState(consist, event);
+      }
+    }
+    if(!event.empty()) {
+      events.push_back(std::make_pair(change, event));
+    }
+  }
+
+  for (const auto& clientNode : clients) {
+    if(!clientNode->isBinary()) {
+      continue;
+    }
+    std::vector<uint8_t> frame;
+    if(!complete) {
+      frame.push_back(WS_BINARY_RESYNC);
+    }
+    if(powerChanged && clientNode->isPowerSubscriber()) {
+      frame.push_back(WS_BINARY_POWER_STATE);
+      frame.push_back(MotorBoardManager::isTrackPowerOn());
+    }
+    for(const auto &event : events) {
+      const auto &change = event.first;
+      bool subscribed = false;
+      if(change.type == ChangeType::TURNOUT) {
+        subscribed = clientNode->isTurnoutSubscriber(change.id);
+      } else if(change.type == ChangeType::SENSOR || change.type == ChangeType::REMOTE_SENSOR) {
+        subscribed = clientNode->isSensorSubscriber(change.id);
+      } else {
+        subscribed = clientNode->isLocoSubscriber(change.id);
+      }
+      if(subscribed) {
+        frame.insert(frame.end(), event.second.begin(), event.second.end());
+      }
+    }
+    if(!frame.empty()) {
+      webSocket.binary(clientNode->getID(), frame.data(), frame.size());
+      webSocketBytesSent += frame.size();
+    }
+  }
+}
+
+uint32_t ESP32CSWebServer::getWebSocketBytesSent() {
+  return webSocketBytesSent;
+}
+
+void ESP32CSWebServer::handleWebAsset(AsyncWebServerRequest *request, const WebAsset *asset) {
+  AsyncWebServerResponse *response;
+  if(request->header("If-None-Match").equals(asset->etag)) {
+    response = request->beginResponse(STATUS_NOT_MODIFIED);
+    recordResponseSize(0);
+  } else {
+    response = request->beginResponse_P(STATUS_OK, asset->contentType, asset->data, asset->size);
+    response->addHeader("Content-Encoding", "gzip");
+    recordResponseSize(asset->size);
+  }
+  response->addHeader("ETag", asset->etag);
+  response->addHeader("Cache-Control", asset->immutable ? WEB_ASSET_CACHE_IMMUTABLE : WEB_ASSET_CACHE_REVALIDATE);
+  request->send(response);
+}
+
 void ESP32CSWebServer::handleProgrammer(AsyncWebServerRequest *request) {
   auto jsonResponse = new AsyncJsonResponse();
-  if(!MotorBoardManager::getBoardByName(MOTORBOARD_NAME_PROG)->isOn()) {
-    MotorBoardManager::powerOn(MOTORBOARD_NAME_PROG);
-  }
   // new programmer request
   if (request->method() == HTTP_GET) {
-    if (request->arg(JSON_PROG_ON_MAIN).equalsIgnoreCase(JSON_VALUE_TRUE)) {
-      jsonResponse->setCode(STATUS_NOT_ALLOWED);
+    if(request->hasArg(JSON_JOB_NODE)) {
+      // status of a previously submitted programming track request
+      uint32_t jobID = request->arg(JSON_JOB_NODE).toInt();
+      std::lock_guard<std::mutex> guard(webProgrammerJobLock);
+      auto job = webProgrammerJobs.find(jobID);
+      if(job == webProgrammerJobs.end()) {
+        jsonResponse->setCode(STATUS_NOT_FOUND);
+      } else if(!job->second.complete) {
+        jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+        jsonResponse->setCode(STATUS_ACCEPTED);
+      } else {
+        auto response = request->beginResponse(job->second.code, "application/json", job->second.body);
+        webProgrammerJobs.erase(job);
+        delete jsonResponse;
+        request->send(response);
+        return;
+      }
+    } else if (request->arg(JSON_PROG_ON_MAIN).equalsIgnoreCase(JSON_VALUE_TRUE)) {
+      // CV read on the main track via RailCom
+      uint16_t cvNumber = request->arg(JSON_CV_NODE).toInt();
+      uint32_t jobID = createWebProgrammerJob();
+      OpsProgrammingManager::readCV(request->arg(JSON_ADDRESS_NODE).toInt(), cvNumber,
+        [jobID, cvNumber](int16_t cvValue) {
+        DynamicJsonBuffer buffer;
+        JsonObject &node = buffer.createObject();
+        node[JSON_CV_NODE] = cvNumber;
+        node[JSON_VALUE_NODE] = cvValue;
+        completeWebProgrammerJob(jobID, cvValue < 0 ? STATUS_SERVER_ERROR : STATUS_OK, node);
+      });
+      jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+      jsonResponse->setCode(STATUS_ACCEPTED);
     } else if(request->hasArg(JSON_IDENTIFY_NODE)) {
-      JsonObject &node = jsonResponse->getRoot();
-      if(enterProgrammingMode()) {
-        int16_t decoderConfig = readCV(CV_NAMES::DECODER_CONFIG);
-        uint16_t decoderAddress = 0;
-        if(decoderConfig > 0) {
-          if(bitRead(decoderConfig, DECODER_CONFIG_BITS::DECODER_TYPE)) {
-            uint8_t decoderManufacturer = readCV(CV_NAMES::DECODER_MANUFACTURER);
-            int16_t addrMSB = readCV(CV_NAMES::ACCESSORY_DECODER_MSB_ADDRESS);
-            int16_t addrLSB = readCV(CV_NAMES::SHORT_ADDRESS);
-            if(addrMSB >= 0 && addrLSB >= 0) {
-              if(decoderManufacturer == 0xA5) { // MERG uses 7 bit LSB
-                decoderAddress = (uint16_t)(((addrMSB & 0x07) << 7) | (addrLSB & 0x7F));
-              } else if(decoderManufacturer == 0x19) { // Team Digital uses 8 bit LSB and 4 bit MSB
-                decoderAddress = (uint16_t)(((addrMSB & 0x0F) << 8) | addrLSB);
-              } else { // NMRA spec shows 6 bit LSB
-                decoderAddress = (uint16_t)(((addrMSB & 0x07) << 6) | (addrLSB & 0x1F));
-              }
-              node[JSON_ADDRESS_MODE_NODE] = JSON_VALUE_LONG_ADDRESS;
-            } else {
-              LOG(WARNING, "Failed to read address MSB/LSB");
-              jsonResponse->setCode(STATUS_SERVER_ERROR);
-            }
-          } else {
-            if(bitRead(decoderConfig, DECODER_CONFIG_BITS::SHORT_OR_LONG_ADDRESS)) {
-              int16_t addrMSB = readCV(CV_NAMES::LONG_ADDRESS_MSB_ADDRESS);
-              int16_t addrLSB = readCV(CV_NAMES::LONG_ADDRESS_LSB_ADDRESS);
-              if(addrMSB >= 0 && addrLSB >= 0) {
-                decoderAddress = (uint16_t)(((addrMSB & 0xFF) << 8) | (addrLSB & 0xFF));
-                node[JSON_ADDRESS_MODE_NODE] = JSON_VALUE_LONG_ADDRESS;
-              } else {
-                LOG(WARNING, "Unable to read address MSB/LSB");
-                jsonResponse->setCode(STATUS_SERVER_ERROR);
-              }
-            } else {
-              int16_t shortAddr = readCV(CV_NAMES::SHORT_ADDRESS);
-              if(shortAddr > 0) {
-                decoderAddress = shortAddr;
-                node[JSON_ADDRESS_MODE_NODE] = JSON_VALUE_SHORT_ADDRESS;
-              } else {
-                LOG(WARNING, "Unable to read short address CV");
-                jsonResponse->setCode(STATUS_SERVER_ERROR);
-              }
-            }
-            if(bitRead(decoderConfig, DECODER_CONFIG_BITS::SPEED_TABLE)) {
-              node[JSON_SPEED_TABLE_NODE] = JSON_VALUE_ON;
-            } else {
-              node[JSON_SPEED_TABLE_NODE] = JSON_VALUE_OFF;
-            }
+      uint32_t jobID = createWebProgrammerJob();
+      bool createRoster = request->hasArg(JSON_CREATE_NODE) && request->arg(JSON_CREATE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE);
+      ProgrammingTrackManager::identify(getWebProgClient(request), [jobID, createRoster](const DecoderIdentity &identity) {
+        DynamicJsonBuffer buffer;
+        JsonObject &node = buffer.createObject();
+        int code = STATUS_OK;
+        if(identity.decoderConfig < 0) {
+          LOG(WARNING, "Failed to read decoder configuration");
+          code = STATUS_SERVER_ERROR;
+        } else if(!identity.address) {
+          LOG(WARNING, "Failed to read decoder address");
+          code = STATUS_SERVER_ERROR;
+        } else {
+          node[JSON_ADDRESS_NODE] = identity.address;
+          node[JSON_ADDRESS_MODE_NODE] = identity.longAddress ? JSON_VALUE_LONG_ADDRESS : JSON_VALUE_SHORT_ADDRESS;
+          if(!identity.stationary) {
+            node[JSON_SPEED_TABLE_NODE] = identity.speedTable ? JSON_VALUE_ON : JSON_VALUE_OFF;
           }
-          if(decoderAddress > 0) {
-            node[JSON_ADDRESS_NODE] = decoderAddress;
-            auto roster = LocomotiveManager::getRosterEntry(decoderAddress, false);
-            if(roster) {
-              node[JSON_LOCO_NODE] = roster;
-            } else if(request->hasArg(JSON_CREATE_NODE) && request->arg(JSON_CREATE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE)) {
-              roster = LocomotiveManager::getRosterEntry(decoderAddress);
-              if(decoderConfig > 0) {
-                if(bitRead(decoderConfig, DECODER_CONFIG_BITS::DECODER_TYPE)) {
-                  roster->setType(JSON_VALUE_STATIONARY_DECODER);
-                } else {
-                  roster->setType(JSON_VALUE_MOBILE_DECODER);
-                }
-              }
-              node[JSON_LOCO_NODE] = roster;
-            }
-          } else {
-            LOG(WARNING, "Failed to read decoder address");
-            jsonResponse->setCode(STATUS_SERVER_ERROR);
+          auto roster = LocomotiveManager::getRosterEntry(identity.address, false);
+          if(!roster && createRoster) {
+            roster = LocomotiveManager::getRosterEntry(identity.address);
+            roster->setType(identity.stationary ? JSON_VALUE_STATIONARY_DECODER : JSON_VALUE_MOBILE_DECODER);
+          }
+          if(roster) {
+            roster->toJson(node.createNestedObject(JSON_LOCO_NODE));
           }
-        } else {
-          LOG(WARNING, "Failed to read decoder configuration");
-          jsonResponse->setCode(STATUS_SERVER_ERROR);
         }
-        leaveProgrammingMode();
-      } else {
-        LOG(WARNING, "Programmer already in use");
-        jsonResponse->setCode(STATUS_SERVER_ERROR);
-      }
+        completeWebProgrammerJob(jobID, code, node);
+      });
+      jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+      jsonResponse->setCode(STATUS_ACCEPTED);
     } else {
       uint16_t cvNumber = request->arg(JSON_CV_NODE).toInt();
-      if(enterProgrammingMode()) {
-        int16_t cvValue = readCV(cvNumber);
-        JsonObject &node = jsonResponse->getRoot();
+      uint32_t jobID = createWebProgrammerJob();
+      ProgrammingTrackManager::readCV(getWebProgClient(request), cvNumber, [jobID, cvNumber](int16_t cvValue) {
+        DynamicJsonBuffer buffer;
+        JsonObject &node = buffer.createObject();
         node[JSON_CV_NODE] = cvNumber;
         node[JSON_VALUE_NODE] = cvValue;
-        if(cvValue < 0) {
-          jsonResponse->setCode(STATUS_SERVER_ERROR);
-        } else {
-          jsonResponse->setCode(STATUS_OK);
-        }
-        leaveProgrammingMode();
-      } else {
-        LOG(WARNING, "Programmer already in use");
-        jsonResponse->setCode(STATUS_SERVER_ERROR);
-      }
+        completeWebProgrammerJob(jobID, cvValue < 0 ? STATUS_SERVER_ERROR : STATUS_OK, node);
+      });
+      jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+      jsonResponse->setCode(STATUS_ACCEPTED);
     }
   } else if(request->method() == HTTP_POST && request->hasArg(JSON_PROG_ON_MAIN)) {
     if (request->arg(JSON_PROG_ON_MAIN).equalsIgnoreCase(JSON_VALUE_TRUE)) {
-      if(request->hasArg(JSON_CV_BIT_NODE)) {
+      if(request->arg(JSON_VERIFY_NODE).equalsIgnoreCase(JSON_VALUE_TRUE) && !request->hasArg(JSON_CV_BIT_NODE)) {
+        // CV write on the main track verified via RailCom
+        uint16_t cvNumber = request->arg(JSON_CV_NODE).toInt();
+        uint32_t jobID = createWebProgrammerJob();
+        OpsProgrammingManager::writeCVByte(request->arg(JSON_ADDRESS_NODE).toInt(), cvNumber,
+          request->arg(JSON_VALUE_NODE).toInt(), [jobID, cvNumber](int16_t value) {
+          DynamicJsonBuffer buffer;
+          JsonObject &node = buffer.createObject();
+          node[JSON_CV_NODE] = cvNumber;
+          node[JSON_VALUE_NODE] = value;
+          completeWebProgrammerJob(jobID, value < 0 ? STATUS_SERVER_ERROR : STATUS_OK, node);
+        });
+        jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+        jsonResponse->setCode(STATUS_ACCEPTED);
+      } else if(request->hasArg(JSON_CV_BIT_NODE)) {
         writeOpsCVBit(request->arg(JSON_ADDRESS_NODE).toInt(), request->arg(JSON_CV_NODE).toInt(),
           request->arg(JSON_CV_BIT_NODE).toInt(), request->arg(JSON_VALUE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE));
+        jsonResponse->setCode(STATUS_OK);
       } else {
         writeOpsCVByte(request->arg(JSON_ADDRESS_NODE).toInt(), request->arg(JSON_CV_NODE).toInt(),
           request->arg(JSON_VALUE_NODE).toInt());
+        jsonResponse->setCode(STATUS_OK);
       }
-      jsonResponse->setCode(STATUS_OK);
     } else {
-      bool writeSuccess = false;
-      if(enterProgrammingMode()) {
-        if(request->hasArg(JSON_CV_BIT_NODE)) {
-          writeSuccess = writeProgCVBit(request->arg(JSON_CV_NODE).toInt(), request->arg(JSON_CV_BIT_NODE).toInt(),
-            request->arg(JSON_VALUE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE));
-        } else {
-          writeSuccess = writeProgCVByte(request->arg(JSON_CV_NODE).toInt(), request->arg(JSON_VALUE_NODE).toInt());
-        }
-        leaveProgrammingMode();
-      }
-      if(writeSuccess) {
-        jsonResponse->setCode(STATUS_OK);
+      uint16_t cvNumber = request->arg(JSON_CV_NODE).toInt();
+      uint32_t jobID = createWebProgrammerJob();
+      auto callback = [jobID, cvNumber](int16_t value) {
+        DynamicJsonBuffer buffer;
+        JsonObject &node = buffer.createObject();
+        node[JSON_CV_NODE] = cvNumber;
+        node[JSON_VALUE_NODE] = value;
+        completeWebProgrammerJob(jobID, value < 0 ? STATUS_SERVER_ERROR : STATUS_OK, node);
+      };
+      if(request->hasArg(JSON_CV_BIT_NODE)) {
+        ProgrammingTrackManager::writeCVBit(getWebProgClient(request), cvNumber, request->arg(JSON_CV_BIT_NODE).toInt(),
+          request->arg(JSON_VALUE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE), callback);
       } else {
-        jsonResponse->setCode(STATUS_SERVER_ERROR);
+        ProgrammingTrackManager::writeCVByte(getWebProgClient(request), cvNumber, request->arg(JSON_VALUE_NODE).toInt(), callback);
       }
+      jsonResponse->getRoot()[JSON_JOB_NODE] = jobID;
+      jsonResponse->setCode(STATUS_ACCEPTED);
     }
   } else {
     jsonResponse->setCode(STATUS_BAD_REQUEST);
   }
-  LOG(VERBOSE, "Setting response size");
-  jsonResponse->setLength();
-  LOG(VERBOSE, "Sending response, %d bytes", jsonResponse->getSize());
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
-  LOG(VERBOSE, "sent");
- }
+}
+
+// GET /backup?name={NAME}[&restore=true] returns the state of a backup (or
+// restore) and the CV values once it is no longer running.
+// POST /backup?name={NAME}&cvs={CV LIST} starts a new backup.
+// POST /backup?name={NAME}&restore=true starts restoring a completed backup.
+// PUT /backup?name={NAME}[&restore=true] resumes an incomplete backup (or
+// restore).
+// DELETE /backup?name={NAME} removes a backup.
+void ESP32CSWebServer::handleDecoderBackup(AsyncWebServerRequest *request) {
+  auto jsonResponse = new AsyncJsonResponse();
+  String name = request->arg(JSON_NAME_NODE);
+  bool restore = request->arg(JSON_RESTORE_NODE).equalsIgnoreCase(JSON_VALUE_TRUE);
+  if(!DecoderBackupManager::isValidName(name)) {
+    jsonResponse->setCode(STATUS_BAD_REQUEST);
+  } else if(request->method() == HTTP_GET) {
+    if(!DecoderBackupManager::getState(name, restore, jsonResponse->getRoot())) {
+      jsonResponse->setCode(STATUS_NOT_FOUND);
+    }
+  } else if(DecoderBackupManager::isActive(name)) {
+    jsonResponse->setCode(STATUS_CONFLICT);
+  } else if(request->method() == HTTP_POST) {
+    bool started = restore ? DecoderBackupManager::startRestore(name) :
+                             DecoderBackupManager::startBackup(name, request->arg(JSON_CVS_NODE));
+    jsonResponse->setCode(started ? STATUS_ACCEPTED : STATUS_BAD_REQUEST);
+  } else if(request->method() == HTTP_PUT) {
+    jsonResponse->setCode(DecoderBackupManager::resume(name, restore) ? STATUS_ACCEPTED : STATUS_PRECONDITION_FAILED);
+  } else if(request->method() == HTTP_DELETE) {
+    DecoderBackupManager::remove(name);
+    jsonResponse->setCode(STATUS_OK);
+  }
+  recordResponseSize(jsonResponse->setLength());
+  request->send(jsonResponse);
+}
 
 void ESP32CSWebServer::handlePower(AsyncWebServerRequest *request) {
   auto jsonResponse = new AsyncJsonResponse(true);
@@ -391,16 +1237,119 @@ void ESP32CSWebServer::handlePower(AsyncWebServerRequest *request) {
       jsonResponse->setCode(STATUS_BAD_REQUEST);
     }
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
  }
 
+// GET /current?name={BOARD}[&interval={100|1000}][&since={SEQ}][&count={COUNT}]
+// returns the current history of a motor board, without since the most
+// recent buckets are returned. Values are in mA and lastUpdate is the uptime
+// (in ms) when the bucket preceding next was recorded. Boards which do not
+// record a history (PROG) are reported as not found.
+void ESP32CSWebServer::handleCurrentHistory(AsyncWebServerRequest *request) {
+  auto board = MotorBoardManager::getBoardByName(request->arg(JSON_NAME_NODE));
+  if(!board || !board->getCurrentHistory()) {
+    request->send(STATUS_NOT_FOUND);
+    return;
+  }
+  const bool coarse = request->hasArg(JSON_INTERVAL_NODE) &&
+    request->arg(JSON_INTERVAL_NODE).toInt() == CurrentHistory::getIntervalMillis(true);
+  const uint32_t interval = CurrentHistory::getIntervalMillis(coarse);
+  uint16_t count = MAX_CURRENT_HISTORY_RESPONSE_BUCKETS;
+  if(request->hasArg(JSON_COUNT_NODE)) {
+    count = constrain(request->arg(JSON_COUNT_NODE).toInt(), 1, MAX_CURRENT_HISTORY_RESPONSE_BUCKETS);
+  }
+  auto history = board->getCurrentHistory();
+  const uint32_t latest = history->getNextSequence(coarse);
+  const uint32_t lastUpdate = history->getLastUpdate(coarse);
+  uint32_t since = latest > count ? latest - count : 0;
+  if(request->hasArg(JSON_SINCE_NODE)) {
+    since = request->arg(JSON_SINCE_NODE).toInt();
+  }
+  std::vector<CurrentHistoryBucket> buckets;
+  const uint32_t first = history->getBuckets(coarse, since, count, buckets);
+  const uint32_t next = first + buckets.size();
+  const uint32_t maxMilliAmps = board->getMaxMilliAmps();
+
+  // the response is generated directly rather than via a JsonObject since
+  // it can contain several hundred entries.
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->printf("{\"%s\":\"%s\",\"%s\":%u,\"%s\":%u,\"%s\":%u,\"%s\":%u,\"%s\":[",
+    JSON_NAME_NODE, board->getName().c_str(), JSON_INTERVAL_NODE, interval,
+    JSON_FIRST_NODE, first, JSON_NEXT_NODE, next, JSON_LAST_UPDATE_NODE,
+    lastUpdate - ((latest - std::min(latest, next)) * interval), JSON_SAMPLES_NODE);
+  for(size_t index = 0; index < buckets.size(); index++) {
+    response->printf("%s[%u,%u,%u]", index ? "," : "",
+      (buckets[index].min * maxMilliAmps) / 4096,
+      (buckets[index].max * maxMilliAmps) / 4096,
+      (buckets[index].avg * maxMilliAmps) / 4096);
+  }
+  response->print("]}");
+  request->send(response);
+}
+
+void ESP32CSWebServer::sendCurrentHistory() {
+  if(millis() - _lastCurrentHistoryCheck < CurrentHistory::getIntervalMillis(false)) {
+    return;
+  }
+  _lastCurrentHistoryCheck = millis();
+  auto clients = getWebSocketClients();
+  bool haveSubscribers = false;
+  for (const auto& clientNode : clients) {
+    if(clientNode->isBinary() && clientNode->isCurrentSubscriber()) {
+      haveSubscribers = true;
+    }
+  }
+  auto boardNames = MotorBoardManager::getBoardNames();
+  _currentHistorySequence.resize(boardNames.size(), 0);
+  for(uint8_t index = 0; index < boardNames.size(); index++) {
+    auto board = MotorBoardManager::getBoardByName(boardNames[index]);
+    auto history = board->getCurrentHistory();
+    if(!history) {
+      continue;
+    }
+    uint32_t &sequence = _currentHistorySequence[index];
+    if(!haveSubscribers) {
+      sequence = history->getNextSequence(false);
+      continue;
+    }
+    std::vector<CurrentHistoryBucket> buckets;
+    uint32_t first = history->getBuckets(false, sequence, MAX_CURRENT_HISTORY_WS_BUCKETS, buckets);
+    sequence = first + buckets.size();
+    if(buckets.empty()) {
+      continue;
+    }
+    std::vector<uint8_t> frame;
+    frame.push_back(WS_BINARY_CURRENT);
+    frame.push_back(index);
+    frame.push_back((first >> 24) & 0xFF);
+    frame.push_back((first >> 16) & 0xFF);
+    frame.push_back((first >> 8) & 0xFF);
+    frame.push_back(first & 0xFF);
+    frame.push_back(buckets.size());
+    for(const auto &bucket : buckets) {
+      for(uint16_t value : {bucket.min, bucket.max, bucket.avg}) {
+        uint16_t milliAmps = (value * board->getMaxMilliAmps()) / 4096;
+        frame.push_back(highByte(milliAmps));
+        frame.push_back(lowByte(milliAmps));
+      }
+    }
+    for (const auto& clientNode : clients) {
+      if(clientNode->isBinary() && clientNode->isCurrentSubscriber()) {
+        webSocket.binary(clientNode->getID(), frame.data(), frame.size());
+        webSocketBytesSent += frame.size();
+      }
+    }
+  }
+}
+
 void ESP32CSWebServer::handleOutputs(AsyncWebServerRequest *request) {
-  auto jsonResponse = new AsyncJsonResponse(request->method() == HTTP_GET && !request->params());
   if (request->method() == HTTP_GET && !request->hasArg(JSON_ID_NODE)) {
-    JsonArray &array = jsonResponse->getRoot();
-    OutputManager::getState(array);
-  } else if (request->method() == HTTP_GET) {
+    sendJsonArray(request, OutputManager::streamState);
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse();
+  if (request->method() == HTTP_GET) {
     auto output = OutputManager::getOutput(request->arg(JSON_ID_NODE).toInt());
     if(output) {
       output->toJson(jsonResponse->getRoot(), true);
@@ -433,7 +1382,7 @@ void ESP32CSWebServer::handleOutputs(AsyncWebServerRequest *request) {
   } else if(request->method() == HTTP_PUT) {
    OutputManager::toggle(request->arg(JSON_ID_NODE).toInt());
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 
@@ -455,19 +1404,20 @@ void ESP32CSWebServer::handleTurnouts(AsyncWebServerRequest *request) {
   //
 
   // if the request is GET and we do not have an ID or ADDRESS parameter we need to return an array, otherwise a single entity.
-  bool needArrayResponse = (
-    request->method() == HTTP_GET &&
-    !request->hasArg(JSON_ID_NODE) &&
-    !request->hasArg(JSON_ADDRESS_NODE));
-  auto jsonResponse = new AsyncJsonResponse(needArrayResponse);
-  if (request->method() == HTTP_GET && !request->hasArg(JSON_ID_NODE)) {
+  if (request->method() == HTTP_GET &&
+      !request->hasArg(JSON_ID_NODE) &&
+      !request->hasArg(JSON_ADDRESS_NODE)) {
     bool readableStrings = true;
     if(request->hasArg(JSON_TURNOUTS_READABLE_STRINGS_NODE)) {
       readableStrings = request->arg(JSON_TURNOUTS_READABLE_STRINGS_NODE).toInt();
     }
-    JsonArray &array = jsonResponse->getRoot();
-    TurnoutManager::getState(array, readableStrings);
-  } else if (request->method() == HTTP_GET) {
+    sendJsonArray(request, [readableStrings](json_stream_visitor_t visitor) {
+      TurnoutManager::streamState(visitor, readableStrings);
+    });
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse();
+  if (request->method() == HTTP_GET) {
     if(request->hasArg(JSON_ID_NODE)) {
       auto turnout = TurnoutManager::getTurnoutByID(request->arg(JSON_ID_NODE).toInt());
       if(turnout) {
@@ -517,16 +1467,17 @@ void ESP32CSWebServer::handleTurnouts(AsyncWebServerRequest *request) {
       jsonResponse->setCode(STATUS_BAD_REQUEST);
     }
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 
 void ESP32CSWebServer::handleSensors(AsyncWebServerRequest *request) {
-  auto jsonResponse = new AsyncJsonResponse(request->method() == HTTP_GET && !request->params());
   if (request->method() == HTTP_GET && !request->hasArg(JSON_ID_NODE)) {
-    JsonArray &array = jsonResponse->getRoot();
-    SensorManager::getState(array);
-  } else if (request->method() == HTTP_GET) {
+    sendJsonArray(request, SensorManager::streamState);
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse();
+  if (request->method() == HTTP_GET) {
     auto sensor = SensorManager::getSensor(request->arg(JSON_ID_NODE).toInt());
     if(sensor) {
       sensor->toJson(jsonResponse->getRoot());
@@ -549,7 +1500,7 @@ void ESP32CSWebServer::handleSensors(AsyncWebServerRequest *request) {
       jsonResponse->setCode(STATUS_NOT_FOUND);
     }
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 
@@ -579,23 +1530,24 @@ void ESP32CSWebServer::handleS88Sensors(AsyncWebServerRequest *request) {
   } else if(request->method() == HTTP_DELETE) {
     S88BusManager::removeBus(request->arg(JSON_ID_NODE).toInt());
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 #endif
 
 void ESP32CSWebServer::handleRemoteSensors(AsyncWebServerRequest *request) {
-  auto jsonResponse = new AsyncJsonResponse(true);
   if(request->method() == HTTP_GET) {
-    JsonArray &array = jsonResponse->getRoot();
-    RemoteSensorManager::getState(array);
-  } else if(request->method() == HTTP_POST) {
+    sendJsonArray(request, RemoteSensorManager::streamState);
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse(true);
+  if(request->method() == HTTP_POST) {
     RemoteSensorManager::createOrUpdate(request->arg(JSON_ID_NODE).toInt(),
       request->arg(JSON_VALUE_NODE).toInt());
   } else if(request->method() == HTTP_DELETE) {
     RemoteSensorManager::remove(request->arg(JSON_ID_NODE).toInt());
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 
@@ -613,16 +1565,24 @@ void ESP32CSWebServer::handleLocomotive(AsyncWebServerRequest *request) {
   // PUT /locomotive?address=<address>&speed=<speed>&dir=[FWD|REV]&fX=[true|false] - Update locomotive state, fX is short for function X where X is 0-28.
   // DELETE /locomotive?address=<address> - removes locomotive from active management
   const String url = request->url();
-  auto jsonResponse = new AsyncJsonResponse(request->method() == HTTP_GET && !request->params());
-  jsonResponse->setCode(STATUS_OK);
   // check if we have an eStop command, we don't care how this gets sent to the
   // command station (method) so check it first
+  if(!url.endsWith("/estop") && request->method() == HTTP_GET &&
+     !request->hasArg(JSON_ADDRESS_NODE)) {
+    if(url.indexOf("/roster") > 0) {
+      sendJsonArray(request, LocomotiveManager::streamRosterEntries);
+    } else {
+      // get all active locomotives
+      sendJsonArray(request, LocomotiveManager::streamActiveLocos);
+    }
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse();
+  jsonResponse->setCode(STATUS_OK);
   if(url.endsWith("/estop")) {
     LocomotiveManager::emergencyStop();
   } else if(url.indexOf("/roster") > 0) {
-    if(request->method() == HTTP_GET && !request->hasArg(JSON_ADDRESS_NODE)) {
-      LocomotiveManager::getRosterEntries(jsonResponse->getRoot());
-    } else if (request->hasArg(JSON_ADDRESS_NODE)) {
+    if (request->hasArg(JSON_ADDRESS_NODE)) {
       if(request->method() == HTTP_DELETE) {
         LocomotiveManager::removeRosterEntry(request->arg(JSON_ADDRESS_NODE).toInt());
       } else {
@@ -648,10 +1608,7 @@ void ESP32CSWebServer::handleLocomotive(AsyncWebServerRequest *request) {
     // Since it is not an eStop or roster command we need to check the request
     // method and ensure it contains the required arguments otherwise the
     // request should be rejected
-    if(request->method() == HTTP_GET && !request->hasArg(JSON_ADDRESS_NODE)) {
-      // get all active locomotives
-      LocomotiveManager::getActiveLocos(jsonResponse->getRoot()); 
-    } else if (request->hasArg(JSON_ADDRESS_NODE)) {
+    if (request->hasArg(JSON_ADDRESS_NODE)) {
       auto loco = LocomotiveManager::getLocomotive(request->arg(JSON_ADDRESS_NODE).toInt());
       if(request->method() == HTTP_PUT || request->method() == HTTP_POST) {
         // Creation / Update of active locomotive
@@ -691,7 +1648,486 @@ void ESP32CSWebServer::handleLocomotive(AsyncWebServerRequest *request) {
       jsonResponse->setCode(STATUS_BAD_REQUEST);
     }
   }
-  jsonResponse->setLength();
+  recordResponseSize(jsonResponse->setLength());
+  request->send(jsonResponse);
+}
+
+
+// populates the current state of the entity referenced by the change, returns
+// false if the entity no longer exists.
+static bool getChangedEntityState(const ChangeLogEntry &change, JsonObject &state) {
+  switch(change.type) {
+    case ChangeType::TURNOUT:
+    {
+      auto turnout = TurnoutManager::getTurnoutByID(change.id);
+      if(turnout) {
+        turnout->toJson(state, true);
+        return true;
+      }
+      break;
+    }
+    case ChangeType::OUTPUT:
+    {
+      auto output = OutputManager::getOutput(change.id);
+      if(output) {
+        output->toJson(state, true);
+        return true;
+      }
+      break;
+    }
+    case ChangeType::SENSOR:
+    {
+      auto sensor = SensorManager::getSensor(change.id);
+      if(sensor) {
+        sensor->toJson(state, true);
+        return true;
+      }
+      break;
+    }
+    case ChangeType::REMOTE_SENSOR:
+    {
+      // SensorManager::getSensor skips the remote sensors since they do not
+      // have a pin.
+      auto sensor = RemoteSensorManager::getSensor(change.id);
+      if(sensor) {
+        sensor->toJson(state);
+        return true;
+      }
+      break;
+    }
+    case ChangeType::LOCOMOTIVE:
+      return LocomotiveManager::getActiveLocoByAddress(change.id, state);
+    case ChangeType::CONSIST:
+    {
+      auto consist = LocomotiveManager::getConsistByID(change.id);
+      if(consist) {
+        consist->toJson(state);
+        return true;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return false;
+}
+
+void ESP32CSWebServer::handleMetrics(AsyncWebServerRequest *request) {
+  auto response = request->beginResponseStream("text/plain; version=0.0.4");
+  Metrics::write(*response);
+  request->send(response);
+}
+
+void ESP32CSWebServer::handleRouteStatistics(AsyncWebServerRequest *request) {
+  auto jsonResponse = new AsyncJsonResponse();
+  JsonObject &root = jsonResponse->getRoot();
+  root[JSON_THRESHOLD_NODE] = ROUTE_HANDLER_BLOCKED_THRESHOLD_USEC;
+  JsonArray &handlerTimeBuckets = root.createNestedArray(JSON_HANDLER_TIME_BUCKETS_NODE);
+  for(auto bound : ROUTE_HANDLER_TIME_BUCKETS) {
+    handlerTimeBuckets.add(bound);
+  }
+  JsonArray &responseSizeBuckets = root.createNestedArray(JSON_RESPONSE_SIZE_BUCKETS_NODE);
+  for(auto bound : ROUTE_RESPONSE_SIZE_BUCKETS) {
+    responseSizeBuckets.add(bound);
+  }
+  JsonArray &routes = root.createNestedArray(JSON_ROUTES_NODE);
+  for(auto route : getRouteStatistics()) {
+    JsonObject &node = routes.createNestedObject();
+    node[JSON_ROUTE_NODE] = route->name;
+    node[JSON_COUNT_NODE] = route->count;
+    node[JSON_BLOCKED_NODE] = route->blocked;
+    node[JSON_MAX_HANDLER_TIME_NODE] = route->maxHandlerTime;
+    JsonArray &handlerTime = node.createNestedArray(JSON_HANDLER_TIME_NODE);
+    for(auto count : route->handlerTime) {
+      handlerTime.add(count);
+    }
+    JsonArray &responseSize = node.createNestedArray(JSON_RESPONSE_SIZE_NODE);
+    for(auto count : route->responseSize) {
+      responseSize.add(count);
+    }
+    for(auto arrays : {std::make_pair(JSON_BUFFERED_NODE, &route->bufferedArrays),
+                       std::make_pair(JSON_STREAMED_NODE, &route->streamedArrays)}) {
+      if(arrays.second->count) {
+        JsonObject &stats = node.createNestedObject(arrays.first);
+        stats[JSON_COUNT_NODE] = arrays.second->count;
+        stats[JSON_MAX_HEAP_USED_NODE] = arrays.second->maxHeapUsed;
+        stats[JSON_AVG_HEAP_USED_NODE] = arrays.second->totalHeapUsed / arrays.second->count;
+        stats[JSON_MAX_FIRST_BYTE_NODE] = arrays.second->maxFirstByte;
+        stats[JSON_AVG_FIRST_BYTE_NODE] = arrays.second->totalFirstByte / arrays.second->count;
+      }
+    }
+  }
+  jsonResponse->setCode(STATUS_OK);
+  recordResponseSize(jsonResponse->setLength());
   request->send(jsonResponse);
 }
 
+// Maps the field names accepted by the fields parameter of the /v2 API to
+// the field flags, the names are the same as the keys used by the full JSON
+// representation.
+struct CompactJsonFieldName {
+  const char *name;
+  uint8_t field;
+};
+
+static const CompactJsonFieldName LOCOMOTIVE_FIELD_NAMES[] = {
+  {JSON_ADDRESS_NODE, LOCO_FIELD_ADDRESS},
+  {JSON_SPEED_NODE, LOCO_FIELD_SPEED},
+  {JSON_DIRECTION_NODE, LOCO_FIELD_DIRECTION},
+  {JSON_ORIENTATION_NODE, LOCO_FIELD_ORIENTATION},
+  {JSON_FUNCTIONS_NODE, LOCO_FIELD_FUNCTIONS},
+  {JSON_CONSIST_NODE, LOCO_FIELD_CONSIST},
+};
+
+static const CompactJsonFieldName TURNOUT_FIELD_NAMES[] = {
+  {JSON_ID_NODE, TURNOUT_FIELD_ID},
+  {JSON_ADDRESS_NODE, TURNOUT_FIELD_ADDRESS},
+  {JSON_BOARD_ADDRESS_NODE, TURNOUT_FIELD_BOARD_ADDRESS},
+  {JSON_SUB_ADDRESS_NODE, TURNOUT_FIELD_SUB_ADDRESS},
+  {JSON_STATE_NODE, TURNOUT_FIELD_STATE},
+  {JSON_TYPE_NODE, TURNOUT_FIELD_TYPE},
+};
+
+// parses the comma separated fields parameter, returns all fields when the
+// parameter is not present or zero if any of the fields are not known.
+template<size_t N>
+static uint8_t parseFieldSelection(AsyncWebServerRequest *request,
+                                   const CompactJsonFieldName (&names)[N],
+                                   const uint8_t allFields) {
+  if(!request->hasArg(JSON_FIELDS_NODE)) {
+    return allFields;
+  }
+  const String selection = request->arg(JSON_FIELDS_NODE);
+  uint8_t fields = 0;
+  int start = 0;
+  while(start <= (int)selection.length()) {
+    int end = selection.indexOf(',', start);
+    if(end < 0) {
+      end = (int)selection.length();
+    }
+    String name = selection.substring(start, end);
+    name.trim();
+    uint8_t field = 0;
+    for(const auto &entry : names) {
+      if(name.equals(entry.name)) {
+        field = entry.field;
+        break;
+      }
+    }
+    if(!field) {
+      return 0;
+    }
+    fields |= field;
+    start = end + 1;
+  }
+  return fields;
+}
+
+void ESP32CSWebServer::handleLocomotiveV2(AsyncWebServerRequest *request) {
+  // GET /v2/locomotive - compact state of all active locomotives and consists
+  // GET /v2/locomotive?address=<address> - compact state of a single locomotive
+  //
+  // Both accept fields=<field>[,<field>...] to limit the fields returned,
+  // valid fields are: address, speed, dir, orientation, functions, consist.
+  // Changes to the locomotive state are made via /locomotive.
+  uint8_t fields = parseFieldSelection(request, LOCOMOTIVE_FIELD_NAMES, LOCO_FIELDS_ALL);
+  if(!fields) {
+    request->send(STATUS_BAD_REQUEST);
+    return;
+  }
+  if(!request->hasArg(JSON_ADDRESS_NODE)) {
+    sendJsonArray(request,
+      std::bind(LocomotiveManager::streamCompactActiveLocos, std::placeholders::_1, fields));
+    return;
+  }
+  auto jsonResponse = new AsyncJsonResponse();
+  if(!LocomotiveManager::getCompactActiveLocoByAddress(request->arg(JSON_ADDRESS_NODE).toInt(),
+                                                       jsonResponse->getRoot(), fields)) {
+    delete jsonResponse;
+    request->send(STATUS_NOT_FOUND);
+    return;
+  }
+  jsonResponse->setCode(STATUS_OK);
+  recordResponseSize(jsonResponse->setLength());
+  request->send(jsonResponse);
+}
+
+void ESP32CSWebServer::handleTurnoutsV2(AsyncWebServerRequest *request) {
+  // GET /v2/turnouts - compact state of all turnouts
+  //
+  // This accepts fields=<field>[,<field>...] to limit the fields returned,
+  // valid fields are: id, address, boardAddress, subAddress, state, type.
+  // Changes to the turnouts are made via /turnouts.
+  uint8_t fields = parseFieldSelection(request, TURNOUT_FIELD_NAMES, TURNOUT_FIELDS_ALL);
+  if(!fields) {
+    request->send(STATUS_BAD_REQUEST);
+    return;
+  }
+  sendJsonArray(request,
+    std::bind(TurnoutManager::streamCompactState, std::placeholders::_1, fields));
+}
+
+void ESP32CSWebServer::handleChanges(AsyncWebServerRequest *request) {
+  // GET /changes - sequence number of the most recent change, resync will be true
+  // GET /changes?since=<seq> - entities which have changed after the sequence number
+  //
+  // When resync is true the changes after the provided sequence number are no
+  // longer available (or the command station has restarted) and the client
+  // should retrieve the full lists of entities before polling again using the
+  // returned sequence number.
+  auto jsonResponse = new AsyncJsonResponse();
+  JsonObject &root = jsonResponse->getRoot();
+  std::vector<ChangeLogEntry> changes;
+  uint32_t sequence = 0;
+  if(!request->hasArg(JSON_SINCE_NODE) ||
+     !ChangeLog::getChanges(strtoul(request->arg(JSON_SINCE_NODE).c_str(), nullptr, 10), changes, sequence)) {
+    sequence = ChangeLog::getSequence();
+    root[JSON_RESYNC_NODE] = true;
+  } else {
+    root[JSON_RESYNC_NODE] = false;
+  }
+  root[JSON_SEQUENCE_NODE] = sequence;
+  JsonArray &array = root.createNestedArray(JSON_CHANGES_NODE);
+  for(const auto &change : changes) {
+    JsonObject &entity = array.createNestedObject();
+    entity[JSON_TYPE_NODE] = ChangeLog::getTypeName(change.type);
+    entity[JSON_ID_NODE] = change.id;
+    entity[JSON_SEQUENCE_NODE] = change.sequence;
+    if(!getChangedEntityState(change, entity.createNestedObject(JSON_STATE_NODE))) {
+      entity.remove(JSON_STATE_NODE);
+      entity[JSON_REMOVED_NODE] = true;
+    }
+  }
+  recordResponseSize(jsonResponse->setLength());
+  request->send(jsonResponse);
+}
+
+// Maximum number of operations accepted in a single POST /batch request.
+static constexpr uint8_t MAX_BATCH_OPERATIONS = 64;
+
+// Maximum length of a single operation object in a POST /batch request,
+// longer operations will be rejected without being parsed.
+static constexpr uint16_t MAX_BATCH_OPERATION_LENGTH = 256;
+
+// Highest locomotive speed accepted in a POST /batch request, speeds are
+// sent using 128 speed steps (0-126 excluding emergency stop).
+static constexpr uint8_t MAX_BATCH_LOCOMOTIVE_SPEED = 126;
+
+enum class BatchOperationType : uint8_t {
+  INVALID,
+  TURNOUT,
+  OUTPUT,
+  LOCOMOTIVE,
+  POWER
+};
+
+struct BatchOperation {
+  BatchOperationType type;
+  // turnout/output ID or locomotive address
+  uint16_t id;
+  bool state;
+  // locomotive speed/direction, -1 when not being changed
+  int16_t speed;
+  int8_t direction;
+  // locomotive functions being changed and their new state
+  uint32_t functionMask;
+  uint32_t functionState;
+};
+
+// Splits the POST /batch body into the individual operation objects as the
+// body is received so only a single operation needs to be buffered.
+class BatchRequestParser {
+public:
+  void feed(const uint8_t *data, size_t len) {
+    for(size_t index = 0; index < len; index++) {
+      char ch = data[index];
+      if(!_depth) {
+        if(ch == '{') {
+          _depth = 1;
+          _current = "{";
+          _truncated = false;
+        }
+        continue;
+      }
+      if(_current.length() < MAX_BATCH_OPERATION_LENGTH) {
+        _current += ch;
+      } else {
+        _truncated = true;
+      }
+      if(_inString) {
+        if(_escape) {
+          _escape = false;
+        } else if(ch == '\\') {
+          _escape = true;
+        } else if(ch == '"') {
+          _inString = false;
+        }
+      } else if(ch == '"') {
+        _inString = true;
+      } else if(ch == '{') {
+        _depth++;
+      } else if(ch == '}' && !--_depth) {
+        addOperation();
+      }
+    }
+  }
+  bool isOverflow() {
+    return _overflow;
+  }
+  std::vector<BatchOperation> operations;
+private:
+  void addOperation() {
+    if(operations.size() >= MAX_BATCH_OPERATIONS) {
+      _overflow = true;
+      return;
+    }
+    BatchOperation operation = {BatchOperationType::INVALID, 0, false, -1, -1, 0, 0};
+    DynamicJsonBuffer buffer(MAX_BATCH_OPERATION_LENGTH);
+    JsonObject &json = buffer.parseObject(_truncated ? "" : _current.c_str());
+    _current = "";
+    if(json.success() && json.containsKey(JSON_OPERATION_NODE)) {
+      String op = json[JSON_OPERATION_NODE].as<String>();
+      operation.state = json[JSON_STATE_NODE] == JSON_VALUE_TRUE || json[JSON_STATE_NODE].as<bool>();
+      if(op.equalsIgnoreCase(JSON_VALUE_TURNOUT) && json.containsKey(JSON_ID_NODE)) {
+        operation.type = BatchOperationType::TURNOUT;
+        operation.id = json[JSON_ID_NODE];
+      } else if(op.equalsIgnoreCase(JSON_VALUE_OUTPUT) && json.containsKey(JSON_ID_NODE)) {
+        operation.type = BatchOperationType::OUTPUT;
+        operation.id = json[JSON_ID_NODE];
+      } else if(op.equalsIgnoreCase(JSON_VALUE_LOCOMOTIVE) && json[JSON_ADDRESS_NODE].as<int>() > 0) {
+        operation.type = BatchOperationType::LOCOMOTIVE;
+        operation.id = json[JSON_ADDRESS_NODE];
+        if(json.containsKey(JSON_SPEED_NODE)) {
+          int speed = json[JSON_SPEED_NODE].as<int>();
+          if(speed < 0 || speed > MAX_BATCH_LOCOMOTIVE_SPEED) {
+            // the operation is rejected without applying any of it.
+            operation.type = BatchOperationType::INVALID;
+          }
+          operation.speed = speed;
+        }
+        if(json.containsKey(JSON_DIRECTION_NODE)) {
+          operation.direction = json[JSON_DIRECTION_NODE] == JSON_VALUE_FORWARD;
+        }
+        for(uint8_t funcID = 0; funcID < MAX_LOCOMOTIVE_FUNCTIONS; funcID++) {
+          String fArg = "f" + String(funcID);
+          if(json.containsKey(fArg)) {
+            bitSet(operation.functionMask, funcID);
+            if(json[fArg] == JSON_VALUE_TRUE || json[fArg].as<bool>()) {
+              bitSet(operation.functionState, funcID);
+            }
+          }
+        }
+      } else if(op.equalsIgnoreCase(JSON_VALUE_POWER)) {
+        operation.type = BatchOperationType::POWER;
+      }
+    }
+    operations.push_back(operation);
+  }
+  String _current{""};
+  uint8_t _depth{0};
+  bool _inString{false};
+  bool _escape{false};
+  bool _truncated{false};
+  bool _overflow{false};
+};
+
+// POST /batch requests which are currently receiving their body.
+static std::map<AsyncWebServerRequest *, std::unique_ptr<BatchRequestParser>> batchRequests;
+static std::mutex batchRequestLock;
+
+// applies a single operation, locomotives which had their speed or direction
+// changed are added to updatedLocomotives so their status is only reported
+// once for the batch.
+static int applyBatchOperation(const BatchOperation &operation, std::set<uint16_t> &updatedLocomotives) {
+  switch(operation.type) {
+    case BatchOperationType::TURNOUT:
+      return TurnoutManager::setByID(operation.id, operation.state) ? STATUS_OK : STATUS_NOT_FOUND;
+    case BatchOperationType::OUTPUT:
+      return OutputManager::set(operation.id, operation.state) ? STATUS_OK : STATUS_NOT_FOUND;
+    case BatchOperationType::LOCOMOTIVE:
+    {
+      auto loco = LocomotiveManager::getLocomotive(operation.id);
+      for(uint8_t funcID = 0; funcID < MAX_LOCOMOTIVE_FUNCTIONS; funcID++) {
+        if(bitRead(operation.functionMask, funcID)) {
+          loco->setFunction(funcID, bitRead(operation.functionState, funcID));
+        }
+      }
+      if(operation.speed >= 0 || operation.direction >= 0) {
+        if(operation.speed >= 0) {
+          loco->setSpeed(operation.speed);
+        }
+        if(operation.direction >= 0) {
+          loco->setDirection(operation.direction);
+        }
+        loco->sendLocoUpdate(true);
+        updatedLocomotives.insert(operation.id);
+      }
+      return STATUS_OK;
+    }
+    case BatchOperationType::POWER:
+      if(operation.state) {
+        MotorBoardManager::powerOnAll();
+      } else {
+        MotorBoardManager::powerOffAll();
+      }
+      return STATUS_OK;
+    default:
+      break;
+  }
+  return STATUS_BAD_REQUEST;
+}
+
+void ESP32CSWebServer::handleBatchBody(AsyncWebServerRequest *request, uint8_t *data,
+                                       size_t len, size_t index, size_t total) {
+  std::lock_guard<std::mutex> guard(batchRequestLock);
+  if(!index) {
+    batchRequests[request].reset(new BatchRequestParser());
+    request->onDisconnect([request]() {
+      std::lock_guard<std::mutex> guard(batchRequestLock);
+      batchRequests.erase(request);
+    });
+  }
+  auto parser = batchRequests.find(request);
+  if(parser != batchRequests.end()) {
+    parser->second->feed(data, len);
+  }
+}
+
+void ESP32CSWebServer::handleBatch(AsyncWebServerRequest *request) {
+  // POST /batch - applies the operations in the body in order, the body must
+  // be sent as application/json and contain an array of operations:
+  //   {"op":"turnout", "id":<id>, "state":[true|false]}
+  //   {"op":"output", "id":<id>, "state":[true|false]}
+  //   {"op":"locomotive", "address":<address>, "speed":<0-126>, "dir":[FWD|REV], "fX":[true|false]}
+  //   {"op":"power", "state":[true|false]}
+  //
+  // The response is an array containing the result code for each operation.
+  std::unique_ptr<BatchRequestParser> parser;
+  {
+    std::lock_guard<std::mutex> guard(batchRequestLock);
+    auto entry = batchRequests.find(request);
+    if(entry != batchRequests.end()) {
+      parser = std::move(entry->second);
+      batchRequests.erase(entry);
+    }
+  }
+  if(!parser) {
+    request->send(STATUS_BAD_REQUEST);
+    return;
+  } else if(parser->isOverflow()) {
+    request->send(STATUS_PAYLOAD_TOO_LARGE);
+    return;
+  }
+  std::set<uint16_t> updatedLocomotives;
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->print("[");
+  for(size_t index = 0; index < parser->operations.size(); index++) {
+    response->printf("%s%d", index ? "," : "",
+      applyBatchOperation(parser->operations[index], updatedLocomotives));
+  }
+  response->print("]");
+  request->send(response);
+  for(auto address : updatedLocomotives) {
+    LocomotiveManager::getLocomotive(address)->showStatus();
+  }
+}
@@ -27,7 +27,7 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 
 #include <freertos_drivers/arduino/WifiDefs.hxx>
 
-#include <utils/socket_listener.hxx>
+#include "SelectTcpServer.h"
 
 #if HC12_RADIO_ENABLED
 #include "HC12Interface.h"
@@ -49,18 +49,32 @@ static constexpr char const * WIFI_ENC_TYPES[] = {
 char WIFI_SSID[] = SSID_NAME;
 char WIFI_PASS[] = SSID_PASSWORD;
 
-void *jmriClientHandler(void *arg);
+constexpr uint16_t JMRI_LISTENER_PORT = 2560;
+
+// DCC++ TCP client, each client has its own protocol consumer so partial
+// commands received from one client do not interfere with another.
+class JmriClient : public SelectTcpClient {
+public:
+  JmriClient(SelectTcpServer *server, int fd) : SelectTcpClient(server, fd) {}
+protected:
+  void connected() override {
+    // tell JMRI about our state
+    DCCPPProtocolHandler::process("s");
+  }
+  void receive(uint8_t *data, size_t len) override {
+    _consumer.feed(data, len);
+  }
+private:
+  DCCPPProtocolConsumer _consumer;
+};
 
 ESP32CSWebServer esp32csWebServer;
-std::vector<int> jmriClients;
-std::unique_ptr<SocketListener> JMRIListener;
+SelectTcpServer jmriServer("JMRI", JMRI_LISTENER_PORT, [](SelectTcpServer *server, int fd) {
+  return new JmriClient(server, fd);
+});
 bool wifiConnected = false;
 WiFiInterface wifiInterface;
 
-constexpr int JMRI_CLIENT_PRIORITY = 0;
-constexpr size_t JMRI_CLIENT_STACK_SIZE = 4096;
-constexpr uint16_t JMRI_LISTENER_PORT = 2560;
-
 static constexpr const char *WIFI_STATUS_STRINGS[] =
 {
     "WiFi Idle",            // WL_IDLE_STATUS
@@ -121,14 +135,12 @@ void WiFiInterface::begin() {
     } else {
       LOG(INFO, "[WiFi] Adding esp32cs.tcp service to mDNS advertiser");
       MDNS.addService("esp32cs", "tcp", JMRI_LISTENER_PORT);
+      LOG(INFO, "[WiFi] Adding withrottle.tcp service to mDNS advertiser");
+      MDNS.addService("withrottle", "tcp", WITHROTTLE_LISTENER_PORT);
     }
 
-    JMRIListener.reset(new SocketListener(JMRI_LISTENER_PORT, [](int fd) {
-      jmriClients.push_back(fd);
-      os_thread_create(nullptr, StringPrintf("jmri-%d", fd).c_str(),
-                       JMRI_CLIENT_PRIORITY, JMRI_CLIENT_STACK_SIZE,
-                       jmriClientHandler, (void *)fd);
-    }));
+    jmriServer.begin();
+    WiThrottleServer::begin();
     esp32csWebServer.begin();
 #if NEXTION_ENABLED
     static_cast<NextionTitlePage *>(nextionPages[TITLE_PAGE])->clearStatusText();
@@ -264,15 +276,51 @@ void WiFiInterface::showInitInfo() {
 }
 
 void WiFiInterface::send(const String &buf) {
-  for (const int client : jmriClients) {
-    ::write(client, buf.c_str(), buf.length());
+  {
+    std::lock_guard<std::mutex> guard(_batchLock);
+    auto batch = _batches.find(xTaskGetCurrentTaskHandle());
+    if(batch != _batches.end()) {
+      batch->second += buf;
+      return;
+    }
   }
+  jmriServer.broadcast(buf.c_str());
   esp32csWebServer.broadcastToWS(buf);
 #if HC12_RADIO_ENABLED
   HC12Interface::send(buf);
 #endif
 }
 
+void WiFiInterface::beginBatch() {
+  std::lock_guard<std::mutex> guard(_batchLock);
+  _batches[xTaskGetCurrentTaskHandle()] = "";
+}
+
+void WiFiInterface::endBatch() {
+  String buf;
+  {
+    std::lock_guard<std::mutex> guard(_batchLock);
+    auto batch = _batches.find(xTaskGetCurrentTaskHandle());
+    if(batch == _batches.end()) {
+      return;
+    }
+    buf = std::move(batch->second);
+    _batches.erase(batch);
+  }
+  if(buf.length()) {
+    send(buf);
+  }
+}
+
+void WiFiInterface::notifyTurnoutState(uint16_t turnoutID, bool thrown) {
+  WiThrottleServer::notifyTurnoutState(turnoutID, thrown);
+}
+
+void WiFiInterface::notifyPowerState() {
+  WiThrottleServer::notifyPowerState();
+  esp32csWebServer.notifyPowerState();
+}
+
 void WiFiInterface::print(const __FlashStringHelper *fmt, ...) {
   char buf[256] = {0};
   va_list args;
@@ -281,37 +329,3 @@ void WiFiInterface::print(const __FlashStringHelper *fmt, ...) {
   va_end(args);
   send(buf);
 }
-
-void *jmriClientHandler(void *arg) {
-  int fd = (int)arg;
-  DCCPPProtocolConsumer consumer;
-  std::unique_ptr<uint8_t> buf(new uint8_t[128]);
-  HASSERT(buf.get() != nullptr);
-
-  // tell JMRI about our state
-  DCCPPProtocolHandler::process("s");
-
-  while (true) {
-    int bytesRead = ::read(fd, buf.get(), 128);
-    if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN)) {
-      // no data to read yet
-    } else if (bytesRead > 0) {
-      consumer.feed(buf.get(), bytesRead);
-    } else if (bytesRead == 0) {
-      // EOF, close client
-      LOG(INFO, "[JMRI %d] disconnected", fd);
-      break;
-    } else {
-      // some other error, close client
-      LOG(INFO, "[JMRI %d] error:%d, %s. Disconnecting.", fd, errno, strerror(errno));
-      break;
-    }
-  }
-  // remove client FD
-  std::vector<int>::iterator it = std::find(jmriClients.begin(), jmriClients.end(), fd);
-  if (it != jmriClients.end()) {
-    jmriClients.erase(it);
-  }
-  ::close(fd);
-  return nullptr;
-}
\ No newline at end of file
@@ -0,0 +1,486 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+#include "SelectTcpServer.h"
+#include "WiThrottle.h"
+
+#include <map>
+#include <executor/Timer.hxx>
+
+// Interval (in seconds) the throttles are asked to send a heartbeat, if a
+// throttle with heartbeat enabled does not send any data within this interval
+// (plus grace period) all locomotives it controls will be stopped.
+static constexpr uint8_t WITHROTTLE_HEARTBEAT_INTERVAL = 10;
+
+// Additional time (in seconds) the throttle is given beyond the heartbeat
+// interval before it is considered to have timed out.
+static constexpr uint8_t WITHROTTLE_HEARTBEAT_GRACE = 2;
+
+// Interval (in milliseconds) between checks for locomotive changes made by
+// other interfaces (DCC++, web, etc), any changes are sent to the throttles
+// controlling the locomotive.
+static constexpr uint32_t WITHROTTLE_STATE_UPDATE_INTERVAL_MS = 100;
+
+// Maximum length of a single WiThrottle command, anything longer than this
+// is discarded.
+static constexpr size_t WITHROTTLE_MAX_LINE_LENGTH = 256;
+
+// Delimiter used between the locomotive key and the command in multi
+// throttle commands.
+static constexpr const char *WITHROTTLE_MT_DELIMITER = "<;>";
+
+// WiThrottle turnout states.
+static constexpr char WITHROTTLE_TURNOUT_CLOSED = '2';
+static constexpr char WITHROTTLE_TURNOUT_THROWN = '4';
+
+class WiThrottleClient;
+
+static SelectTcpServer *withrottleServer = nullptr;
+
+// All WiThrottle clients, this is only accessed from the socket executor.
+static std::vector<WiThrottleClient *> withrottleClients;
+
+// returns the DCC address from a WiThrottle locomotive key (L341, S3).
+static uint16_t getAddressFromKey(const std::string &key) {
+  if(key.length() < 2 || (key[0] != 'L' && key[0] != 'S')) {
+    return 0;
+  }
+  return atoi(key.c_str() + 1);
+}
+
+// returns the Locomotive (or LocomotiveConsist) instance to report state from.
+static Locomotive *getLocomotiveForThrottle(uint16_t address) {
+  if(LocomotiveManager::isConsistAddress(address)) {
+    return LocomotiveManager::getConsistByID(address);
+  } else if(LocomotiveManager::isAddressInConsist(address)) {
+    return LocomotiveManager::getConsistForLoco(address);
+  }
+  return LocomotiveManager::getLocomotive(address);
+}
+
+static void setLocomotiveThrottle(uint16_t address, int8_t speed, bool forward) {
+  if(LocomotiveManager::isConsistAddress(address) || LocomotiveManager::isAddressInConsist(address)) {
+    std::vector<String> args;
+    args.push_back("0");
+    args.push_back(String(address));
+    args.push_back(String(speed));
+    args.push_back(String(forward));
+    LocomotiveManager::processConsistThrottle(args);
+  } else {
+    auto loco = LocomotiveManager::getLocomotive(address);
+    loco->setSpeed(speed);
+    loco->setDirection(forward);
+    loco->sendLocoUpdate(true);
+    // report the change to DCC++ and web clients the same as a <t> command.
+    loco->showStatus();
+  }
+}
+
+static void syncLocoState(uint16_t);
+
+class WiThrottleClient : public SelectTcpClient {
+public:
+  WiThrottleClient(SelectTcpServer *server, int fd) : SelectTcpClient(server, fd) {
+    withrottleClients.push_back(this);
+  }
+  virtual ~WiThrottleClient() {
+    auto it = std::find(withrottleClients.begin(), withrottleClients.end(), this);
+    if(it != withrottleClients.end()) {
+      withrottleClients.erase(it);
+    }
+  }
+  // sends any state of the locomotive which differs from what was last
+  // reported to each throttle controlling it.
+  void syncLocomotive(uint16_t address) {
+    std::string response;
+    for(const auto& entry : _throttles) {
+      for(const auto& key : entry.second) {
+        if(getAddressFromKey(key) == address) {
+          response += buildLocoState(entry.first, key, false);
+        }
+      }
+    }
+    if(!response.empty()) {
+      send(response);
+    }
+  }
+  void syncAllLocomotives() {
+    std::string response;
+    for(const auto& entry : _throttles) {
+      for(const auto& key : entry.second) {
+        response += buildLocoState(entry.first, key, false);
+      }
+    }
+    if(!response.empty()) {
+      send(response);
+    }
+  }
+  void checkHeartbeat(uint64_t now) {
+    if(!_heartbeatEnabled || _heartbeatExpired) {
+      return;
+    }
+    if(now - _lastActivity > SEC_TO_USEC(WITHROTTLE_HEARTBEAT_INTERVAL + WITHROTTLE_HEARTBEAT_GRACE)) {
+      LOG(WARNING, "[WiThrottle %d] %s heartbeat timeout, stopping locomotives",
+          getFD(), _name.c_str());
+      _heartbeatExpired = true;
+      for(const auto& entry : _throttles) {
+        for(const auto& key : entry.second) {
+          uint16_t address = getAddressFromKey(key);
+          auto loco = getLocomotiveForThrottle(address);
+          setLocomotiveThrottle(address, 0, loco->isDirectionForward());
+          syncLocoState(address);
+        }
+      }
+    }
+  }
+protected:
+  void connected() override {
+    _lastActivity = esp_timer_get_time();
+    std::string init = "VN2.0\nHTESP32CommandStation\nHtESP32 Command Station v" VERSION "\n";
+    init += StringPrintf("PW%d\n", 80);
+    auto roster = LocomotiveManager::getRosterEntries();
+    init += StringPrintf("RL%d", (int)roster.size());
+    for(const auto& entry : roster) {
+      init += StringPrintf("]\\[%s}|{%d}|{%c", entry->getDescription().c_str(),
+                           entry->getAddress(), entry->getAddress() > 127 ? 'L' : 'S');
+    }
+    init += "\n";
+    init += StringPrintf("PPA%d\n", MotorBoardManager::isTrackPowerOn());
+    init += StringPrintf("PTT]\\[Turnouts}|{Turnout]\\[%s}|{%c]\\[%s}|{%c\n",
+                         JSON_VALUE_CLOSED, WITHROTTLE_TURNOUT_CLOSED,
+                         JSON_VALUE_THROWN, WITHROTTLE_TURNOUT_THROWN);
+    init += "PTL";
+    for(uint16_t index = 0; index < TurnoutManager::getTurnoutCount(); index++) {
+      auto turnout = TurnoutManager::getTurnoutByIndex(index);
+      init += StringPrintf("]\\[%d}|{%d}|{%c", turnout->getID(), turnout->getAddress(),
+                           turnout->isThrown() ? WITHROTTLE_TURNOUT_THROWN : WITHROTTLE_TURNOUT_CLOSED);
+    }
+    init += "\n";
+    init += StringPrintf("*%d\n", WITHROTTLE_HEARTBEAT_INTERVAL);
+    send(init);
+  }
+  void receive(uint8_t *data, size_t len) override {
+    _lastActivity = esp_timer_get_time();
+    _heartbeatExpired = false;
+    for(size_t index = 0; index < len; index++) {
+      if(data[index] == '\n' || data[index] == '\r') {
+        if(!_line.empty()) {
+          processLine();
+          _line.clear();
+        }
+      } else if(_line.length() < WITHROTTLE_MAX_LINE_LENGTH) {
+        _line += (char)data[index];
+      }
+    }
+  }
+private:
+  void processLine() {
+    LOG(VERBOSE, "[WiThrottle %d] <- %s", getFD(), _line.c_str());
+    switch(_line[0]) {
+      case '*':
+        if(_line.length() > 1) {
+          _heartbeatEnabled = (_line[1] == '+');
+        }
+        break;
+      case 'N':
+        _name = _line.substr(1);
+        LOG(INFO, "[WiThrottle %d] Throttle name: %s", getFD(), _name.c_str());
+        send(StringPrintf("*%d\n", WITHROTTLE_HEARTBEAT_INTERVAL));
+        break;
+      case 'H':
+        // hardware identifier (HU), not used.
+        break;
+      case 'P':
+        if(_line.compare(0, 3, "PPA") == 0 && _line.length() > 3) {
+          if(_line[3] == '1') {
+            MotorBoardManager::powerOnAll();
+          } else {
+            MotorBoardManager::powerOffAll();
+          }
+        } else if(_line.compare(0, 3, "PTA") == 0 && _line.length() > 4) {
+          uint16_t turnoutID = atoi(_line.c_str() + 4);
+          if(_line[3] == 'T') {
+            TurnoutManager::setByID(turnoutID, true);
+          } else if(_line[3] == 'C') {
+            TurnoutManager::setByID(turnoutID, false);
+          } else {
+            TurnoutManager::toggleByID(turnoutID);
+          }
+        }
+        break;
+      case 'M':
+        processMultiThrottle();
+        break;
+      case 'Q':
+        LOG(INFO, "[WiThrottle %d] %s disconnecting", getFD(), _name.c_str());
+        close();
+        break;
+      default:
+        LOG(VERBOSE, "[WiThrottle %d] Unsupported command: %s", getFD(), _line.c_str());
+    }
+  }
+
+  // M{THROTTLE}{ACTION}{KEY}<;>{COMMAND}
+  void processMultiThrottle() {
+    size_t delim = _line.find(WITHROTTLE_MT_DELIMITER);
+    if(_line.length() < 4 || delim == std::string::npos) {
+      return;
+    }
+    char throttle = _line[1];
+    char action = _line[2];
+    std::string key = _line.substr(3, delim - 3);
+    std::string command = _line.substr(delim + strlen(WITHROTTLE_MT_DELIMITER));
+    auto &locos = _throttles[throttle];
+    if(action == '+') {
+      uint16_t address = getAddressFromKey(key);
+      if(!address) {
+        return;
+      }
+      if(std::find(locos.begin(), locos.end(), key) == locos.end()) {
+        locos.push_back(key);
+      }
+      std::string response = StringPrintf("M%c+%s%s\n", throttle, key.c_str(), WITHROTTLE_MT_DELIMITER);
+      response += buildLocoState(throttle, key, true);
+      response += StringPrintf("M%cA%s%ss1\n", throttle, key.c_str(), WITHROTTLE_MT_DELIMITER);
+      send(response);
+    } else if(action == '-') {
+      if(key == "*") {
+        for(const auto& locoKey : locos) {
+          send(StringPrintf("M%c-%s%s\n", throttle, locoKey.c_str(), WITHROTTLE_MT_DELIMITER));
+          _reported.erase(getReportedKey(throttle, locoKey));
+        }
+        locos.clear();
+      } else {
+        auto it = std::find(locos.begin(), locos.end(), key);
+        if(it != locos.end()) {
+          locos.erase(it);
+        }
+        _reported.erase(getReportedKey(throttle, key));
+        send(StringPrintf("M%c-%s%s\n", throttle, key.c_str(), WITHROTTLE_MT_DELIMITER));
+      }
+    } else if(action == 'A' && !command.empty()) {
+      if(key == "*") {
+        for(const auto& locoKey : locos) {
+          processLocoAction(throttle, locoKey, command);
+        }
+      } else if(std::find(locos.begin(), locos.end(), key) != locos.end()) {
+        processLocoAction(throttle, key, command);
+      }
+    }
+  }
+
+  void processLocoAction(char throttle, const std::string &key, const std::string &command) {
+    uint16_t address = getAddressFromKey(key);
+    auto loco = getLocomotiveForThrottle(address);
+    std::string prefix = StringPrintf("M%cA%s%s", throttle, key.c_str(), WITHROTTLE_MT_DELIMITER);
+    switch(command[0]) {
+      case 'V':
+      {
+        int speed = atoi(command.c_str() + 1);
+        if(speed < 0) {
+          speed = 0;
+        }
+        setLocomotiveThrottle(address, speed, loco->isDirectionForward());
+        syncLocoState(address);
+        break;
+      }
+      case 'R':
+      {
+        bool forward = command.length() > 1 && command[1] == '1';
+        setLocomotiveThrottle(address, loco->getSpeed(), forward);
+        syncLocoState(address);
+        break;
+      }
+      case 'X':
+      case 'I':
+        setLocomotiveThrottle(address, 0, loco->isDirectionForward());
+        syncLocoState(address);
+        break;
+      case 'F':
+      case 'f':
+        if(command.length() > 2) {
+          uint8_t funcID = atoi(command.c_str() + 2);
+          bool state = command[1] == '1';
+          if(funcID >= MAX_LOCOMOTIVE_FUNCTIONS) {
+            break;
+          }
+          if(command[0] == 'F') {
+            // button press toggles the function, release is ignored.
+            if(!state) {
+              break;
+            }
+            state = !loco->isFunctionEnabled(funcID);
+          }
+          loco->setFunction(funcID, state);
+          syncLocoState(address);
+        }
+        break;
+      case 'q':
+        if(command.length() > 1 && command[1] == 'V') {
+          send(StringPrintf("%sV%d\n", prefix.c_str(), loco->getSpeed()));
+        } else if(command.length() > 1 && command[1] == 'R') {
+          send(StringPrintf("%sR%d\n", prefix.c_str(), loco->isDirectionForward()));
+        }
+        break;
+      case 's':
+        // only 128 speed step mode is supported
+        send(StringPrintf("%ss1\n", prefix.c_str()));
+        break;
+      default:
+        LOG(VERBOSE, "[WiThrottle %d] Unsupported loco command: %s", getFD(), command.c_str());
+    }
+  }
+
+  // locomotive state last sent to a throttle.
+  struct ReportedLocoState {
+    int8_t speed;
+    bool forward;
+    uint32_t functions;
+  };
+
+  static std::string getReportedKey(char throttle, const std::string &key) {
+    return std::string(1, throttle) + key;
+  }
+
+  // builds the state updates for a locomotive controlled by a throttle, only
+  // the state which differs from what was last reported is included unless
+  // a full update is requested.
+  std::string buildLocoState(char throttle, const std::string &key, bool full) {
+    auto loco = getLocomotiveForThrottle(getAddressFromKey(key));
+    std::string prefix = StringPrintf("M%cA%s%s", throttle, key.c_str(), WITHROTTLE_MT_DELIMITER);
+    std::string response;
+    ReportedLocoState current = {loco->getSpeed(), loco->isDirectionForward(), loco->getFunctionMask()};
+    auto reported = _reported.find(getReportedKey(throttle, key));
+    if(reported == _reported.end()) {
+      full = true;
+    }
+    for(uint8_t funcID = 0; funcID < MAX_LOCOMOTIVE_FUNCTIONS; funcID++) {
+      bool state = bitRead(current.functions, funcID);
+      if(full || state != bitRead(reported->second.functions, funcID)) {
+        response += StringPrintf("%sF%d%d\n", prefix.c_str(), state, funcID);
+      }
+    }
+    if(full || current.speed != reported->second.speed) {
+      response += StringPrintf("%sV%d\n", prefix.c_str(), current.speed);
+    }
+    if(full || current.forward != reported->second.forward) {
+      response += StringPrintf("%sR%d\n", prefix.c_str(), current.forward);
+    }
+    _reported[getReportedKey(throttle, key)] = current;
+    return response;
+  }
+
+  std::string _line;
+  std::string _name;
+  std::map<char, std::vector<std::string>> _throttles;
+  std::map<std::string, ReportedLocoState> _reported;
+  bool _heartbeatEnabled{false};
+  bool _heartbeatExpired{false};
+  uint64_t _lastActivity{0};
+};
+
+// sends the locomotive state to all throttles controlling the address.
+static void syncLocoState(uint16_t address) {
+  for(const auto& client : withrottleClients) {
+    client->syncLocomotive(address);
+  }
+}
+
+// Periodic timer on the socket executor which checks for throttles that have
+// stopped sending heartbeats.
+class WiThrottleHeartbeatTimer : public ::Timer {
+public:
+  WiThrottleHeartbeatTimer() : ::Timer(SelectTcpServer::executor()->active_timers()) {
+  }
+  long long timeout() override {
+    uint64_t now = esp_timer_get_time();
+    for(const auto& client : withrottleClients) {
+      client->checkHeartbeat(now);
+    }
+    return RESTART;
+  }
+};
+
+static WiThrottleHeartbeatTimer *heartbeatTimer = nullptr;
+
+// Periodic timer on the socket executor which sends locomotive changes made
+// by other interfaces to the throttles. Consist changes may affect the state
+// reported for any member address so all locomotives are checked, only the
+// state which has changed is sent.
+class WiThrottleStateTimer : public ::Timer {
+public:
+  WiThrottleStateTimer() : ::Timer(SelectTcpServer::executor()->active_timers()),
+    _sequence(ChangeLog::getSequence()) {
+  }
+  long long timeout() override {
+    std::vector<ChangeLogEntry> changes;
+    bool locoChanged = !ChangeLog::getChanges(_sequence, changes, _sequence);
+    for(const auto& change : changes) {
+      if(change.type == ChangeType::LOCOMOTIVE || change.type == ChangeType::CONSIST) {
+        locoChanged = true;
+      }
+    }
+    if(locoChanged) {
+      for(const auto& client : withrottleClients) {
+        client->syncAllLocomotives();
+      }
+    }
+    return RESTART;
+  }
+private:
+  uint32_t _sequence;
+};
+
+static WiThrottleStateTimer *stateTimer = nullptr;
+
+void WiThrottleServer::begin() {
+  if(withrottleServer) {
+    return;
+  }
+  withrottleServer = new SelectTcpServer("WiThrottle", WITHROTTLE_LISTENER_PORT,
+    [](SelectTcpServer *server, int fd) {
+      return new WiThrottleClient(server, fd);
+    });
+  withrottleServer->begin();
+  heartbeatTimer = new WiThrottleHeartbeatTimer();
+  heartbeatTimer->start(SEC_TO_NSEC(1));
+  stateTimer = new WiThrottleStateTimer();
+  stateTimer->start(MSEC_TO_NSEC(WITHROTTLE_STATE_UPDATE_INTERVAL_MS));
+}
+
+size_t WiThrottleServer::getClientCount() {
+  if(withrottleServer) {
+    return withrottleServer->getClientCount();
+  }
+  return 0;
+}
+
+void WiThrottleServer::notifyTurnoutState(uint16_t turnoutID, bool thrown) {
+  if(!withrottleServer) {
+    return;
+  }
+  withrottleServer->broadcast(StringPrintf("PTA%c%d\n",
+    thrown ? WITHROTTLE_TURNOUT_THROWN : WITHROTTLE_TURNOUT_CLOSED, turnoutID));
+}
+
+void WiThrottleServer::notifyPowerState() {
+  if(!withrottleServer) {
+    return;
+  }
+  withrottleServer->broadcast(StringPrintf("PPA%d\n", MotorBoardManager::isTrackPowerOn()));
+}
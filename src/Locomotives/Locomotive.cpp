@@ -26,6 +26,10 @@ constexpr uint64_t LOCO_SPEED_PACKET_INTERVAL = MSEC_TO_USEC(100);
 // default is approximately every second.
 constexpr uint64_t LOCO_FUNCTION_PACKET_INTERVAL = SEC_TO_USEC(60);
 
+// Throttle updates received within this interval of the previous packet will
+// be combined and sent once the interval has expired.
+constexpr uint64_t LOCO_UPDATE_COALESCE_WINDOW = MSEC_TO_USEC(LOCO_UPDATE_COALESCE_WINDOW_MS);
+
 Locomotive::Locomotive(uint8_t registerNumber) : _registerNumber(registerNumber) {
   createFunctionPackets();
 }
@@ -49,7 +53,15 @@ Locomotive::Locomotive(JsonObject &json) {
 }
 
 void Locomotive::sendLocoUpdate(bool force) {
-  if(force || esp_timer_get_time() > (_lastPacketTime + LOCO_SPEED_PACKET_INTERVAL)) {
+  if(force && esp_timer_get_time() < (_lastPacketTime + LOCO_UPDATE_COALESCE_WINDOW)) {
+    // a speed packet was sent recently, the latest speed and direction will
+    // be sent by the periodic update once the window has expired.
+    _speedUpdatePending = true;
+    return;
+  }
+  if(force || esp_timer_get_time() > (_lastPacketTime + LOCO_SPEED_PACKET_INTERVAL) ||
+     (_speedUpdatePending && esp_timer_get_time() >= (_lastPacketTime + LOCO_UPDATE_COALESCE_WINDOW))) {
+    _speedUpdatePending = false;
     LOG(VERBOSE, "[Loco %d, speed: %d, dir: %s] Building speed packet",
       _locoAddress, _speed, _direction ? JSON_VALUE_FORWARD : JSON_VALUE_REVERSE);
     std::vector<uint8_t> packetBuffer;
@@ -84,6 +96,30 @@ void Locomotive::sendLocoUpdate(bool force) {
   for(uint8_t pkt = 0; pkt < MAX_LOCOMOTIVE_FUNCTION_PACKETS; pkt++) {
     _lastFunctionsPacketTime[pkt] = esp_timer_get_time();
   }
+  // send any function packets which were deferred, these contain the latest
+  // state of all functions in the packet.
+  if(!force && _pendingFunctionPackets &&
+     esp_timer_get_time() >= (_lastFunctionUpdateTime + LOCO_UPDATE_COALESCE_WINDOW)) {
+    uint8_t pending = _pendingFunctionPackets.exchange(0);
+    for(uint8_t pkt = 0; pkt < MAX_LOCOMOTIVE_FUNCTION_PACKETS; pkt++) {
+      if(bitRead(pending, pkt)) {
+        dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(_functionPackets[pkt]);
+      }
+    }
+    _lastFunctionUpdateTime = esp_timer_get_time();
+  }
+}
+
+void Locomotive::sendFunctionPacket(uint8_t pkt) {
+  if(esp_timer_get_time() < (_lastFunctionUpdateTime + LOCO_UPDATE_COALESCE_WINDOW)) {
+    // a function packet was sent recently, defer this one to the periodic
+    // update so multiple changes to the same packet are only sent once.
+    _pendingFunctionPackets |= (1 << pkt);
+    return;
+  }
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(_functionPackets[pkt]);
+  _lastFunctionUpdateTime = esp_timer_get_time();
+  _lastFunctionsPacketTime[pkt] = _lastFunctionUpdateTime;
 }
 
 void Locomotive::showStatus() {
@@ -92,6 +128,10 @@ void Locomotive::showStatus() {
   wifiInterface.print(F("<T %d %d %d>"), _registerNumber, _speed, _direction);
 }
 
+void Locomotive::markChanged() {
+  _changeSequence = ChangeLog::record(getChangeType(), _locoAddress);
+}
+
 void Locomotive::toJson(JsonObject &jsonObject, bool includeSpeedDir, bool includeFunctions) {
   jsonObject[JSON_ADDRESS_NODE] = _locoAddress;
   if(includeSpeedDir) {
@@ -109,6 +149,34 @@ void Locomotive::toJson(JsonObject &jsonObject, bool includeSpeedDir, bool inclu
   }
 }
 
+void Locomotive::toCompactJson(JsonObject &jsonObject, uint8_t fields) {
+  if(fields & LOCO_FIELD_ADDRESS) {
+    jsonObject[JSON_V2_ADDRESS_NODE] = _locoAddress;
+  }
+  if(fields & LOCO_FIELD_SPEED) {
+    jsonObject[JSON_V2_SPEED_NODE] = _speed;
+  }
+  if(fields & LOCO_FIELD_DIRECTION) {
+    jsonObject[JSON_V2_DIRECTION_NODE] = (uint8_t)_direction;
+  }
+  if(fields & LOCO_FIELD_ORIENTATION) {
+    jsonObject[JSON_V2_ORIENTATION_NODE] = (uint8_t)_orientation;
+  }
+  if(fields & LOCO_FIELD_FUNCTIONS) {
+    jsonObject[JSON_V2_FUNCTIONS_NODE] = getFunctionMask();
+  }
+}
+
+uint32_t Locomotive::getFunctionMask() {
+  uint32_t mask = 0;
+  for(uint8_t funcID = 0; funcID < MAX_LOCOMOTIVE_FUNCTIONS; funcID++) {
+    if(_functionState[funcID]) {
+      mask |= (1UL << funcID);
+    }
+  }
+  return mask;
+}
+
 void Locomotive::createFunctionPackets() {
   LOG(VERBOSE, "[Loco %d] Building Function packets", _locoAddress);
   // seed functions packets with locomotive numbers
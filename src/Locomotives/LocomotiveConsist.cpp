@@ -126,6 +126,16 @@ void LocomotiveConsist::toJson(JsonObject &jsonObject, bool includeSpeedDir, boo
   }
 }
 
+void LocomotiveConsist::toCompactJson(JsonObject &jsonObject, uint8_t fields) {
+  Locomotive::toCompactJson(jsonObject, fields);
+  if(fields & LOCO_FIELD_CONSIST) {
+    JsonArray &locoArray = jsonObject.createNestedArray(JSON_V2_CONSIST_NODE);
+    for (const auto& loco : _locos) {
+      locoArray.add(loco->getLocoAddress());
+    }
+  }
+}
+
 bool LocomotiveConsist::isAddressInConsist(uint16_t locoAddress) {
   for (const auto& loco : _locos) {
     if (loco->getLocoAddress() == locoAddress) {
@@ -147,6 +157,7 @@ void LocomotiveConsist::updateThrottle(uint16_t locoAddress, int8_t speed, bool
         loco->setDirection(forward);
         loco->sendLocoUpdate();
       }
+      markChanged();
     } else if (_locos[0]->getLocoAddress() == locoAddress ||
                _locos[1]->getLocoAddress() == locoAddress ||
                getLocoAddress() == locoAddress) {
@@ -164,6 +175,7 @@ void LocomotiveConsist::addLocomotive(uint16_t locoAddress, bool forward,
   Locomotive *loco = LocomotiveManager::getLocomotive(locoAddress, false);
   loco->setOrientationForward(forward);
   _locos.push_back(loco);
+  markChanged();
   if(_decoderAssisstedConsist) {
     // write the loco consist address
     if(forward) {
@@ -211,6 +223,7 @@ bool LocomotiveConsist::removeLocomotive(uint16_t locoAddress) {
   }
   if(locoFound) {
     _locos.erase(_locos.begin() + index);
+    markChanged();
     if(_decoderAssisstedConsist) {
       // if we are in an advanced consist, send a progtramming packet to clear
       // the consist address from the decoder
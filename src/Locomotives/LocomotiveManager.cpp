@@ -77,8 +77,14 @@ void LocomotiveManager::processThrottle(const std::vector<String> arguments) {
   if(instance == nullptr) {
     instance = new Locomotive(registerNumber);
     _locos.add(instance);
+  } else if(instance->getLocoAddress() != locoAddress) {
+    // the register is being reused for a different locomotive
+    ChangeLog::record(ChangeType::LOCOMOTIVE, instance->getLocoAddress());
+  }
+  if(instance->getLocoAddress() != locoAddress) {
+    instance->setLocoAddress(locoAddress);
+    instance->markChanged();
   }
-  instance->setLocoAddress(locoAddress);
   instance->setSpeed(arguments[2].toInt());
   instance->setDirection(arguments[3].toInt() == 1);
   instance->sendLocoUpdate(true);
@@ -170,6 +176,7 @@ void LocomotiveManager::showConsistStatus() {
 
 void LocomotiveManager::update(void *arg) {
   esp_task_wdt_add(NULL);
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
   TickType_t lastWakeupTick = xTaskGetTickCount();
   while(true) {
     esp_task_wdt_reset();
@@ -207,6 +214,7 @@ Locomotive *LocomotiveManager::getLocomotive(const uint16_t locoAddress, const b
       instance->setLocoAddress(locoAddress);
       if(managed) {
         _locos.add(instance);
+        instance->markChanged();
       }
     }
   }
@@ -222,6 +230,15 @@ Locomotive *LocomotiveManager::getLocomotiveByRegister(const uint8_t registerNum
   return nullptr;
 }
 
+Locomotive *LocomotiveManager::getActiveLocomotive(const uint16_t locoAddress) {
+  for (const auto& loco : _locos) {
+    if(loco->getLocoAddress() == locoAddress) {
+      return loco;
+    }
+  }
+  return nullptr;
+}
+
 void LocomotiveManager::removeLocomotive(const uint16_t locoAddress) {
   Locomotive *locoToRemove = nullptr;
   for (const auto& loco : _locos) {
@@ -231,6 +248,7 @@ void LocomotiveManager::removeLocomotive(const uint16_t locoAddress) {
   }
   if(locoToRemove != nullptr) {
     locoToRemove->setIdle();
+    ChangeLog::record(ChangeType::LOCOMOTIVE, locoAddress);
     _locos.remove(locoToRemove);
   }
 }
@@ -244,6 +262,7 @@ bool LocomotiveManager::removeLocomotiveConsist(const uint16_t consistAddress) {
   }
   if (consistToRemove != nullptr) {
     consistToRemove->releaseLocomotives();
+    ChangeLog::record(ChangeType::CONSIST, consistAddress);
     _consists.remove(consistToRemove);
     return true;
   }
@@ -403,12 +422,81 @@ void LocomotiveManager::getActiveLocos(JsonArray &array) {
   }
 }
 
+bool LocomotiveManager::getActiveLocoByAddress(const uint16_t address, JsonObject &json) {
+  auto loco = getActiveLocomotive(address);
+  if(loco) {
+    loco->toJson(json);
+    return true;
+  }
+  return false;
+}
+
+void LocomotiveManager::streamActiveLocos(json_stream_visitor_t visitor) {
+  // active locomotives are reported first followed by the consists, the same
+  // as getActiveLocos(JsonArray &).
+  for (const auto& loco : _locos) {
+    JsonObject *json = visitor(loco->getLocoAddress());
+    if(json) {
+      loco->toJson(*json);
+    }
+  }
+  for (const auto& consist : _consists) {
+    JsonObject *json = visitor(consist->getLocoAddress() | LOCO_STREAM_CONSIST_KEY);
+    if(json) {
+      consist->toJson(*json);
+    }
+  }
+}
+
+bool LocomotiveManager::getCompactActiveLocoByAddress(const uint16_t address, JsonObject &json,
+                                                      const uint8_t fields) {
+  auto loco = getActiveLocomotive(address);
+  if(loco) {
+    loco->toCompactJson(json, fields);
+    return true;
+  }
+  return false;
+}
+
+void LocomotiveManager::streamCompactActiveLocos(json_stream_visitor_t visitor,
+                                                  const uint8_t fields) {
+  for (const auto& loco : _locos) {
+    JsonObject *json = visitor(loco->getLocoAddress());
+    if(json) {
+      loco->toCompactJson(*json, fields);
+    }
+  }
+  for (const auto& consist : _consists) {
+    JsonObject *json = visitor(consist->getLocoAddress() | LOCO_STREAM_CONSIST_KEY);
+    if(json) {
+      consist->toCompactJson(*json, fields);
+    }
+  }
+}
+
 void LocomotiveManager::getRosterEntries(JsonArray &array) {
   for (const auto& entry : _roster) {
     entry->toJson(array.createNestedObject());
   }
 }
 
+void LocomotiveManager::streamRosterEntries(json_stream_visitor_t visitor) {
+  for (const auto& entry : _roster) {
+    JsonObject *json = visitor(entry->getAddress());
+    if(json) {
+      entry->toJson(*json);
+    }
+  }
+}
+
+std::vector<RosterEntry *> LocomotiveManager::getRosterEntries() {
+  std::vector<RosterEntry *> retval;
+  for (const auto& entry : _roster) {
+    retval.push_back(entry);
+  }
+  return retval;
+}
+
 bool LocomotiveManager::isConsistAddress(uint16_t address) {
   for (const auto& consist : _consists) {
     if(consist->getLocoAddress() == address) {
@@ -458,15 +546,19 @@ LocomotiveConsist *LocomotiveManager::createLocomotiveConsist(int8_t consistAddr
     }
     if(newConsistAddress > 0) {
       LOG(INFO, "[Consist] Adding new Loco Consist %d", newConsistAddress);
-      _consists.add(new LocomotiveConsist(newConsistAddress, true));
-      return getConsistByID(newConsistAddress);
+      auto consist = new LocomotiveConsist(newConsistAddress, true);
+      _consists.add(consist);
+      consist->markChanged();
+      return consist;
     } else {
       LOG(INFO, "[Consist] Unable to locate free address for new Loco Consist, giving up.");
     }
   } else {
     LOG(INFO, "[Consist] Adding new Loco Consist %d", consistAddress);
-    _consists.add(new LocomotiveConsist(abs(consistAddress), consistAddress < 0));
-    return getConsistByID(abs(consistAddress));
+    auto consist = new LocomotiveConsist(abs(consistAddress), consistAddress < 0);
+    _consists.add(consist);
+    consist->markChanged();
+    return consist;
   }
   return nullptr;
 }
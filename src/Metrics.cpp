@@ -0,0 +1,195 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ESP32CommandStation.h"
+#include "S88Sensors.h"
+#include "SelectTcpServer.h"
+#include "WebServer.h"
+
+#include <mutex>
+#include <esp_heap_caps.h>
+
+// Prefix added to the name of all metrics.
+static constexpr const char * METRICS_PREFIX = "esp32cs_";
+
+static std::mutex metricsTaskLock;
+static std::vector<TaskHandle_t> metricsTasks;
+
+void Metrics::registerTask(TaskHandle_t task) {
+  std::lock_guard<std::mutex> guard(metricsTaskLock);
+  if(std::find(metricsTasks.begin(), metricsTasks.end(), task) == metricsTasks.end()) {
+    metricsTasks.push_back(task);
+  }
+}
+
+void Metrics::unregisterTask(TaskHandle_t task) {
+  std::lock_guard<std::mutex> guard(metricsTaskLock);
+  metricsTasks.erase(std::remove(metricsTasks.begin(), metricsTasks.end(), task), metricsTasks.end());
+}
+
+// writes the HELP and TYPE lines which precede the samples of a metric.
+static void writeHeader(Print &out, const char *name, const char *type, const char *help) {
+  out.printf("# HELP %s%s %s\n# TYPE %s%s %s\n", METRICS_PREFIX, name, help,
+             METRICS_PREFIX, name, type);
+}
+
+static void writeSample(Print &out, const char *name, uint32_t value) {
+  out.printf("%s%s %u\n", METRICS_PREFIX, name, value);
+}
+
+static void writeSample(Print &out, const char *name, const char *label,
+                        const char *labelValue, uint32_t value) {
+  out.printf("%s%s{%s=\"%s\"} %u\n", METRICS_PREFIX, name, label, labelValue, value);
+}
+
+static void writeMetric(Print &out, const char *name, const char *type,
+                        const char *help, uint32_t value) {
+  writeHeader(out, name, type, help);
+  writeSample(out, name, value);
+}
+
+static void writeSystemMetrics(Print &out) {
+  writeMetric(out, "uptime_seconds", "gauge", "Seconds since startup.", millis() / 1000);
+  writeMetric(out, "heap_free_bytes", "gauge", "Free heap.",
+              heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  writeMetric(out, "heap_min_free_bytes", "gauge", "Lowest free heap since startup.",
+              heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+  writeMetric(out, "heap_largest_free_block_bytes", "gauge", "Largest allocatable heap block.",
+              heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  writeHeader(out, "task_stack_free_bytes", "gauge", "Lowest amount of unused task stack.");
+  std::lock_guard<std::mutex> guard(metricsTaskLock);
+  for(auto task : metricsTasks) {
+    writeSample(out, "task_stack_free_bytes", "task", pcTaskGetTaskName(task),
+                uxTaskGetStackHighWaterMark(task) * sizeof(portSTACK_TYPE));
+  }
+}
+
+static void writeSignalGeneratorMetrics(Print &out) {
+  struct {
+    const char *name;
+    const char *type;
+    const char *help;
+    std::function<uint32_t(SignalGenerator *)> value;
+  } metrics[] = {
+    {"dcc_packets_queued_total", "counter", "DCC packets added to the send queue.",
+      [](SignalGenerator *signal) { return signal->getStatistics().queued.load(); }},
+    {"dcc_packets_sent_total", "counter", "DCC packets sent with all repeats.",
+      [](SignalGenerator *signal) { return signal->getStatistics().sent.load(); }},
+    {"dcc_packets_discarded_total", "counter", "DCC packets discarded from the send queue before being sent.",
+      [](SignalGenerator *signal) { return signal->getStatistics().discarded.load(); }},
+    {"dcc_idle_packets_total", "counter", "DCC idle packets sent due to an empty send queue.",
+      [](SignalGenerator *signal) { return signal->getStatistics().idle.load(); }},
+    {"dcc_slow_transmits_total", "counter", "DCC packets which took longer than expected to transmit.",
+      [](SignalGenerator *signal) { return signal->getStatistics().slowTransmits.load(); }},
+    {"dcc_queue_depth", "gauge", "DCC packets waiting in the send queue.",
+      [](SignalGenerator *signal) { return (uint32_t)signal->sendQueueUtilization(); }},
+    {"dcc_queue_high_water", "gauge", "Largest number of DCC packets in the send queue.",
+      [](SignalGenerator *signal) { return signal->getStatistics().queueHighWater.load(); }},
+    {"dcc_queue_capacity", "gauge", "Maximum number of DCC packets in the send queue.",
+      [](SignalGenerator *signal) { return (uint32_t)signal->getSendQueueCapacity(); }},
+  };
+  for(const auto &metric : metrics) {
+    writeHeader(out, metric.name, metric.type, metric.help);
+    for(auto signal : dccSignal) {
+      if(signal) {
+        writeSample(out, metric.name, "track", signal->getName(), metric.value(signal));
+      }
+    }
+  }
+}
+
+static void writeMotorBoardMetrics(Print &out) {
+  std::vector<GenericMotorBoard *> boards;
+  for(auto name : MotorBoardManager::getBoardNames()) {
+    boards.push_back(MotorBoardManager::getBoardByName(name));
+  }
+  writeHeader(out, "motorboard_current_milliamps", "gauge", "Most recent current reading.");
+  for(auto board : boards) {
+    writeSample(out, "motorboard_current_milliamps", "board", board->getName().c_str(),
+                board->getCurrentDraw());
+  }
+  writeHeader(out, "motorboard_power_on", "gauge", "Motor board output is enabled.");
+  for(auto board : boards) {
+    writeSample(out, "motorboard_power_on", "board", board->getName().c_str(), board->isOn());
+  }
+  writeHeader(out, "motorboard_overcurrent", "gauge", "Motor board has been disabled due to an overcurrent.");
+  for(auto board : boards) {
+    writeSample(out, "motorboard_overcurrent", "board", board->getName().c_str(),
+                board->isOverCurrent());
+  }
+}
+
+static void writeClientMetrics(Print &out) {
+  writeMetric(out, "websocket_clients", "gauge", "Connected WebSocket clients.",
+              esp32csWebServer.getWebSocketClientCount());
+  writeMetric(out, "websocket_sent_bytes_total", "counter", "Bytes queued for WebSocket clients.",
+              esp32csWebServer.getWebSocketBytesSent());
+  auto &servers = SelectTcpServer::getServers();
+  writeHeader(out, "tcp_clients", "gauge", "Connected TCP clients.");
+  for(auto server : servers) {
+    writeSample(out, "tcp_clients", "server", server->getName(), server->getClientCount());
+  }
+  writeHeader(out, "tcp_sent_bytes_total", "counter", "Bytes sent to TCP clients.");
+  for(auto server : servers) {
+    writeSample(out, "tcp_sent_bytes_total", "server", server->getName(), server->getBytesSent());
+  }
+  writeHeader(out, "tcp_received_bytes_total", "counter", "Bytes received from TCP clients.");
+  for(auto server : servers) {
+    writeSample(out, "tcp_received_bytes_total", "server", server->getName(), server->getBytesReceived());
+  }
+  writeHeader(out, "tcp_discarded_bytes_total", "counter", "Bytes discarded for TCP clients which are not reading.");
+  for(auto server : servers) {
+    writeSample(out, "tcp_discarded_bytes_total", "server", server->getName(), server->getBytesDiscarded());
+  }
+}
+
+void Metrics::write(Print &out) {
+  writeSystemMetrics(out);
+  writeSignalGeneratorMetrics(out);
+  writeMotorBoardMetrics(out);
+  writeClientMetrics(out);
+  writeMetric(out, "active_locomotives", "gauge", "Locomotives being refreshed on the track.",
+              LocomotiveManager::getActiveLocoCount());
+  writeMetric(out, "change_sequence", "counter", "Entity state changes recorded.",
+              ChangeLog::getSequence());
+#if S88_ENABLED
+  writeMetric(out, "s88_scan_microseconds", "gauge", "Duration of the most recent S88 scan.",
+              S88BusManager::getLastScanMicros());
+  writeMetric(out, "s88_scan_max_microseconds", "gauge", "Duration of the slowest S88 scan.",
+              S88BusManager::getMaxScanMicros());
+  writeMetric(out, "s88_scans_total", "counter", "S88 scans completed.",
+              S88BusManager::getScanCount());
+#endif
+#if LOCONET_ENABLED
+  writeMetric(out, "loconet_rx_packets_total", "counter", "LocoNet packets received.",
+              locoNet.getRxStats()->rxPackets);
+  writeMetric(out, "loconet_rx_errors_total", "counter", "LocoNet receive errors.",
+              locoNet.getRxStats()->rxErrors);
+  writeMetric(out, "loconet_tx_packets_total", "counter", "LocoNet packets sent.",
+              locoNet.getTxStats()->txPackets);
+  writeMetric(out, "loconet_tx_errors_total", "counter", "LocoNet transmit errors.",
+              locoNet.getTxStats()->txErrors);
+  writeMetric(out, "loconet_collisions_total", "counter", "LocoNet transmit collisions.",
+              locoNet.getTxStats()->collisions);
+#endif
+#if LCC_ENABLED
+  writeMetric(out, "lcc_buffer_pool_bytes", "gauge", "Bytes allocated by the LCC buffer pool.",
+              mainBufferPool->total_size());
+  writeMetric(out, "lcc_buffer_pool_free_items", "gauge", "Free buffers held by the LCC buffer pool.",
+              mainBufferPool->free_items());
+#endif
+}
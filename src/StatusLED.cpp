@@ -65,6 +65,7 @@ TaskHandle_t statusTaskHandle;
 
 void updateStatusLEDs(void *arg) {
     esp_task_wdt_add(NULL);
+    Metrics::registerTask(xTaskGetCurrentTaskHandle());
     statusLED.Begin();
     statusLED.SetBrightness(STATUS_LED_BRIGHTNESS);
     statusLED.ClearTo(RGB_OFF);
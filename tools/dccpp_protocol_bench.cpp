@@ -0,0 +1,170 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host benchmark of the DCC++ protocol handling. This links the firmware
+// src/Interfaces/DCCppProtocol.cpp with the host stubs from tools/host and
+// replays command mixes through DCCPPProtocolConsumer::feed as the JMRI and
+// WebSocket interfaces do. For each mix the CPU time and heap allocations per
+// command and the time from the start of feed until each DCC packet (or
+// programming track job) is queued are reported, followed by the <stats>
+// output of the firmware. It also verifies that programming track jobs from
+// different connections are queued separately.
+//
+// usage: g++ -std=c++11 -O2 -Wall -Wno-sign-compare -I tools/host -I include tools/dccpp_protocol_bench.cpp tools/host/HostStubs.cpp tools/host/HostProgrammingTrack.cpp src/Interfaces/DCCppProtocol.cpp -o dccpp_protocol_bench && ./dccpp_protocol_bench [ITERATIONS]
+//
+// The exit code is non-zero if the programming track jobs are not queued per
+// connection.
+//
+// The host times are only useful for comparing changes, the ESP32 is
+// roughly an order of magnitude slower. The allocation counts match the
+// firmware for the protocol code, the command handlers are stubs which
+// build the same DCC packets as the firmware handlers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ESP32CommandStation.h"
+
+struct CommandMix {
+  const char *name;
+  // each entry is passed to a single feed call.
+  std::vector<const char *> feeds;
+  // number of commands contained in all of the feeds.
+  uint32_t commands;
+};
+
+struct MixResult {
+  uint64_t time{0};
+  uint64_t allocations{0};
+  uint64_t bytes{0};
+  uint32_t commands{0};
+  uint32_t packets{0};
+  uint32_t progJobs{0};
+  std::vector<uint32_t> latencies;
+};
+
+static uint32_t percentile(std::vector<uint32_t> &samples, uint8_t percentile) {
+  if(samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[std::min(samples.size() - 1, (samples.size() * percentile) / 100)];
+}
+
+static MixResult run(const CommandMix &mix, uint32_t iterations) {
+  MixResult result;
+  DCCPPProtocolConsumer consumer;
+  // sized for the largest feed so that the copy does not allocate.
+  uint8_t buffer[256];
+  result.latencies.reserve(iterations * mix.commands * 2);
+  for(uint32_t iteration = 0; iteration < iterations; iteration++) {
+    hostEnqueueRecorder.clear();
+    for(auto feed : mix.feeds) {
+      size_t len = strlen(feed);
+      memcpy(buffer, feed, len);
+      auto allocations = getHostAllocationStats();
+      uint64_t start = getHostTimeNanos();
+      hostEnqueueRecorder.start = start;
+      consumer.feed(buffer, len);
+      result.time += getHostTimeNanos() - start;
+      auto after = getHostAllocationStats();
+      result.allocations += after.allocations - allocations.allocations;
+      result.bytes += after.bytes - allocations.bytes;
+    }
+    result.commands += mix.commands;
+    result.packets += hostEnqueueRecorder.packets;
+    result.progJobs += hostEnqueueRecorder.progJobs;
+    result.latencies.insert(result.latencies.end(), hostEnqueueRecorder.latencies.begin(),
+                            hostEnqueueRecorder.latencies.end());
+  }
+  return result;
+}
+
+// returns the client used for a <R> command received via the consumer.
+static prog_client_t getReadCVClient(DCCPPProtocolConsumer &consumer) {
+  char command[] = "<R 1 100 200>";
+  consumer.feed((uint8_t *)command, strlen(command));
+  return hostEnqueueRecorder.progClient;
+}
+
+// each connection has its own consumer and must have its own programming
+// track queue, commands from the same connection share the queue.
+static bool connectionsQueuedSeparately() {
+  DCCPPProtocolConsumer first;
+  DCCPPProtocolConsumer second;
+  prog_client_t firstClient = getReadCVClient(first);
+  prog_client_t secondClient = getReadCVClient(second);
+  return firstClient != secondClient &&
+         getReadCVClient(first) == firstClient &&
+         (firstClient >> 32) == PROG_CLIENT_DCCPP &&
+         (secondClient >> 32) == PROG_CLIENT_DCCPP;
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = argc > 1 ? atoi(argv[1]) : 20000;
+  DCCPPProtocolHandler::init();
+  if(!connectionsQueuedSeparately()) {
+    printf("FAILED: programming track jobs from different connections share a queue\n");
+    return 1;
+  }
+
+  const std::vector<CommandMix> mixes = {
+    // a single throttle change per frame, typical of a JMRI throttle.
+    {"throttle", {"<t 1 3 50 1>"}, 1},
+    // eight throttle changes for two locomotives received together, the
+    // batch path drops the superseded changes.
+    {"throttle burst", {"<t 1 3 10 1><t 2 4 10 1><t 1 3 20 1><t 2 4 20 1>"
+                        "<t 1 3 30 1><t 2 4 30 1><t 1 3 40 1><t 2 4 40 1>"}, 8},
+    // function changes for FL-F4 and F13-F20.
+    {"functions", {"<f 3 144>", "<f 3 222 5>"}, 2},
+    // a throttle command split across three reads of the socket, the
+    // latency is measured from the final read.
+    {"split throttle", {"<t 1 3", " 60", " 1>"}, 1},
+    // one of each of the commonly used commands per frame.
+    {"mixed", {"<t 1 3 70 1>", "<f 3 128>", "<a 10 1 1>", "<T 5 1>",
+               "<w 3 29 6>", "<R 1 100 200>", "<c>", "<F>"}, 8},
+  };
+
+  printf("%-16s %8s %10s %9s %11s %8s %8s %8s %8s\n", "mix", "commands",
+         "ns/cmd", "allocs/cmd", "bytes/cmd", "queued", "p50 ns", "p99 ns", "max ns");
+  for(const auto &mix : mixes) {
+    // the first pass creates the locomotives, it is not included.
+    run(mix, 1);
+    auto result = run(mix, iterations);
+    uint32_t queued = result.packets + result.progJobs;
+    printf("%-16s %8u %10.1f %10.2f %11.1f %8u %8u %8u %8u\n", mix.name,
+           result.commands, (double)result.time / result.commands,
+           (double)result.allocations / result.commands,
+           (double)result.bytes / result.commands, queued,
+           percentile(result.latencies, 50), percentile(result.latencies, 99),
+           percentile(result.latencies, 100));
+  }
+
+  printf("\nfirmware statistics:\n");
+  wifiInterface.capture = true;
+  DCCPPProtocolConsumer consumer;
+  char stats[] = "<stats>";
+  consumer.feed((uint8_t *)stats, strlen(stats));
+  String output = wifiInterface.captured;
+  int start = 0;
+  int end;
+  while((end = output.indexOf('>', start)) >= 0) {
+    printf("%s\n", output.substring(start, end + 1).c_str());
+    start = end + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,348 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+// Host replacement for include/ESP32CommandStation.h, this allows firmware
+// sources such as src/Interfaces/DCCppProtocol.cpp to be compiled and linked
+// into the host tools. This directory must be before include on the include
+// path so it is used instead of the real header.
+//
+// Only the declarations used by the linked sources are provided. The
+// managers parse their arguments and build DCC packets as the firmware does
+// but the packets and programming track jobs are only recorded, the
+// implementations are in tools/host/HostStubs.cpp.
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <stdint.h>
+#include <vector>
+
+#include <WString.h>
+
+#include "DCCppProtocol.h"
+#include "DCCProgrammer.h"
+
+#define VERSION "host"
+#define S88_ENABLED false
+#define STATUS_LED_ENABLED false
+#define VIRTUAL_DECODER_ENABLED false
+
+// the host tools measure the protocol handling, not the console output.
+#define LOG(level, fmt, ...) do {} while(0)
+#define LOG_ERROR(fmt, ...) do {} while(0)
+
+#define MOTORBOARD_NAME_PROG "PROG"
+
+#define DCC_SIGNAL_OPERATIONS 0
+#define DCC_SIGNAL_PROGRAMMING 1
+#define MAX_DCC_SIGNAL_GENERATORS 2
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? ((value) |= (1UL << (bit))) : ((value) &= ~(1UL << (bit))))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+
+// minimal version of the ESPAsyncWebServer LinkedList used by the firmware.
+template <typename T>
+class LinkedList {
+public:
+  typedef std::function<void(const T &)> OnRemove;
+  LinkedList(OnRemove onRemove) : _onRemove(onRemove) {}
+  ~LinkedList() {
+    for(auto item : _items) {
+      _onRemove(item);
+    }
+  }
+  void add(const T &item) {
+    _items.push_back(item);
+  }
+  typename std::list<T>::const_iterator begin() const {
+    return _items.begin();
+  }
+  typename std::list<T>::const_iterator end() const {
+    return _items.end();
+  }
+private:
+  OnRemove _onRemove;
+  std::list<T> _items;
+};
+
+// Counters maintained by the global operator new of HostStubs.cpp.
+struct HostAllocationStats {
+  uint64_t allocations{0};
+  uint64_t bytes{0};
+};
+HostAllocationStats getHostAllocationStats();
+
+// monotonic host time in nanoseconds.
+uint64_t getHostTimeNanos();
+
+// Records the time from the start of DCCPPProtocolConsumer::feed (or any
+// other entry point being measured) until a DCC packet or programming track
+// job has been queued.
+struct HostEnqueueRecorder {
+  // set by the tool immediately before calling the entry point.
+  uint64_t start{0};
+  // nanoseconds from start for each packet or job queued.
+  std::vector<uint32_t> latencies;
+  uint32_t packets{0};
+  uint32_t progJobs{0};
+  // client of the most recently queued programming track job.
+  prog_client_t progClient{0};
+  void record() {
+    latencies.push_back(getHostTimeNanos() - start);
+  }
+  void clear() {
+    latencies.clear();
+    packets = 0;
+    progJobs = 0;
+  }
+};
+extern HostEnqueueRecorder hostEnqueueRecorder;
+
+class ESPClass {
+public:
+  // simulated free heap, this decreases by the number of bytes currently
+  // allocated via operator new.
+  uint32_t getFreeHeap();
+};
+extern ESPClass ESP;
+
+int64_t esp_timer_get_time();
+
+// Simulated time in microseconds for the tools which model the programming
+// track, this is advanced by vTaskDelay and by the transmission time of each
+// packet sent via a SignalGenerator which has a packetSent handler.
+extern uint64_t hostSimulatedMicros;
+
+// FreeRTOS functions used by the linked sources, one tick is 1ms. Tasks are
+// never started, tools call the task bodies directly.
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t UBaseType_t;
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdMS_TO_TICKS(ms) (ms)
+void vTaskDelay(uint32_t);
+BaseType_t xTaskCreate(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *);
+static inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return nullptr;
+}
+static inline void xTaskNotifyGive(TaskHandle_t) {}
+static inline uint32_t ulTaskNotifyTake(BaseType_t, uint32_t) {
+  return 0;
+}
+static inline void esp_task_wdt_reset() {}
+
+class Metrics {
+public:
+  static void registerTask(TaskHandle_t) {}
+};
+
+static constexpr uint8_t resetPacket[] = {0x00, 0x00};
+
+class SignalGenerator {
+public:
+  // the packet is only recorded, repeat and priority are ignored.
+  void loadPacket(std::vector<uint8_t>, int=0, bool=false, uint32_t=0);
+  // when packetSent is set the packet is queued for waitForQueueEmpty,
+  // otherwise this is the same as loadPacket.
+  void loadBytePacket(const uint8_t *, uint8_t, uint8_t, bool=false, uint32_t=0);
+  // transmits the queued packets, each packet (with the checksum byte) is
+  // passed to packetSent once per transmission as the firmware would
+  // transmit it and hostSimulatedMicros is advanced by the transmission time.
+  void waitForQueueEmpty();
+  bool isEnabled() {
+    return _enabled;
+  }
+  bool _enabled{true};
+  std::function<void(const uint8_t *, uint8_t)> packetSent;
+private:
+  std::vector<std::vector<uint8_t>> _queue;
+};
+extern SignalGenerator *dccSignal[MAX_DCC_SIGNAL_GENERATORS];
+bool stopDCCSignalGenerators();
+void startDCCSignalGenerators();
+
+// Discards all output unless capture is set, in which case the output is
+// appended to captured. Batches are supported for the calling thread only.
+class WiFiInterface {
+public:
+  void showInitInfo();
+  void send(const String &);
+  void print(const __FlashStringHelper *fmt, ...);
+  void notifyTurnoutState(uint16_t, bool) {}
+  void notifyPowerState() {}
+  void beginBatch();
+  void endBatch();
+  bool capture{false};
+  String captured;
+  uint32_t messages{0};
+  uint64_t bytes{0};
+private:
+  bool _batchActive{false};
+  String _batch;
+};
+extern WiFiInterface wifiInterface;
+
+class ConfigurationManager {
+public:
+  void clear() {}
+};
+extern ConfigurationManager configStore;
+
+class Locomotive {
+public:
+  Locomotive(int registerNumber) : _registerNumber(registerNumber) {}
+  int getRegister() {
+    return _registerNumber;
+  }
+  uint16_t getLocoAddress() {
+    return _locoAddress;
+  }
+  void setLocoAddress(uint16_t address) {
+    _locoAddress = address;
+  }
+  void markChanged() {}
+  int8_t getSpeed() {
+    return _speed;
+  }
+  void setSpeed(int8_t speed) {
+    _speed = speed;
+  }
+  bool isDirectionForward() {
+    return _direction;
+  }
+  void setDirection(bool forward) {
+    _direction = forward;
+  }
+  void setFunction(uint8_t, bool, bool=false);
+  void setFunctions(uint8_t, uint8_t, uint8_t);
+  bool isFunctionEnabled(uint8_t funcID) {
+    return bitRead(_functions, funcID);
+  }
+  void sendLocoUpdate(bool=false);
+  void showStatus();
+private:
+  void sendFunctionPacket(uint8_t);
+  int _registerNumber;
+  uint16_t _locoAddress{0};
+  int8_t _speed{0};
+  bool _direction{true};
+  uint32_t _functions{0};
+};
+
+class LocomotiveManager {
+public:
+  static void processThrottle(const std::vector<String>);
+  static void processThrottleEx(const std::vector<String>);
+  static void processFunction(const std::vector<String>);
+  static void processFunctionEx(const std::vector<String>);
+  static void emergencyStop();
+  static Locomotive *getLocomotive(const uint16_t, const bool=true);
+  static Locomotive *getLocomotiveByRegister(const uint8_t);
+  static bool isConsistAddress(uint16_t) {
+    return false;
+  }
+  static bool isAddressInConsist(uint16_t) {
+    return false;
+  }
+  static void showStatus();
+  static void clear();
+  static uint16_t store() {
+    return 0;
+  }
+};
+
+class TurnoutManager {
+public:
+  static void clear() {}
+  static uint16_t store() {
+    return 0;
+  }
+  static void showStatus() {}
+};
+
+class SensorManager {
+public:
+  static void clear() {}
+  static uint16_t store() {
+    return 0;
+  }
+};
+
+class OutputManager {
+public:
+  static void clear() {}
+  static uint16_t store() {
+    return 0;
+  }
+  static void showStatus() {}
+};
+
+// Motor board methods used by src/DCC/DCCProgrammer.cpp, these are only
+// declared here and must be implemented by the tools which link it, see
+// tools/virtual_decoder_sim.cpp.
+class GenericMotorBoard {
+public:
+  void powerOn(bool=true);
+  void powerOff(bool=true);
+  uint32_t getMaxMilliAmps();
+  uint16_t captureSample(uint8_t, bool=false);
+  void startAckSampling();
+  void stopAckSampling();
+  void resetAckDetection();
+  bool waitForAck(uint16_t, uint32_t);
+};
+
+class MotorBoardManager {
+public:
+  static GenericMotorBoard *getBoardByName(String);
+  static void showStatus();
+};
+
+// DCC++ command handlers implemented by other firmware modules, each one
+// parses its arguments and queues the same DCC packets as the firmware
+// handler. The IDs match the firmware handlers so that the lookup in
+// DCCPPProtocolHandler::getCommandHandler has the same cost.
+#define HOST_COMMAND_ADAPTER(name, id)                 \
+  class name : public DCCPPProtocolCommand {           \
+  public:                                              \
+    void process(const std::vector<String>);           \
+    String getID() {                                   \
+      return id;                                       \
+    }                                                  \
+  };
+
+HOST_COMMAND_ADAPTER(ThrottleCommandAdapter, "t")
+HOST_COMMAND_ADAPTER(ThrottleExCommandAdapter, "tex")
+HOST_COMMAND_ADAPTER(FunctionCommandAdapter, "f")
+HOST_COMMAND_ADAPTER(FunctionExCommandAdapter, "fex")
+HOST_COMMAND_ADAPTER(ConsistCommandAdapter, "C")
+HOST_COMMAND_ADAPTER(AccessoryCommand, "a")
+HOST_COMMAND_ADAPTER(PowerOnCommand, "1")
+HOST_COMMAND_ADAPTER(PowerOffCommand, "0")
+HOST_COMMAND_ADAPTER(CurrentDrawCommand, "c")
+HOST_COMMAND_ADAPTER(OutputCommandAdapter, "Z")
+HOST_COMMAND_ADAPTER(OutputExCommandAdapter, "Zex")
+HOST_COMMAND_ADAPTER(TurnoutCommandAdapter, "T")
+HOST_COMMAND_ADAPTER(TurnoutExCommandAdapter, "Tex")
+HOST_COMMAND_ADAPTER(SensorCommandAdapter, "S")
+HOST_COMMAND_ADAPTER(RemoteSensorsCommandAdapter, "RS")
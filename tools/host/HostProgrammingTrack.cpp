@@ -0,0 +1,82 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host implementations of the ProgrammingTrackManager and OPS programming
+// functions which only record the jobs and packets, this file is linked into
+// the host tools which measure the protocol handling. Tools which execute
+// programming track jobs link src/DCC/DCCProgrammer.cpp instead.
+
+#include "ESP32CommandStation.h"
+
+// Programming track jobs are recorded and the callback is discarded, the job
+// is never executed.
+static std::vector<prog_cv_callback_t> progJobs;
+
+static void queueProgJob(const prog_client_t client, prog_cv_callback_t callback) {
+  progJobs.push_back(callback);
+  hostEnqueueRecorder.progClient = client;
+  hostEnqueueRecorder.progJobs++;
+  hostEnqueueRecorder.record();
+  if(progJobs.size() > 64) {
+    progJobs.clear();
+  }
+}
+
+void ProgrammingTrackManager::readCV(const prog_client_t client, const uint16_t, prog_cv_callback_t callback) {
+  queueProgJob(client, callback);
+}
+
+void ProgrammingTrackManager::writeCVByte(const prog_client_t client, const uint16_t, const uint8_t,
+                                          prog_cv_callback_t callback) {
+  queueProgJob(client, callback);
+}
+
+void ProgrammingTrackManager::writeCVBit(const prog_client_t client, const uint16_t, const uint8_t,
+                                         const bool, prog_cv_callback_t callback) {
+  queueProgJob(client, callback);
+}
+
+CVReadStatistics ProgrammingTrackManager::getReadStatistics() {
+  return CVReadStatistics();
+}
+
+void ProgrammingTrackManager::resetReadStatistics() {
+}
+
+void writeOpsCVByte(const uint16_t locoAddress, const uint16_t cv, const uint8_t value) {
+  std::vector<uint8_t> packetBuffer;
+  if(locoAddress > 127) {
+    packetBuffer.push_back((uint8_t)(0xC0 | highByte(locoAddress)));
+  }
+  packetBuffer.push_back(lowByte(locoAddress));
+  packetBuffer.push_back(0xEC + (highByte(cv - 1) & 0x03));
+  packetBuffer.push_back(lowByte(cv - 1));
+  packetBuffer.push_back(value);
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packetBuffer, 4);
+}
+
+void writeOpsCVBit(const uint16_t locoAddress, const uint16_t cv, const uint8_t bit, const bool value) {
+  std::vector<uint8_t> packetBuffer;
+  if(locoAddress > 127) {
+    packetBuffer.push_back((uint8_t)(0xC0 | highByte(locoAddress)));
+  }
+  packetBuffer.push_back(lowByte(locoAddress));
+  packetBuffer.push_back(0xE8 + (highByte(cv - 1) & 0x03));
+  packetBuffer.push_back(lowByte(cv - 1));
+  packetBuffer.push_back(0xF0 + bit + value * 8);
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packetBuffer, 4);
+}
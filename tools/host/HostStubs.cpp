@@ -0,0 +1,463 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host implementations of the declarations in tools/host/ESP32CommandStation.h,
+// this file is linked into each host tool which links firmware sources.
+
+#include "ESP32CommandStation.h"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+
+// Size of the simulated heap reported by ESP.getFreeHeap().
+static constexpr uint32_t HOST_HEAP_SIZE = 200 * 1024;
+
+// Bytes reserved in front of each allocation to hold the allocation size,
+// this keeps the returned pointer aligned for any type.
+static constexpr size_t HOST_ALLOCATION_HEADER = 16;
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+static std::atomic<int64_t> liveBytes{0};
+
+static void *hostAllocate(size_t size) {
+  uint8_t *block = (uint8_t *)malloc(size + HOST_ALLOCATION_HEADER);
+  if(!block) {
+    throw std::bad_alloc();
+  }
+  *(size_t *)block = size;
+  allocations++;
+  allocatedBytes += size;
+  liveBytes += size;
+  return block + HOST_ALLOCATION_HEADER;
+}
+
+static void hostRelease(void *ptr) {
+  if(ptr) {
+    uint8_t *block = (uint8_t *)ptr - HOST_ALLOCATION_HEADER;
+    liveBytes -= *(size_t *)block;
+    free(block);
+  }
+}
+
+void *operator new(size_t size) {
+  return hostAllocate(size);
+}
+
+void *operator new[](size_t size) {
+  return hostAllocate(size);
+}
+
+void operator delete(void *ptr) noexcept {
+  hostRelease(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  hostRelease(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  hostRelease(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+  hostRelease(ptr);
+}
+
+HostAllocationStats getHostAllocationStats() {
+  HostAllocationStats stats;
+  stats.allocations = allocations;
+  stats.bytes = allocatedBytes;
+  return stats;
+}
+
+uint64_t getHostTimeNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+HostEnqueueRecorder hostEnqueueRecorder;
+
+ESPClass ESP;
+
+uint32_t ESPClass::getFreeHeap() {
+  return HOST_HEAP_SIZE - liveBytes;
+}
+
+int64_t esp_timer_get_time() {
+  return getHostTimeNanos() / 1000;
+}
+
+uint64_t hostSimulatedMicros = 0;
+
+void vTaskDelay(uint32_t ticks) {
+  hostSimulatedMicros += ticks * 1000ULL;
+}
+
+BaseType_t xTaskCreate(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *) {
+  return pdPASS;
+}
+
+// Duration of the DCC bits generated by src/DCC/DCCSignalGenerator_RMT.cpp.
+static constexpr uint32_t DCC_ONE_BIT_USEC = 116;
+static constexpr uint32_t DCC_ZERO_BIT_USEC = 196;
+
+// Number of preamble bits sent before each packet, this matches
+// PACKET_PREAMBLE_BITS.
+static constexpr uint32_t DCC_PREAMBLE_BITS = 22;
+
+static SignalGenerator opsSignal;
+static SignalGenerator progSignal;
+SignalGenerator *dccSignal[MAX_DCC_SIGNAL_GENERATORS] = {&opsSignal, &progSignal};
+
+void SignalGenerator::loadPacket(std::vector<uint8_t> data, int, bool, uint32_t) {
+  hostEnqueueRecorder.packets++;
+  hostEnqueueRecorder.record();
+}
+
+void SignalGenerator::loadBytePacket(const uint8_t *data, uint8_t length, uint8_t repeatCount, bool, uint32_t) {
+  if(!packetSent) {
+    loadPacket(std::vector<uint8_t>(data, data + length), repeatCount);
+    return;
+  }
+  std::vector<uint8_t> packet(data, data + length);
+  uint8_t checksum = 0;
+  for(auto value : packet) {
+    checksum ^= value;
+  }
+  packet.push_back(checksum);
+  // the firmware sends the packet once when the repeat count is zero.
+  for(uint8_t count = 0; count < std::max((uint8_t)1, repeatCount); count++) {
+    _queue.push_back(packet);
+  }
+}
+
+void SignalGenerator::waitForQueueEmpty() {
+  for(auto &packet : _queue) {
+    uint32_t packetTime = DCC_PREAMBLE_BITS * DCC_ONE_BIT_USEC;
+    for(auto value : packet) {
+      // zero start bit followed by the data bits.
+      packetTime += DCC_ZERO_BIT_USEC;
+      for(uint8_t bit = 0; bit < 8; bit++) {
+        packetTime += ((value >> bit) & 0x01) ? DCC_ONE_BIT_USEC : DCC_ZERO_BIT_USEC;
+      }
+    }
+    // packet end bit and the trailing bit added by the RMT conversion.
+    packetTime += 2 * DCC_ONE_BIT_USEC;
+    hostSimulatedMicros += packetTime;
+    packetSent(packet.data(), packet.size());
+  }
+  _queue.clear();
+}
+
+bool stopDCCSignalGenerators() {
+  return false;
+}
+
+void startDCCSignalGenerators() {
+}
+
+WiFiInterface wifiInterface;
+
+void WiFiInterface::showInitInfo() {
+  print(F("<N1: host>"));
+}
+
+void WiFiInterface::send(const String &buf) {
+  if(_batchActive) {
+    _batch += buf;
+    return;
+  }
+  messages++;
+  bytes += buf.length();
+  if(capture) {
+    captured += buf;
+  }
+}
+
+void WiFiInterface::print(const __FlashStringHelper *fmt, ...) {
+  char buf[256] = {0};
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), (const char *)fmt, args);
+  va_end(args);
+  send(buf);
+}
+
+void WiFiInterface::beginBatch() {
+  _batchActive = true;
+  _batch = "";
+}
+
+void WiFiInterface::endBatch() {
+  String buf = std::move(_batch);
+  _batchActive = false;
+  if(buf.length()) {
+    send(buf);
+  }
+}
+
+ConfigurationManager configStore;
+
+// The coalescing of forced updates done by the firmware is not modelled,
+// every forced update queues a speed packet.
+void Locomotive::sendLocoUpdate(bool force) {
+  if(!force) {
+    return;
+  }
+  std::vector<uint8_t> packetBuffer;
+  if(_locoAddress > 127) {
+    packetBuffer.push_back((uint8_t)(0xC0 | highByte(_locoAddress)));
+  }
+  packetBuffer.push_back(lowByte(_locoAddress));
+  packetBuffer.push_back(0x3F);
+  if(_speed < 0) {
+    _speed = 0;
+    packetBuffer.push_back(1);
+  } else {
+    packetBuffer.push_back((uint8_t)(_speed + (_speed > 0) + _direction * 128));
+  }
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packetBuffer);
+}
+
+void Locomotive::showStatus() {
+  wifiInterface.print(F("<T %d %d %d>"), _registerNumber, _speed, _direction);
+}
+
+void Locomotive::setFunction(uint8_t funcID, bool state, bool batch) {
+  if(state) {
+    _functions |= (1UL << funcID);
+  } else {
+    _functions &= ~(1UL << funcID);
+  }
+  if(!batch) {
+    sendFunctionPacket(funcID);
+  }
+}
+
+void Locomotive::setFunctions(uint8_t firstFunction, uint8_t lastFunction, uint8_t mask) {
+  for(uint8_t funcID = firstFunction; funcID <= lastFunction; funcID++) {
+    setFunction(funcID, bitRead(mask, funcID - firstFunction), funcID < lastFunction);
+  }
+}
+
+// sends the function group packet which contains the function.
+void Locomotive::sendFunctionPacket(uint8_t funcID) {
+  std::vector<uint8_t> packetBuffer;
+  if(_locoAddress > 127) {
+    packetBuffer.push_back((uint8_t)(0xC0 | highByte(_locoAddress)));
+  }
+  packetBuffer.push_back(lowByte(_locoAddress));
+  if(funcID <= 4) {
+    packetBuffer.push_back(0x80 | (bitRead(_functions, 0) << 4) | ((_functions >> 1) & 0x0F));
+  } else if(funcID <= 8) {
+    packetBuffer.push_back(0xB0 | ((_functions >> 5) & 0x0F));
+  } else if(funcID <= 12) {
+    packetBuffer.push_back(0xA0 | ((_functions >> 9) & 0x0F));
+  } else if(funcID <= 20) {
+    packetBuffer.push_back(0xDE);
+    packetBuffer.push_back((_functions >> 13) & 0xFF);
+  } else {
+    packetBuffer.push_back(0xDF);
+    packetBuffer.push_back((_functions >> 21) & 0xFF);
+  }
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packetBuffer);
+}
+
+static std::list<Locomotive *> locos;
+
+void LocomotiveManager::processThrottle(const std::vector<String> arguments) {
+  int registerNumber = arguments[0].toInt();
+  uint16_t locoAddress = arguments[1].toInt();
+  Locomotive *instance = getLocomotiveByRegister(registerNumber);
+  if(instance == nullptr) {
+    instance = new Locomotive(registerNumber);
+    locos.push_back(instance);
+  }
+  if(instance->getLocoAddress() != locoAddress) {
+    instance->setLocoAddress(locoAddress);
+    instance->markChanged();
+  }
+  instance->setSpeed(arguments[2].toInt());
+  instance->setDirection(arguments[3].toInt() == 1);
+  instance->sendLocoUpdate(true);
+  instance->showStatus();
+}
+
+void LocomotiveManager::processThrottleEx(const std::vector<String> arguments) {
+  auto instance = getLocomotive(arguments[0].toInt());
+  int8_t speed = arguments[1].toInt();
+  int8_t dir = arguments[2].toInt();
+  if(speed >= 0) {
+    instance->setSpeed(speed);
+  }
+  if(dir >= 0) {
+    instance->setDirection(dir == 1);
+  }
+  instance->sendLocoUpdate(true);
+  instance->showStatus();
+}
+
+void LocomotiveManager::processFunction(const std::vector<String> arguments) {
+  auto loco = getLocomotive(arguments[0].toInt());
+  int functionByte = arguments[1].toInt();
+  if(arguments.size() > 2) {
+    int secondaryFunctionByte = arguments[2].toInt();
+    if((functionByte & 0xDE) == 0xDE) {
+      loco->setFunctions(13, 20, secondaryFunctionByte);
+    } else {
+      loco->setFunctions(21, 28, secondaryFunctionByte);
+    }
+  } else if((functionByte & 0xB0) == 0xB0) {
+    loco->setFunctions(5, 8, functionByte);
+  } else if((functionByte & 0xA0) == 0xA0) {
+    loco->setFunctions(9, 12, functionByte);
+  } else {
+    loco->setFunction(0, bitRead(functionByte, 4), true);
+    loco->setFunctions(1, 4, functionByte);
+  }
+}
+
+void LocomotiveManager::processFunctionEx(const std::vector<String> arguments) {
+  auto loco = getLocomotive(arguments[0].toInt());
+  loco->setFunction(arguments[1].toInt(), arguments[2].toInt());
+}
+
+void LocomotiveManager::emergencyStop() {
+  for(auto loco : locos) {
+    loco->setSpeed(-1);
+    loco->sendLocoUpdate(true);
+  }
+}
+
+Locomotive *LocomotiveManager::getLocomotive(const uint16_t locoAddress, const bool) {
+  if(!locoAddress) {
+    return nullptr;
+  }
+  for(auto loco : locos) {
+    if(loco->getLocoAddress() == locoAddress) {
+      return loco;
+    }
+  }
+  auto instance = new Locomotive(-1);
+  instance->setLocoAddress(locoAddress);
+  locos.push_back(instance);
+  return instance;
+}
+
+Locomotive *LocomotiveManager::getLocomotiveByRegister(const uint8_t registerNumber) {
+  for(auto loco : locos) {
+    if(loco->getRegister() == registerNumber) {
+      return loco;
+    }
+  }
+  return nullptr;
+}
+
+void LocomotiveManager::showStatus() {
+  for(auto loco : locos) {
+    loco->showStatus();
+  }
+}
+
+void LocomotiveManager::clear() {
+  for(auto loco : locos) {
+    delete loco;
+  }
+  locos.clear();
+}
+
+void MotorBoardManager::showStatus() {
+  wifiInterface.print(F("<p1 MAIN>"));
+}
+
+void ThrottleCommandAdapter::process(const std::vector<String> arguments) {
+  LocomotiveManager::processThrottle(arguments);
+}
+
+void ThrottleExCommandAdapter::process(const std::vector<String> arguments) {
+  LocomotiveManager::processThrottleEx(arguments);
+}
+
+void FunctionCommandAdapter::process(const std::vector<String> arguments) {
+  LocomotiveManager::processFunction(arguments);
+}
+
+void FunctionExCommandAdapter::process(const std::vector<String> arguments) {
+  LocomotiveManager::processFunctionEx(arguments);
+}
+
+void ConsistCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
+
+void AccessoryCommand::process(const std::vector<String> arguments) {
+  std::vector<uint8_t> packetBuffer;
+  uint16_t boardAddress = arguments[0].toInt();
+  uint8_t boardIndex = arguments[1].toInt();
+  bool activate = arguments[2].toInt() == 1;
+  packetBuffer.push_back(0x80 + boardAddress % 64);
+  packetBuffer.push_back(((((boardAddress / 64) % 8) << 4) +
+    (boardIndex % 4 << 1) + activate) ^ 0xF8);
+  dccSignal[DCC_SIGNAL_OPERATIONS]->loadPacket(packetBuffer, 1);
+}
+
+void PowerOnCommand::process(const std::vector<String>) {
+  wifiInterface.print(F("<p1 MAIN>"));
+}
+
+void PowerOffCommand::process(const std::vector<String>) {
+  wifiInterface.print(F("<p0 MAIN>"));
+}
+
+void CurrentDrawCommand::process(const std::vector<String>) {
+  wifiInterface.print(F("<a %d>"), 0);
+}
+
+void OutputCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
+
+void OutputExCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
+
+void TurnoutCommandAdapter::process(const std::vector<String> arguments) {
+  if(arguments.size() == 2) {
+    // throws the turnout, the packet is the same as an accessory command.
+    AccessoryCommand accessory;
+    accessory.process({arguments[0], "0", arguments[1]});
+    wifiInterface.print(F("<H %d %d>"), (int)arguments[0].toInt(), (int)arguments[1].toInt());
+  } else {
+    wifiInterface.send(COMMAND_FAILED_RESPONSE);
+  }
+}
+
+void TurnoutExCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
+
+void SensorCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
+
+void RemoteSensorsCommandAdapter::process(const std::vector<String>) {
+  wifiInterface.send(COMMAND_FAILED_RESPONSE);
+}
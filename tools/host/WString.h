@@ -0,0 +1,171 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#pragma once
+
+// Host replacement for the subset of the Arduino String class used by the
+// firmware sources which are linked into the host tools. As with the
+// arduino-esp32 core the firmware is built against every non-empty String
+// owns a heap buffer (there is no small string optimization) so that the
+// allocation counts reported by the host tools match the device.
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <utility>
+
+class __FlashStringHelper;
+#define F(str) (reinterpret_cast<const __FlashStringHelper *>(str))
+
+class String {
+public:
+  String() {}
+  String(const char *str) {
+    assign(str, str ? strlen(str) : 0);
+  }
+  String(const __FlashStringHelper *str) : String(reinterpret_cast<const char *>(str)) {}
+  String(const String &other) {
+    assign(other._buffer, other._length);
+  }
+  String(String &&other) {
+    swap(other);
+  }
+  ~String() {
+    delete[] _buffer;
+  }
+  String &operator=(const String &other) {
+    if(this != &other) {
+      assign(other._buffer, other._length);
+    }
+    return *this;
+  }
+  String &operator=(String &&other) {
+    swap(other);
+    return *this;
+  }
+  String &operator=(const char *str) {
+    assign(str, str ? strlen(str) : 0);
+    return *this;
+  }
+  String &operator+=(const String &other) {
+    append(other._buffer, other._length);
+    return *this;
+  }
+  String &operator+=(const char *str) {
+    append(str, str ? strlen(str) : 0);
+    return *this;
+  }
+  String &operator+=(char ch) {
+    append(&ch, 1);
+    return *this;
+  }
+  bool reserve(unsigned int size) {
+    if(size > _capacity) {
+      grow(size);
+    }
+    return true;
+  }
+  unsigned int length() const {
+    return _length;
+  }
+  const char *c_str() const {
+    return _buffer ? _buffer : "";
+  }
+  int indexOf(char ch, unsigned int fromIndex = 0) const {
+    if(fromIndex >= _length) {
+      return -1;
+    }
+    const char *found = strchr(_buffer + fromIndex, ch);
+    return found ? found - _buffer : -1;
+  }
+  String substring(unsigned int left, unsigned int right) const {
+    if(left > right) {
+      std::swap(left, right);
+    }
+    right = right > _length ? _length : right;
+    String result;
+    if(left < right) {
+      result.assign(_buffer + left, right - left);
+    }
+    return result;
+  }
+  long toInt() const {
+    return _buffer ? atol(_buffer) : 0;
+  }
+  bool equalsIgnoreCase(const String &other) const {
+    return _length == other._length && !strcasecmp(c_str(), other.c_str());
+  }
+  bool operator==(const String &other) const {
+    return _length == other._length && !strcmp(c_str(), other.c_str());
+  }
+  bool operator==(const char *str) const {
+    return !strcmp(c_str(), str ? str : "");
+  }
+  bool operator!=(const String &other) const {
+    return !(*this == other);
+  }
+  bool operator<(const String &other) const {
+    return strcmp(c_str(), other.c_str()) < 0;
+  }
+private:
+  void swap(String &other) {
+    std::swap(_buffer, other._buffer);
+    std::swap(_length, other._length);
+    std::swap(_capacity, other._capacity);
+  }
+  void grow(unsigned int size) {
+    char *buffer = new char[size + 1];
+    if(_buffer) {
+      memcpy(buffer, _buffer, _length + 1);
+      delete[] _buffer;
+    }
+    _buffer = buffer;
+    _capacity = size;
+  }
+  void assign(const char *str, unsigned int len) {
+    if(!len) {
+      if(_buffer) {
+        _buffer[0] = 0;
+      }
+      _length = 0;
+      return;
+    }
+    if(len > _capacity) {
+      delete[] _buffer;
+      _buffer = nullptr;
+      _capacity = 0;
+      grow(len);
+    }
+    memcpy(_buffer, str, len);
+    _buffer[len] = 0;
+    _length = len;
+  }
+  void append(const char *str, unsigned int len) {
+    if(!len) {
+      return;
+    }
+    if(_length + len > _capacity) {
+      grow(_length + len);
+    }
+    memcpy(_buffer + _length, str, len);
+    _length += len;
+    _buffer[_length] = 0;
+  }
+  char *_buffer{nullptr};
+  unsigned int _length{0};
+  unsigned int _capacity{0};
+};
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#######################################################################
+# ESP32 COMMAND STATION
+#
+# COPYRIGHT (c) 2019 Mike Dunston
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see http://www.gnu.org/licenses
+#######################################################################
+
+# Compares the fully buffered (stream=false) and streamed JSON array
+# responses of the collection endpoints. Each endpoint is requested the
+# given number of times in each mode, the time to first byte and total time
+# are measured on the host and the heap used and time to first byte measured
+# by the command station are read from GET /diagnostics/routes.
+#
+# usage: json_array_compare.py {COMMAND STATION IP} [--count 10] [--turnouts 500]
+#
+# With --turnouts the given number of temporary turnouts are created before
+# the comparison and deleted afterwards. The results are printed as a single
+# JSON document.
+
+import argparse
+import http.client
+import json
+import statistics
+import time
+
+ENDPOINTS = ['/turnouts', '/v2/turnouts', '/outputs', '/sensors',
+             '/remoteSensors', '/locomotive', '/v2/locomotive',
+             '/locomotive/roster']
+
+# IDs used for the temporary turnouts, these are well above the IDs which
+# are normally assigned.
+FIRST_TEMP_TURNOUT_ID = 30000
+
+def request(host, method, path):
+    conn = http.client.HTTPConnection(host, 80, timeout=30)
+    start = time.monotonic()
+    conn.request(method, path)
+    response = conn.getresponse()
+    first = response.read(1)
+    first_byte = time.monotonic() - start
+    body = first + response.read()
+    total = time.monotonic() - start
+    conn.close()
+    return response.status, body, first_byte * 1000, total * 1000
+
+def summarize(samples):
+    return {
+        'min_ms': round(min(samples), 1),
+        'p50_ms': round(statistics.median(samples), 1),
+        'max_ms': round(max(samples), 1),
+    }
+
+def device_route_stats(host):
+    status, body, _, _ = request(host, 'GET', '/diagnostics/routes')
+    if status != 200:
+        return {}
+    return {route['route']: route for route in json.loads(body.decode())['routes']}
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host')
+    parser.add_argument('--count', type=int, default=10)
+    parser.add_argument('--turnouts', type=int, default=0)
+    args = parser.parse_args()
+
+    for index in range(args.turnouts):
+        request(args.host, 'POST', '/turnouts?id=%d&address=%d&subAddress=%d&type=0' %
+                (FIRST_TEMP_TURNOUT_ID + index, 100 + (index // 4), index % 4))
+
+    results = {}
+    try:
+        for endpoint in ENDPOINTS:
+            results[endpoint] = {}
+            for mode, query in (('buffered', '?stream=false'), ('streamed', '')):
+                first_byte = []
+                total = []
+                entities = None
+                for _ in range(args.count):
+                    status, body, ttfb, elapsed = request(args.host, 'GET', endpoint + query)
+                    if status != 200:
+                        break
+                    entities = len(json.loads(body.decode()))
+                    first_byte.append(ttfb)
+                    total.append(elapsed)
+                if not first_byte:
+                    results[endpoint][mode] = {'status': status}
+                    continue
+                results[endpoint][mode] = {
+                    'entities': entities,
+                    'bytes': len(body),
+                    'host_first_byte': summarize(first_byte),
+                    'host_total': summarize(total),
+                }
+        # the device side statistics are per route and include the requests
+        # made by other clients, /locomotive/roster is included in the
+        # statistics of /locomotive.
+        routes = device_route_stats(args.host)
+        for endpoint in ENDPOINTS:
+            route = routes.get(endpoint, {})
+            for mode in ('buffered', 'streamed'):
+                if mode in route and mode in results[endpoint]:
+                    results[endpoint][mode]['device'] = route[mode]
+    finally:
+        for index in range(args.turnouts):
+            request(args.host, 'DELETE', '/turnouts?id=%d' % (FIRST_TEMP_TURNOUT_ID + index))
+
+    print(json.dumps({'count': args.count, 'temporary_turnouts': args.turnouts,
+                      'endpoints': results}, indent=2))
+
+if __name__ == '__main__':
+    main()
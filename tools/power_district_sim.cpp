@@ -0,0 +1,268 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host side simulation of the power district fault handling, this drives
+// PowerDistrictState with a simulated 1ms clock the same way the current
+// monitoring task does and verifies the resulting behavior.
+//
+// usage: g++ -std=c++11 -Wall -I include tools/power_district_sim.cpp -o power_district_sim && ./power_district_sim
+//
+// The exit code is non-zero if any check fails.
+
+#include <stdio.h>
+#include <vector>
+#include "PowerDistrict.h"
+
+// ADC limits matching an ARDUINO_SHIELD (1750mA of 2000mA).
+static constexpr uint32_t OVERLOAD_LIMIT = 3584;
+static constexpr uint32_t SHORT_LIMIT = 3700;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if(!(cond)) {                                                     \
+      printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+      failures++;                                                     \
+    }                                                                 \
+  } while(0)
+
+struct Event {
+  uint32_t time;
+  PowerDistrictEvent event;
+};
+
+// advances the clock one millisecond at a time until the provided time and
+// returns the first event raised, the current readings are applied only
+// while the district is enabled as done by GenericMotorBoard::check.
+static Event run(PowerDistrictState &district, uint32_t &now, uint32_t until,
+                 uint32_t fastCurrent, uint32_t slowCurrent) {
+  while(now < until) {
+    now++;
+    auto event = district.update(now, fastCurrent, slowCurrent);
+    if(event != POWER_DISTRICT_NONE) {
+      return {now, event};
+    }
+  }
+  return {now, POWER_DISTRICT_NONE};
+}
+
+// posts an enable (or disable) request as done by GenericMotorBoard::powerOn
+// (or powerOff) and advances the clock until the monitoring task has applied
+// it, returns the event raised.
+static PowerDistrictEvent powerOn(PowerDistrictState &district, uint32_t &now) {
+  district.requestEnable();
+  return district.update(++now, 0, 0);
+}
+
+static PowerDistrictEvent powerOff(PowerDistrictState &district, uint32_t &now) {
+  district.requestDisable();
+  return district.update(++now, 0, 0);
+}
+
+// updates the enable pin state as done by
+// GenericMotorBoard::handleDistrictEvent.
+static void updateOutput(bool &output, PowerDistrictEvent event) {
+  if(event == POWER_DISTRICT_RETRY || event == POWER_DISTRICT_ENABLED) {
+    output = true;
+  } else if(event != POWER_DISTRICT_NONE) {
+    output = false;
+  }
+}
+
+static PowerDistrictSummary summarize(const std::vector<PowerDistrictState *> &districts) {
+  PowerDistrictSummary summary;
+  for(auto district : districts) {
+    summary.add(*district);
+  }
+  return summary;
+}
+
+static void yardShortLeavesMainRunning() {
+  printf("yard short leaves main running\n");
+  PowerDistrictState main(OVERLOAD_LIMIT, SHORT_LIMIT);
+  PowerDistrictState yard(OVERLOAD_LIMIT, SHORT_LIMIT);
+  uint32_t now = 0;
+  uint32_t mainNow = now;
+  CHECK(powerOn(main, mainNow) == POWER_DISTRICT_ENABLED);
+  CHECK(powerOn(yard, now) == POWER_DISTRICT_ENABLED);
+  uint32_t enabledAt = now;
+  CHECK(run(main, mainNow, 1000, 500, 500).event == POWER_DISTRICT_NONE);
+  auto event = run(yard, now, 1000, 4095, 1000);
+  CHECK(event.event == POWER_DISTRICT_SHORT_CIRCUIT);
+  CHECK(event.time == enabledAt + MOTOR_BOARD_INRUSH_BLANKING_MS);
+  CHECK(main.isEnabled());
+  CHECK(!main.isFaulted());
+  CHECK(!yard.isEnabled());
+  CHECK(yard.isFaulted());
+  auto summary = summarize({&main, &yard});
+  CHECK(summary.anyEnabled);
+  CHECK(summary.anyFaulted);
+  CHECK(summary.isSignalRequired());
+}
+
+static void retryBacksOff() {
+  printf("retry backs off on repeated faults\n");
+  PowerDistrictState district(OVERLOAD_LIMIT, SHORT_LIMIT);
+  uint32_t now = 0;
+  CHECK(powerOn(district, now) == POWER_DISTRICT_ENABLED);
+  const uint32_t expected[] = {5000, 10000, 20000, 40000, 60000, 60000};
+  for(auto delay : expected) {
+    // the short is still present, the district faults as soon as blanking
+    // has expired after each retry.
+    auto event = run(district, now, now + 1000, 4095, 1000);
+    CHECK(event.event == POWER_DISTRICT_SHORT_CIRCUIT);
+    CHECK(district.getRetryDelay() == delay);
+    CHECK(district.getRetryRemaining(now) == delay);
+    uint32_t faultTime = now;
+    event = run(district, now, now + delay + 1000, 4095, 1000);
+    CHECK(event.event == POWER_DISTRICT_RETRY);
+    CHECK(event.time - faultTime == delay);
+    CHECK(district.isEnabled());
+  }
+  CHECK(district.getFaultCount() == 6);
+}
+
+static void retryDelayResets() {
+  printf("retry delay resets after running without faults\n");
+  PowerDistrictState district(OVERLOAD_LIMIT, SHORT_LIMIT);
+  uint32_t now = 0;
+  CHECK(powerOn(district, now) == POWER_DISTRICT_ENABLED);
+  CHECK(run(district, now, 100, 4095, 1000).event == POWER_DISTRICT_SHORT_CIRCUIT);
+  CHECK(run(district, now, now + 10000, 0, 0).event == POWER_DISTRICT_RETRY);
+  CHECK(run(district, now, now + 100, 4095, 1000).event == POWER_DISTRICT_SHORT_CIRCUIT);
+  CHECK(district.getRetryDelay() == 10000);
+  CHECK(run(district, now, now + 20000, 0, 0).event == POWER_DISTRICT_RETRY);
+  // fault just before the reset period expires, the delay keeps increasing.
+  CHECK(run(district, now, now + MOTOR_BOARD_FAULT_RESET_MS - 2, 500, 500).event == POWER_DISTRICT_NONE);
+  CHECK(run(district, now, now + 1, 500, 4000).event == POWER_DISTRICT_OVERLOAD);
+  CHECK(district.getRetryDelay() == 20000);
+  CHECK(run(district, now, now + 30000, 0, 0).event == POWER_DISTRICT_RETRY);
+  // fault after the reset period has expired, the delay starts over.
+  CHECK(run(district, now, now + MOTOR_BOARD_FAULT_RESET_MS, 500, 500).event == POWER_DISTRICT_NONE);
+  CHECK(run(district, now, now + 1, 500, 4000).event == POWER_DISTRICT_OVERLOAD);
+  CHECK(district.getRetryDelay() == MOTOR_BOARD_FAULT_RETRY_MS);
+  CHECK(district.getFaultCount() == 1);
+}
+
+static void explicitOffCancelsRetry() {
+  printf("explicit power off cancels the retry\n");
+  PowerDistrictState main(OVERLOAD_LIMIT, SHORT_LIMIT);
+  PowerDistrictState yard(OVERLOAD_LIMIT, SHORT_LIMIT);
+  uint32_t now = 0;
+  CHECK(powerOn(yard, now) == POWER_DISTRICT_ENABLED);
+  CHECK(run(yard, now, 100, 4095, 1000).event == POWER_DISTRICT_SHORT_CIRCUIT);
+  // the main district is off, the faulted yard still needs the signal.
+  CHECK(summarize({&main, &yard}).isSignalRequired());
+  // the request is only applied by the monitoring task.
+  yard.requestDisable();
+  CHECK(yard.isRequestPending());
+  CHECK(yard.isFaulted());
+  CHECK(yard.update(++now, 0, 0) == POWER_DISTRICT_DISABLED);
+  CHECK(!yard.isRequestPending());
+  CHECK(!yard.isFaulted());
+  CHECK(yard.getRetryRemaining(now) == 0);
+  CHECK(run(yard, now, now + 120000, 4095, 1000).event == POWER_DISTRICT_NONE);
+  CHECK(!yard.isEnabled());
+  CHECK(!summarize({&main, &yard}).isSignalRequired());
+  // a second power off has no effect.
+  CHECK(powerOff(yard, now) == POWER_DISTRICT_NONE);
+  // an explicit power on during the retry delay also cancels it.
+  CHECK(powerOn(yard, now) == POWER_DISTRICT_ENABLED);
+  CHECK(run(yard, now, now + 100, 4095, 1000).event == POWER_DISTRICT_SHORT_CIRCUIT);
+  CHECK(powerOn(yard, now) == POWER_DISTRICT_ENABLED);
+  CHECK(!yard.isFaulted());
+  CHECK(run(yard, now, now + 120000, 500, 500).event == POWER_DISTRICT_NONE);
+  CHECK(yard.isEnabled());
+  // only the most recent request is applied.
+  yard.requestDisable();
+  yard.requestEnable();
+  CHECK(yard.update(++now, 500, 500) == POWER_DISTRICT_NONE);
+  CHECK(yard.isEnabled());
+}
+
+static void powerOffRacesRetry() {
+  printf("power off racing the retry stays off\n");
+  // the power off request from another task is posted at each tick around
+  // the expiry of the retry delay, either before the monitoring task runs
+  // update or after update has returned but before the enable pin has been
+  // written.
+  for(int32_t offset = -2; offset <= 2; offset++) {
+    for(bool afterUpdate : {false, true}) {
+      PowerDistrictState district(OVERLOAD_LIMIT, SHORT_LIMIT);
+      bool output = false;
+      uint32_t now = 0;
+      updateOutput(output, powerOn(district, now));
+      auto fault = run(district, now, now + 100, 4095, 1000);
+      CHECK(fault.event == POWER_DISTRICT_SHORT_CIRCUIT);
+      updateOutput(output, fault.event);
+      uint32_t requestAt = fault.time + district.getRetryDelay() + offset;
+      uint8_t retries = 0;
+      while(now < requestAt + 100) {
+        now++;
+        if(now == requestAt && !afterUpdate) {
+          district.requestDisable();
+        }
+        auto event = district.update(now, 0, 0);
+        if(now == requestAt && afterUpdate) {
+          district.requestDisable();
+        }
+        retries += event == POWER_DISTRICT_RETRY;
+        updateOutput(output, event);
+      }
+      // the district is only re-enabled when the retry delay expired before
+      // the request was posted.
+      CHECK(retries == (offset > 0 || (offset == 0 && afterUpdate) ? 1 : 0));
+      CHECK(!output);
+      CHECK(!district.isEnabled());
+      CHECK(!district.isFaulted());
+    }
+  }
+}
+
+static void inrushBlanking() {
+  printf("inrush blanking suppresses short circuit detection only\n");
+  PowerDistrictState district(OVERLOAD_LIMIT, SHORT_LIMIT);
+  uint32_t now = 1000;
+  CHECK(powerOn(district, now) == POWER_DISTRICT_ENABLED);
+  // a brief inrush pulse is ignored.
+  CHECK(run(district, now, now + MOTOR_BOARD_INRUSH_BLANKING_MS - 1, 4095, 1000).event == POWER_DISTRICT_NONE);
+  CHECK(run(district, now, now + 1000, 500, 500).event == POWER_DISTRICT_NONE);
+  CHECK(district.isEnabled());
+  // a sustained overload is detected during the blanking period.
+  CHECK(powerOff(district, now) == POWER_DISTRICT_DISABLED);
+  CHECK(powerOn(district, now) == POWER_DISTRICT_ENABLED);
+  uint32_t enabledAt = now;
+  auto event = run(district, now, now + 1000, 500, 4000);
+  CHECK(event.event == POWER_DISTRICT_OVERLOAD);
+  CHECK(event.time == enabledAt + 1);
+}
+
+int main() {
+  yardShortLeavesMainRunning();
+  retryBacksOff();
+  retryDelayResets();
+  explicitOffCancelsRetry();
+  powerOffRacesRetry();
+  inrushBlanking();
+  if(failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#######################################################################
+# ESP32 COMMAND STATION
+#
+# COPYRIGHT (c) 2019 Mike Dunston
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see http://www.gnu.org/licenses
+#######################################################################
+
+# Host side WiThrottle test client, this measures the time from sending a
+# speed change until the command station reports it back for both the native
+# WiThrottle server and the DCC++ (JMRI) interface. It also verifies that a
+# speed change made through one interface is reported on the other.
+#
+# usage: throttle_latency.py {COMMAND STATION IP} [--address 3] [--count 100]
+#
+# The results are printed as a single JSON document.
+
+import argparse
+import json
+import socket
+import statistics
+import sys
+import time
+
+WITHROTTLE_PORT = 12090
+DCCPP_PORT = 2560
+MT_DELIMITER = '<;>'
+
+class LineClient:
+    def __init__(self, host, port, separator):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.separator = separator
+        self.buffer = ''
+
+    def send(self, data):
+        self.sock.sendall(data.encode('ascii'))
+
+    def wait_for(self, match, timeout=2.0):
+        deadline = time.monotonic() + timeout
+        while True:
+            while self.separator in self.buffer:
+                line, self.buffer = self.buffer.split(self.separator, 1)
+                if match(line.strip()):
+                    return line.strip()
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.sock.settimeout(remaining)
+            try:
+                data = self.sock.recv(4096)
+            except socket.timeout:
+                return None
+            if not data:
+                return None
+            self.buffer += data.decode('ascii', 'replace')
+
+    def drain(self):
+        self.wait_for(lambda line: False, timeout=0.2)
+
+def summarize(samples):
+    if not samples:
+        return None
+    ordered = sorted(samples)
+    return {
+        'count': len(ordered),
+        'min_ms': round(ordered[0], 3),
+        'p50_ms': round(statistics.median(ordered), 3),
+        'p99_ms': round(ordered[min(len(ordered) - 1, int(len(ordered) * 0.99))], 3),
+        'max_ms': round(ordered[-1], 3),
+    }
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host')
+    parser.add_argument('--address', type=int, default=3)
+    parser.add_argument('--count', type=int, default=100)
+    args = parser.parse_args()
+
+    key = '%s%d' % ('L' if args.address > 127 else 'S', args.address)
+    prefix = 'MTA%s%s' % (key, MT_DELIMITER)
+
+    withrottle = LineClient(args.host, WITHROTTLE_PORT, '\n')
+    withrottle.send('Nthrottle_latency\nHUthrottle_latency\n')
+    withrottle.send('MT+%s%s%s\n' % (key, MT_DELIMITER, key))
+    if not withrottle.wait_for(lambda line: line.startswith('MT+%s' % key)):
+        sys.exit('WiThrottle server did not acknowledge the locomotive')
+    withrottle.drain()
+
+    # DCC++ responses are not newline separated, they are split on the
+    # closing bracket instead.
+    dccpp = LineClient(args.host, DCCPP_PORT, '>')
+    dccpp.drain()
+
+    results = {'withrottle': [], 'dccpp': []}
+    missed = {'withrottle': 0, 'dccpp': 0}
+    cross = {'withrottle_to_dccpp': 0, 'dccpp_to_withrottle': 0}
+    for iteration in range(args.count):
+        # alternate the speed so every command changes the state.
+        speed = 10 + (iteration % 2)
+        start = time.monotonic()
+        withrottle.send('%sV%d\n' % (prefix, speed))
+        if withrottle.wait_for(lambda line: line == '%sV%d' % (prefix, speed)):
+            results['withrottle'].append((time.monotonic() - start) * 1000)
+        else:
+            missed['withrottle'] += 1
+        if dccpp.wait_for(lambda line: line.startswith('<T ') and
+                          line.split()[2] == str(speed)):
+            cross['withrottle_to_dccpp'] += 1
+
+        speed = 20 + (iteration % 2)
+        start = time.monotonic()
+        dccpp.send('<t 1 %d %d 1>' % (args.address, speed))
+        if dccpp.wait_for(lambda line: line.startswith('<T 1 %d ' % speed)):
+            results['dccpp'].append((time.monotonic() - start) * 1000)
+        else:
+            missed['dccpp'] += 1
+        if withrottle.wait_for(lambda line: line == '%sV%d' % (prefix, speed)):
+            cross['dccpp_to_withrottle'] += 1
+
+    withrottle.send('MT-%s%sr\nQ\n' % (key, MT_DELIMITER))
+    print(json.dumps({
+        'address': args.address,
+        'withrottle': summarize(results['withrottle']),
+        'dccpp': summarize(results['dccpp']),
+        'missed': missed,
+        'cross_interface_updates': cross,
+    }, indent=2))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,171 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host benchmark comparing the CPU time and heap allocations of the DCC++
+// text protocol and the binary WebSocket protocol for the same throttle
+// changes. The text commands are processed by the firmware
+// DCCPPProtocolConsumer (src/Interfaces/DCCppProtocol.cpp), the binary
+// commands are decoded by decodeBinaryLocoCommand (include/BinaryThrottle.h)
+// and applied the same way as WebSocketClient::processBinary. Both use the
+// host stubs from tools/host for the locomotives and the DCC packet queue.
+//
+// usage: g++ -std=c++11 -O2 -Wall -Wno-sign-compare -I tools/host -I include tools/throttle_protocol_bench.cpp tools/host/HostStubs.cpp tools/host/HostProgrammingTrack.cpp src/Interfaces/DCCppProtocol.cpp -o throttle_protocol_bench && ./throttle_protocol_bench [ITERATIONS]
+//
+// The exit code is non-zero if the binary decoder accepts an invalid command.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ESP32CommandStation.h"
+#include "BinaryThrottle.h"
+
+struct Scenario {
+  const char *name;
+  uint32_t commands;
+  const char *text;
+  std::vector<uint8_t> binary;
+};
+
+struct Result {
+  uint64_t time{0};
+  uint64_t allocations{0};
+};
+
+// applies the locomotive commands of a binary frame as done by
+// WebSocketClient::processBinary, returns false if a command was rejected.
+static bool processBinary(const uint8_t *data, size_t len) {
+  size_t index = 0;
+  while(index < len) {
+    uint8_t opcode = data[index++];
+    BinaryLocoCommand command;
+    size_t consumed = decodeBinaryLocoCommand(opcode, &data[index], len - index, command);
+    if(!consumed || !command.valid) {
+      return false;
+    }
+    index += consumed;
+    auto loco = LocomotiveManager::getLocomotive(command.address);
+    if(opcode == WS_BINARY_FUNCTION) {
+      loco->setFunction(command.value, command.state);
+    } else if(opcode != WS_BINARY_LOCO_QUERY) {
+      if(opcode == WS_BINARY_SPEED) {
+        loco->setSpeed(command.value);
+      } else {
+        loco->setDirection(command.value);
+      }
+      loco->sendLocoUpdate(true);
+      loco->showStatus();
+    }
+  }
+  return true;
+}
+
+template<typename F>
+static Result measure(uint32_t iterations, F process) {
+  Result result;
+  auto allocations = getHostAllocationStats();
+  uint64_t start = getHostTimeNanos();
+  for(uint32_t iteration = 0; iteration < iterations; iteration++) {
+    process();
+  }
+  result.time = getHostTimeNanos() - start;
+  result.allocations = getHostAllocationStats().allocations - allocations.allocations;
+  return result;
+}
+
+static int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if(!(cond)) {                                                     \
+      printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+      failures++;                                                     \
+    }                                                                 \
+  } while(0)
+
+// commands which must be rejected without touching a locomotive.
+static void rejectsInvalidCommands() {
+  BinaryLocoCommand command;
+  const uint8_t zeroSpeed[] = {0x00, 0x00, 10};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_SPEED, zeroSpeed, sizeof(zeroSpeed), command) == 3);
+  CHECK(!command.valid);
+  const uint8_t fastSpeed[] = {0x00, 0x03, 127};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_SPEED, fastSpeed, sizeof(fastSpeed), command) == 3);
+  CHECK(!command.valid);
+  const uint8_t maxSpeed[] = {0x00, 0x03, 126};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_SPEED, maxSpeed, sizeof(maxSpeed), command) == 3);
+  CHECK(command.valid);
+  const uint8_t zeroFunction[] = {0x00, 0x00, 1, 1};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_FUNCTION, zeroFunction, sizeof(zeroFunction), command) == 4);
+  CHECK(!command.valid);
+  const uint8_t highFunction[] = {0x00, 0x03, 29, 1};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_FUNCTION, highFunction, sizeof(highFunction), command) == 4);
+  CHECK(!command.valid);
+  const uint8_t zeroQuery[] = {0x00, 0x00};
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_LOCO_QUERY, zeroQuery, sizeof(zeroQuery), command) == 2);
+  CHECK(!command.valid);
+  // truncated commands are not consumed.
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_SPEED, maxSpeed, 2, command) == 0);
+  CHECK(decodeBinaryLocoCommand(WS_BINARY_TURNOUT, maxSpeed, sizeof(maxSpeed), command) == 0);
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = argc > 1 ? atoi(argv[1]) : 50000;
+  DCCPPProtocolHandler::init();
+  rejectsInvalidCommands();
+
+  const std::vector<Scenario> scenarios = {
+    {"speed", 1, "<t 1 3 50 1>", {WS_BINARY_SPEED, 0x00, 0x03, 50}},
+    {"function", 1, "<fex 3 5 1>", {WS_BINARY_FUNCTION, 0x00, 0x03, 5, 1}},
+    {"long address", 1, "<t 1 4012 50 1>", {WS_BINARY_SPEED, 0x0F, 0xAC, 50}},
+    // one change for each of four locomotives in a single frame.
+    {"4 locos", 4, "<t 1 3 50 1><t 2 4 50 1><t 3 5 50 1><t 4 6 50 1>",
+     {WS_BINARY_SPEED, 0x00, 0x03, 50, WS_BINARY_SPEED, 0x00, 0x04, 50,
+      WS_BINARY_SPEED, 0x00, 0x05, 50, WS_BINARY_SPEED, 0x00, 0x06, 50}},
+  };
+
+  printf("%-14s %13s %13s %13s %13s %10s %10s %6s\n", "scenario", "text ns/cmd",
+         "binary ns/cmd", "text allocs", "binary allocs", "text bytes", "bin bytes", "ratio");
+  for(const auto &scenario : scenarios) {
+    DCCPPProtocolConsumer consumer;
+    uint8_t buffer[256];
+    size_t textLen = strlen(scenario.text);
+    auto processText = [&]() {
+      memcpy(buffer, scenario.text, textLen);
+      consumer.feed(buffer, textLen);
+    };
+    auto processBinaryFrame = [&]() {
+      CHECK(processBinary(scenario.binary.data(), scenario.binary.size()));
+    };
+    // the first pass creates the locomotives, it is not included.
+    processText();
+    processBinaryFrame();
+    auto text = measure(iterations, processText);
+    auto binary = measure(iterations, processBinaryFrame);
+    uint32_t commands = iterations * scenario.commands;
+    printf("%-14s %13.1f %13.1f %13.2f %13.2f %10.1f %10.1f %6.1f\n", scenario.name,
+           (double)text.time / commands, (double)binary.time / commands,
+           (double)text.allocations / commands, (double)binary.allocations / commands,
+           (double)textLen / scenario.commands,
+           (double)scenario.binary.size() / scenario.commands,
+           (double)text.time / binary.time);
+  }
+  if(failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
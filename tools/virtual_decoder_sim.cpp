@@ -0,0 +1,370 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2019 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host side simulation of the programming track. This links the firmware
+// src/DCC/DCCProgrammer.cpp with the host stubs from tools/host, the packets
+// it sends on the PROG signal are passed to a VirtualDecoderModel
+// (include/VirtualDecoderModel.h) and the resulting current draw, including
+// the ACK pulses, is sampled every ACK_SAMPLE_INTERVAL_USEC by a stub
+// GenericMotorBoard which uses the firmware AckDetector
+// (include/AckDetector.h). Time is simulated, see hostSimulatedMicros.
+//
+// The CV read/write results, the number of attempts and the ACK thresholds
+// are verified for a well behaved decoder and for decoders which do not
+// ACK, ACK late, send short or weak ACK pulses, have a noisy current draw or
+// miss some of their ACKs.
+//
+// usage: g++ -std=c++11 -O2 -Wall -Wno-sign-compare -I tools/host -I include tools/virtual_decoder_sim.cpp tools/host/HostStubs.cpp src/DCC/DCCProgrammer.cpp -o virtual_decoder_sim && ./virtual_decoder_sim
+//
+// The exit code is non-zero if any check fails.
+
+#include <stdio.h>
+#include "ESP32CommandStation.h"
+#include "AckDetector.h"
+#include "VirtualDecoderModel.h"
+
+// full scale current of the PROG motor board (ARDUINO_SHIELD).
+static constexpr uint32_t PROG_MAX_MILLIAMPS = 2000;
+
+// matches VIRTUAL_DECODER_DEFAULT_PROFILE in src/DCC/VirtualDecoder.cpp.
+static constexpr VirtualDecoderProfile DEFAULT_PROFILE = {
+  1000,   // ackDelayUsec
+  6000,   // ackDurationUsec
+  10,     // idleMilliAmps
+  80,     // ackMilliAmps
+  5,      // noiseMilliAmps
+  0       // missedAckPercent
+};
+
+static int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if(!(cond)) {                                                     \
+      printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+      failures++;                                                     \
+    }                                                                 \
+  } while(0)
+
+// deterministic pseudo random numbers so that the results are repeatable.
+static uint32_t randomState = 1;
+static uint32_t simRandom() {
+  randomState = randomState * 1103515245 + 12345;
+  return (randomState >> 16) & 0x7FFF;
+}
+
+// Virtual decoder on the simulated PROG track, this generates the ACK pulses
+// the same way as src/DCC/VirtualDecoder.cpp but using the simulated time.
+struct SimulatedDecoder {
+  VirtualDecoderModel model;
+  VirtualDecoderProfile profile{DEFAULT_PROFILE};
+  uint64_t ackStart{0};
+  uint64_t ackEnd{0};
+  uint32_t acksSent{0};
+  uint32_t acksMissed{0};
+  // number of write byte/bit packets received, including repeats.
+  uint32_t writePackets{0};
+
+  void reset(const VirtualDecoderProfile &newProfile) {
+    model.reset();
+    profile = newProfile;
+    ackStart = ackEnd = 0;
+    acksSent = acksMissed = writePackets = 0;
+  }
+  void packetSent(const uint8_t *data, uint8_t length) {
+    if(length == 4 && ((data[0] & 0xFC) == 0x7C ||
+                       ((data[0] & 0xFC) == 0x78 && (data[2] & 0xF0) == 0xF0))) {
+      writePackets++;
+    }
+    if(model.packetReceived(data, length)) {
+      if((simRandom() % 100) < profile.missedAckPercent) {
+        acksMissed++;
+        return;
+      }
+      acksSent++;
+      ackStart = hostSimulatedMicros + profile.ackDelayUsec;
+      ackEnd = ackStart + profile.ackDurationUsec;
+    }
+  }
+  uint16_t getCurrentSample(uint64_t time) {
+    int32_t milliAmps = profile.idleMilliAmps;
+    if(time >= ackStart && time < ackEnd) {
+      milliAmps += profile.ackMilliAmps;
+    }
+    if(profile.noiseMilliAmps) {
+      milliAmps += (int32_t)(simRandom() % ((profile.noiseMilliAmps * 2) + 1)) - profile.noiseMilliAmps;
+    }
+    return getVirtualDecoderSample(milliAmps, PROG_MAX_MILLIAMPS);
+  }
+};
+
+static SimulatedDecoder decoder;
+
+// ACK detection state of the PROG motor board, the samples which the ACK
+// sampling timer would have captured are generated when they are consumed.
+static AckDetector ackDetector;
+static uint64_t nextSampleTime{0};
+static bool progTrackPowered{false};
+static uint32_t ackOverruns{0};
+
+void GenericMotorBoard::powerOn(bool) {
+  progTrackPowered = true;
+}
+
+void GenericMotorBoard::powerOff(bool) {
+  progTrackPowered = false;
+}
+
+uint32_t GenericMotorBoard::getMaxMilliAmps() {
+  return PROG_MAX_MILLIAMPS;
+}
+
+uint16_t GenericMotorBoard::captureSample(uint8_t sampleCount, bool) {
+  uint32_t total = 0;
+  for(uint8_t sample = 0; sample < sampleCount; sample++) {
+    total += decoder.getCurrentSample(hostSimulatedMicros);
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+  return sampleCount ? total / sampleCount : 0;
+}
+
+void GenericMotorBoard::startAckSampling() {
+  resetAckDetection();
+}
+
+void GenericMotorBoard::stopAckSampling() {
+}
+
+void GenericMotorBoard::resetAckDetection() {
+  nextSampleTime = hostSimulatedMicros;
+  ackDetector.reset();
+}
+
+// same as the firmware version except that the samples are generated from
+// the simulated decoder instead of being captured by the sampling timer.
+bool GenericMotorBoard::waitForAck(uint16_t ackThreshold, uint32_t timeoutMs) {
+  uint64_t deadline = hostSimulatedMicros + (timeoutMs * 1000ULL);
+  while(true) {
+    uint64_t buffered = (hostSimulatedMicros - nextSampleTime) / ACK_SAMPLE_INTERVAL_USEC;
+    if(buffered > ACK_SAMPLE_BUFFER_SIZE) {
+      ackOverruns++;
+      nextSampleTime += (buffered - ACK_SAMPLE_BUFFER_SIZE) * ACK_SAMPLE_INTERVAL_USEC;
+    }
+    while(nextSampleTime <= hostSimulatedMicros) {
+      uint16_t sample = decoder.getCurrentSample(nextSampleTime);
+      nextSampleTime += ACK_SAMPLE_INTERVAL_USEC;
+      if(ackDetector.addSample(sample, ackThreshold)) {
+        return true;
+      }
+    }
+    if(hostSimulatedMicros > deadline) {
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+}
+
+static GenericMotorBoard progBoard;
+
+GenericMotorBoard *MotorBoardManager::getBoardByName(String) {
+  return &progBoard;
+}
+
+// resets the decoder and enters programming mode, returns false if the
+// programming track could not be energized.
+static bool startSession(const VirtualDecoderProfile &profile) {
+  decoder.reset(profile);
+  ackOverruns = 0;
+  return enterProgrammingMode();
+}
+
+static void wellBehavedDecoder() {
+  printf("well behaved decoder\n");
+  CHECK(startSession(DEFAULT_PROFILE));
+  CHECK(progTrackPowered);
+  // the defaults are read via the candidate values.
+  CHECK(readCV(CV_NAMES::SHORT_ADDRESS) == 3);
+  CHECK(readCV(CV_NAMES::DECODER_CONFIG) == 6);
+  // CVs without candidates are read by probing each bit.
+  decoder.model.setCV(100, 0xA5);
+  CHECK(readCV(100) == 0xA5);
+  CHECK(readCV(101) == 0);
+  CHECK(writeProgCVByte(100, 42));
+  CHECK(decoder.model.getCV(100) == 42);
+  CHECK(readCV(100) == 42);
+  CHECK(writeProgCVBit(CV_NAMES::DECODER_CONFIG, DECODER_CONFIG_BITS::SHORT_OR_LONG_ADDRESS, true));
+  CHECK(decoder.model.getCV(CV_NAMES::DECODER_CONFIG) == 38);
+  // a single attempt for each write.
+  CHECK(decoder.writePackets == 8);
+  // CV7 is read-only and is never acknowledged.
+  CHECK(!writeProgCVByte(CV_NAMES::DECODER_VERSION, 5));
+  CHECK(decoder.model.getCV(CV_NAMES::DECODER_VERSION) == 1);
+  CHECK(!ackOverruns);
+  leaveProgrammingMode();
+  CHECK(!progTrackPowered);
+}
+
+static void silentDecoder() {
+  printf("decoder without ACK\n");
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.missedAckPercent = 100;
+  CHECK(startSession(profile));
+  CHECK(readCV(CV_NAMES::SHORT_ADDRESS) == -1);
+  CHECK(readCV(200) == -1);
+  decoder.writePackets = 0;
+  CHECK(!writeProgCVByte(200, 7));
+  // every attempt is made (four packets each), the reset burst between
+  // attempts must not overrun the ACK sample buffer.
+  CHECK(decoder.writePackets == 3 * 4);
+  decoder.writePackets = 0;
+  CHECK(!writeProgCVBit(200, 1, true));
+  CHECK(decoder.writePackets == 3 * 4);
+  CHECK(!ackOverruns);
+  leaveProgrammingMode();
+}
+
+static void lateAck() {
+  printf("late ACK\n");
+  // the ACK ends during the remaining repeats of the instruction or while
+  // waiting for the ACK, it is still detected.
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.ackDelayUsec = 20000;
+  CHECK(startSession(profile));
+  CHECK(writeProgCVByte(300, 9));
+  CHECK(readCV(300) == 9);
+  leaveProgrammingMode();
+  // the ACK starts after the wait for the ACK has timed out.
+  profile.ackDelayUsec = 70000;
+  CHECK(startSession(profile));
+  CHECK(!writeProgCVByte(300, 9));
+  CHECK(readCV(300) == -1);
+  leaveProgrammingMode();
+}
+
+static void shortAck() {
+  printf("short ACK\n");
+  // RCN-216 allows 5ms to 7ms, pulses shorter than ACK_MIN_SAMPLES are
+  // ignored.
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.ackDurationUsec = 3000;
+  CHECK(startSession(profile));
+  CHECK(!writeProgCVByte(301, 9));
+  CHECK(readCV(CV_NAMES::SHORT_ADDRESS) == -1);
+  leaveProgrammingMode();
+  profile.ackDurationUsec = 5500;
+  CHECK(startSession(profile));
+  CHECK(writeProgCVByte(301, 9));
+  CHECK(readCV(CV_NAMES::SHORT_ADDRESS) == 3);
+  leaveProgrammingMode();
+}
+
+static void ackThreshold() {
+  printf("ACK threshold\n");
+  // an ACK must be at least 60mA above the idle current draw.
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.idleMilliAmps = 40;
+  profile.noiseMilliAmps = 0;
+  profile.ackMilliAmps = 50;
+  CHECK(startSession(profile));
+  CHECK(!writeProgCVByte(302, 9));
+  leaveProgrammingMode();
+  profile.ackMilliAmps = 70;
+  CHECK(startSession(profile));
+  CHECK(writeProgCVByte(302, 9));
+  CHECK(readCV(302) == 9);
+  leaveProgrammingMode();
+}
+
+static void noisyDecoder() {
+  printf("noisy current draw\n");
+  // noise alone never exceeds the threshold long enough to be an ACK.
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.idleMilliAmps = 60;
+  profile.noiseMilliAmps = 40;
+  profile.missedAckPercent = 100;
+  CHECK(startSession(profile));
+  CHECK(!writeProgCVByte(303, 9));
+  CHECK(readCV(303) == -1);
+  leaveProgrammingMode();
+  // ACK samples which dip below the threshold are tolerated.
+  profile.noiseMilliAmps = 25;
+  profile.missedAckPercent = 0;
+  CHECK(startSession(profile));
+  decoder.model.setCV(303, 0x5A);
+  CHECK(readCV(303) == 0x5A);
+  CHECK(writeProgCVByte(303, 0xC3));
+  CHECK(readCV(303) == 0xC3);
+  leaveProgrammingMode();
+}
+
+static void unreliableDecoder() {
+  printf("decoder missing ACKs\n");
+  // a missed ACK causes a bit to be read as zero or a write to be retried,
+  // the verify prevents an incorrect value from being returned.
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.missedAckPercent = 10;
+  CHECK(startSession(profile));
+  uint8_t reads = 0;
+  uint8_t writes = 0;
+  for(uint16_t cv = 400; cv < 420; cv++) {
+    uint8_t value = (cv * 37) & 0xFF;
+    decoder.model.setCV(cv, value);
+    int16_t read = readCV(cv);
+    CHECK(read == value || read == -1);
+    reads += (read == value);
+    if(writeProgCVByte(cv, ~value)) {
+      CHECK(decoder.model.getCV(cv) == (uint8_t)~value);
+      writes++;
+    }
+  }
+  printf("  %d/20 reads, %d/20 writes\n", reads, writes);
+  // the retries recover most of the operations.
+  CHECK(reads >= 15);
+  CHECK(writes >= 18);
+  CHECK(!ackOverruns);
+  leaveProgrammingMode();
+}
+
+static void overcurrentDecoder() {
+  printf("decoder drawing over 100mA\n");
+  VirtualDecoderProfile profile = DEFAULT_PROFILE;
+  profile.idleMilliAmps = 150;
+  CHECK(!startSession(profile));
+  CHECK(!progTrackPowered);
+}
+
+int main() {
+  dccSignal[DCC_SIGNAL_PROGRAMMING]->packetSent = [](const uint8_t *data, uint8_t length) {
+    if(progTrackPowered) {
+      decoder.packetSent(data, length);
+    }
+  };
+  wellBehavedDecoder();
+  silentDecoder();
+  lateAck();
+  shortAck();
+  ackThreshold();
+  noisyDecoder();
+  unreliableDecoder();
+  overcurrentDecoder();
+  if(failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}